@@ -0,0 +1,523 @@
+/**************************************************************
+ *
+ *                     channel.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that handles the I/O channels a UM's IN and OUT instructions
+       go through. Every channel buffers its output and its input, so a UM
+       instruction costs a byte copy instead of a locked stdio call. There
+       are three kinds: file descriptor channels with large buffers, memory
+       channels that read from a caller's buffer and collect output in a
+       growing one, and callback channels that hand blocks of bytes to
+       functions the caller provides. Buffered output is written out before
+       a channel blocks for input, and whenever flush_channel is called.
+       try_read_byte reads without blocking, for engines that stop a UM
+       whose input is not ready and run it again later.
+ *
+ **************************************************************/
+
+#include "channel.h"
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE (64 * 1024)
+
+/*the Channel struct holds a channel's output buffer and input buffer, and
+the two functions that make it one kind of channel: fill refills inBuf and
+returns how many bytes it now holds (0 at end of input), waiting for input
+if wait is set and otherwise returning CHANNEL_NOT_READY when there is
+none yet, and drain makes room in outBuf. keepsOutput is set for memory 
+channels, whose output stays in outBuf for get_mem_output instead of being
+drained on a flush.
+lineFlush drains after every newline, as stdio does for a terminal. The
+remaining members belong to the kind of channel that uses them*/
+struct Channel
+{
+        uint8_t *outBuf;
+        size_t outLen;
+        size_t outCap;
+        const uint8_t *inBuf;
+        size_t inPos;
+        size_t inLen;
+        uint8_t *inStore;
+        size_t inCap;
+        bool keepsOutput;
+        bool lineFlush;
+        size_t (*fill)(Channel ch, bool wait);
+        void (*drain)(Channel ch);
+        int inFd;
+        int outFd;
+        Channel_reader reader;
+        Channel_writer writer;
+        void *cl;
+};
+
+/*helper functions */
+static Channel new_channel(size_t outCap);
+static int next_byte(Channel ch, bool wait);
+static size_t fill_fd(Channel ch, bool wait);
+static void drain_fd(Channel ch);
+static size_t fill_mem(Channel ch, bool wait);
+static void drain_mem(Channel ch);
+static size_t fill_callback(Channel ch, bool wait);
+static void drain_callback(Channel ch);
+
+/************init_fd_channel****************************************
+*
+* Description: Function that creates a channel reading from and writing to
+*              file descriptors
+*
+* Parameters: int inFd: the descriptor IN reads from
+*             int outFd: the descriptor OUT writes to
+*
+* Returns: a pointer to the new channel
+*
+* Expects: memory allocation suceeds
+*
+* Notes: the descriptors are not closed by free_channel. Output to a
+*        terminal is also flushed at every newline
+**************************************************************/
+Channel init_fd_channel(int inFd, int outFd)
+{
+        return init_fd_channel_sized(inFd, outFd, BUFFER_SIZE);
+}
+
+/************init_fd_channel_sized****************************************
+*
+* Description: Function that creates a file descriptor channel with 
+*              buffers of a given size
+*
+* Parameters: int inFd: the descriptor IN reads from
+*             int outFd: the descriptor OUT writes to
+*             size_t size: the size of each of the two buffers
+*
+* Returns: a pointer to the new channel
+*
+* Expects: size > 0, and memory allocation suceeds
+*
+* Notes: for hosts with many UMs that mostly wait for input, where the 
+*        buffers of init_fd_channel would be most of their memory
+**************************************************************/
+Channel init_fd_channel_sized(int inFd, int outFd, size_t size)
+{
+        assert(size > 0);
+        Channel ch = new_channel(size);
+        ch->inStore = malloc(size);
+        assert(ch->inStore);
+        ch->inCap = size;
+        ch->inBuf = ch->inStore;
+        ch->inFd = inFd;
+        ch->outFd = outFd;
+        ch->lineFlush = isatty(outFd);
+        ch->fill = fill_fd;
+        ch->drain = drain_fd;
+        return ch;
+}
+
+/************init_mem_channel****************************************
+*
+* Description: Function that creates a channel reading from a buffer in
+*              memory and collecting its output in memory
+*
+* Parameters: const uint8_t *input: the bytes IN will read
+*             size_t length: the number of bytes in input
+*
+* Returns: a pointer to the new channel
+*
+* Expects: input != NULL unless length is 0, and memory allocation suceeds
+*
+* Notes: input is not copied, so it must outlive the channel. The output is
+*        read back with get_mem_output
+**************************************************************/
+Channel init_mem_channel(const uint8_t *input, size_t length)
+{
+        assert(input != NULL || length == 0);
+        Channel ch = new_channel(BUFFER_SIZE);
+        ch->inBuf = input;
+        ch->inLen = length;
+        ch->keepsOutput = true;
+        ch->fill = fill_mem;
+        ch->drain = drain_mem;
+        return ch;
+}
+
+/************init_callback_channel****************************************
+*
+* Description: Function that creates a channel whose input and output are
+*              handled by functions the caller provides
+*
+* Parameters: Channel_reader reader: fills a buffer with input
+*             Channel_writer writer: takes a block of output
+*             void *cl: passed to reader and writer on every call
+*
+* Returns: a pointer to the new channel
+*
+* Expects: reader != NULL, writer != NULL, and memory allocation suceeds
+*
+* Notes: reader is called only when the input buffer is empty, after the
+*        buffered output has been given to writer
+**************************************************************/
+Channel init_callback_channel(Channel_reader reader, Channel_writer writer,
+                              void *cl)
+{
+        assert(reader && writer);
+        Channel ch = new_channel(BUFFER_SIZE);
+        ch->inStore = malloc(BUFFER_SIZE);
+        assert(ch->inStore);
+        ch->inBuf = ch->inStore;
+        ch->reader = reader;
+        ch->writer = writer;
+        ch->cl = cl;
+        ch->fill = fill_callback;
+        ch->drain = drain_callback;
+        return ch;
+}
+
+/************new_channel****************************************
+*
+* Description: Function that allocates a channel with empty buffers
+*
+* Parameters: size_t outCap: the size of the output buffer
+*
+* Returns: a pointer to the new channel
+*
+* Expects: outCap > 0, and memory allocation suceeds
+*
+* Notes: the caller sets the input buffer and the channel's functions
+**************************************************************/
+static Channel new_channel(size_t outCap)
+{
+        assert(outCap > 0);
+        Channel ch = calloc(1, sizeof(struct Channel));
+        assert(ch);
+        ch->outBuf = malloc(outCap);
+        assert(ch->outBuf);
+        ch->outCap = outCap;
+        ch->inFd = -1;
+        ch->outFd = -1;
+        return ch;
+}
+
+/************free_channel****************************************
+*
+* Description: Function that flushes a channel and frees its memory
+*
+* Parameters: Channel ch: the channel being freed
+*
+* Returns: void
+*
+* Expects: ch != NULL
+*
+* Notes: N/A
+**************************************************************/
+void free_channel(Channel ch)
+{
+        assert(ch);
+        flush_channel(ch);
+        free(ch->outBuf);
+        free(ch->inStore);
+        free(ch);
+}
+
+/************read_byte****************************************
+*
+* Description: Function that reads the next input byte of a channel
+*
+* Parameters: Channel ch: the channel being read
+*
+* Returns: the byte, or EOF at the end of input
+*
+* Expects: ch != NULL
+*
+* Notes: when the input buffer is empty the buffered output is flushed
+*        first, so a prompt is visible before the channel blocks
+**************************************************************/
+int read_byte(Channel ch)
+{
+        assert(ch);
+        return next_byte(ch, true);
+}
+
+/************try_read_byte****************************************
+*
+* Description: Function that reads the next input byte of a channel if one
+*              is ready, without blocking
+*
+* Parameters: Channel ch: the channel being read
+*
+* Returns: the byte, EOF at the end of input, or BYTE_NOT_READY
+*
+* Expects: ch != NULL
+*
+* Notes: a descriptor that is not in non-blocking mode still blocks, as 
+*        read would. The buffered output is flushed before any read
+**************************************************************/
+int try_read_byte(Channel ch)
+{
+        assert(ch);
+        return next_byte(ch, false);
+}
+
+/************next_byte****************************************
+*
+* Description: Function that reads the next input byte of a channel,
+*              refilling its input buffer when it is empty
+*
+* Parameters: Channel ch: the channel being read
+*             bool wait: whether to wait for input that is not ready
+*
+* Returns: the byte, EOF at the end of input, or BYTE_NOT_READY if wait is
+*          not set and there is no input yet
+*
+* Expects: ch != NULL
+*
+* Notes: N/A
+**************************************************************/
+static int next_byte(Channel ch, bool wait)
+{
+        if (ch->inPos == ch->inLen) {
+                flush_channel(ch);
+                size_t got = ch->fill(ch, wait);
+                if (got == CHANNEL_NOT_READY) {
+                        return BYTE_NOT_READY;
+                }
+                ch->inPos = 0;
+                ch->inLen = got;
+                if (ch->inLen == 0) {
+                        return EOF;
+                }
+        }
+        return ch->inBuf[ch->inPos++];
+}
+
+/************write_byte****************************************
+*
+* Description: Function that writes an output byte to a channel
+*
+* Parameters: Channel ch: the channel being written
+*             uint8_t byte: the byte
+*
+* Returns: void
+*
+* Expects: ch != NULL
+*
+* Notes: the byte is only buffered unless the buffer fills or the channel
+*        flushes at newlines
+**************************************************************/
+void write_byte(Channel ch, uint8_t byte)
+{
+        assert(ch);
+        if (ch->outLen == ch->outCap) {
+                ch->drain(ch);
+        }
+        ch->outBuf[ch->outLen++] = byte;
+        if (byte == '\n' && ch->lineFlush) {
+                ch->drain(ch);
+        }
+}
+
+/************flush_channel****************************************
+*
+* Description: Function that writes out a channel's buffered output
+*
+* Parameters: Channel ch: the channel being flushed
+*
+* Returns: void
+*
+* Expects: ch != NULL
+*
+* Notes: does nothing for memory channels, whose output is kept
+**************************************************************/
+void flush_channel(Channel ch)
+{
+        assert(ch);
+        if (!ch->keepsOutput && ch->outLen > 0) {
+                ch->drain(ch);
+        }
+}
+
+/************get_mem_output****************************************
+*
+* Description: Function that gets the output collected by a memory channel
+*
+* Parameters: Channel ch: a channel from init_mem_channel
+*             size_t *length: set to the number of output bytes
+*
+* Returns: a pointer to the output bytes
+*
+* Expects: ch != NULL, length != NULL, and ch is a memory channel
+*
+* Notes: the pointer is valid until the next write_byte or free_channel
+**************************************************************/
+const uint8_t *get_mem_output(Channel ch, size_t *length)
+{
+        assert(ch && length);
+        assert(ch->keepsOutput);
+        *length = ch->outLen;
+        return ch->outBuf;
+}
+
+/************fill_fd****************************************
+*
+* Description: Function that refills a file descriptor channel's input
+*
+* Parameters: Channel ch: the channel
+*             bool wait: whether to wait for a non-blocking descriptor
+*
+* Returns: the number of bytes read, 0 at end of input or on an error, or
+*          CHANNEL_NOT_READY if the descriptor is non-blocking, has no 
+*          input yet, and wait is not set
+*
+* Expects: ch != NULL
+*
+* Notes: retries reads interrupted by a signal, and waits in poll when 
+*        wait is set
+**************************************************************/
+static size_t fill_fd(Channel ch, bool wait)
+{
+        while (true) {
+                ssize_t got = read(ch->inFd, ch->inStore, ch->inCap);
+                if (got >= 0) {
+                        return got;
+                }
+                if (errno == EINTR) {
+                        continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        return 0;
+                }
+                if (!wait) {
+                        return CHANNEL_NOT_READY;
+                }
+                struct pollfd ready = { ch->inFd, POLLIN, 0 };
+                poll(&ready, 1, -1);
+        }
+}
+
+/************drain_fd****************************************
+*
+* Description: Function that writes out a file descriptor channel's output
+*
+* Parameters: Channel ch: the channel
+*
+* Returns: void
+*
+* Expects: ch != NULL
+*
+* Notes: output that cannot be written (a closed pipe, say) is dropped, as
+*        putchar's would be. A non-blocking descriptor that is full is 
+*        waited for in poll
+**************************************************************/
+static void drain_fd(Channel ch)
+{
+        size_t done = 0;
+        while (done < ch->outLen) {
+                ssize_t put = write(ch->outFd, ch->outBuf + done,
+                                    ch->outLen - done);
+                if (put < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        struct pollfd ready = { ch->outFd, POLLOUT, 0 };
+                        poll(&ready, 1, -1);
+                        continue;
+                }
+                if (put <= 0) {
+                        break;
+                }
+                done += put;
+        }
+        ch->outLen = 0;
+}
+
+/************fill_mem****************************************
+*
+* Description: Function that refills a memory channel's input
+*
+* Parameters: Channel ch: the channel
+*             bool wait: unused
+*
+* Returns: 0, since all of the input was there from the start
+*
+* Expects: ch != NULL
+*
+* Notes: N/A
+**************************************************************/
+static size_t fill_mem(Channel ch, bool wait)
+{
+        (void)ch;
+        (void)wait;
+        return 0;
+}
+
+/************drain_mem****************************************
+*
+* Description: Function that makes room in a memory channel's output by
+*              doubling the buffer
+*
+* Parameters: Channel ch: the channel
+*
+* Returns: void
+*
+* Expects: ch != NULL, and memory allocation suceeds
+*
+* Notes: only called when the buffer is full
+**************************************************************/
+static void drain_mem(Channel ch)
+{
+        ch->outCap *= 2;
+        ch->outBuf = realloc(ch->outBuf, ch->outCap);
+        assert(ch->outBuf);
+}
+
+/************fill_callback****************************************
+*
+* Description: Function that refills a callback channel's input
+*
+* Parameters: Channel ch: the channel
+*             bool wait: whether to keep calling a reader that has no 
+*                        input yet
+*
+* Returns: the number of bytes the reader gave, 0 at end of input, or
+*          CHANNEL_NOT_READY if the reader had none yet and wait is not set
+*
+* Expects: ch != NULL
+*
+* Notes: a reader that returns CHANNEL_NOT_READY to a waiting read is 
+*        called again straight away, so it should block rather than do that
+*        when it can
+**************************************************************/
+static size_t fill_callback(Channel ch, bool wait)
+{
+        size_t got;
+        do {
+                got = ch->reader(ch->cl, ch->inStore, BUFFER_SIZE);
+        } while (got == CHANNEL_NOT_READY && wait);
+        assert(got <= BUFFER_SIZE || got == CHANNEL_NOT_READY);
+        return got;
+}
+
+/************drain_callback****************************************
+*
+* Description: Function that hands a callback channel's output to its writer
+*
+* Parameters: Channel ch: the channel
+*
+* Returns: void
+*
+* Expects: ch != NULL
+*
+* Notes: N/A
+**************************************************************/
+static void drain_callback(Channel ch)
+{
+        ch->writer(ch->cl, ch->outBuf, ch->outLen);
+        ch->outLen = 0;
+}
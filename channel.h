@@ -0,0 +1,52 @@
+/**************************************************************
+ *
+ *                     channel.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the channel module; contains declarations of the
+       functions that create the buffered I/O channels a UM reads its IN
+       bytes from and writes its OUT bytes to (refer to the channel.c header
+       for more details), as well as the privately defined Channel struct.
+ *
+ **************************************************************/
+
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct Channel;
+typedef struct Channel *Channel;
+
+/*callbacks for init_callback_channel. A reader fills buf with up to cap
+bytes and returns how many it wrote, 0 meaning end of input, or
+CHANNEL_NOT_READY if it has no input yet; a writer takes len bytes of
+output. cl is the closure given to init_callback_channel*/
+typedef size_t (*Channel_reader)(void *cl, uint8_t *buf, size_t cap);
+typedef void (*Channel_writer)(void *cl, const uint8_t *buf, size_t len);
+
+#define CHANNEL_NOT_READY ((size_t)-1)
+
+/*returned by try_read_byte when no input byte is ready*/
+#define BYTE_NOT_READY (-2)
+
+Channel init_fd_channel(int inFd, int outFd);
+Channel init_fd_channel_sized(int inFd, int outFd, size_t size);
+Channel init_mem_channel(const uint8_t *input, size_t length);
+Channel init_callback_channel(Channel_reader reader, Channel_writer writer,
+                              void *cl);
+void free_channel(Channel ch);
+
+int read_byte(Channel ch);
+int try_read_byte(Channel ch);
+void write_byte(Channel ch, uint8_t byte);
+void flush_channel(Channel ch);
+
+const uint8_t *get_mem_output(Channel ch, size_t *length);
+
+#endif
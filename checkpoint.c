@@ -0,0 +1,422 @@
+/**************************************************************
+ *
+ *                     checkpoint.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that checkpoints a running UM incrementally. The UM's 
+       segment table tracks what changes (see track_dirty in seg.c), and 
+       each checkpoint appends to a log only the segments, or pages of 
+       large segments, that changed since the one before; the first 
+       checkpoint holds the whole table. The UM's thread only takes the 
+       delta (pinning the changed segments so later stores copy them, and 
+       copying the changed pages); a writer thread writes it out while the
+       UM keeps running. A checkpoint that comes due while the last one is
+       still being written is skipped, and its changes go into the next.
+
+       The log is a Log_header followed by one record per checkpoint: a 
+       Checkpoint_header with the registers and pc, the delta, and a 
+       Checkpoint_trailer. A record is only counted once its trailer is 
+       written, so restoring from a log whose writer died halfway uses 
+       the checkpoint before. As with snapshots, the UM's input and output
+       are not part of a checkpoint, and a log is only read back on a host
+       with the byte order it was written with.
+ *
+ **************************************************************/
+
+#include "checkpoint.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_MAGIC "UMCKLOG1"
+#define LOG_VERSION 1
+#define BYTE_ORDER_MARK 0x01020304u
+#define RECORD_MAGIC 0x4b434d55u
+#define TRAILER_MAGIC 0x454e4f44u
+#define NUM_REGISTERS 8
+#define FIRST_RECORD 64
+
+/*the first FIRST_RECORD bytes of a log*/
+typedef struct Log_header {
+        char magic[8];
+        uint32_t byteOrder;
+        uint32_t version;
+        uint32_t reserved[12];
+} Log_header;
+
+/*the start of a record; the delta follows, length bytes long*/
+typedef struct Checkpoint_header {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t registers[NUM_REGISTERS];
+        uint32_t pc;
+        uint32_t reserved;
+        uint64_t instructions;
+        uint64_t length;
+} Checkpoint_header;
+
+/*the end of a record, written last*/
+typedef struct Checkpoint_trailer {
+        uint32_t magic;
+        uint32_t sequence;
+} Checkpoint_trailer;
+
+/*the Checkpointer struct holds the log and the writer thread. pending is
+the delta handed to the writer (NULL while it is idle) with the header of 
+its record at pendingAt, and written is the last delta the writer 
+finished, which the UM's thread frees since freeing it changes the 
+segment table. lock guards pending, written, stopping and failed; next and
+sequence are only used on the UM's thread*/
+struct Checkpointer {
+        Um universe;
+        int fd;
+        uint64_t next;
+        uint32_t sequence;
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        Seg_delta pending;
+        Checkpoint_header header;
+        uint64_t pendingAt;
+        Seg_delta written;
+        bool stopping;
+        bool failed;
+};
+
+static void *write_checkpoints(void *arg);
+static bool write_record(int fd, uint64_t at, 
+                         const Checkpoint_header *header, Seg_delta delta);
+static bool read_log_header(const uint8_t *image, size_t length);
+
+/************start_checkpoints****************************************
+*
+* Description: Function that creates a checkpoint log for a UM and starts
+*              its writer thread
+*
+* Parameters: Um universe: the UM, which is not running
+*             const char *path: the log file, created or truncated
+*
+* Returns: the Checkpointer, or NULL if the log cannot be created
+*
+* Expects: universe != NULL, path != NULL, and memory allocation suceeds
+*      
+* Notes: turns on dirty tracking for the UM's segments, which every 
+*        engine reports its stores, maps and unmaps to. take_checkpoint 
+*        needs the UM stopped between instructions, as run_um_until and 
+*        run_um_for leave it
+**************************************************************/
+Checkpointer start_checkpoints(Um universe, const char *path)
+{
+        assert(universe && path);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+                return NULL;
+        }
+        Log_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+        header.byteOrder = BYTE_ORDER_MARK;
+        header.version = LOG_VERSION;
+        if (pwrite(fd, &header, sizeof(header), 0) != 
+            (ssize_t)sizeof(header)) {
+                close(fd);
+                return NULL;
+        }
+
+        Checkpointer ckpt = calloc(1, sizeof(struct Checkpointer));
+        assert(ckpt);
+        ckpt->universe = universe;
+        ckpt->fd = fd;
+        ckpt->next = FIRST_RECORD;
+        pthread_mutex_init(&ckpt->lock, NULL);
+        pthread_cond_init(&ckpt->wake, NULL);
+        track_dirty(get_seg_sequences(universe));
+        int failed = pthread_create(&ckpt->thread, NULL, write_checkpoints,
+                                    ckpt);
+        assert(failed == 0);
+        (void)failed;
+        return ckpt;
+}
+
+/************take_checkpoint****************************************
+*
+* Description: Function that takes a checkpoint of the UM as it is now and
+*              hands it to the writer thread
+*
+* Parameters: Checkpointer ckpt: the Checkpointer
+*
+* Returns: true if the checkpoint was taken, false if it was skipped 
+*          because the writer is still busy with the one before
+*
+* Expects: ckpt != NULL, and the UM is not running
+*      
+* Notes: does not wait for the checkpoint to be written
+**************************************************************/
+bool take_checkpoint(Checkpointer ckpt)
+{
+        assert(ckpt);
+        allSegments segs = get_seg_sequences(ckpt->universe);
+        pthread_mutex_lock(&ckpt->lock);
+        if (ckpt->pending != NULL) {
+                pthread_mutex_unlock(&ckpt->lock);
+                return false;
+        }
+        Seg_delta written = ckpt->written;
+        ckpt->written = NULL;
+        pthread_mutex_unlock(&ckpt->lock);
+        if (written != NULL) {
+                free_delta(segs, written);
+        }
+
+        Checkpoint_header header;
+        memset(&header, 0, sizeof(header));
+        header.magic = RECORD_MAGIC;
+        header.sequence = ckpt->sequence++;
+        for (unsigned i = 0; i < NUM_REGISTERS; i++) {
+                header.registers[i] = get_register(ckpt->universe, i);
+        }
+        header.pc = get_pc(ckpt->universe);
+        header.instructions = get_instruction_count(ckpt->universe);
+        uint64_t at = ckpt->next;
+        Seg_delta delta = take_delta(segs, at + sizeof(header));
+        header.length = delta_length(delta);
+        ckpt->next = at + sizeof(header) + header.length + 
+                     sizeof(Checkpoint_trailer);
+
+        pthread_mutex_lock(&ckpt->lock);
+        ckpt->header = header;
+        ckpt->pendingAt = at;
+        ckpt->pending = delta;
+        pthread_cond_broadcast(&ckpt->wake);
+        pthread_mutex_unlock(&ckpt->lock);
+        return true;
+}
+
+/************finish_checkpoints****************************************
+*
+* Description: Function that takes a last checkpoint, waits for everything
+*              to be written, and frees the Checkpointer
+*
+* Parameters: Checkpointer ckpt: the Checkpointer
+*
+* Returns: true if every checkpoint that was taken was written
+*
+* Expects: ckpt != NULL, and the UM is not running
+*      
+* Notes: the UM's segments are still tracked afterwards, which only costs 
+*        the tracking; the log is closed
+**************************************************************/
+bool finish_checkpoints(Checkpointer ckpt)
+{
+        assert(ckpt);
+        pthread_mutex_lock(&ckpt->lock);
+        while (ckpt->pending != NULL) {
+                pthread_cond_wait(&ckpt->wake, &ckpt->lock);
+        }
+        pthread_mutex_unlock(&ckpt->lock);
+        take_checkpoint(ckpt);
+
+        pthread_mutex_lock(&ckpt->lock);
+        ckpt->stopping = true;
+        pthread_cond_broadcast(&ckpt->wake);
+        pthread_mutex_unlock(&ckpt->lock);
+        pthread_join(ckpt->thread, NULL);
+
+        if (ckpt->written != NULL) {
+                free_delta(get_seg_sequences(ckpt->universe), ckpt->written);
+        }
+        bool ok = !ckpt->failed;
+        ok = close(ckpt->fd) == 0 && ok;
+        pthread_cond_destroy(&ckpt->wake);
+        pthread_mutex_destroy(&ckpt->lock);
+        free(ckpt);
+        return ok;
+}
+
+/************restore_checkpoint****************************************
+*
+* Description: Function that makes a new UM from the last complete 
+*              checkpoint in a log
+*
+* Parameters: const char *path: the log
+*
+* Returns: the restored UM, ready to run from where the checkpoint was 
+*          taken, or NULL if the file is not a log, has no complete 
+*          checkpoint, or a complete checkpoint in it is invalid
+*
+* Expects: path != NULL, and memory allocation suceeds
+*      
+* Notes: replays every checkpoint in order, copying the words out of the 
+*        log, so the log is not needed once this returns
+**************************************************************/
+Um restore_checkpoint(const char *path)
+{
+        assert(path);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return NULL;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < FIRST_RECORD) {
+                close(fd);
+                return NULL;
+        }
+        size_t length = info.st_size;
+        uint8_t *image = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (image == MAP_FAILED) {
+                return NULL;
+        }
+        if (!read_log_header(image, length)) {
+                munmap(image, length);
+                return NULL;
+        }
+
+        allSegments segs = init_allSegs_words(NULL, 0);
+        Checkpoint_header last;
+        memset(&last, 0, sizeof(last));
+        bool restored = false;
+        bool valid = true;
+        uint64_t at = FIRST_RECORD;
+        for (uint32_t sequence = 0; valid; sequence++) {
+                Checkpoint_header header;
+                Checkpoint_trailer trailer;
+                if (at + sizeof(header) > length) {
+                        break;
+                }
+                memcpy(&header, image + at, sizeof(header));
+                uint64_t body = at + sizeof(header);
+                if (header.magic != RECORD_MAGIC || 
+                    header.sequence != sequence ||
+                    header.length > length - body ||
+                    sizeof(trailer) > length - body - header.length) {
+                        break;
+                }
+                memcpy(&trailer, image + body + header.length, 
+                       sizeof(trailer));
+                if (trailer.magic != TRAILER_MAGIC || 
+                    trailer.sequence != sequence) {
+                        break;
+                }
+                valid = apply_delta(segs, image + body, header.length, body);
+                last = header;
+                restored = valid;
+                at = body + header.length + sizeof(trailer);
+        }
+        munmap(image, length);
+        if (!restored) {
+                free_allSegments(segs);
+                return NULL;
+        }
+        Um universe = init_um_segs(segs);
+        for (unsigned i = 0; i < NUM_REGISTERS; i++) {
+                set_register(universe, i, last.registers[i]);
+        }
+        set_pc(universe, last.pc);
+        return universe;
+}
+
+/************write_checkpoints****************************************
+*
+* Description: Body of the writer thread: writes each delta it is handed 
+*              until the Checkpointer is stopped
+*
+* Parameters: void *arg: the Checkpointer
+*
+* Returns: NULL
+*
+* Expects: arg != NULL
+*      
+* Notes: a pending delta is always written before the thread stops
+**************************************************************/
+static void *write_checkpoints(void *arg)
+{
+        Checkpointer ckpt = arg;
+        pthread_mutex_lock(&ckpt->lock);
+        while (true) {
+                while (ckpt->pending == NULL && !ckpt->stopping) {
+                        pthread_cond_wait(&ckpt->wake, &ckpt->lock);
+                }
+                if (ckpt->pending == NULL) {
+                        break;
+                }
+                Seg_delta delta = ckpt->pending;
+                Checkpoint_header header = ckpt->header;
+                uint64_t at = ckpt->pendingAt;
+                pthread_mutex_unlock(&ckpt->lock);
+
+                bool ok = write_record(ckpt->fd, at, &header, delta);
+
+                pthread_mutex_lock(&ckpt->lock);
+                ckpt->failed = ckpt->failed || !ok;
+                ckpt->written = delta;
+                ckpt->pending = NULL;
+                pthread_cond_broadcast(&ckpt->wake);
+        }
+        pthread_mutex_unlock(&ckpt->lock);
+        return NULL;
+}
+
+/************write_record****************************************
+*
+* Description: Function that writes one checkpoint record to the log
+*
+* Parameters: int fd: the log
+*             uint64_t at: the offset of the record
+*             const Checkpoint_header *header: its header
+*             Seg_delta delta: its delta
+*
+* Returns: true if every write succeeded
+*
+* Expects: header != NULL, delta != NULL
+*      
+* Notes: the trailer is only written once the rest of the record is on 
+*        disk, so a record with a trailer is complete
+**************************************************************/
+static bool write_record(int fd, uint64_t at, 
+                         const Checkpoint_header *header, Seg_delta delta)
+{
+        Checkpoint_trailer trailer = { TRAILER_MAGIC, header->sequence };
+        uint64_t end = at + sizeof(*header) + header->length;
+        return write_delta(delta, fd) &&
+               pwrite(fd, header, sizeof(*header), at) == 
+                        (ssize_t)sizeof(*header) &&
+               fdatasync(fd) == 0 &&
+               pwrite(fd, &trailer, sizeof(trailer), end) == 
+                        (ssize_t)sizeof(trailer) &&
+               fdatasync(fd) == 0;
+}
+
+/************read_log_header****************************************
+*
+* Description: Function that checks a file starts with a Log_header this
+*              module can read
+*
+* Parameters: const uint8_t *image: the file
+*             size_t length: its length, at least FIRST_RECORD
+*
+* Returns: true if it does
+*
+* Expects: image != NULL
+*      
+* Notes: N/A
+**************************************************************/
+static bool read_log_header(const uint8_t *image, size_t length)
+{
+        assert(image && length >= sizeof(Log_header));
+        (void)length;
+        Log_header header;
+        memcpy(&header, image, sizeof(header));
+        return memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) == 0 &&
+               header.byteOrder == BYTE_ORDER_MARK &&
+               header.version == LOG_VERSION;
+}
@@ -0,0 +1,30 @@
+/**************************************************************
+ *
+ *                     checkpoint.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the checkpoint module, which writes incremental 
+       checkpoints of a running UM to a log from a background thread, and
+       restores a UM from the last complete checkpoint in a log (refer to 
+       the checkpoint.c header for more details).
+ *
+ **************************************************************/
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdbool.h>
+#include "um.h"
+
+struct Checkpointer;
+typedef struct Checkpointer *Checkpointer;
+
+Checkpointer start_checkpoints(Um universe, const char *path);
+bool take_checkpoint(Checkpointer ckpt);
+bool finish_checkpoints(Checkpointer ckpt);
+Um restore_checkpoint(const char *path);
+
+#endif
@@ -0,0 +1,438 @@
+/**************************************************************
+ *
+ *                     host.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that runs many interactive UMs, each reading from and
+       writing to descriptors of its own (pipes or sockets, say), on a few
+       threads. A UM runs for a slice of instructions at a time with
+       run_um_for. One that reaches an IN with no input ready stops there
+       without blocking, since its input descriptor is made non-blocking,
+       and is set aside in an epoll set until the descriptor is readable;
+       a UM that runs through its slice goes to the back of the ready list.
+       A UM that waits needs no stack of its own: run_um_for leaves it at
+       the IN, so running it again is all it takes to resume it.
+
+       Every thread takes UMs off the ready list, and when the list is
+       empty waits in epoll_wait on the one epoll set, which holds every
+       waiting UM's descriptor (armed for one event at a time, so a UM is
+       only ever taken by one thread) and an eventfd that wakes a waiting
+       thread when a UM is added to the ready list. A waiting UM costs its
+       struct, its decoded segment 0, and the HOST_BUFFER bytes of each of
+       its channel's two buffers; UMs forked from one loaded UM (see
+       fork_um) share the rest copy on write.
+ *
+ **************************************************************/
+
+#include "host.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define HOST_BUFFER 4096
+#define HOST_EVENTS 64
+
+/*a UM on the host. watched is set once inFd is in the epoll set*/
+typedef struct Session {
+        Um universe;
+        int inFd;
+        bool watched;
+        Host_done done;
+        void *cl;
+        struct Session *next;
+} Session;
+
+/*the Host struct holds the threads, the epoll set they wait in, the
+eventfd that wakes them, and the list of UMs ready to run. lock guards the
+list, idle (the threads in epoll_wait), sessions (the UMs added that have
+not finished, which host_wait sleeps on finished for), stopping and
+stats*/
+struct Host {
+        int epoll;
+        int wakeup;
+        pthread_t *threads;
+        unsigned numThreads;
+        uint64_t slice;
+        pthread_mutex_t lock;
+        pthread_cond_t finished;
+        Session *readyHead;
+        Session *readyTail;
+        unsigned idle;
+        uint64_t sessions;
+        bool stopping;
+        Host_stats stats;
+};
+
+static void *run_host_thread(void *arg);
+static void run_session(Host host, Session *session);
+static void watch_session(Host host, Session *session, int op);
+static void push_ready(Host host, Session *session);
+static Session *pop_ready(Host host);
+
+/************init_host****************************************
+*
+* Description: Function that starts a host with its threads
+*
+* Parameters: unsigned numThreads: how many threads to run UMs on
+*             uint64_t slice: the most instructions a UM runs before it
+*                             goes to the back of the ready list
+*
+* Returns: the Host
+*
+* Expects: numThreads > 0, slice > 0, and memory allocation, the epoll set,
+*          the eventfd and thread creation all succeed
+*
+* Notes: the threads wait in epoll_wait until host_add gives them UMs
+**************************************************************/
+Host init_host(unsigned numThreads, uint64_t slice)
+{
+        assert(numThreads > 0 && slice > 0);
+        Host host = calloc(1, sizeof(struct Host));
+        assert(host);
+        host->threads = calloc(numThreads, sizeof(pthread_t));
+        assert(host->threads);
+        host->numThreads = numThreads;
+        host->slice = slice;
+        host->epoll = epoll_create1(EPOLL_CLOEXEC);
+        assert(host->epoll >= 0);
+        host->wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK |
+                                  EFD_SEMAPHORE);
+        assert(host->wakeup >= 0);
+        struct epoll_event event = { EPOLLIN, { .ptr = NULL } };
+        int failed = epoll_ctl(host->epoll, EPOLL_CTL_ADD, host->wakeup,
+                               &event);
+        assert(failed == 0);
+        pthread_mutex_init(&host->lock, NULL);
+        pthread_cond_init(&host->finished, NULL);
+        for (unsigned i = 0; i < numThreads; i++) {
+                failed = pthread_create(&host->threads[i], NULL,
+                                        run_host_thread, host);
+                assert(failed == 0);
+        }
+        (void)failed;
+        return host;
+}
+
+/************host_add****************************************
+*
+* Description: Function that gives a UM to the host to run until it halts
+*              or faults, reading from and writing to the given descriptors
+*
+* Parameters: Host host: the Host
+*             Um universe: the UM, which nothing else may run or change
+*                          until done is called
+*             int inFd: the descriptor IN reads from, which is made
+*                       non-blocking
+*             int outFd: the descriptor OUT writes to
+*             Host_done done: called on a host thread once the UM halts or
+*                             faults
+*             void *cl: passed to done
+*
+* Returns: void
+*
+* Expects: host != NULL, universe != NULL, done != NULL, inFd and outFd
+*          are open
+*
+* Notes: the UM gets a new channel on the descriptors, with small buffers.
+*        Writes to outFd wait for room if it is non-blocking and full,
+*        holding the thread. A regular file for inFd is always readable,
+*        so its UM never waits
+**************************************************************/
+void host_add(Host host, Um universe, int inFd, int outFd, Host_done done,
+              void *cl)
+{
+        assert(host && universe && done);
+        int flags = fcntl(inFd, F_GETFL);
+        assert(flags >= 0);
+        fcntl(inFd, F_SETFL, flags | O_NONBLOCK);
+        set_channel(universe, init_fd_channel_sized(inFd, outFd,
+                                                    HOST_BUFFER));
+        Session *session = malloc(sizeof(Session));
+        assert(session);
+        session->universe = universe;
+        session->inFd = inFd;
+        session->watched = false;
+        session->done = done;
+        session->cl = cl;
+        session->next = NULL;
+        pthread_mutex_lock(&host->lock);
+        host->sessions++;
+        push_ready(host, session);
+        pthread_mutex_unlock(&host->lock);
+}
+
+/************host_wait****************************************
+*
+* Description: Function that waits until few enough of the UMs added are
+*              still running
+*
+* Parameters: Host host: the Host
+*             uint64_t most: how many may still be running; 0 waits for all
+*                            of them to finish
+*
+* Returns: void
+*
+* Expects: host != NULL
+*
+* Notes: N/A
+**************************************************************/
+void host_wait(Host host, uint64_t most)
+{
+        assert(host);
+        pthread_mutex_lock(&host->lock);
+        while (host->sessions > most) {
+                pthread_cond_wait(&host->finished, &host->lock);
+        }
+        pthread_mutex_unlock(&host->lock);
+}
+
+/************get_host_stats****************************************
+*
+* Description: Function that gets what the host's threads have done
+*
+* Parameters: Host host: the Host
+*
+* Returns: the totals over all threads
+*
+* Expects: host != NULL
+*
+* Notes: N/A
+**************************************************************/
+Host_stats get_host_stats(Host host)
+{
+        assert(host);
+        pthread_mutex_lock(&host->lock);
+        Host_stats stats = host->stats;
+        pthread_mutex_unlock(&host->lock);
+        return stats;
+}
+
+/************free_host****************************************
+*
+* Description: Function that waits for every UM added to finish, then
+*              stops the threads and frees the Host
+*
+* Parameters: Host host: the Host
+*
+* Returns: void
+*
+* Expects: host != NULL
+*
+* Notes: N/A
+**************************************************************/
+void free_host(Host host)
+{
+        assert(host);
+        host_wait(host, 0);
+        pthread_mutex_lock(&host->lock);
+        host->stopping = true;
+        uint64_t wakeups = host->numThreads;
+        ssize_t put = write(host->wakeup, &wakeups, sizeof(wakeups));
+        assert(put == sizeof(wakeups));
+        (void)put;
+        pthread_mutex_unlock(&host->lock);
+        for (unsigned i = 0; i < host->numThreads; i++) {
+                pthread_join(host->threads[i], NULL);
+        }
+        close(host->wakeup);
+        close(host->epoll);
+        pthread_cond_destroy(&host->finished);
+        pthread_mutex_destroy(&host->lock);
+        free(host->threads);
+        free(host);
+}
+
+/************run_host_thread****************************************
+*
+* Description: Body of a host thread: runs UMs off the ready list, and
+*              waits in epoll_wait for more when it is empty
+*
+* Parameters: void *arg: the Host
+*
+* Returns: NULL
+*
+* Expects: arg != NULL
+*
+* Notes: a UM whose descriptor becomes readable goes on the ready list, so
+*        one epoll_wait can wake many UMs for the threads to share. The
+*        thread stops once the host is stopping and the list is empty
+**************************************************************/
+static void *run_host_thread(void *arg)
+{
+        Host host = arg;
+        struct epoll_event events[HOST_EVENTS];
+        while (true) {
+                pthread_mutex_lock(&host->lock);
+                Session *session = pop_ready(host);
+                if (session != NULL) {
+                        pthread_mutex_unlock(&host->lock);
+                        run_session(host, session);
+                        continue;
+                }
+                if (host->stopping) {
+                        pthread_mutex_unlock(&host->lock);
+                        return NULL;
+                }
+                host->idle++;
+                pthread_mutex_unlock(&host->lock);
+
+                int n = epoll_wait(host->epoll, events, HOST_EVENTS, -1);
+
+                pthread_mutex_lock(&host->lock);
+                host->idle--;
+                for (int i = 0; i < n; i++) {
+                        if (events[i].data.ptr == NULL) {
+                                uint64_t count;
+                                ssize_t got = read(host->wakeup, &count,
+                                                   sizeof(count));
+                                (void)got;
+                        } else {
+                                push_ready(host, events[i].data.ptr);
+                        }
+                }
+                pthread_mutex_unlock(&host->lock);
+        }
+}
+
+/************run_session****************************************
+*
+* Description: Function that runs a UM for a slice, then puts it where it
+*              belongs: back on the ready list, in the epoll set, or, if it
+*              finished, to its done callback
+*
+* Parameters: Host host: the Host
+*             Session *session: the UM, which no other thread has
+*
+* Returns: void
+*
+* Expects: host != NULL, session != NULL
+*
+* Notes: a finished UM's descriptor leaves the epoll set before done is
+*        called, since done may close it
+**************************************************************/
+static void run_session(Host host, Session *session)
+{
+        Um_status status = run_um_for(session->universe, host->slice);
+        pthread_mutex_lock(&host->lock);
+        host->stats.slices++;
+        if (status == UM_BUDGET_EXHAUSTED) {
+                push_ready(host, session);
+                pthread_mutex_unlock(&host->lock);
+                return;
+        }
+        if (status == UM_WAITING_INPUT) {
+                host->stats.waits++;
+                int op = session->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+                session->watched = true;
+                pthread_mutex_unlock(&host->lock);
+                watch_session(host, session, op);
+                return;
+        }
+        host->stats.finished++;
+        pthread_mutex_unlock(&host->lock);
+
+        if (session->watched) {
+                epoll_ctl(host->epoll, EPOLL_CTL_DEL, session->inFd, NULL);
+        }
+        session->done(session->universe, status, session->cl);
+        free(session);
+        pthread_mutex_lock(&host->lock);
+        host->sessions--;
+        pthread_cond_broadcast(&host->finished);
+        pthread_mutex_unlock(&host->lock);
+}
+
+/************watch_session****************************************
+*
+* Description: Function that sets a UM aside until its input descriptor
+*              is readable
+*
+* Parameters: Host host: the Host
+*             Session *session: the UM, which stopped at an IN
+*             int op: EPOLL_CTL_ADD the first time, EPOLL_CTL_MOD after
+*
+* Returns: void
+*
+* Expects: host != NULL, session != NULL
+*
+* Notes: the descriptor is armed for a single event, after which the UM
+*        belongs to whichever thread got it, so the session is not touched
+*        once it is armed; watched is set beforehand, under the host's
+*        lock, which is what orders it and the UM's state before the
+*        thread that takes it next. A descriptor epoll cannot watch puts
+*        the UM back on the ready list instead
+**************************************************************/
+static void watch_session(Host host, Session *session, int op)
+{
+        struct epoll_event event = { EPOLLIN | EPOLLONESHOT,
+                                     { .ptr = session } };
+        if (epoll_ctl(host->epoll, op, session->inFd, &event) != 0) {
+                pthread_mutex_lock(&host->lock);
+                session->watched = op == EPOLL_CTL_MOD;
+                push_ready(host, session);
+                pthread_mutex_unlock(&host->lock);
+        }
+}
+
+/************push_ready****************************************
+*
+* Description: Function that puts a UM at the back of the ready list, and
+*              wakes a thread waiting in epoll_wait if there is one
+*
+* Parameters: Host host: the Host, whose lock is held
+*             Session *session: the UM
+*
+* Returns: void
+*
+* Expects: host != NULL, session != NULL
+*
+* Notes: the eventfd counts as a semaphore, so each write wakes one thread
+**************************************************************/
+static void push_ready(Host host, Session *session)
+{
+        session->next = NULL;
+        if (host->readyTail == NULL) {
+                host->readyHead = session;
+        } else {
+                host->readyTail->next = session;
+        }
+        host->readyTail = session;
+        if (host->idle > 0) {
+                uint64_t one = 1;
+                ssize_t put = write(host->wakeup, &one, sizeof(one));
+                (void)put;
+        }
+}
+
+/************pop_ready****************************************
+*
+* Description: Function that takes the UM at the front of the ready list
+*
+* Parameters: Host host: the Host, whose lock is held
+*
+* Returns: the UM, or NULL if the list is empty
+*
+* Expects: host != NULL
+*
+* Notes: N/A
+**************************************************************/
+static Session *pop_ready(Host host)
+{
+        Session *session = host->readyHead;
+        if (session != NULL) {
+                host->readyHead = session->next;
+                if (host->readyHead == NULL) {
+                        host->readyTail = NULL;
+                }
+        }
+        return session;
+}
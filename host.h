@@ -0,0 +1,45 @@
+/**************************************************************
+ *
+ *                     host.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the host module, which runs many interactive UMs on a
+       few threads, setting aside each UM that waits for input until its
+       descriptor is readable (refer to the host.c header for more
+       details).
+ *
+ **************************************************************/
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+#include "um.h"
+
+/* called on a host thread when a UM given to host_add halts or faults,
+which status tells; cl is the closure given with it. The UM and its
+descriptors are the callback's to free and close */
+typedef void (*Host_done)(Um universe, Um_status status, void *cl);
+
+/*what a host's threads have done so far: the slices they ran, the times a
+UM was set aside to wait for input, and the UMs that finished*/
+typedef struct Host_stats {
+        uint64_t slices;
+        uint64_t waits;
+        uint64_t finished;
+} Host_stats;
+
+struct Host;
+typedef struct Host *Host;
+
+Host init_host(unsigned numThreads, uint64_t slice);
+void host_add(Host host, Um universe, int inFd, int outFd, Host_done done,
+              void *cl);
+void host_wait(Host host, uint64_t most);
+Host_stats get_host_stats(Host host);
+void free_host(Host host);
+
+#endif
@@ -0,0 +1,714 @@
+/**************************************************************
+ *
+ *                     jit.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that translates segment 0 into x86-64 machine code and runs
+ *     it. Each UM word becomes one block of native code that falls through
+ *     to the next, and a table maps every segment 0 index to its block so
+ *     LOADP jumps within segment 0 stay native.
+ *
+ *     The eight UM registers live in r8d-r15d while translated code runs.
+ *     Arithmetic, NAND, CMOV, LV and LOADP jumps within segment 0 run
+ *     natively. SLOAD and SSTORE call small helpers around seg.c, saving
+ *     only the caller-saved r8d-r11d. MAP, UNMAP, IN, OUT and LOADP of
+ *     another segment spill the registers into the UM and call the handler
+ *     in operations[]. Translated code returns to run_um_jit to halt, to
+ *     retranslate after segment 0 is replaced, and after every store into
+ *     segment 0 so the stored word can be translated again.
+ *
+ **************************************************************/
+
+#include "jit.h"
+#include "seg.h"
+#include "op.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assert.h"
+#include "bitpack.h"
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+#define NUM_REGISTERS 8
+#define OPBITS 4
+#define REGID 3
+#define WORDBITS 32
+#define VALUE 25
+#define REGA 6
+
+/* upper bound on the bytes of native code for any one UM word */
+#define MAX_BLOCK 192
+/* a block must have room for the jmp rel32 that redirects it when patched */
+#define MIN_BLOCK 5
+#define PROLOGUE_SIZE 128
+#define MIN_PATCH_SPACE (64 * 1024)
+
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+} Um_opcode;
+
+/* why translated code returned to run_um_jit. The status is returned in the
+low byte, the register holding the index of a store into segment 0 in the
+next byte, and the pc to continue from in the upper 32 bits */
+typedef enum Jit_exit {
+        EXIT_HALT = 0, EXIT_RELOAD, EXIT_STORE0, EXIT_BAD, EXIT_JUMP
+} Jit_exit;
+
+/* x86-64 register numbers; UM register i lives in host register R8 + i */
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8 };
+
+/* A translation of segment 0. code holds the entry prologue and shared
+exit stub, then one block per word, then a patch area that retranslated
+words are appended to. start[i] is where block i was first emitted, and
+where the block before it falls through to; table[i] is where block i
+currently lives, and is what LOADP jumps through. seg0 is the segment the
+translation is of, so a LOADP of a segment that segment 0 already shares 
+keeps the translation */
+struct Jit {
+        Um universe;
+        segment seg0;
+        uint8_t *code;
+        size_t size;
+        size_t used;
+        uint8_t *exitStub;
+        uint8_t **start;
+        uint8_t **table;
+        uint32_t numWords;
+};
+typedef struct Jit *Jit;
+
+typedef uint64_t (*entry_fn)(void *block);
+
+static bool translate(Jit jit);
+static void free_translation(Jit jit);
+static segment current_seg0(Jit jit);
+static bool patch_word(Jit jit, uint32_t index);
+static uint8_t *emit_block(Jit jit, uint8_t *p, uint32_t index,
+                           uint32_t word);
+static uint8_t *emit_prologue(Jit jit, uint8_t *p);
+static uint8_t *emit_exit_stub(Jit jit, uint8_t *p);
+static uint32_t jit_sload(allSegments segs, uint32_t id, uint32_t index);
+static void jit_sstore(Um universe, uint32_t id, uint32_t index,
+                       uint32_t val);
+
+/* small encoders; each writes one instruction at p and returns the byte
+after it. Register arguments are x86-64 register numbers */
+static uint8_t *emit_rex(uint8_t *p, bool w, unsigned reg, unsigned rm)
+{
+        uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+        if (rex != 0x40) {
+                *p++ = rex;
+        }
+        return p;
+}
+
+/* op dst, src for the two-byte-or-less opcodes that take reg, r/m */
+static uint8_t *emit_rr(uint8_t *p, const uint8_t *op, unsigned opLen,
+                        unsigned reg, unsigned rm)
+{
+        p = emit_rex(p, false, reg, rm);
+        memcpy(p, op, opLen);
+        p += opLen;
+        *p++ = 0xc0 | ((reg & 7) << 3) | (rm & 7);
+        return p;
+}
+
+static uint8_t *emit_mov(uint8_t *p, unsigned dst, unsigned src)
+{
+        static const uint8_t op[] = { 0x8b };
+        return emit_rr(p, op, 1, dst, src);
+}
+
+static uint8_t *emit_alu(uint8_t *p, uint8_t opcode, unsigned dst,
+                         unsigned src)
+{
+        return emit_rr(p, &opcode, 1, dst, src);
+}
+
+static uint8_t *emit_0f(uint8_t *p, uint8_t opcode, unsigned dst,
+                        unsigned src)
+{
+        uint8_t op[] = { 0x0f, opcode };
+        return emit_rr(p, op, 2, dst, src);
+}
+
+static uint8_t *emit_f7(uint8_t *p, unsigned ext, unsigned rm)
+{
+        static const uint8_t op[] = { 0xf7 };
+        return emit_rr(p, op, 1, ext, rm);
+}
+
+static uint8_t *emit_imm32(uint8_t *p, uint32_t imm)
+{
+        memcpy(p, &imm, sizeof(imm));
+        return p + sizeof(imm);
+}
+
+static uint8_t *emit_mov_imm32(uint8_t *p, unsigned dst, uint32_t imm)
+{
+        p = emit_rex(p, false, 0, dst);
+        *p++ = 0xb8 + (dst & 7);
+        return emit_imm32(p, imm);
+}
+
+static uint8_t *emit_mov_imm64(uint8_t *p, unsigned dst, uint64_t imm)
+{
+        p = emit_rex(p, true, 0, dst);
+        *p++ = 0xb8 + (dst & 7);
+        memcpy(p, &imm, sizeof(imm));
+        return p + sizeof(imm);
+}
+
+/* mov [rbx + disp8], reg when store, else mov reg, [rbx + disp8] */
+static uint8_t *emit_regfile(uint8_t *p, bool store, unsigned reg,
+                             uint8_t disp)
+{
+        p = emit_rex(p, false, reg, RBX);
+        *p++ = store ? 0x89 : 0x8b;
+        *p++ = 0x40 | ((reg & 7) << 3) | RBX;
+        *p++ = disp;
+        return p;
+}
+
+static uint8_t *emit_spill(uint8_t *p, bool store)
+{
+        for (unsigned i = 0; i < NUM_REGISTERS; i++) {
+                p = emit_regfile(p, store, R8 + i, i * sizeof(uint32_t));
+        }
+        return p;
+}
+
+/* jmp or jcc rel32 to target; cc is the second byte of 0f 8x, or 0 */
+static uint8_t *emit_jump(uint8_t *p, uint8_t cc, uint8_t *target)
+{
+        if (cc == 0) {
+                *p++ = 0xe9;
+        } else {
+                *p++ = 0x0f;
+                *p++ = cc;
+        }
+        int32_t rel = (int32_t)(target - (p + sizeof(int32_t)));
+        return emit_imm32(p, (uint32_t)rel);
+}
+
+/* leave translated code through the exit stub with a status and pc */
+static uint8_t *emit_exit(Jit jit, uint8_t *p, uint32_t status,
+                          uint32_t pc)
+{
+        p = emit_mov_imm64(p, RAX, ((uint64_t)pc << 32) | status);
+        return emit_jump(p, 0, jit->exitStub);
+}
+
+/* spill, set_pc(universe, pc) so the handler can report where it failed,
+call operations[op](universe, a, b, c), reload */
+static uint8_t *emit_callback(Jit jit, uint8_t *p, unsigned op,
+                              unsigned a, unsigned b, unsigned c,
+                              uint32_t pc)
+{
+        p = emit_spill(p, true);
+        p = emit_mov_imm64(p, RDI, (uint64_t)(uintptr_t)jit->universe);
+        p = emit_mov_imm32(p, RSI, pc);
+        p = emit_mov_imm64(p, RAX, (uint64_t)(uintptr_t)set_pc);
+        *p++ = 0xff;
+        *p++ = 0xd0;
+        p = emit_mov_imm64(p, RDI, (uint64_t)(uintptr_t)jit->universe);
+        p = emit_mov_imm32(p, RSI, a);
+        p = emit_mov_imm32(p, RDX, b);
+        p = emit_mov_imm32(p, RCX, c);
+        p = emit_mov_imm64(p, RAX, (uint64_t)(uintptr_t)operations[op]);
+        *p++ = 0xff;
+        *p++ = 0xd0;
+        return emit_spill(p, false);
+}
+
+/* call fn(arg0, args...) with UM registers as the 32 bit arguments, saving
+and restoring r8d-r11d, which the callee may clobber. The result, if any, 
+is left in eax */
+static uint8_t *emit_helper(uint8_t *p, void *fn, void *arg0,
+                            unsigned nargs, const unsigned *args)
+{
+        static const uint8_t push[] = {
+                0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53
+        };
+        static const uint8_t pop[] = {
+                0x41, 0x5b, 0x41, 0x5a, 0x41, 0x59, 0x41, 0x58
+        };
+        static const unsigned argRegs[] = { RSI, RDX, RCX };
+        memcpy(p, push, sizeof(push));
+        p += sizeof(push);
+        p = emit_mov_imm64(p, RDI, (uint64_t)(uintptr_t)arg0);
+        for (unsigned k = 0; k < nargs; k++) {
+                p = emit_mov(p, argRegs[k], args[k]);
+        }
+        p = emit_mov_imm64(p, RAX, (uint64_t)(uintptr_t)fn);
+        *p++ = 0xff;
+        *p++ = 0xd0;
+        memcpy(p, pop, sizeof(pop));
+        return p + sizeof(pop);
+}
+
+/************ run_um_jit ************
+*
+* Description: Function that runs the UM by translating segment 0 to x86-64
+* code and jumping into it, retranslating whenever segment 0 changes
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: void
+*
+* Expects: universe != NULL
+*
+* Notes: falls back to run_um_threaded if executable memory cannot be
+* mapped. Exits with EXIT_FAILURE on an invalid instruction or a LOADP past
+* the end of segment 0
+**********************************/
+void run_um_jit(Um universe)
+{
+        assert(universe);
+        struct Jit jit;
+        memset(&jit, 0, sizeof(jit));
+        jit.universe = universe;
+        if (!translate(&jit)) {
+                run_um_threaded(universe);
+                return;
+        }
+
+        uint32_t pc = get_pc(universe);
+        for (;;) {
+                entry_fn enter = (entry_fn)(void *)jit.code;
+                uint64_t result = enter(pc < jit.numWords ?
+                                        jit.table[pc] :
+                                        jit.table[jit.numWords]);
+                Jit_exit status = (Jit_exit)(result & 0xff);
+                pc = (uint32_t)(result >> 32);
+
+                if (status == EXIT_HALT) {
+                        set_pc(universe, pc);
+                        flush_channel(get_channel(universe));
+                        break;
+                }
+                else if (status == EXIT_RELOAD) {
+                        pc = get_pc(universe);
+                        if (current_seg0(&jit) == jit.seg0) {
+                                continue;
+                        }
+                        free_translation(&jit);
+                        if (!translate(&jit)) {
+                                run_um_threaded(universe);
+                                return;
+                        }
+                }
+                else if (status == EXIT_STORE0) {
+                        unsigned rB = (result >> 8) & 0xff;
+                        uint32_t index = get_register(universe, rB);
+                        jit.seg0 = current_seg0(&jit);
+                        if (!patch_word(&jit, index)) {
+                                free_translation(&jit);
+                                if (!translate(&jit)) {
+                                        set_pc(universe, pc);
+                                        run_um_threaded(universe);
+                                        return;
+                                }
+                        }
+                }
+                else if (status == EXIT_JUMP) {
+                        flush_channel(get_channel(universe));
+                        fprintf(stderr, "um: jump past the end of segment 0 "
+                                "at pc %u\n", pc);
+                        exit(EXIT_FAILURE);
+                }
+                else {
+                        flush_channel(get_channel(universe));
+                        fprintf(stderr, "um: invalid instruction at pc %u\n",
+                                pc);
+                        exit(EXIT_FAILURE);
+                }
+        }
+        free_translation(&jit);
+}
+
+/************ translate ************
+*
+* Description: Function that translates all of the current segment 0
+*
+* Parameters: Jit jit: a JIT whose universe is set and which holds no
+*                      translation
+*
+* Returns: true on success, false if memory could not be mapped
+*
+* Expects: jit != NULL
+*
+* Notes: the code buffer is sized from MAX_BLOCK, plus a patch area of at
+* least a quarter of the blocks for words stored into segment 0 later
+**********************************/
+static bool translate(Jit jit)
+{
+        assert(jit);
+        segment seg0 = current_seg0(jit);
+        uint32_t *words = get_mem(seg0);
+        jit->seg0 = seg0;
+        jit->numWords = get_length(seg0);
+
+        size_t blocks = ((size_t)jit->numWords + 1) * MAX_BLOCK;
+        size_t patchSpace = blocks / 4 > MIN_PATCH_SPACE ?
+                            blocks / 4 : MIN_PATCH_SPACE;
+        jit->size = PROLOGUE_SIZE + blocks + patchSpace;
+        void *code = mmap(NULL, jit->size,
+                          PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+                return false;
+        }
+        jit->code = code;
+        jit->start = malloc((jit->numWords + 1) * sizeof(uint8_t *));
+        jit->table = malloc((jit->numWords + 1) * sizeof(uint8_t *));
+        assert(jit->start && jit->table);
+
+        uint8_t *p = emit_prologue(jit, jit->code);
+        jit->exitStub = p;
+        p = emit_exit_stub(jit, p);
+        assert(p <= jit->code + PROLOGUE_SIZE);
+        p = jit->code + PROLOGUE_SIZE;
+
+        for (uint32_t i = 0; i < jit->numWords; i++) {
+                jit->start[i] = jit->table[i] = p;
+                p = emit_block(jit, p, i, words[i]);
+        }
+        /* running off the end of segment 0 */
+        jit->start[jit->numWords] = jit->table[jit->numWords] = p;
+        p = emit_exit(jit, p, EXIT_BAD, jit->numWords);
+        jit->used = p - jit->code;
+        return true;
+}
+
+/************ patch_word ************
+*
+* Description: Function that retranslates one word of segment 0 after it
+* has been stored into
+*
+* Parameters: Jit jit: a JIT holding a translation of segment 0
+*             uint32_t index: the index of the word that changed
+*
+* Returns: false if the patch area is full, true otherwise
+*
+* Expects: jit != NULL
+*
+* Notes: the new block is appended to the patch area and ends with a jump
+* to the next word. The first bytes of the word's original block are
+* overwritten with a jump to the new one, so code falling through from the
+* previous word reaches it too
+**********************************/
+static bool patch_word(Jit jit, uint32_t index)
+{
+        assert(jit);
+        if (index >= jit->numWords) {
+                return true;
+        }
+        if (jit->size - jit->used < MAX_BLOCK + MIN_BLOCK) {
+                return false;
+        }
+        segment seg0 = get_segment(get_seg_sequences(jit->universe), 0);
+        uint8_t *block = jit->code + jit->used;
+        uint8_t *p = emit_block(jit, block, index, get_mem(seg0)[index]);
+        p = emit_jump(p, 0, jit->start[index + 1]);
+        jit->used = p - jit->code;
+
+        jit->table[index] = block;
+        emit_jump(jit->start[index], 0, block);
+        return true;
+}
+
+/************ free_translation ************
+*
+* Description: Function that frees the code and tables of a translation
+*
+* Parameters: Jit jit: a JIT holding a translation of segment 0
+*
+* Returns: void
+*
+* Expects: jit != NULL
+*
+* Notes: N/A
+**********************************/
+static void free_translation(Jit jit)
+{
+        assert(jit);
+        munmap(jit->code, jit->size);
+        free(jit->start);
+        free(jit->table);
+        jit->code = NULL;
+        jit->start = NULL;
+        jit->table = NULL;
+}
+
+/************ current_seg0 ************
+*
+* Description: gets the segment that is segment 0 of the JIT's UM now
+*
+* Parameters: Jit jit: a JIT whose universe is set
+*
+* Returns: segment 0
+*
+* Expects: jit != NULL
+*
+* Notes: a store into a shared segment 0 replaces it with a copy, so this 
+* can differ from jit->seg0 without the words differing
+**********************************/
+static segment current_seg0(Jit jit)
+{
+        assert(jit);
+        return get_segment(get_seg_sequences(jit->universe), 0);
+}
+
+/************ emit_prologue ************
+*
+* Description: Function that emits the entry point of translated code,
+* called from C as uint64_t enter(void *block)
+*
+* Parameters: Jit jit: the JIT being translated
+*             uint8_t *p: where to emit
+*
+* Returns: the byte after the emitted code
+*
+* Expects: jit != NULL, p != NULL
+*
+* Notes: saves the callee-saved registers, points rbx at the UM's register
+* file and rbp at the jump table, loads r8d-r15d from the register file, and
+* jumps to the block. The stack stays 16-byte aligned for callbacks
+**********************************/
+static uint8_t *emit_prologue(Jit jit, uint8_t *p)
+{
+        static const uint8_t push[] = {
+                0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,
+                0x48, 0x83, 0xec, 0x08
+        };
+        memcpy(p, push, sizeof(push));
+        p += sizeof(push);
+        p = emit_mov_imm64(p, RBX,
+                           (uint64_t)(uintptr_t)get_register_file(
+                                   jit->universe));
+        p = emit_mov_imm64(p, RBP, (uint64_t)(uintptr_t)jit->table);
+        p = emit_spill(p, false);
+        *p++ = 0xff;
+        *p++ = 0xe7;
+        return p;
+}
+
+/************ emit_exit_stub ************
+*
+* Description: Function that emits the shared exit path of translated code
+*
+* Parameters: Jit jit: the JIT being translated
+*             uint8_t *p: where to emit
+*
+* Returns: the byte after the emitted code
+*
+* Expects: jit != NULL, p != NULL
+*
+* Notes: stores r8d-r15d back into the register file and undoes the
+* prologue; rax already holds the status and pc to return
+**********************************/
+static uint8_t *emit_exit_stub(Jit jit, uint8_t *p)
+{
+        (void)jit;
+        static const uint8_t pop[] = {
+                0x48, 0x83, 0xc4, 0x08,
+                0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b,
+                0xc3
+        };
+        p = emit_spill(p, true);
+        memcpy(p, pop, sizeof(pop));
+        return p + sizeof(pop);
+}
+
+/************ emit_block ************
+*
+* Description: Function that translates one UM word into native code
+*
+* Parameters: Jit jit: the JIT being translated
+*             uint8_t *p: where to emit
+*             uint32_t index: the word's index in segment 0
+*             uint32_t word: the word
+*
+* Returns: the byte after the emitted code
+*
+* Expects: jit != NULL, p != NULL
+*
+* Notes: the block falls through to the next word. It is padded to at least
+* MIN_BLOCK bytes and never exceeds MAX_BLOCK
+**********************************/
+static uint8_t *emit_block(Jit jit, uint8_t *p, uint32_t index,
+                           uint32_t word)
+{
+        assert(jit && p);
+        uint8_t *begin = p;
+        unsigned op = Bitpack_getu(word, OPBITS, WORDBITS - OPBITS);
+        unsigned a = Bitpack_getu(word, REGID, REGA);
+        unsigned b = Bitpack_getu(word, REGID, REGID);
+        unsigned c = Bitpack_getu(word, REGID, 0);
+        unsigned xa = R8 + a, xb = R8 + b, xc = R8 + c;
+
+        switch (op) {
+        case CMOV:
+                p = emit_alu(p, 0x85, xc, xc);
+                p = emit_0f(p, 0x45, xa, xb);
+                break;
+        case ADD:
+                if (a == b) {
+                        p = emit_alu(p, 0x03, xa, xc);
+                } else if (a == c) {
+                        p = emit_alu(p, 0x03, xa, xb);
+                } else {
+                        p = emit_mov(p, xa, xb);
+                        p = emit_alu(p, 0x03, xa, xc);
+                }
+                break;
+        case MUL:
+                p = emit_mov(p, RAX, xb);
+                p = emit_0f(p, 0xaf, RAX, xc);
+                p = emit_mov(p, xa, RAX);
+                break;
+        case DIV:
+                p = emit_mov(p, RAX, xb);
+                p = emit_alu(p, 0x33, RDX, RDX);
+                p = emit_f7(p, 6, xc);
+                p = emit_mov(p, xa, RAX);
+                break;
+        case NAND:
+                p = emit_mov(p, RAX, xb);
+                p = emit_alu(p, 0x23, RAX, xc);
+                p = emit_f7(p, 2, RAX);
+                p = emit_mov(p, xa, RAX);
+                break;
+        case HALT:
+                p = emit_exit(jit, p, EXIT_HALT, index);
+                break;
+        case SLOAD: {
+                unsigned args[] = { xb, xc };
+                p = emit_helper(p, (void *)jit_sload,
+                                get_seg_sequences(jit->universe), 2, args);
+                p = emit_mov(p, xa, RAX);
+                break;
+        }
+        case ACTIVATE:
+        case INACTIVATE:
+        case OUT:
+        case IN:
+                p = emit_callback(jit, p, op, a, b, c, index);
+                break;
+        case SSTORE: {
+                unsigned args[] = { xa, xb, xc };
+                p = emit_helper(p, (void *)jit_sstore, jit->universe, 3, 
+                                args);
+                /* a store into segment 0 leaves for retranslation */
+                p = emit_alu(p, 0x85, xa, xa);
+                *p++ = 0x75;
+                uint8_t *skip = p++;
+                p = emit_exit(jit, p, EXIT_STORE0 | (b << 8), index + 1);
+                *skip = (uint8_t)(p - (skip + 1));
+                break;
+        }
+        case LOADP: {
+                p = emit_alu(p, 0x85, xb, xb);
+                uint8_t *slow = p;
+                p = emit_jump(p, 0x85, p);
+                p = emit_mov(p, RCX, xc);
+                *p++ = 0x81;
+                *p++ = 0xf9;
+                p = emit_imm32(p, jit->numWords);
+                uint8_t *range = p;
+                p = emit_jump(p, 0x83, p);
+                /* jmp [rbp + rcx * 8] */
+                *p++ = 0xff;
+                *p++ = 0x64;
+                *p++ = 0xcd;
+                *p++ = 0x00;
+
+                emit_jump(range, 0x83, p);
+                p = emit_exit(jit, p, EXIT_JUMP, index);
+                emit_jump(slow, 0x85, p);
+                p = emit_callback(jit, p, op, a, b, c, index);
+                p = emit_exit(jit, p, EXIT_RELOAD, 0);
+                break;
+        }
+        case LV:
+                a = Bitpack_getu(word, REGID, VALUE);
+                p = emit_mov_imm32(p, R8 + a, Bitpack_getu(word, VALUE, 0));
+                break;
+        default:
+                p = emit_exit(jit, p, EXIT_BAD, index);
+                break;
+        }
+
+        while (p - begin < MIN_BLOCK) {
+                *p++ = 0x90;
+        }
+        assert(p - begin <= MAX_BLOCK);
+        return p;
+}
+
+/************ jit_sload ************
+*
+* Description: Helper called from translated code to load a word from a
+* segment
+*
+* Parameters: allSegments segs: the UM's segments
+*             uint32_t id: the segment ID
+*             uint32_t index: the index of the word in the segment
+*
+* Returns: the word
+*
+* Expects: segs != NULL, id is mapped and index is in bounds
+*
+* Notes: N/A
+**********************************/
+static uint32_t jit_sload(allSegments segs, uint32_t id, uint32_t index)
+{
+        return get_mem(get_segment(segs, id))[index];
+}
+
+/************ jit_sstore ************
+*
+* Description: Helper called from translated code to store a word into a
+* segment
+*
+* Parameters: Um universe: the UM being run
+*             uint32_t id: the segment ID
+*             uint32_t index: the index of the word in the segment
+*             uint32_t val: the word to store
+*
+* Returns: void
+*
+* Expects: universe != NULL, id is mapped and index is in bounds
+*
+* Notes: the store is reported to dirty tracking, as store_segment reports
+* it. Stores into segment 0 keep the UM's decoded copy up to date too; the
+* translated code is patched once the caller returns to run_um_jit
+**********************************/
+static void jit_sstore(Um universe, uint32_t id, uint32_t index,
+                       uint32_t val)
+{
+        allSegments segs = get_seg_sequences(universe);
+        get_writable_mem(segs, id)[index] = val;
+        mark_dirty(segs, id, index);
+        if (id == 0) {
+                patch_decoded(universe, index, val);
+        }
+}
+
+#else
+
+/* no code generator for this architecture; use the threaded engine */
+void run_um_jit(Um universe)
+{
+        assert(universe);
+        run_um_threaded(universe);
+}
+
+#endif
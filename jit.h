@@ -0,0 +1,21 @@
+/**************************************************************
+ *
+ *                     jit.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the JIT module, an execution engine that translates
+ *     segment 0 into x86-64 machine code and runs it natively
+ *
+ **************************************************************/
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "um.h"
+
+void run_um_jit(Um universe);
+
+#endif
@@ -0,0 +1,674 @@
+/**************************************************************
+ *
+ *                     main.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Driver for the UM. Opens the program file named on the command line,
+ *     initializes the machine, and runs it with the selected execution
+ *     engine until it halts
+ *
+ *     Usage: um [-H policy] [-c] [-t | -j | -g | -p profile.json | 
+ *               -s stacks.folded] program.um
+ *            um [-S snapshot [-N n] | [-t] -C log [-I n]] program.um
+ *            um [-t | -j | -g | -p profile.json | -s stacks.folded |
+ *                -S snapshot [-N n] | [-t] -C log [-I n]] -R snapshot
+ *            um [-t | -j | -P threads | -E threads] -F n 
+ *               (program.um | -R snapshot) input ...
+ *            -t   run with the threaded (computed goto) engine
+ *            -j   run with the x86-64 JIT
+ *            -g   count opcode pairs and triples, reported on stderr
+ *            -p   profile the run, writing JSON to profile.json and a
+ *                 summary to stderr (only when built with -DUM_PROFILE)
+ *            -c   measure the load, execute and teardown phases of the
+ *                 run (with -t, -j or neither) with hardware counters,
+ *                 reported on stderr
+ *            -s   sample the run from a SIGPROF timer, writing folded
+ *                 stacks to stacks.folded and a summary to stderr
+ *            -S   write a snapshot of the machine to snapshot when it 
+ *                 halts, and each time the process gets SIGUSR1
+ *            -N   with -S, write the snapshot after n instructions 
+ *                 instead of at the halt, then keep running
+ *            -C   write an incremental checkpoint to log every n 
+ *                 instructions (-I, default CHECKPOINT_INTERVAL) and at 
+ *                 the halt (with -t or neither)
+ *            -R   start from a snapshot, or from the last complete 
+ *                 checkpoint in a log, instead of a program
+ *            -F   run n instructions, then fork the machine once per 
+ *                 input file and run each copy to its halt (with -t, -j
+ *                 or neither), reading that file and writing input.out
+ *            -P   with -F, run the copies at once on a pool of threads,
+ *                 with the threaded engine, POOL_SLICE instructions at a
+ *                 time
+ *            -E   with -F, run the copies at once as sessions on a host of
+ *                 threads, HOST_SLICE instructions at a time, feeding each
+ *                 its input file through a pipe as it runs
+ *            -H   map large segments for transparent huge pages: never
+ *                 (the default), data (all but segment 0) or all; it may
+ *                 be given with any of the forms above
+ *
+ **************************************************************/
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "assert.h"
+#include "um.h"
+#include "jit.h"
+#include "perf.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "pool.h"
+#include "host.h"
+
+#define CHECKPOINT_INTERVAL 100000000
+#define POOL_SLICE 1000000
+#define HOST_SLICE 1000000
+#define FEED_BUFFER (64 * 1024)
+
+/* the UM run_snapshotted is running, and whether SIGUSR1 asked it for a 
+snapshot */
+static Um running;
+static volatile sig_atomic_t snapshotRequested;
+
+static void usage(const char *progname);
+static void run_profiled(Um universe, const char *path);
+static void run_sampled(Um universe, const char *path);
+static void run_snapshotted(Um universe, const char *path, uint64_t after);
+static void request_snapshot(int signum);
+static void write_snapshot(Um universe, const char *path);
+static void run_checkpointed(Um universe, const char *path, 
+                             uint64_t interval, bool threaded);
+static bool run_forked(Um universe, uint64_t warmup, char *inputs[], 
+                       int count, void engine(Um universe), unsigned threads,
+                       bool hosted);
+static void feed_input(int file, int feed);
+static void finish_forked(Um child, Um_status status, void *cl);
+
+int main(int argc, char *argv[])
+{
+        bool threaded = false;
+        bool census = false;
+        bool jit = false;
+        bool counters = false;
+        const char *profilePath = NULL;
+        const char *samplePath = NULL;
+        const char *snapshotPath = NULL;
+        const char *restorePath = NULL;
+        uint64_t snapshotAfter = 0;
+        const char *checkpointPath = NULL;
+        uint64_t interval = CHECKPOINT_INTERVAL;
+        bool forking = false;
+        uint64_t warmup = 0;
+        unsigned threads = 0;
+        unsigned hostThreads = 0;
+        int i = 1;
+        for (; i < argc && argv[i][0] == '-'; i++) {
+                if (strcmp(argv[i], "-t") == 0) {
+                        threaded = true;
+                } else if (strcmp(argv[i], "-j") == 0) {
+                        jit = true;
+                } else if (strcmp(argv[i], "-g") == 0) {
+                        census = true;
+                } else if (strcmp(argv[i], "-c") == 0) {
+                        counters = true;
+                } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                        samplePath = argv[++i];
+                } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+                        snapshotPath = argv[++i];
+                } else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc) {
+                        snapshotAfter = strtoull(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+                        checkpointPath = argv[++i];
+                } else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+                        interval = strtoull(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+                        forking = true;
+                        warmup = strtoull(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+                        threads = strtoul(argv[++i], NULL, 10);
+                        if (threads == 0) {
+                                usage(argv[0]);
+                        }
+                } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+                        hostThreads = strtoul(argv[++i], NULL, 10);
+                        if (hostThreads == 0) {
+                                usage(argv[0]);
+                        }
+                } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+                        restorePath = argv[++i];
+                } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+                        Huge_policy policy;
+                        if (!parse_huge_policy(argv[++i], &policy)) {
+                                usage(argv[0]);
+                        }
+                        set_huge_policy(policy);
+#ifdef UM_PROFILE
+                } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+                        profilePath = argv[++i];
+#endif
+                } else {
+                        usage(argv[0]);
+                }
+        }
+        bool otherEngine = threaded || jit || census || counters ||
+                           profilePath != NULL || samplePath != NULL;
+        int programs = restorePath == NULL;
+        if ((forking ? argc - i <= programs : argc - i != programs) ||
+            (forking && (census || counters || profilePath != NULL || 
+                         samplePath != NULL || snapshotPath != NULL || 
+                         checkpointPath != NULL)) ||
+            (snapshotPath != NULL && otherEngine) ||
+            (checkpointPath != NULL && (jit || census || counters ||
+                                        profilePath != NULL ||
+                                        samplePath != NULL ||
+                                        snapshotPath != NULL)) ||
+            interval == 0 ||
+            (snapshotAfter != 0 && snapshotPath == NULL) ||
+            (restorePath != NULL && counters) ||
+            (threads != 0 && (!forking || jit)) ||
+            (hostThreads != 0 && (!forking || jit || threads != 0))) {
+                usage(argv[0]);
+        }
+
+        FILE *instructions = NULL;
+        if (restorePath == NULL) {
+                instructions = fopen(argv[i], "rb");
+                if (instructions == NULL) {
+                        fprintf(stderr, "%s: could not open %s\n", argv[0],
+                                argv[i]);
+                        exit(EXIT_FAILURE);
+                }
+        }
+        if (counters) {
+                Perf perf = init_perf();
+                perf_run(perf, instructions, jit ? run_um_jit : 
+                         threaded ? run_um_threaded : run_um);
+                fclose(instructions);
+                write_perf_report(perf, stderr);
+                free_perf(perf);
+                return EXIT_SUCCESS;
+        }
+        Um universe;
+        if (instructions != NULL) {
+                universe = init_um(instructions);
+                fclose(instructions);
+        } else {
+                universe = restore_snapshot(restorePath);
+                if (universe == NULL) {
+                        universe = restore_checkpoint(restorePath);
+                }
+                if (universe == NULL) {
+                        fprintf(stderr, "%s: could not restore %s\n", 
+                                argv[0], restorePath);
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        if (forking) {
+                bool ok = run_forked(universe, warmup, argv + i + programs,
+                                     argc - i - programs, jit ? run_um_jit :
+                                     threaded ? run_um_threaded : run_um,
+                                     hostThreads > 0 ? hostThreads : threads,
+                                     hostThreads > 0);
+                free_um(universe);
+                return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else if (snapshotPath != NULL) {
+                run_snapshotted(universe, snapshotPath, snapshotAfter);
+        } else if (checkpointPath != NULL) {
+                run_checkpointed(universe, checkpointPath, interval, 
+                                 threaded);
+        } else if (profilePath != NULL) {
+                run_profiled(universe, profilePath);
+        } else if (samplePath != NULL) {
+                run_sampled(universe, samplePath);
+        } else if (census) {
+                run_um_census(universe, stderr);
+        } else if (jit) {
+                run_um_jit(universe);
+        } else if (threaded) {
+                run_um_threaded(universe);
+        } else {
+                run_um(universe);
+        }
+        free_um(universe);
+        return EXIT_SUCCESS;
+}
+
+/************ usage ************
+*
+* Description: prints the command line usage of the UM and exits
+*
+* Parameters: const char *progname: the name the UM was invoked with
+*
+* Returns: does not return
+*
+* Expects: progname != NULL
+*
+* Notes: exits with EXIT_FAILURE
+**********************************/
+static void usage(const char *progname)
+{
+#ifdef UM_PROFILE
+        fprintf(stderr, "usage: %s [-H policy] [-c] [-t | -j | -g | "
+                "-p profile.json |\n          -s stacks.folded | "
+                "-S snapshot [-N n] | [-t] -C log [-I n]]\n"
+                "          (program.um | -R snapshot)\n"
+                "       %s [-H policy] [-t | -j | -P threads | -E threads] "
+                "-F n\n          (program.um | -R snapshot) input ...\n"
+                "policy is never, data or all\n", progname, progname);
+#else
+        fprintf(stderr, "usage: %s [-H policy] [-c] [-t | -j | -g | "
+                "-s stacks.folded |\n          -S snapshot [-N n] | "
+                "[-t] -C log [-I n]] (program.um | -R snapshot)\n"
+                "       %s [-H policy] [-t | -j | -P threads | -E threads] "
+                "-F n\n          (program.um | -R snapshot) input ...\n"
+                "policy is never, data or all\n", progname, progname);
+#endif
+        exit(EXIT_FAILURE);
+}
+
+/************ run_profiled ************
+*
+* Description: runs the UM with run_um and a profile attached, then writes
+* the profile out
+*
+* Parameters: Um universe: the UM to run
+*             const char *path: the file the JSON report is written to
+*
+* Returns: void
+*
+* Expects: universe != NULL, path != NULL
+*
+* Notes: the summary goes to stderr. Without -DUM_PROFILE -p is not 
+* accepted, so this is never reached
+**********************************/
+static void run_profiled(Um universe, const char *path)
+{
+        assert(universe && path);
+        FILE *report = fopen(path, "w");
+        if (report == NULL) {
+                fprintf(stderr, "um: could not open %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+        Profile prof = init_profile();
+        set_profile(universe, prof);
+        run_um(universe);
+        set_profile(universe, NULL);
+        write_profile_json(prof, report);
+        fclose(report);
+        write_profile_summary(prof, stderr);
+        free_profile(prof);
+}
+
+/************ run_sampled ************
+*
+* Description: runs the UM with run_um while a sampler records where it is,
+* then writes the samples out
+*
+* Parameters: Um universe: the UM to run
+*             const char *path: the file the folded stacks are written to
+*
+* Returns: void
+*
+* Expects: universe != NULL, path != NULL
+*
+* Notes: samples at SAMPLER_HZ; the summary goes to stderr
+**********************************/
+static void run_sampled(Um universe, const char *path)
+{
+        assert(universe && path);
+        FILE *stacks = fopen(path, "w");
+        if (stacks == NULL) {
+                fprintf(stderr, "um: could not open %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+        Sampler sampler = start_sampler(get_published(universe), SAMPLER_HZ);
+        run_um(universe);
+        stop_sampler(sampler);
+        write_folded(sampler, stacks);
+        fclose(stacks);
+        write_sampler_summary(sampler, stderr);
+        free_sampler(sampler);
+}
+
+/************ run_snapshotted ************
+*
+* Description: runs the UM with run_um_until, writing snapshots of it at 
+* the points -S and -N asked for
+*
+* Parameters: Um universe: the UM to run
+*             const char *path: the snapshot file, rewritten each time
+*             uint64_t after: the instruction count to snapshot at, or 0 to
+*                             snapshot at the halt
+*
+* Returns: void
+*
+* Expects: universe != NULL, path != NULL
+*
+* Notes: SIGUSR1 also takes a snapshot, at the next instruction boundary. 
+* A snapshot taken at the halt has the pc on the HALT instruction, so the
+* machine it restores halts at once
+**********************************/
+static void run_snapshotted(Um universe, const char *path, uint64_t after)
+{
+        assert(universe && path);
+        running = universe;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = request_snapshot;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, NULL);
+
+        uint64_t budget = after == 0 ? UINT64_MAX : after;
+        while (true) {
+                uint64_t before = get_instruction_count(universe);
+                bool halted = run_um_until(universe, budget);
+                if (budget != UINT64_MAX) {
+                        budget -= get_instruction_count(universe) - before;
+                }
+                if (halted) {
+                        break;
+                }
+                if (budget == 0 || snapshotRequested) {
+                        snapshotRequested = 0;
+                        write_snapshot(universe, path);
+                }
+                if (budget == 0) {
+                        budget = UINT64_MAX;
+                }
+        }
+        if (after == 0) {
+                set_pc(universe, get_pc(universe) - 1);
+                write_snapshot(universe, path);
+        }
+        signal(SIGUSR1, SIG_DFL);
+        running = NULL;
+}
+
+/************ request_snapshot ************
+*
+* Description: SIGUSR1 handler: stops the running UM so run_snapshotted 
+* can write a snapshot
+*
+* Parameters: int signum: the signal
+*
+* Returns: void
+*
+* Expects: N/A
+*
+* Notes: only stores, so it is async signal safe
+**********************************/
+static void request_snapshot(int signum)
+{
+        (void)signum;
+        snapshotRequested = 1;
+        if (running != NULL) {
+                request_stop(running);
+        }
+}
+
+/************ write_snapshot ************
+*
+* Description: writes a snapshot of the UM, exiting if it cannot
+*
+* Parameters: Um universe: the UM
+*             const char *path: the snapshot file
+*
+* Returns: void
+*
+* Expects: universe != NULL, path != NULL
+*
+* Notes: exits with EXIT_FAILURE if the snapshot is not written
+**********************************/
+static void write_snapshot(Um universe, const char *path)
+{
+        assert(universe && path);
+        if (!save_snapshot(universe, path)) {
+                fprintf(stderr, "um: could not write snapshot %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+/************ run_checkpointed ************
+*
+* Description: runs the UM with run_um_until, or run_um_for when threaded,
+* taking an incremental checkpoint every interval instructions and at the 
+* halt
+*
+* Parameters: Um universe: the UM to run
+*             const char *path: the checkpoint log
+*             uint64_t interval: the instructions between checkpoints
+*             bool threaded: whether to run with the threaded engine
+*
+* Returns: void
+*
+* Expects: universe != NULL, path != NULL, interval > 0
+*
+* Notes: checkpoints are written by a background thread; one that comes due
+* while the one before is still being written is skipped. The checkpoint 
+* at the halt has the pc on the HALT instruction, as a snapshot does. 
+* Exits with EXIT_FAILURE if the log cannot be written, or if the threaded
+* engine faults
+**********************************/
+static void run_checkpointed(Um universe, const char *path, 
+                             uint64_t interval, bool threaded)
+{
+        assert(universe && path && interval > 0);
+        Checkpointer ckpt = start_checkpoints(universe, path);
+        if (ckpt == NULL) {
+                fprintf(stderr, "um: could not create checkpoint log %s\n",
+                        path);
+                exit(EXIT_FAILURE);
+        }
+        if (threaded) {
+                Um_status status = run_um_for(universe, interval);
+                while (status != UM_HALTED && status != UM_FAULTED) {
+                        if (status == UM_BUDGET_EXHAUSTED) {
+                                take_checkpoint(ckpt);
+                        }
+                        status = run_um_for(universe, interval);
+                }
+                if (status == UM_FAULTED) {
+                        fprintf(stderr, "um: faulted at pc %u\n",
+                                get_pc(universe));
+                        exit(EXIT_FAILURE);
+                }
+        } else {
+                while (!run_um_until(universe, interval)) {
+                        take_checkpoint(ckpt);
+                }
+                set_pc(universe, get_pc(universe) - 1);
+        }
+        if (!finish_checkpoints(ckpt)) {
+                fprintf(stderr, "um: could not write checkpoint log %s\n",
+                        path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+/* what finish_forked needs to finish a copy run on a pool or a host */
+typedef struct Forked {
+        const char *input;
+        int in;
+        int out;
+        bool *faulted;
+} Forked;
+
+/************ run_forked ************
+*
+* Description: runs the UM for a while, then forks it once per input file 
+* and runs each copy to its halt
+*
+* Parameters: Um universe: the UM to run and fork
+*             uint64_t warmup: the instructions to run before forking
+*             char *inputs[]: the input files
+*             int count: how many there are
+*             void engine(Um universe): the engine the copies run with
+*             unsigned threads: how many threads to run the copies on at 
+*                               once with run_um_for, or 0 to run them one
+*                               after another with engine
+*             bool hosted: whether those threads are a host, rather than a
+*                          pool
+*
+* Returns: true if every input could be opened and its output created, and
+* no copy faulted
+*
+* Expects: universe != NULL, inputs != NULL
+*
+* Notes: the warmup runs with run_um_until, and exits with EXIT_FAILURE if
+* the UM halts during it. Each copy reads its input file and writes the 
+* file's name with ".out" added, and shares every segment it does not store
+* into. On a pool or a host, at most 4 copies per thread are in flight at 
+* once, which bounds the files open. A copy on a host reads a pipe, which 
+* this thread fills from the input file after adding the copy (see 
+* feed_input), so the copy waits for its input as an interactive one would
+**********************************/
+static bool run_forked(Um universe, uint64_t warmup, char *inputs[], 
+                       int count, void engine(Um universe), unsigned threads,
+                       bool hosted)
+{
+        assert(universe && inputs && engine);
+        if (warmup > 0 && run_um_until(universe, warmup)) {
+                fprintf(stderr, "um: halted before %llu instructions\n",
+                        (unsigned long long)warmup);
+                exit(EXIT_FAILURE);
+        }
+        Pool pool = threads > 0 && !hosted ? init_pool(threads, POOL_SLICE)
+                                           : NULL;
+        Host host = hosted ? init_host(threads, HOST_SLICE) : NULL;
+        if (host != NULL) {
+                signal(SIGPIPE, SIG_IGN);
+        }
+        bool ok = true;
+        bool faulted = false;
+        for (int i = 0; i < count; i++) {
+                size_t length = strlen(inputs[i]);
+                char *outPath = malloc(length + sizeof(".out"));
+                assert(outPath);
+                memcpy(outPath, inputs[i], length);
+                memcpy(outPath + length, ".out", sizeof(".out"));
+                Forked *forked = malloc(sizeof(Forked));
+                assert(forked);
+                forked->input = inputs[i];
+                forked->faulted = &faulted;
+                forked->in = open(inputs[i], O_RDONLY);
+                forked->out = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 
+                                   0644);
+                if (forked->in < 0 || forked->out < 0) {
+                        fprintf(stderr, "um: could not open %s or %s\n", 
+                                inputs[i], outPath);
+                        ok = false;
+                        finish_forked(NULL, UM_HALTED, forked);
+                } else {
+                        int file = forked->in;
+                        int ends[2];
+                        if (host != NULL) {
+                                int failed = pipe(ends);
+                                assert(failed == 0);
+                                (void)failed;
+                                forked->in = ends[0];
+                        }
+                        Um child = fork_um(universe, 
+                                           init_fd_channel(forked->in, 
+                                                           forked->out));
+                        if (host != NULL) {
+                                host_wait(host, 4 * (uint64_t)threads - 1);
+                                host_add(host, child, forked->in, 
+                                         forked->out, finish_forked, forked);
+                                feed_input(file, ends[1]);
+                        } else if (pool != NULL) {
+                                pool_wait(pool, 4 * (uint64_t)threads - 1);
+                                pool_submit(pool, child, finish_forked, 
+                                            forked);
+                        } else {
+                                engine(child);
+                                finish_forked(child, UM_HALTED, forked);
+                        }
+                }
+                free(outPath);
+        }
+        if (pool != NULL) {
+                free_pool(pool);
+        }
+        if (host != NULL) {
+                free_host(host);
+        }
+        return ok && !__atomic_load_n(&faulted, __ATOMIC_RELAXED);
+}
+
+/************ feed_input ************
+*
+* Description: copies an input file into the pipe a copy on a host reads,
+* then closes both
+*
+* Parameters: int file: the input file
+*             int feed: the write end of the pipe
+*
+* Returns: void
+*
+* Expects: file and feed are open
+*
+* Notes: blocks while the pipe is full, until the copy reads. A copy that 
+* halts before reading all of its input closes the read end, and the rest
+* is dropped (SIGPIPE is ignored while a host runs)
+**********************************/
+static void feed_input(int file, int feed)
+{
+        char buffer[FEED_BUFFER];
+        bool reading = true;
+        ssize_t got;
+        while (reading && (got = read(file, buffer, sizeof(buffer))) > 0) {
+                for (ssize_t put = 0; reading && put < got; ) {
+                        ssize_t n = write(feed, buffer + put, got - put);
+                        reading = n >= 0;
+                        put += n;
+                }
+        }
+        close(file);
+        close(feed);
+}
+
+/************ finish_forked ************
+*
+* Description: frees a copy run_forked ran, and closes its files
+*
+* Parameters: Um child: the copy, or NULL if it was never made
+*             Um_status status: how the copy stopped
+*             void *cl: its Forked, which is freed
+*
+* Returns: void
+*
+* Expects: cl != NULL
+*
+* Notes: the Pool_done and Host_done for copies run on a pool or a host, so
+* it may be called on a worker thread. A copy that faulted is reported on 
+* stderr, and sets the flag run_forked returns failure for
+**********************************/
+static void finish_forked(Um child, Um_status status, void *cl)
+{
+        Forked *forked = cl;
+        assert(forked);
+        if (status == UM_FAULTED) {
+                fprintf(stderr, "um: the copy reading %s faulted at pc %u\n",
+                        forked->input, get_pc(child));
+                __atomic_store_n(forked->faulted, true, __ATOMIC_RELAXED);
+        }
+        if (child != NULL) {
+                free_um(child);
+        }
+        if (forked->in >= 0) {
+                close(forked->in);
+        }
+        if (forked->out >= 0) {
+                close(forked->out);
+        }
+        free(forked);
+}
@@ -8,7 +8,9 @@
  *
  *     This file contains the functions for the specific operations the UM can
  *     carry out. Morever, the op module contains an array of function pointers
- *     to be used by the UM module as it carries out the instructions
+ *     to be used by the UM module as it carries out the instructions. The
+ *     handlers reach the UM's registers and segment 0 through the inline 
+ *     accessors in um_state.h
  *
  **************************************************************/
 
@@ -21,6 +23,7 @@
 #include "um.h"
 #include "seg.h"
 #include "op.h"
+#include "um_state.h"
 
 /*three register function declarations. Note that some of these functions have
 uneccesary parameters, but this syntax allows for the use of an array of 
@@ -37,9 +40,12 @@ void unmap_segment(Um universe, unsigned rA, unsigned rB, unsigned rC);
 void output(Um universe, unsigned rA, unsigned rB, unsigned rC);
 void input(Um universe, unsigned rA, unsigned rB, unsigned rC);
 void load_program(Um universe, unsigned rA, unsigned rB, unsigned rC);
+void invalid_instruction(Um universe, unsigned rA, unsigned rB, unsigned rC);
 
-/*array of function pointers for 3 register functions, indexed by opcode*/
-func_ptr operations[] = {
+/*array of function pointers for 3 register functions, indexed by decoded 
+opcode. Opcodes 14 and 15 are decoded to 14, so every decoded opcode has an 
+entry. It is never written, so UMs on any number of threads share it*/
+func_ptr const operations[] = {
         conditional_move,
         segment_load,
         segment_store,
@@ -52,7 +58,9 @@ func_ptr operations[] = {
         unmap_segment,
         output,
         input,
-        load_program
+        load_program,
+        NULL,
+        invalid_instruction
 };
 
 
@@ -77,8 +85,8 @@ void output(Um universe, unsigned rA, unsigned rB, unsigned rC) {
         assert(universe);
         (void) rA;
         (void) rB;
-        char val = get_register(universe, rC);
-        putchar(val);
+        uint8_t val = um_get_reg_unchecked(universe, rC);
+        write_byte(universe->io, val);
 }
 
 /************ input ************
@@ -101,10 +109,10 @@ void input(Um universe, unsigned rA, unsigned rB, unsigned rC) {
         assert(universe);
         (void) rA;
         (void) rB;
-        int input = fgetc(stdin);
-        set_register(universe, rC, (uint32_t)input);
+        int input = read_byte(universe->io);
+        um_set_reg_unchecked(universe, rC, (uint32_t)input);
         if (input == EOF) {
-                set_register(universe, rC, (uint32_t)~0);
+                um_set_reg_unchecked(universe, rC, (uint32_t)~0);
         }
 }
 
@@ -129,9 +137,9 @@ void input(Um universe, unsigned rA, unsigned rB, unsigned rC) {
 void conditional_move(Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
-        if(get_register(universe, rC) != 0) {
-            uint32_t val = get_register(universe, rB);
-            set_register(universe, rA, val);
+        if(um_get_reg_unchecked(universe, rC) != 0) {
+            uint32_t val = um_get_reg_unchecked(universe, rB);
+            um_set_reg_unchecked(universe, rA, val);
         }
         return;
 }
@@ -153,16 +161,22 @@ void conditional_move(Um universe, unsigned rA, unsigned rB, unsigned rC)
 *      
 * Notes: if a segment ID that has not been mapped, or a word index greater 
 * than the amount of words in a segnent, is in rB or rC respectively, the UM
-* will fail
+* will fail. Loads from segment 0 go through the UM's cached segment 0
 **********************************/
 void segment_load(Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
-        allSegments segSeqs = get_seg_sequences(universe);
-        uint32_t segmentIndex = get_register(universe, rB);
-        segment seg = get_segment(segSeqs, segmentIndex);
-        uint32_t memIndex =  get_register(universe, rC);
-        set_register(universe, rA, get_mem(seg)[memIndex]);
+        uint32_t segmentIndex = um_get_reg_unchecked(universe, rB);
+        uint32_t memIndex =  um_get_reg_unchecked(universe, rC);
+        uint32_t val;
+        if (segmentIndex == 0) {
+                val = um_seg0_word(universe, memIndex);
+        }
+        else {
+                segment seg = get_segment(universe->umSegments, segmentIndex);
+                val = get_mem(seg)[memIndex];
+        }
+        um_set_reg_unchecked(universe, rA, val);
         return;
 }
 
@@ -183,15 +197,21 @@ void segment_load(Um universe, unsigned rA, unsigned rB, unsigned rC)
 *      
 * Notes: if a segment ID that has not been mapped, or a word index greater 
 * than the amount of words in a segnent, is in rA or rB respectively, the UM
-* will fail
+* will fail. Stores into segment 0 also update the decoded copy of it. The
+* store is reported to the segment's dirty tracking (see mark_dirty)
 **********************************/
 void segment_store(Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
-        allSegments segs = get_seg_sequences(universe);
-        uint32_t segmentIndex = get_register(universe, rA);
-        segment segA = get_segment(segs, segmentIndex);
-        get_mem(segA)[get_register(universe, rB)] = get_register(universe, rC);
+        allSegments segs = universe->umSegments;
+        uint32_t segmentIndex = um_get_reg_unchecked(universe, rA);
+        uint32_t wordIndex = um_get_reg_unchecked(universe, rB);
+        uint32_t val = um_get_reg_unchecked(universe, rC);
+        get_writable_mem(segs, segmentIndex)[wordIndex] = val;
+        mark_dirty(segs, segmentIndex, wordIndex);
+        if (segmentIndex == 0) {
+                patch_decoded(universe, wordIndex, val);
+        }
         return;
 }
 
@@ -214,8 +234,9 @@ void segment_store(Um universe, unsigned rA, unsigned rB, unsigned rC)
 void add(Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
-        uint32_t val = get_register(universe, rB) + get_register(universe, rC);
-        set_register(universe, rA, val);
+        uint32_t val = um_get_reg_unchecked(universe, rB) + 
+                       um_get_reg_unchecked(universe, rC);
+        um_set_reg_unchecked(universe, rA, val);
 }
 
 /************multiply****************************8**
@@ -237,9 +258,9 @@ void add(Um universe, unsigned rA, unsigned rB, unsigned rC)
 void multiply(Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
-        uint32_t valB = get_register(universe, rB);
-        uint32_t valC = get_register(universe, rC);
-        set_register(universe, rA, valC * valB);
+        uint32_t valB = um_get_reg_unchecked(universe, rB);
+        uint32_t valC = um_get_reg_unchecked(universe, rC);
+        um_set_reg_unchecked(universe, rA, valC * valB);
 }
 
 /************divide****************************************
@@ -262,8 +283,9 @@ void multiply(Um universe, unsigned rA, unsigned rB, unsigned rC)
 void divide(Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
-        uint32_t val = get_register(universe, rB) / get_register(universe, rC);
-        set_register(universe, rA, val);
+        uint32_t val = um_get_reg_unchecked(universe, rB) / 
+                       um_get_reg_unchecked(universe, rC);
+        um_set_reg_unchecked(universe, rA, val);
 }
 
 /************bitNAND****************************8**
@@ -285,9 +307,9 @@ void divide(Um universe, unsigned rA, unsigned rB, unsigned rC)
 void bitNAND (Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
-        uint32_t valB = get_register(universe, rB);
-        uint32_t valC = get_register(universe, rC);
-        set_register(universe, rA, ~(valB & valC));
+        uint32_t valB = um_get_reg_unchecked(universe, rB);
+        uint32_t valC = um_get_reg_unchecked(universe, rC);
+        um_set_reg_unchecked(universe, rA, ~(valB & valC));
         return;
 }
  
@@ -312,10 +334,11 @@ void bitNAND (Um universe, unsigned rA, unsigned rB, unsigned rC)
 void map_segment (Um universe, unsigned rA, unsigned rB, unsigned rC) {
         assert(universe);
         (void) rA;
-        allSegments segs = get_seg_sequences(universe);
-        uint32_t val = get_register(universe, rC);
+        allSegments segs = universe->umSegments;
+        uint32_t val = um_get_reg_unchecked(universe, rC);
         uint32_t segId = init_segment(val, segs);
-        set_register(universe, rB, segId);
+        mark_dirty(segs, segId, DIRTY_WHOLE);
+        um_set_reg_unchecked(universe, rB, segId);
         return;
 }
 
@@ -333,8 +356,9 @@ void map_segment (Um universe, unsigned rA, unsigned rB, unsigned rC) {
 *
 * Expects: universe != NULL
 *      
-* Notes: frees all memory of the unampped segemnt. UM will fail if function  
-* attempts to unmap an ID that does not correlate to a mapped segment 
+* Notes: the unmapped segemnt's memory goes back to the segment pool. UM 
+* will fail if function attempts to unmap an ID that does not correlate to a
+* mapped segment 
 ****************************************************/
 void unmap_segment (Um universe, unsigned rA, unsigned rB, unsigned rC) 
 {
@@ -342,11 +366,10 @@ void unmap_segment (Um universe, unsigned rA, unsigned rB, unsigned rC)
         assert(universe);
         (void) rA;
         (void) rB;
-        allSegments segs = get_seg_sequences(universe);
-        uint32_t val = get_register(universe, rC);
-        segment segC = get_segment(segs, val);
-        free_segment(segC);
+        allSegments segs = universe->umSegments;
+        uint32_t val = um_get_reg_unchecked(universe, rC);
         unmap_id(val, segs);
+        mark_dirty(segs, val, DIRTY_WHOLE);
         return;
 }
 
@@ -365,23 +388,40 @@ void unmap_segment (Um universe, unsigned rA, unsigned rB, unsigned rC)
 *
 * Expects: universe != NULL
 *      
-* Notes: frees all memory associated with the old segment 0, and allocates 
-* memory for the duplicated segment. This particular operation is not 
-* is equal to 0
+* Notes: releases the old segment 0, which then shares its memory with the
+* duplicated segment until one of them is stored into. This particular 
+* operation is not is equal to 0. Replacing segment 0 discards its decoded 
+* copy, unless segment 0 was already shared with the loaded segment, and 
+* counts as a new segment 0 generation for the sampler. A jump past the end
+* of the segment it would run is checked before anything is replaced, and 
+* exits with EXIT_FAILURE, as it does in run_um_threaded
 **************************************************/
 void load_program(Um universe, unsigned rA, unsigned rB, unsigned rC)
 {
         assert(universe);
         (void)rA;
-        uint32_t wordIndex = get_register(universe, rC);
-        allSegments segs = get_seg_sequences(universe);
-        if (get_register(universe, rB) == 0){
-                set_pc(universe, wordIndex);
+        uint32_t wordIndex = um_get_reg_unchecked(universe, rC);
+        uint32_t segmentIndex = um_get_reg_unchecked(universe, rB);
+        allSegments segs = universe->umSegments;
+        uint32_t targetLen = segmentIndex == 0 ? universe->seg0Len :
+                             get_length(get_segment(segs, segmentIndex));
+        if (wordIndex >= targetLen) {
+                flush_channel(universe->io);
+                fprintf(stderr, "um: jump past the end of segment 0 at pc "
+                        "%u\n", universe->pc);
+                exit(EXIT_FAILURE);
+        }
+        if (segmentIndex == 0){
+                universe->pc = wordIndex;
                 return;
         }
-        segment segB = copy_and_replace(segs, get_register(universe, rB));
-        (void) segB;
-        set_pc(universe, wordIndex);
+        segment oldSeg0 = get_segment(segs, 0);
+        universe->generation++;
+        if (copy_and_replace(segs, segmentIndex) != oldSeg0) {
+                invalidate_decoded(universe);
+        }
+        mark_dirty(segs, 0, DIRTY_WHOLE);
+        universe->pc = wordIndex;
         return;
 }
 
@@ -400,5 +440,32 @@ void load_program(Um universe, unsigned rA, unsigned rB, unsigned rC)
 void load_value(Um universe, unsigned rA, uint32_t val) 
 {
         assert(universe);
-        set_register(universe, rA, val);        
-}
\ No newline at end of file
+        um_set_reg_unchecked(universe, rA, val);        
+}
+
+/************invalid_instruction******************************
+*
+* Description: Function that fails the UM when it executes a word whose 
+* opcode is not a UM instruction (14 or 15)
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             rA: voided
+*             rB: voided
+*             rC: voided
+*           
+* Returns: does not return
+*
+* Expects: universe != NULL
+*      
+* Notes: exits with EXIT_FAILURE
+**************************************************/
+void invalid_instruction(Um universe, unsigned rA, unsigned rB, unsigned rC)
+{
+        assert(universe);
+        (void) rA;
+        (void) rB;
+        (void) rC;
+        flush_channel(universe->io);
+        fprintf(stderr, "um: invalid instruction\n");
+        exit(EXIT_FAILURE);
+}
@@ -21,6 +21,6 @@
 #ifndef OP_H
 #define OP_H
 typedef void (*func_ptr)(Um universe, unsigned rA, unsigned rB, unsigned rC);
-extern func_ptr operations[];
+extern func_ptr const operations[];
 void load_value(Um universe, unsigned rA, uint32_t val);
 #endif
\ No newline at end of file
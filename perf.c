@@ -0,0 +1,530 @@
+/**************************************************************
+ *
+ *                     perf.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that measures UM runs with hardware performance counters.
+       On Linux it opens perf_event_open counters for cycles, instructions,
+       branch misses, cache misses and data TLB load misses of the calling
+       thread, in user space
+       only so that it works at the default perf_event_paranoid setting.
+       perf_start and perf_stop bracket a phase of the run; perf_run
+       brackets the three phases of a whole run (init_um, an execution
+       engine, free_um) and keeps the number of UM instructions and
+       dispatches the engine reports, so the counts can be given per UM
+       instruction and per dispatch. A counter the host cannot open (no
+       PMU in a virtual machine, perf_event_paranoid of 3, another OS) is
+       marked as not counted and the rest still work; wall time is always
+       measured.
+ *
+ **************************************************************/
+
+#include "perf.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *event_names[PERF_NUM_EVENTS] = {
+        "cycles", "instructions", "branch-misses", "cache-misses",
+        "dTLB-misses"
+};
+
+static const char *phase_names[PERF_NUM_PHASES] = {
+        "load", "execute", "teardown"
+};
+
+/*the Perf struct holds a descriptor per event (-1 if it could not be
+opened, with the errno of the first failure in openError), the counts
+accumulated per phase, and the readings taken when each phase was last
+started. instructions and dispatches are what the engine measured by
+perf_run reported for its run*/
+struct Perf {
+        int fds[PERF_NUM_EVENTS];
+        int openError;
+        Perf_counts phases[PERF_NUM_PHASES];
+        uint64_t startValue[PERF_NUM_PHASES][PERF_NUM_EVENTS];
+        uint64_t startNs[PERF_NUM_PHASES];
+        uint64_t instructions;
+        uint64_t dispatches;
+};
+
+/*helper functions */
+static int open_event(Perf_event event);
+static uint64_t read_event(int fd);
+static uint64_t now_ns(void);
+static double ratio(uint64_t count, bool counted, uint64_t per);
+
+/************init_perf****************************************
+*
+* Description: Function that opens the counters for the calling thread
+*
+* Parameters: N/A
+*
+* Returns: a pointer to the new Perf, with every phase at zero
+*
+* Expects: memory allocation suceeds
+*
+* Notes: counters that cannot be opened are left out, rather than failing;
+*        perf_available says whether any were opened
+**************************************************************/
+Perf init_perf(void)
+{
+        Perf perf = calloc(1, sizeof(struct Perf));
+        assert(perf);
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                perf->fds[e] = open_event(e);
+                if (perf->fds[e] < 0 && perf->openError == 0) {
+                        perf->openError = errno;
+                }
+        }
+        return perf;
+}
+
+/************free_perf****************************************
+*
+* Description: Function that closes the counters and frees a Perf
+*
+* Parameters: Perf perf: the Perf being freed
+*
+* Returns: void
+*
+* Expects: perf != NULL
+*
+* Notes: N/A
+**************************************************************/
+void free_perf(Perf perf)
+{
+        assert(perf);
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                if (perf->fds[e] >= 0) {
+                        close(perf->fds[e]);
+                }
+        }
+        free(perf);
+}
+
+/************perf_available****************************************
+*
+* Description: Function that says whether any hardware counter is open
+*
+* Parameters: Perf perf: the Perf
+*
+* Returns: true if at least one event is being counted
+*
+* Expects: perf != NULL
+*
+* Notes: N/A
+**************************************************************/
+bool perf_available(Perf perf)
+{
+        assert(perf);
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                if (perf->fds[e] >= 0) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+/************perf_start****************************************
+*
+* Description: Function that starts measuring a phase
+*
+* Parameters: Perf perf: the Perf
+*             Perf_phase phase: the phase being started
+*
+* Returns: void
+*
+* Expects: perf != NULL, phase < PERF_NUM_PHASES
+*
+* Notes: the counters run all the time; a phase is the difference between
+*        the readings at perf_start and perf_stop, added to the phase's
+*        counts, so a phase can be started and stopped more than once
+**************************************************************/
+void perf_start(Perf perf, Perf_phase phase)
+{
+        assert(perf);
+        assert(phase < PERF_NUM_PHASES);
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                perf->startValue[phase][e] = read_event(perf->fds[e]);
+        }
+        perf->startNs[phase] = now_ns();
+}
+
+/************perf_stop****************************************
+*
+* Description: Function that stops measuring a phase and adds what was
+*              measured to its counts
+*
+* Parameters: Perf perf: the Perf
+*             Perf_phase phase: the phase being stopped
+*
+* Returns: void
+*
+* Expects: perf != NULL, phase < PERF_NUM_PHASES, and perf_start was called
+*          for the phase
+*
+* Notes: the wall clock is read first and the counters last, the reverse of
+*        perf_start, so the phase includes as little of perf as possible
+**************************************************************/
+void perf_stop(Perf perf, Perf_phase phase)
+{
+        assert(perf);
+        assert(phase < PERF_NUM_PHASES);
+        Perf_counts *counts = &perf->phases[phase];
+        counts->ns += now_ns() - perf->startNs[phase];
+        for (int e = PERF_NUM_EVENTS - 1; e >= 0; e--) {
+                if (perf->fds[e] < 0) {
+                        continue;
+                }
+                uint64_t value = read_event(perf->fds[e]);
+                counts->value[e] += value - perf->startValue[phase][e];
+                counts->counted[e] = true;
+        }
+}
+
+/************perf_run****************************************
+*
+* Description: Function that loads, runs and frees a UM, measuring each of
+*              the three as a phase
+*
+* Parameters: Perf perf: the Perf
+*             FILE *program: the open program file, given to init_um
+*             Perf_engine engine: the execution engine to run it with
+*
+* Returns: void
+*
+* Expects: perf != NULL, program != NULL, engine != NULL
+*
+* Notes: keeps the instruction and dispatch counts of the run (see
+*        get_instruction_count in um.c); the JIT does not count, which
+*        leaves the per instruction figures undefined
+**************************************************************/
+void perf_run(Perf perf, FILE *program, Perf_engine engine)
+{
+        assert(perf && program && engine);
+        perf_start(perf, PERF_LOAD);
+        Um universe = init_um(program);
+        perf_stop(perf, PERF_LOAD);
+
+        perf_start(perf, PERF_EXECUTE);
+        engine(universe);
+        perf_stop(perf, PERF_EXECUTE);
+        perf->instructions = get_instruction_count(universe);
+        perf->dispatches = get_dispatch_count(universe);
+
+        perf_start(perf, PERF_TEARDOWN);
+        free_um(universe);
+        perf_stop(perf, PERF_TEARDOWN);
+}
+
+/************get_perf_counts****************************************
+*
+* Description: Function that gets what was measured over a phase
+*
+* Parameters: Perf perf: the Perf
+*             Perf_phase phase: the phase
+*
+* Returns: a copy of the phase's counts
+*
+* Expects: perf != NULL, phase < PERF_NUM_PHASES
+*
+* Notes: N/A
+**************************************************************/
+Perf_counts get_perf_counts(Perf perf, Perf_phase phase)
+{
+        assert(perf);
+        assert(phase < PERF_NUM_PHASES);
+        return perf->phases[phase];
+}
+
+/************get_perf_instructions****************************************
+*
+* Description: Function that gets the number of UM instructions executed
+*              in the run measured by perf_run
+*
+* Parameters: Perf perf: the Perf
+*
+* Returns: the count, or 0 if there was no run or the engine did not count
+*
+* Expects: perf != NULL
+*
+* Notes: N/A
+**************************************************************/
+uint64_t get_perf_instructions(Perf perf)
+{
+        assert(perf);
+        return perf->instructions;
+}
+
+/************get_perf_dispatches****************************************
+*
+* Description: Function that gets the number of dispatches in the run
+*              measured by perf_run
+*
+* Parameters: Perf perf: the Perf
+*
+* Returns: the count, or 0 if there was no run or the engine did not count
+*
+* Expects: perf != NULL
+*
+* Notes: fewer than the instructions when superinstructions ran
+**************************************************************/
+uint64_t get_perf_dispatches(Perf perf)
+{
+        assert(perf);
+        return perf->dispatches;
+}
+
+/************perf_per_instruction****************************************
+*
+* Description: Function that gives how many of an event the execute phase
+*              counted per UM instruction
+*
+* Parameters: Perf perf: the Perf
+*             Perf_event event: the event
+*
+* Returns: the ratio, or -1 if the event was not counted or the number of
+*          UM instructions is not known
+*
+* Expects: perf != NULL, event < PERF_NUM_EVENTS
+*
+* Notes: with PERF_INSTRUCTIONS this is host instructions per UM instruction
+**************************************************************/
+double perf_per_instruction(Perf perf, Perf_event event)
+{
+        assert(perf);
+        assert(event < PERF_NUM_EVENTS);
+        Perf_counts *counts = &perf->phases[PERF_EXECUTE];
+        return ratio(counts->value[event], counts->counted[event],
+                     perf->instructions);
+}
+
+/************perf_per_dispatch****************************************
+*
+* Description: Function that gives how many of an event the execute phase
+*              counted per dispatch
+*
+* Parameters: Perf perf: the Perf
+*             Perf_event event: the event
+*
+* Returns: the ratio, or -1 if the event was not counted or the number of
+*          dispatches is not known
+*
+* Expects: perf != NULL, event < PERF_NUM_EVENTS
+*
+* Notes: with PERF_BRANCH_MISSES this is mispredicts per dispatch
+**************************************************************/
+double perf_per_dispatch(Perf perf, Perf_event event)
+{
+        assert(perf);
+        assert(event < PERF_NUM_EVENTS);
+        Perf_counts *counts = &perf->phases[PERF_EXECUTE];
+        return ratio(counts->value[event], counts->counted[event],
+                     perf->dispatches);
+}
+
+/************write_perf_report****************************************
+*
+* Description: Function that writes a table of the counts per phase and
+*              the per instruction and per dispatch figures
+*
+* Parameters: Perf perf: the Perf
+*             FILE *out: the file the report is written to
+*
+* Returns: void
+*
+* Expects: perf != NULL, out != NULL
+*
+* Notes: events that were not counted are shown as "-", and the reason the
+*        first counter could not be opened is given
+**************************************************************/
+void write_perf_report(Perf perf, FILE *out)
+{
+        assert(perf && out);
+        if (!perf_available(perf)) {
+                fprintf(out, "hardware counters unavailable (%s), "
+                        "wall time only\n", strerror(perf->openError));
+        } else if (perf->openError != 0) {
+                fprintf(out, "some hardware counters unavailable (%s)\n",
+                        strerror(perf->openError));
+        }
+        fprintf(out, "%-9s %10s", "phase", "ms");
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                fprintf(out, " %15s", event_names[e]);
+        }
+        fprintf(out, "\n");
+        for (int p = 0; p < PERF_NUM_PHASES; p++) {
+                Perf_counts *counts = &perf->phases[p];
+                fprintf(out, "%-9s %10.3f", phase_names[p],
+                        counts->ns / 1e6);
+                for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                        if (counts->counted[e]) {
+                                fprintf(out, " %15llu",
+                                        (unsigned long long)counts->value[e]);
+                        } else {
+                                fprintf(out, " %15s", "-");
+                        }
+                }
+                fprintf(out, "\n");
+        }
+        if (perf->instructions == 0) {
+                fprintf(out, "UM instructions not counted by this engine\n");
+                return;
+        }
+        fprintf(out, "%llu UM instructions, %llu dispatches, %.1f MIPS\n",
+                (unsigned long long)perf->instructions,
+                (unsigned long long)perf->dispatches,
+                perf->phases[PERF_EXECUTE].ns ? perf->instructions * 1e3 /
+                perf->phases[PERF_EXECUTE].ns : 0.0);
+        double hostPerUm = perf_per_instruction(perf, PERF_INSTRUCTIONS);
+        double cyclesPerUm = perf_per_instruction(perf, PERF_CYCLES);
+        double missesPerDispatch = perf_per_dispatch(perf,
+                                                     PERF_BRANCH_MISSES);
+        double cachePerUm = perf_per_instruction(perf, PERF_CACHE_MISSES);
+        double tlbPerUm = perf_per_instruction(perf, PERF_DTLB_MISSES);
+        if (hostPerUm >= 0) {
+                fprintf(out, "host instructions per UM instruction: %.2f\n",
+                        hostPerUm);
+        }
+        if (cyclesPerUm >= 0) {
+                fprintf(out, "cycles per UM instruction: %.2f\n",
+                        cyclesPerUm);
+        }
+        if (missesPerDispatch >= 0) {
+                fprintf(out, "branch misses per dispatch: %.4f\n",
+                        missesPerDispatch);
+        }
+        if (cachePerUm >= 0) {
+                fprintf(out, "cache misses per 1000 UM instructions: %.3f\n",
+                        cachePerUm * 1000);
+        }
+        if (tlbPerUm >= 0) {
+                fprintf(out, "dTLB misses per 1000 UM instructions: %.3f\n",
+                        tlbPerUm * 1000);
+        }
+}
+
+/************open_event****************************************
+*
+* Description: Function that opens a counter for one event of the calling
+*              thread, counting in user space from now on
+*
+* Parameters: Perf_event event: the event
+*
+* Returns: the counter's descriptor, or -1 with errno set if it could not
+*          be opened
+*
+* Expects: event < PERF_NUM_EVENTS
+*
+* Notes: always fails with ENOSYS off Linux
+**************************************************************/
+static int open_event(Perf_event event)
+{
+#ifdef __linux__
+        static const uint64_t configs[PERF_NUM_EVENTS] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_CACHE_DTLB | 
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        };
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = event == PERF_DTLB_MISSES ? PERF_TYPE_HW_CACHE : 
+                                                PERF_TYPE_HARDWARE;
+        attr.config = configs[event];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                            PERF_FLAG_FD_CLOEXEC);
+#else
+        (void)event;
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+/************read_event****************************************
+*
+* Description: Function that reads a counter
+*
+* Parameters: int fd: the counter's descriptor, or -1
+*
+* Returns: the count so far, scaled up by the time the counter was enabled
+*          over the time it was running, or 0 if fd is -1 or the read fails
+*
+* Expects: N/A
+*
+* Notes: the scaling estimates the count while the kernel multiplexed more
+*        events than the PMU has counters
+**************************************************************/
+static uint64_t read_event(int fd)
+{
+        if (fd < 0) {
+                return 0;
+        }
+        uint64_t buf[3];
+        if (read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0) {
+                return 0;
+        }
+        if (buf[1] == buf[2]) {
+                return buf[0];
+        }
+        return (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+}
+
+/************now_ns****************************************
+*
+* Description: Function that reads the monotonic clock
+*
+* Parameters: N/A
+*
+* Returns: the time in nanoseconds
+*
+* Expects: N/A
+*
+* Notes: N/A
+**************************************************************/
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/************ratio****************************************
+*
+* Description: Function that divides a count by a number of UM instructions
+*              or dispatches
+*
+* Parameters: uint64_t count: the count
+*             bool counted: whether the count was measured
+*             uint64_t per: the divisor
+*
+* Returns: count / per, or -1 if the count was not measured or per is 0
+*
+* Expects: N/A
+*
+* Notes: N/A
+**************************************************************/
+static double ratio(uint64_t count, bool counted, uint64_t per)
+{
+        if (!counted || per == 0) {
+                return -1.0;
+        }
+        return (double)count / per;
+}
@@ -0,0 +1,65 @@
+/**************************************************************
+ *
+ *                     perf.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the perf module, which measures a UM run with the
+       host's hardware performance counters (refer to the perf.c header for
+       more details). Counts are kept per phase of the run, and can be read
+       back through get_perf_counts or written as a report.
+ *
+ **************************************************************/
+
+#ifndef PERF_H_
+#define PERF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "um.h"
+
+typedef enum Perf_phase {
+        PERF_LOAD = 0, PERF_EXECUTE, PERF_TEARDOWN, PERF_NUM_PHASES
+} Perf_phase;
+
+typedef enum Perf_event {
+        PERF_CYCLES = 0, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES,
+        PERF_CACHE_MISSES, PERF_DTLB_MISSES, PERF_NUM_EVENTS
+} Perf_event;
+
+/* what was measured over one phase. counted[e] is false when the host
+could not count event e, in which case value[e] is 0. Counts are scaled up
+when the kernel had to multiplex the counters */
+typedef struct Perf_counts {
+        uint64_t value[PERF_NUM_EVENTS];
+        bool counted[PERF_NUM_EVENTS];
+        uint64_t ns;
+} Perf_counts;
+
+/* an execution engine perf_run can measure: run_um, run_um_threaded or
+run_um_jit */
+typedef void (*Perf_engine)(Um universe);
+
+struct Perf;
+typedef struct Perf *Perf;
+
+Perf init_perf(void);
+void free_perf(Perf perf);
+bool perf_available(Perf perf);
+
+void perf_start(Perf perf, Perf_phase phase);
+void perf_stop(Perf perf, Perf_phase phase);
+void perf_run(Perf perf, FILE *program, Perf_engine engine);
+
+Perf_counts get_perf_counts(Perf perf, Perf_phase phase);
+uint64_t get_perf_instructions(Perf perf);
+uint64_t get_perf_dispatches(Perf perf);
+double perf_per_instruction(Perf perf, Perf_event event);
+double perf_per_dispatch(Perf perf, Perf_event event);
+
+void write_perf_report(Perf perf, FILE *out);
+
+#endif
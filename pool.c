@@ -0,0 +1,497 @@
+/**************************************************************
+ *
+ *                     pool.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that runs many UMs at once on a pool of worker threads.
+       Every worker has its own queue of UMs, and runs the one at the head
+       for a slice of instructions (with run_um_for) before putting it
+       back at the tail, so a long running UM cannot hold a worker while
+       others wait. A worker whose queue is empty steals half of the queue
+       of another worker, starting from a random one, and only sleeps when
+       no queue has anything in it. New UMs are dealt out to the workers'
+       queues in turn. The pool has no way to learn when input arrives, so
+       a UM that stops because no input is ready is finished there, and 
+       handed to its done callback with UM_WAITING_INPUT; interactive UMs,
+       which wait on descriptors, are the host module's to run. Once
+       pool_cancel is called, a UM that uses up its slice is finished 
+       instead of going back in its queue, so a pool of UMs that never 
+       halt can still be freed.
+
+       UMs share nothing a worker writes to: the instruction table is read
+       only, every UM has its own channel, and UMs forked from one another
+       (see fork_um) share their segments copy on write with atomic
+       reference counts. Forking one loaded UM for every run is how a batch
+       shares one program image between all of its UMs.
+ *
+ **************************************************************/
+
+#include "pool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_HINT 16
+
+/*a UM in a queue, with what to call when it finishes*/
+typedef struct Pool_job {
+        Um universe;
+        Pool_done done;
+        void *cl;
+} Pool_job;
+
+/*a worker and its queue, a ring of capacity jobs of which count start at
+head. lock guards the queue, which other workers steal from; seed is the
+worker's random number state for picking whom to steal from*/
+typedef struct Worker {
+        Pool pool;
+        unsigned index;
+        pthread_t thread;
+        pthread_mutex_t lock;
+        Pool_job *jobs;
+        uint32_t head;
+        uint32_t count;
+        uint32_t capacity;
+        uint32_t seed;
+        uint64_t slices;
+        uint64_t steals;
+        uint64_t finished;
+} Worker;
+
+/*the Pool struct holds the workers and the counts they sleep and wait
+on. queued is the number of UMs in all the queues, and unfinished the
+number submitted that have not halted or faulted; a worker sleeps on work
+when queued is 0, and pool_wait sleeps on finished. lock guards both, and
+nextWorker and stopping. cancelled is only ever set, and is read without
+the lock*/
+struct Pool {
+        Worker *workers;
+        unsigned numWorkers;
+        uint64_t slice;
+        pthread_mutex_t lock;
+        pthread_cond_t work;
+        pthread_cond_t finished;
+        uint64_t queued;
+        uint64_t unfinished;
+        unsigned nextWorker;
+        bool stopping;
+        bool cancelled;
+};
+
+static void *run_worker(void *arg);
+static bool take_job(Worker *worker, Pool_job *job);
+static bool steal_jobs(Worker *thief);
+static void push_job(Worker *worker, Pool_job job);
+static bool pop_job(Worker *worker, Pool_job *job);
+
+/************init_pool****************************************
+*
+* Description: Function that starts a pool of worker threads
+*
+* Parameters: unsigned numWorkers: how many threads to run UMs on
+*             uint64_t slice: the most instructions a UM runs before it
+*                             goes back in its queue
+*
+* Returns: the Pool
+*
+* Expects: numWorkers > 0, slice > 0, and memory allocation and thread
+*          creation succeed
+*
+* Notes: the workers sleep until pool_submit gives them UMs
+**************************************************************/
+Pool init_pool(unsigned numWorkers, uint64_t slice)
+{
+        assert(numWorkers > 0 && slice > 0);
+        Pool pool = calloc(1, sizeof(struct Pool));
+        assert(pool);
+        pool->workers = calloc(numWorkers, sizeof(Worker));
+        assert(pool->workers);
+        pool->numWorkers = numWorkers;
+        pool->slice = slice;
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->work, NULL);
+        pthread_cond_init(&pool->finished, NULL);
+        for (unsigned i = 0; i < numWorkers; i++) {
+                Worker *worker = &pool->workers[i];
+                worker->pool = pool;
+                worker->index = i;
+                worker->seed = 2654435761u * (i + 1);
+                worker->capacity = QUEUE_HINT;
+                worker->jobs = malloc(QUEUE_HINT * sizeof(Pool_job));
+                assert(worker->jobs);
+                pthread_mutex_init(&worker->lock, NULL);
+        }
+        for (unsigned i = 0; i < numWorkers; i++) {
+                int failed = pthread_create(&pool->workers[i].thread, NULL,
+                                            run_worker, &pool->workers[i]);
+                assert(failed == 0);
+                (void)failed;
+        }
+        return pool;
+}
+
+/************pool_submit****************************************
+*
+* Description: Function that gives a UM to the pool to run until it halts
+*
+* Parameters: Pool pool: the Pool
+*             Um universe: the UM, which nothing else may run or change
+*                          until done is called
+*             Pool_done done: called on a worker thread once the UM halts,
+*                             faults, waits for input, or is cancelled
+*             void *cl: passed to done
+*
+* Returns: void
+*
+* Expects: pool != NULL, universe != NULL, done != NULL
+*
+* Notes: the UM runs with run_um_for, so its input and output should go
+*        through a channel of its own rather than the process's standard
+*        input and output. A channel that blocks for input (an fd channel
+*        on a blocking descriptor, a mem channel, or a callback channel 
+*        whose reader never returns CHANNEL_NOT_READY) holds its worker 
+*        while it waits. A UM whose channel reports that no input is ready
+*        is not run again: done gets it with UM_WAITING_INPUT, still at its
+*        IN, and may resume it elsewhere or give up on it
+**************************************************************/
+void pool_submit(Pool pool, Um universe, Pool_done done, void *cl)
+{
+        assert(pool && universe && done);
+        Pool_job job = { universe, done, cl };
+        pthread_mutex_lock(&pool->lock);
+        Worker *worker = &pool->workers[pool->nextWorker];
+        pool->nextWorker = (pool->nextWorker + 1) % pool->numWorkers;
+        pool->unfinished++;
+        pool->queued++;
+        pthread_mutex_unlock(&pool->lock);
+
+        pthread_mutex_lock(&worker->lock);
+        push_job(worker, job);
+        pthread_mutex_unlock(&worker->lock);
+
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+}
+
+/************pool_wait****************************************
+*
+* Description: Function that waits until few enough submitted UMs are
+*              still running
+*
+* Parameters: Pool pool: the Pool
+*             uint64_t most: how many may still be running; 0 waits for all
+*                            of them to halt
+*
+* Returns: void
+*
+* Expects: pool != NULL
+*
+* Notes: lets a caller with more UMs than it wants in memory at once keep
+*        a bounded number in the pool
+**************************************************************/
+void pool_wait(Pool pool, uint64_t most)
+{
+        assert(pool);
+        pthread_mutex_lock(&pool->lock);
+        while (pool->unfinished > most) {
+                pthread_cond_wait(&pool->finished, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+}
+
+/************pool_cancel****************************************
+*
+* Description: Function that stops the pool running UMs to their halts
+*
+* Parameters: Pool pool: the Pool
+*
+* Returns: void
+*
+* Expects: pool != NULL
+*
+* Notes: every UM still in the pool is finished at the end of its current
+*        slice, or the next one it is given, and handed to its done 
+*        callback with UM_BUDGET_EXHAUSTED; so is any UM submitted later.
+*        pool_wait then returns within a slice per queued UM, however 
+*        long they would have run
+**************************************************************/
+void pool_cancel(Pool pool)
+{
+        assert(pool);
+        __atomic_store_n(&pool->cancelled, true, __ATOMIC_RELAXED);
+}
+
+/************get_pool_stats****************************************
+*
+* Description: Function that adds up what the workers have done
+*
+* Parameters: Pool pool: the Pool
+*
+* Returns: the totals over all workers
+*
+* Expects: pool != NULL
+*
+* Notes: exact once pool_wait(pool, 0) has returned
+**************************************************************/
+Pool_stats get_pool_stats(Pool pool)
+{
+        assert(pool);
+        Pool_stats stats = { 0, 0, 0 };
+        for (unsigned i = 0; i < pool->numWorkers; i++) {
+                Worker *worker = &pool->workers[i];
+                pthread_mutex_lock(&worker->lock);
+                stats.slices += worker->slices;
+                stats.steals += worker->steals;
+                stats.finished += worker->finished;
+                pthread_mutex_unlock(&worker->lock);
+        }
+        return stats;
+}
+
+/************free_pool****************************************
+*
+* Description: Function that waits for every submitted UM to halt, then
+*              stops the workers and frees the Pool
+*
+* Parameters: Pool pool: the Pool
+*
+* Returns: void
+*
+* Expects: pool != NULL
+*
+* Notes: N/A
+**************************************************************/
+void free_pool(Pool pool)
+{
+        assert(pool);
+        pool_wait(pool, 0);
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+        for (unsigned i = 0; i < pool->numWorkers; i++) {
+                pthread_join(pool->workers[i].thread, NULL);
+        }
+        for (unsigned i = 0; i < pool->numWorkers; i++) {
+                pthread_mutex_destroy(&pool->workers[i].lock);
+                free(pool->workers[i].jobs);
+        }
+        pthread_cond_destroy(&pool->finished);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->workers);
+        free(pool);
+}
+
+/************run_worker****************************************
+*
+* Description: Body of a worker thread: runs a slice of the UM at the head
+*              of its queue, over and over, until the pool is stopped
+*
+* Parameters: void *arg: the Worker
+*
+* Returns: NULL
+*
+* Expects: arg != NULL
+*
+* Notes: a UM that used up its slice goes back at the tail of this 
+*        worker's queue, where other workers can steal it
+**************************************************************/
+static void *run_worker(void *arg)
+{
+        Worker *worker = arg;
+        Pool pool = worker->pool;
+        while (true) {
+                Pool_job job;
+                if (!take_job(worker, &job)) {
+                        pthread_mutex_lock(&pool->lock);
+                        while (pool->queued == 0 && !pool->stopping) {
+                                pthread_cond_wait(&pool->work, &pool->lock);
+                        }
+                        bool stop = pool->queued == 0;
+                        pthread_mutex_unlock(&pool->lock);
+                        if (stop) {
+                                return NULL;
+                        }
+                        continue;
+                }
+                Um_status status = run_um_for(job.universe, pool->slice);
+                bool finished = status != UM_BUDGET_EXHAUSTED ||
+                        __atomic_load_n(&pool->cancelled, __ATOMIC_RELAXED);
+                if (!finished) {
+                        pthread_mutex_lock(&pool->lock);
+                        pool->queued++;
+                        pthread_mutex_unlock(&pool->lock);
+                }
+
+                pthread_mutex_lock(&worker->lock);
+                worker->slices++;
+                worker->finished += finished;
+                if (!finished) {
+                        push_job(worker, job);
+                }
+                pthread_mutex_unlock(&worker->lock);
+                if (!finished) {
+                        continue;
+                }
+                job.done(job.universe, status, job.cl);
+                pthread_mutex_lock(&pool->lock);
+                pool->unfinished--;
+                pthread_cond_broadcast(&pool->finished);
+                pthread_mutex_unlock(&pool->lock);
+        }
+}
+
+/************take_job****************************************
+*
+* Description: Function that takes the next UM for a worker to run, from
+*              its own queue or, if that is empty, from another's
+*
+* Parameters: Worker *worker: the worker
+*             Pool_job *job: set to the UM taken
+*
+* Returns: true if a UM was taken
+*
+* Expects: worker != NULL, job != NULL
+*
+* Notes: N/A
+**************************************************************/
+static bool take_job(Worker *worker, Pool_job *job)
+{
+        Pool pool = worker->pool;
+        bool taken = false;
+        for (int attempt = 0; attempt < 2 && !taken; attempt++) {
+                pthread_mutex_lock(&worker->lock);
+                taken = pop_job(worker, job);
+                pthread_mutex_unlock(&worker->lock);
+                if (!taken && !steal_jobs(worker)) {
+                        break;
+                }
+        }
+        if (taken) {
+                pthread_mutex_lock(&pool->lock);
+                pool->queued--;
+                pthread_mutex_unlock(&pool->lock);
+        }
+        return taken;
+}
+
+/************steal_jobs****************************************
+*
+* Description: Function that moves half of another worker's queue (at
+*              least one UM) to the tail of a worker's own
+*
+* Parameters: Worker *thief: the worker whose queue is empty
+*
+* Returns: true if anything was stolen
+*
+* Expects: thief != NULL
+*
+* Notes: the others are tried in turn, starting from a random one. The
+*        stolen UMs are the ones that have waited longest. Only one
+*        worker's lock is held at a time
+**************************************************************/
+static bool steal_jobs(Worker *thief)
+{
+        Pool pool = thief->pool;
+        if (pool->numWorkers == 1) {
+                return false;
+        }
+        thief->seed ^= thief->seed << 13;
+        thief->seed ^= thief->seed >> 17;
+        thief->seed ^= thief->seed << 5;
+        unsigned start = thief->seed % pool->numWorkers;
+        for (unsigned i = 0; i < pool->numWorkers; i++) {
+                Worker *victim = &pool->workers[(start + i) %
+                                                pool->numWorkers];
+                if (victim == thief) {
+                        continue;
+                }
+                pthread_mutex_lock(&victim->lock);
+                uint32_t n = (victim->count + 1) / 2;
+                Pool_job *stolen = NULL;
+                if (n > 0) {
+                        stolen = malloc(n * sizeof(Pool_job));
+                        assert(stolen);
+                        for (uint32_t j = 0; j < n; j++) {
+                                pop_job(victim, &stolen[j]);
+                        }
+                }
+                pthread_mutex_unlock(&victim->lock);
+                if (n == 0) {
+                        continue;
+                }
+                pthread_mutex_lock(&thief->lock);
+                for (uint32_t j = 0; j < n; j++) {
+                        push_job(thief, stolen[j]);
+                }
+                thief->steals++;
+                pthread_mutex_unlock(&thief->lock);
+                free(stolen);
+                return true;
+        }
+        return false;
+}
+
+/************push_job****************************************
+*
+* Description: Function that adds a UM at the tail of a worker's queue,
+*              doubling the queue when it is full
+*
+* Parameters: Worker *worker: the worker, whose lock is held
+*             Pool_job job: the UM
+*
+* Returns: void
+*
+* Expects: worker != NULL, and memory allocation suceeds
+*
+* Notes: N/A
+**************************************************************/
+static void push_job(Worker *worker, Pool_job job)
+{
+        if (worker->count == worker->capacity) {
+                uint32_t capacity = worker->capacity * 2;
+                Pool_job *jobs = malloc(capacity * sizeof(Pool_job));
+                assert(jobs);
+                for (uint32_t i = 0; i < worker->count; i++) {
+                        jobs[i] = worker->jobs[(worker->head + i) %
+                                               worker->capacity];
+                }
+                free(worker->jobs);
+                worker->jobs = jobs;
+                worker->head = 0;
+                worker->capacity = capacity;
+        }
+        worker->jobs[(worker->head + worker->count) % worker->capacity] = job;
+        worker->count++;
+}
+
+/************pop_job****************************************
+*
+* Description: Function that takes the UM at the head of a worker's queue
+*
+* Parameters: Worker *worker: the worker, whose lock is held
+*             Pool_job *job: set to the UM taken
+*
+* Returns: true if the queue was not empty
+*
+* Expects: worker != NULL, job != NULL
+*
+* Notes: N/A
+**************************************************************/
+static bool pop_job(Worker *worker, Pool_job *job)
+{
+        if (worker->count == 0) {
+                return false;
+        }
+        *job = worker->jobs[worker->head];
+        worker->head = (worker->head + 1) % worker->capacity;
+        worker->count--;
+        return true;
+}
@@ -0,0 +1,45 @@
+/**************************************************************
+ *
+ *                     pool.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the pool module, which runs many UMs at once on a 
+       pool of worker threads with a work stealing scheduler (refer to the
+       pool.c header for more details).
+ *
+ **************************************************************/
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdint.h>
+#include "um.h"
+
+/* called on a worker thread when a UM submitted with pool_submit halts,
+faults, stops because no input is ready, or is cancelled by pool_cancel 
+(UM_BUDGET_EXHAUSTED), which status tells; cl is the closure given with 
+it. The UM is the callback's to free */
+typedef void (*Pool_done)(Um universe, Um_status status, void *cl);
+
+/*what a pool's workers have done so far: the slices they ran, the UMs
+that finished, and the times a worker took UMs from another's queue*/
+typedef struct Pool_stats {
+        uint64_t slices;
+        uint64_t steals;
+        uint64_t finished;
+} Pool_stats;
+
+struct Pool;
+typedef struct Pool *Pool;
+
+Pool init_pool(unsigned numWorkers, uint64_t slice);
+void pool_submit(Pool pool, Um universe, Pool_done done, void *cl);
+void pool_wait(Pool pool, uint64_t most);
+void pool_cancel(Pool pool);
+Pool_stats get_pool_stats(Pool pool);
+void free_pool(Pool pool);
+
+#endif
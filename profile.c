@@ -0,0 +1,649 @@
+/**************************************************************
+ *
+ *                     profile.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that records a profile of a UM run: how often each opcode
+       ran and an estimate of the time spent in it (from timing on average
+       one instruction in every PROFILE_SAMPLE), execution counts for ranges
+       of segment 0 PCs, every LOADP edge from the PC it ran at to the segment
+       and PC it loaded (the program's branch and call graph), how many
+       segments were mapped and unmapped and how big they were, and the
+       most frequent pairs and triples of opcodes. Opcodes are the base
+       opcodes 0 to 13, with 14 for the invalid ones.
+ *
+ **************************************************************/
+
+#include "profile.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define NUM_OPS 15
+#define RANGE_WORDS 16
+#define SIZE_BUCKETS 33
+#define EDGE_HINT 256
+#define TOP_RANGES 10
+#define TOP_EDGES 20
+#define TOP_NGRAMS 10
+#define CALIBRATION_READS 256
+
+static const char *op_names[NUM_OPS] = {
+        "CMOV", "SLOAD", "SSTORE", "ADD", "MUL", "DIV", "NAND", "HALT",
+        "MAP", "UNMAP", "OUT", "IN", "LOADP", "LV", "BAD"
+};
+
+/*a LOADP edge: the PC the LOADP ran at, the segment it loaded (0 for a
+jump) and the PC it went to, and how many times it was taken*/
+struct edge {
+        uint32_t pc;
+        uint32_t id;
+        uint32_t target;
+        uint64_t count;
+};
+
+/*the Profile struct. startTicks and startNs are profile_ticks and the wall
+clock when the profile was created, for converting ticks to nanoseconds,
+and overheadTicks is what two back to back profile_ticks read, which is 
+taken off every sample. counts and sampled/sampledTicks are per opcode; 
+pairs and triples are indexed by the opcodes in order, base NUM_OPS; prev1 
+and prev2 are the last two opcodes. ranges counts instructions per 
+RANGE_WORDS PCs and grows as needed. edges is an open addressing hash 
+table of LOADP edges, kept at most half full. sizes counts mapped 
+segments by the number of bits in their length*/
+struct Profile {
+        uint64_t startTicks;
+        uint64_t startNs;
+        uint64_t overheadTicks;
+        uint64_t total;
+        uint64_t counts[NUM_OPS];
+        uint64_t sampled[NUM_OPS];
+        uint64_t sampledTicks[NUM_OPS];
+        uint64_t pairs[NUM_OPS * NUM_OPS];
+        uint64_t triples[NUM_OPS * NUM_OPS * NUM_OPS];
+        unsigned prev1;
+        unsigned prev2;
+        uint64_t *ranges;
+        uint32_t numRanges;
+        struct edge *edges;
+        uint32_t numEdges;
+        uint32_t edgeCapacity;
+        uint64_t maps;
+        uint64_t unmaps;
+        uint64_t wordsMapped;
+        uint64_t sizes[SIZE_BUCKETS];
+};
+
+/*helper functions */
+static void grow_ranges(Profile prof, uint32_t range);
+static struct edge *find_edge(struct edge *edges, uint32_t capacity,
+                              uint32_t pc, uint32_t id, uint32_t target);
+static void grow_edges(Profile prof);
+static size_t top_indices(const uint64_t *counts, size_t n, size_t *top,
+                          size_t k);
+static uint64_t estimated_ns(Profile prof, unsigned op);
+static uint64_t wall_ns(void);
+
+/************init_profile****************************************
+*
+* Description: Function that creates an empty profile
+*
+* Parameters: N/A
+*
+* Returns: a pointer to the new profile
+*
+* Expects: memory allocation suceeds
+*
+* Notes: N/A
+**************************************************************/
+Profile init_profile(void)
+{
+        Profile prof = calloc(1, sizeof(struct Profile));
+        assert(prof);
+        prof->edgeCapacity = EDGE_HINT;
+        prof->edges = calloc(prof->edgeCapacity, sizeof(struct edge));
+        assert(prof->edges);
+        prof->overheadTicks = UINT64_MAX;
+        for (int i = 0; i < CALIBRATION_READS; i++) {
+                uint64_t start = profile_ticks();
+                uint64_t ticks = profile_ticks() - start;
+                if (ticks < prof->overheadTicks) {
+                        prof->overheadTicks = ticks;
+                }
+        }
+        prof->startTicks = profile_ticks();
+        prof->startNs = wall_ns();
+        return prof;
+}
+
+/************free_profile****************************************
+*
+* Description: Function that frees a profile
+*
+* Parameters: Profile prof: the profile being freed
+*
+* Returns: void
+*
+* Expects: prof != NULL
+*
+* Notes: N/A
+**************************************************************/
+void free_profile(Profile prof)
+{
+        assert(prof);
+        free(prof->ranges);
+        free(prof->edges);
+        free(prof);
+}
+
+/************profile_instruction****************************************
+*
+* Description: Function that records one executed instruction
+*
+* Parameters: Profile prof: the profile
+*             unsigned op: the instruction's base opcode
+*             uint32_t pc: where in segment 0 it ran
+*
+* Returns: void
+*
+* Expects: prof != NULL, op < 15
+*
+* Notes: called once per instruction, so it only counts
+**************************************************************/
+void profile_instruction(Profile prof, unsigned op, uint32_t pc)
+{
+        assert(prof && op < NUM_OPS);
+        uint64_t n = prof->total++;
+        prof->counts[op]++;
+        if (n >= 1) {
+                prof->pairs[prof->prev1 * NUM_OPS + op]++;
+        }
+        if (n >= 2) {
+                prof->triples[(prof->prev2 * NUM_OPS + prof->prev1) *
+                              NUM_OPS + op]++;
+        }
+        prof->prev2 = prof->prev1;
+        prof->prev1 = op;
+
+        uint32_t range = pc / RANGE_WORDS;
+        if (range >= prof->numRanges) {
+                grow_ranges(prof, range);
+        }
+        prof->ranges[range]++;
+}
+
+/************profile_time****************************************
+*
+* Description: Function that records how long a sampled instruction took
+*
+* Parameters: Profile prof: the profile
+*             unsigned op: the instruction's base opcode
+*             uint64_t ticks: how long it took, in profile_ticks
+*
+* Returns: void
+*
+* Expects: prof != NULL, op < 15
+*
+* Notes: the time per opcode is estimated from the samples in proportion to
+*        its count. The cost of reading the clock is taken off first
+**************************************************************/
+void profile_time(Profile prof, unsigned op, uint64_t ticks)
+{
+        assert(prof && op < NUM_OPS);
+        prof->sampled[op]++;
+        if (ticks > prof->overheadTicks) {
+                prof->sampledTicks[op] += ticks - prof->overheadTicks;
+        }
+}
+
+/************profile_loadp****************************************
+*
+* Description: Function that records a LOADP edge
+*
+* Parameters: Profile prof: the profile
+*             uint32_t pc: where the LOADP ran
+*             uint32_t id: the segment it loaded
+*             uint32_t target: the PC it went to
+*
+* Returns: void
+*
+* Expects: prof != NULL
+*
+* Notes: N/A
+**************************************************************/
+void profile_loadp(Profile prof, uint32_t pc, uint32_t id, uint32_t target)
+{
+        assert(prof);
+        struct edge *e = find_edge(prof->edges, prof->edgeCapacity, pc, id,
+                                   target);
+        if (e->count == 0) {
+                if (2 * (prof->numEdges + 1) > prof->edgeCapacity) {
+                        grow_edges(prof);
+                        e = find_edge(prof->edges, prof->edgeCapacity, pc,
+                                      id, target);
+                }
+                e->pc = pc;
+                e->id = id;
+                e->target = target;
+                prof->numEdges++;
+        }
+        e->count++;
+}
+
+/************profile_map****************************************
+*
+* Description: Function that records a segment being mapped
+*
+* Parameters: Profile prof: the profile
+*             uint32_t numWords: the length of the segment
+*
+* Returns: void
+*
+* Expects: prof != NULL
+*
+* Notes: sizes are bucketed by bit length, so bucket b holds lengths below
+*        2^b
+**************************************************************/
+void profile_map(Profile prof, uint32_t numWords)
+{
+        assert(prof);
+        unsigned bits = 0;
+        while (bits < 32 && (numWords >> bits) != 0) {
+                bits++;
+        }
+        prof->maps++;
+        prof->wordsMapped += numWords;
+        prof->sizes[bits]++;
+}
+
+/************profile_unmap****************************************
+*
+* Description: Function that records a segment being unmapped
+*
+* Parameters: Profile prof: the profile
+*
+* Returns: void
+*
+* Expects: prof != NULL
+*
+* Notes: N/A
+**************************************************************/
+void profile_unmap(Profile prof)
+{
+        assert(prof);
+        prof->unmaps++;
+}
+
+/************write_profile_json****************************************
+*
+* Description: Function that writes a profile as a JSON object
+*
+* Parameters: Profile prof: the profile
+*             FILE *out: where it is written
+*
+* Returns: void
+*
+* Expects: prof != NULL, out != NULL
+*
+* Notes: lists are sorted by count, most frequent first; the opcode list
+*        has every opcode that ran
+**************************************************************/
+void write_profile_json(Profile prof, FILE *out)
+{
+        assert(prof && out);
+        size_t top[TOP_EDGES];
+        fprintf(out, "{\n  \"instructions\": %llu,\n  \"sample_every\": %d,"
+                "\n  \"opcodes\": [", (unsigned long long)prof->total,
+                PROFILE_SAMPLE);
+        size_t order[NUM_OPS];
+        size_t n = top_indices(prof->counts, NUM_OPS, order, NUM_OPS);
+        for (size_t i = 0; i < n; i++) {
+                unsigned op = order[i];
+                fprintf(out, "%s\n    {\"op\": \"%s\", \"count\": %llu, "
+                        "\"est_ns\": %llu}", i ? "," : "", op_names[op],
+                        (unsigned long long)prof->counts[op],
+                        (unsigned long long)estimated_ns(prof, op));
+        }
+
+        fprintf(out, "\n  ],\n  \"hot_ranges\": [");
+        n = top_indices(prof->ranges, prof->numRanges, top, TOP_RANGES);
+        for (size_t i = 0; i < n; i++) {
+                fprintf(out, "%s\n    {\"start\": %llu, \"end\": %llu, "
+                        "\"count\": %llu}", i ? "," : "",
+                        (unsigned long long)top[i] * RANGE_WORDS,
+                        (unsigned long long)(top[i] + 1) * RANGE_WORDS - 1,
+                        (unsigned long long)prof->ranges[top[i]]);
+        }
+
+        fprintf(out, "\n  ],\n  \"loadp_edges\": [");
+        uint64_t *edgeCounts = malloc(prof->edgeCapacity * sizeof(uint64_t));
+        assert(edgeCounts);
+        for (uint32_t i = 0; i < prof->edgeCapacity; i++) {
+                edgeCounts[i] = prof->edges[i].count;
+        }
+        n = top_indices(edgeCounts, prof->edgeCapacity, top, TOP_EDGES);
+        free(edgeCounts);
+        for (size_t i = 0; i < n; i++) {
+                struct edge *e = &prof->edges[top[i]];
+                fprintf(out, "%s\n    {\"pc\": %u, \"segment\": %u, "
+                        "\"target\": %u, \"count\": %llu}", i ? "," : "",
+                        e->pc, e->id, e->target,
+                        (unsigned long long)e->count);
+        }
+        fprintf(out, "\n  ],\n  \"distinct_loadp_edges\": %u,\n",
+                prof->numEdges);
+
+        fprintf(out, "  \"segments\": {\"maps\": %llu, \"unmaps\": %llu, "
+                "\"words_mapped\": %llu, \"sizes\": [",
+                (unsigned long long)prof->maps,
+                (unsigned long long)prof->unmaps,
+                (unsigned long long)prof->wordsMapped);
+        bool first = true;
+        for (unsigned b = 0; b < SIZE_BUCKETS; b++) {
+                if (prof->sizes[b] == 0) {
+                        continue;
+                }
+                fprintf(out, "%s{\"below\": %llu, \"count\": %llu}",
+                        first ? "" : ", ", 1ULL << b,
+                        (unsigned long long)prof->sizes[b]);
+                first = false;
+        }
+        fprintf(out, "]},\n");
+
+        for (unsigned len = 2; len <= 3; len++) {
+                const uint64_t *counts = len == 2 ? prof->pairs :
+                                                    prof->triples;
+                size_t size = len == 2 ? NUM_OPS * NUM_OPS :
+                                         NUM_OPS * NUM_OPS * NUM_OPS;
+                fprintf(out, "  \"%s\": [", len == 2 ? "pairs" : "triples");
+                n = top_indices(counts, size, top, TOP_NGRAMS);
+                for (size_t i = 0; i < n; i++) {
+                        fprintf(out, "%s\n    {\"ops\": [", i ? "," : "");
+                        for (int k = len - 1; k >= 0; k--) {
+                                size_t div = k == 2 ? NUM_OPS * NUM_OPS :
+                                             k == 1 ? NUM_OPS : 1;
+                                fprintf(out, "\"%s\"%s",
+                                        op_names[(top[i] / div) % NUM_OPS],
+                                        k ? ", " : "");
+                        }
+                        fprintf(out, "], \"count\": %llu}",
+                                (unsigned long long)counts[top[i]]);
+                }
+                fprintf(out, "\n  ]%s\n", len == 2 ? "," : "");
+        }
+        fprintf(out, "}\n");
+}
+
+/************write_profile_summary****************************************
+*
+* Description: Function that writes a profile for people to read
+*
+* Parameters: Profile prof: the profile
+*             FILE *out: where it is written
+*
+* Returns: void
+*
+* Expects: prof != NULL, out != NULL
+*
+* Notes: has the same lists as the JSON, with percentages
+**************************************************************/
+void write_profile_summary(Profile prof, FILE *out)
+{
+        assert(prof && out);
+        size_t top[TOP_EDGES];
+        double total = prof->total ? (double)prof->total : 1.0;
+        uint64_t totalNs = 0;
+        for (unsigned op = 0; op < NUM_OPS; op++) {
+                totalNs += estimated_ns(prof, op);
+        }
+
+        fprintf(out, "%llu instructions, ~%.3f s (sampled 1 in %d)\n",
+                (unsigned long long)prof->total, totalNs / 1e9,
+                PROFILE_SAMPLE);
+        fprintf(out, "opcodes:         count   %%count    %%time\n");
+        size_t order[NUM_OPS];
+        size_t n = top_indices(prof->counts, NUM_OPS, order, NUM_OPS);
+        for (size_t i = 0; i < n; i++) {
+                unsigned op = order[i];
+                fprintf(out, "  %-6s %14llu  %6.2f%%  %6.2f%%\n",
+                        op_names[op], (unsigned long long)prof->counts[op],
+                        100.0 * prof->counts[op] / total,
+                        totalNs ? 100.0 * estimated_ns(prof, op) / totalNs
+                                : 0.0);
+        }
+
+        fprintf(out, "hot segment 0 ranges:\n");
+        n = top_indices(prof->ranges, prof->numRanges, top, TOP_RANGES);
+        for (size_t i = 0; i < n; i++) {
+                fprintf(out, "  %10llu-%-10llu %6.2f%%\n",
+                        (unsigned long long)top[i] * RANGE_WORDS,
+                        (unsigned long long)(top[i] + 1) * RANGE_WORDS - 1,
+                        100.0 * prof->ranges[top[i]] / total);
+        }
+
+        fprintf(out, "LOADP edges (%u distinct):\n", prof->numEdges);
+        uint64_t *edgeCounts = malloc(prof->edgeCapacity * sizeof(uint64_t));
+        assert(edgeCounts);
+        for (uint32_t i = 0; i < prof->edgeCapacity; i++) {
+                edgeCounts[i] = prof->edges[i].count;
+        }
+        n = top_indices(edgeCounts, prof->edgeCapacity, top, TOP_EDGES);
+        free(edgeCounts);
+        for (size_t i = 0; i < n; i++) {
+                struct edge *e = &prof->edges[top[i]];
+                fprintf(out, "  %10u -> m[%u][%u]  %llu\n", e->pc, e->id,
+                        e->target, (unsigned long long)e->count);
+        }
+
+        fprintf(out, "segments: %llu mapped (%llu words), %llu unmapped\n",
+                (unsigned long long)prof->maps,
+                (unsigned long long)prof->wordsMapped,
+                (unsigned long long)prof->unmaps);
+        for (unsigned b = 0; b < SIZE_BUCKETS; b++) {
+                if (prof->sizes[b] != 0) {
+                        fprintf(out, "  < %-10llu %llu\n", 1ULL << b,
+                                (unsigned long long)prof->sizes[b]);
+                }
+        }
+
+        for (unsigned len = 2; len <= 3; len++) {
+                const uint64_t *counts = len == 2 ? prof->pairs :
+                                                    prof->triples;
+                size_t size = len == 2 ? NUM_OPS * NUM_OPS :
+                                         NUM_OPS * NUM_OPS * NUM_OPS;
+                fprintf(out, "top %u-grams:\n", len);
+                n = top_indices(counts, size, top, TOP_NGRAMS);
+                for (size_t i = 0; i < n; i++) {
+                        fprintf(out, "  %6.2f%%  ",
+                                100.0 * counts[top[i]] / total);
+                        for (int k = len - 1; k >= 0; k--) {
+                                size_t div = k == 2 ? NUM_OPS * NUM_OPS :
+                                             k == 1 ? NUM_OPS : 1;
+                                fprintf(out, " %s",
+                                        op_names[(top[i] / div) % NUM_OPS]);
+                        }
+                        fprintf(out, "\n");
+                }
+        }
+}
+
+/************grow_ranges****************************************
+*
+* Description: Function that makes room in the PC range counts
+*
+* Parameters: Profile prof: the profile
+*             uint32_t range: a range index that must fit
+*
+* Returns: void
+*
+* Expects: prof != NULL, and memory allocation suceeds
+*
+* Notes: new ranges start at 0
+**************************************************************/
+static void grow_ranges(Profile prof, uint32_t range)
+{
+        uint32_t capacity = prof->numRanges ? prof->numRanges : 64;
+        while (capacity <= range) {
+                capacity *= 2;
+        }
+        prof->ranges = realloc(prof->ranges, capacity * sizeof(uint64_t));
+        assert(prof->ranges);
+        memset(prof->ranges + prof->numRanges, 0,
+               (capacity - prof->numRanges) * sizeof(uint64_t));
+        prof->numRanges = capacity;
+}
+
+/************find_edge****************************************
+*
+* Description: Function that finds the slot of a LOADP edge
+*
+* Parameters: struct edge *edges: a hash table of edges
+*             uint32_t capacity: its size, a power of two
+*             uint32_t pc, id, target: the edge
+*
+* Returns: the edge's slot, or the empty slot where it belongs
+*
+* Expects: edges != NULL, and the table has an empty slot
+*
+* Notes: linear probing
+**************************************************************/
+static struct edge *find_edge(struct edge *edges, uint32_t capacity,
+                              uint32_t pc, uint32_t id, uint32_t target)
+{
+        uint64_t h = (pc * 0x9e3779b97f4a7c15ULL) ^
+                     (id * 0xc2b2ae3d27d4eb4fULL) ^
+                     (target * 0x165667b19e3779f9ULL);
+        uint32_t i = (h ^ (h >> 29)) & (capacity - 1);
+        while (edges[i].count != 0 && (edges[i].pc != pc ||
+               edges[i].id != id || edges[i].target != target)) {
+                i = (i + 1) & (capacity - 1);
+        }
+        return &edges[i];
+}
+
+/************grow_edges****************************************
+*
+* Description: Function that doubles the LOADP edge table
+*
+* Parameters: Profile prof: the profile
+*
+* Returns: void
+*
+* Expects: prof != NULL, and memory allocation suceeds
+*
+* Notes: N/A
+**************************************************************/
+static void grow_edges(Profile prof)
+{
+        uint32_t capacity = prof->edgeCapacity * 2;
+        struct edge *edges = calloc(capacity, sizeof(struct edge));
+        assert(edges);
+        for (uint32_t i = 0; i < prof->edgeCapacity; i++) {
+                struct edge *old = &prof->edges[i];
+                if (old->count != 0) {
+                        *find_edge(edges, capacity, old->pc, old->id,
+                                   old->target) = *old;
+                }
+        }
+        free(prof->edges);
+        prof->edges = edges;
+        prof->edgeCapacity = capacity;
+}
+
+/************top_indices****************************************
+*
+* Description: Function that finds the indices of the largest counts
+*
+* Parameters: const uint64_t *counts: the counts
+*             size_t n: how many counts there are
+*             size_t *top: where the indices are written
+*             size_t k: the most indices wanted
+*
+* Returns: the number of indices written, at most k
+*
+* Expects: counts != NULL unless n is 0, top != NULL
+*
+* Notes: zero counts are left out; ties go to the lower index. Does not
+*        change counts
+**************************************************************/
+static size_t top_indices(const uint64_t *counts, size_t n, size_t *top,
+                          size_t k)
+{
+        size_t found = 0;
+        for (; found < k; found++) {
+                bool any = false;
+                size_t best = 0;
+                for (size_t i = 0; i < n; i++) {
+                        if (counts[i] == 0) {
+                                continue;
+                        }
+                        if (found > 0) {
+                                size_t last = top[found - 1];
+                                if (counts[i] > counts[last] ||
+                                    (counts[i] == counts[last] &&
+                                     i <= last)) {
+                                        continue;
+                                }
+                        }
+                        if (!any || counts[i] > counts[best]) {
+                                best = i;
+                                any = true;
+                        }
+                }
+                if (!any) {
+                        break;
+                }
+                top[found] = best;
+        }
+        return found;
+}
+
+/************estimated_ns****************************************
+*
+* Description: Function that estimates the time spent in one opcode
+*
+* Parameters: Profile prof: the profile
+*             unsigned op: the opcode
+*
+* Returns: the sampled time scaled up to all of the opcode's instructions,
+*          in nanoseconds
+*
+* Expects: prof != NULL, op < 15
+*
+* Notes: 0 if none of the opcode's instructions were sampled. Ticks are 
+*        converted at the rate they ran at since init_profile
+**************************************************************/
+static uint64_t estimated_ns(Profile prof, unsigned op)
+{
+        if (prof->sampled[op] == 0) {
+                return 0;
+        }
+        uint64_t ticks = profile_ticks() - prof->startTicks;
+        uint64_t ns = wall_ns() - prof->startNs;
+        double nsPerTick = ticks ? (double)ns / ticks : 1.0;
+        return (uint64_t)((double)prof->sampledTicks[op] * prof->counts[op] /
+                          prof->sampled[op] * nsPerTick);
+}
+
+/************wall_ns****************************************
+*
+* Description: Function that reads a monotonic clock
+*
+* Parameters: N/A
+*
+* Returns: the time in nanoseconds
+*
+* Expects: N/A
+*
+* Notes: N/A
+**************************************************************/
+static uint64_t wall_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
@@ -0,0 +1,59 @@
+/**************************************************************
+ *
+ *                     profile.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the profile module, which collects what run_um
+       executes when the UM is built with -DUM_PROFILE and a profile is
+       attached with set_profile (refer to the profile.c header for what is
+       recorded), and writes it out as JSON or as a readable summary.
+ *
+ **************************************************************/
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* on average one instruction in every PROFILE_SAMPLE is timed */
+#define PROFILE_SAMPLE 64
+
+struct Profile;
+typedef struct Profile *Profile;
+
+Profile init_profile(void);
+void free_profile(Profile prof);
+
+void profile_instruction(Profile prof, unsigned op, uint32_t pc);
+void profile_time(Profile prof, unsigned op, uint64_t ticks);
+void profile_loadp(Profile prof, uint32_t pc, uint32_t id, uint32_t target);
+void profile_map(Profile prof, uint32_t numWords);
+void profile_unmap(Profile prof);
+
+void write_profile_json(Profile prof, FILE *out);
+void write_profile_summary(Profile prof, FILE *out);
+
+/* the clock sampled instructions are timed with: the time stamp counter 
+where there is one, since a clock_gettime can cost more than the instruction
+being timed, and nanoseconds elsewhere. The profile converts ticks to 
+nanoseconds against the wall clock when it is written */
+static inline uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+#endif
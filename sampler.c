@@ -0,0 +1,524 @@
+/**************************************************************
+ *
+ *                     sampler.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that profiles a running UM by sampling instead of counting.
+       An ITIMER_PROF timer raises SIGPROF every 1/hz seconds of CPU time,
+       and the handler copies the UM's published sample word (program
+       counter, last opcode and segment 0 generation; see sampler.h) into a
+       lock-free ring. A drain thread empties the ring every few
+       milliseconds into a table of counts per distinct word, so the handler
+       never allocates or locks and the ring only fills if the drain thread
+       is starved. The counts are written out as folded stacks, one line
+       per stack, which flamegraph.pl and speedscope read directly:
+
+           um;seg0 #<generation>;words <first>-<last>;pc <pc>;after <OP> <n>
+
+       Only one sampler can run at a time, since SIGPROF is per process.
+ *
+ **************************************************************/
+
+#include "sampler.h"
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define RING_SIZE 65536
+#define DRAIN_NS 10000000
+#define TABLE_HINT 1024
+#define RANGE_WORDS 16
+#define NUM_OPS 15
+#define TOP_STACKS 10
+
+static const char *op_names[NUM_OPS] = {
+        "CMOV", "SLOAD", "SSTORE", "ADD", "MUL", "DIV", "NAND", "HALT",
+        "MAP", "UNMAP", "OUT", "IN", "LOADP", "LV", "BAD"
+};
+
+/*the Sampler struct holds the ring the SIGPROF handler writes, and the
+table the drain thread folds it into. The handler is the only writer of
+head and the drain thread the only writer of tail, so neither needs a lock;
+head - tail is the number of samples waiting. keys and counts are an open
+addressing table of sample words, at most half full, in which a count of 0
+marks an empty slot. samples and dropped count what the handler saw,
+including samples that found the ring full*/
+struct Sampler {
+        uint64_t ring[RING_SIZE];
+        uint32_t head;
+        uint32_t tail;
+        uint64_t dropped;
+        const volatile uint64_t *published;
+        unsigned hz;
+
+        uint64_t *keys;
+        uint64_t *counts;
+        size_t cap;
+        size_t used;
+        uint64_t samples;
+
+        pthread_t drainer;
+        int stopping;
+        bool running;
+        struct sigaction oldAction;
+        struct itimerval oldTimer;
+};
+
+/* the sampler the SIGPROF handler records into, or NULL */
+static Sampler active = NULL;
+
+/*helper functions */
+static void on_sigprof(int sig);
+static void *drain_loop(void *cl);
+static void drain_ring(Sampler sampler);
+static void count_word(Sampler sampler, uint64_t word, uint64_t n);
+static size_t word_slot(uint64_t word, size_t cap);
+static uint64_t *collect_entries(Sampler sampler, size_t *n);
+static int compare_words(const void *a, const void *b);
+static int compare_counts(const void *a, const void *b);
+static void print_stack(FILE *out, uint64_t word);
+
+/************start_sampler****************************************
+*
+* Description: Function that starts sampling a UM's published word
+*
+* Parameters: const volatile uint64_t *published: the word the UM keeps
+*                                                 current (get_published)
+*             unsigned hz: samples per second of CPU time
+*
+* Returns: a pointer to the running sampler
+*
+* Expects: published != NULL, 0 < hz <= 1000000, no other sampler is
+*          running, and memory allocation, the timer, the handler and the
+*          drain thread can all be set up
+*
+* Notes: SIGPROF is blocked while the drain thread is created, so the thread
+*        inherits the mask and every sample is taken on the thread running
+*        the UM. The handler is installed with SA_RESTART, and the channel
+*        module retries reads and writes a signal interrupts anyway
+**************************************************************/
+Sampler start_sampler(const volatile uint64_t *published, unsigned hz)
+{
+        assert(published);
+        assert(hz > 0 && hz <= 1000000);
+        assert(active == NULL);
+        Sampler sampler = calloc(1, sizeof(struct Sampler));
+        assert(sampler);
+        sampler->published = published;
+        sampler->hz = hz;
+        sampler->cap = TABLE_HINT;
+        sampler->keys = calloc(sampler->cap, sizeof(uint64_t));
+        sampler->counts = calloc(sampler->cap, sizeof(uint64_t));
+        assert(sampler->keys && sampler->counts);
+
+        sigset_t prof, old;
+        sigemptyset(&prof);
+        sigaddset(&prof, SIGPROF);
+        int failed = pthread_sigmask(SIG_BLOCK, &prof, &old);
+        failed |= pthread_create(&sampler->drainer, NULL, drain_loop,
+                                 sampler);
+        failed |= pthread_sigmask(SIG_SETMASK, &old, NULL);
+        assert(!failed);
+
+        __atomic_store_n(&active, sampler, __ATOMIC_RELEASE);
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = on_sigprof;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        failed |= sigaction(SIGPROF, &action, &sampler->oldAction);
+
+        struct itimerval timer;
+        timer.it_interval.tv_sec = hz == 1 ? 1 : 0;
+        timer.it_interval.tv_usec = hz == 1 ? 0 : 1000000 / hz;
+        timer.it_value = timer.it_interval;
+        failed |= setitimer(ITIMER_PROF, &timer, &sampler->oldTimer);
+        assert(!failed);
+        (void)failed;
+        sampler->running = true;
+        return sampler;
+}
+
+/************stop_sampler****************************************
+*
+* Description: Function that stops a sampler's timer and drain thread, and
+*              folds in the samples still in the ring
+*
+* Parameters: Sampler sampler: the running sampler
+*
+* Returns: void
+*
+* Expects: sampler != NULL
+*
+* Notes: does nothing if the sampler is already stopped. The timer is
+*        stopped before the old SIGPROF action is put back; a signal the
+*        timer already raised is delivered as setitimer returns, to the
+*        handler, so it cannot reach a default action that would end the
+*        process
+**************************************************************/
+void stop_sampler(Sampler sampler)
+{
+        assert(sampler);
+        if (!sampler->running) {
+                return;
+        }
+        int failed = setitimer(ITIMER_PROF, &sampler->oldTimer, NULL);
+        __atomic_store_n(&active, NULL, __ATOMIC_RELEASE);
+        failed |= sigaction(SIGPROF, &sampler->oldAction, NULL);
+        __atomic_store_n(&sampler->stopping, 1, __ATOMIC_RELEASE);
+        failed |= pthread_join(sampler->drainer, NULL);
+        assert(!failed);
+        (void)failed;
+        drain_ring(sampler);
+        sampler->running = false;
+}
+
+/************free_sampler****************************************
+*
+* Description: Function that stops a sampler if it is running and frees it
+*
+* Parameters: Sampler sampler: the sampler being freed
+*
+* Returns: void
+*
+* Expects: sampler != NULL
+*
+* Notes: N/A
+**************************************************************/
+void free_sampler(Sampler sampler)
+{
+        assert(sampler);
+        stop_sampler(sampler);
+        free(sampler->keys);
+        free(sampler->counts);
+        free(sampler);
+}
+
+/************on_sigprof****************************************
+*
+* Description: SIGPROF handler that pushes the published word of the UM
+*              being sampled onto the ring
+*
+* Parameters: int sig: voided
+*
+* Returns: void
+*
+* Expects: N/A
+*
+* Notes: async-signal-safe: one volatile load of the published word, and
+*        atomic loads and stores of the ring indices. When the ring is full
+*        the sample is counted as dropped
+**************************************************************/
+static void on_sigprof(int sig)
+{
+        (void)sig;
+        Sampler sampler = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+        if (sampler == NULL) {
+                return;
+        }
+        uint64_t word = *sampler->published;
+        uint32_t head = __atomic_load_n(&sampler->head, __ATOMIC_RELAXED);
+        uint32_t tail = __atomic_load_n(&sampler->tail, __ATOMIC_ACQUIRE);
+        if (head - tail == RING_SIZE) {
+                __atomic_add_fetch(&sampler->dropped, 1, __ATOMIC_RELAXED);
+                return;
+        }
+        sampler->ring[head & (RING_SIZE - 1)] = word;
+        __atomic_store_n(&sampler->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/************drain_loop****************************************
+*
+* Description: Body of the drain thread, which empties the ring every
+*              DRAIN_NS nanoseconds until the sampler is stopped
+*
+* Parameters: void *cl: the sampler
+*
+* Returns: NULL
+*
+* Expects: cl != NULL
+*
+* Notes: a ring of RING_SIZE samples lasts over a minute at 997 Hz, so a
+*        late wakeup does not lose samples
+**************************************************************/
+static void *drain_loop(void *cl)
+{
+        Sampler sampler = cl;
+        struct timespec pause = { 0, DRAIN_NS };
+        while (!__atomic_load_n(&sampler->stopping, __ATOMIC_ACQUIRE)) {
+                nanosleep(&pause, NULL);
+                drain_ring(sampler);
+        }
+        return NULL;
+}
+
+/************drain_ring****************************************
+*
+* Description: Function that moves every sample waiting in the ring into
+*              the sampler's table of counts
+*
+* Parameters: Sampler sampler: the sampler
+*
+* Returns: void
+*
+* Expects: sampler != NULL, and it is only called by one thread at a time
+*
+* Notes: the slots are read before tail is released back to the handler
+**************************************************************/
+static void drain_ring(Sampler sampler)
+{
+        uint32_t tail = sampler->tail;
+        uint32_t head = __atomic_load_n(&sampler->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+                count_word(sampler, sampler->ring[tail & (RING_SIZE - 1)], 1);
+                sampler->samples++;
+        }
+        __atomic_store_n(&sampler->tail, tail, __ATOMIC_RELEASE);
+}
+
+/************count_word****************************************
+*
+* Description: Function that adds to the count of a sample word
+*
+* Parameters: Sampler sampler: the sampler
+*             uint64_t word: the sample word
+*             uint64_t n: how much to add, more than 0
+*
+* Returns: void
+*
+* Expects: sampler != NULL, and memory allocation suceeds
+*
+* Notes: doubles the table when it would become more than half full
+**************************************************************/
+static void count_word(Sampler sampler, uint64_t word, uint64_t n)
+{
+        size_t mask = sampler->cap - 1;
+        size_t i = word_slot(word, sampler->cap);
+        while (sampler->counts[i] != 0 && sampler->keys[i] != word) {
+                i = (i + 1) & mask;
+        }
+        if (sampler->counts[i] != 0) {
+                sampler->counts[i] += n;
+                return;
+        }
+        if (2 * (sampler->used + 1) > sampler->cap) {
+                uint64_t *oldKeys = sampler->keys;
+                uint64_t *oldCounts = sampler->counts;
+                size_t oldCap = sampler->cap;
+                sampler->cap *= 2;
+                sampler->keys = calloc(sampler->cap, sizeof(uint64_t));
+                sampler->counts = calloc(sampler->cap, sizeof(uint64_t));
+                assert(sampler->keys && sampler->counts);
+                sampler->used = 0;
+                for (size_t j = 0; j < oldCap; j++) {
+                        if (oldCounts[j] != 0) {
+                                count_word(sampler, oldKeys[j], oldCounts[j]);
+                        }
+                }
+                free(oldKeys);
+                free(oldCounts);
+                count_word(sampler, word, n);
+                return;
+        }
+        sampler->keys[i] = word;
+        sampler->counts[i] = n;
+        sampler->used++;
+}
+
+/************word_slot****************************************
+*
+* Description: Function that hashes a sample word to its first slot
+*
+* Parameters: uint64_t word: the sample word
+*             size_t cap: the table capacity, a power of 2
+*
+* Returns: the slot index
+*
+* Expects: N/A
+*
+* Notes: Fibonacci hashing, so neighbouring pcs spread over the table
+**************************************************************/
+static size_t word_slot(uint64_t word, size_t cap)
+{
+        return (size_t)((word * 0x9e3779b97f4a7c15ull) >> 32) & (cap - 1);
+}
+
+/************write_folded****************************************
+*
+* Description: Function that writes a sampler's counts as folded stacks
+*
+* Parameters: Sampler sampler: a stopped sampler
+*             FILE *out: the file the stacks are written to
+*
+* Returns: void
+*
+* Expects: sampler != NULL, out != NULL, the sampler is stopped, and memory
+*          allocation suceeds
+*
+* Notes: the lines are ordered by generation, then pc, then opcode, so the
+*        output of two runs of one program can be diffed
+**************************************************************/
+void write_folded(Sampler sampler, FILE *out)
+{
+        assert(sampler && out);
+        assert(!sampler->running);
+        size_t n;
+        uint64_t *entries = collect_entries(sampler, &n);
+        qsort(entries, n, 2 * sizeof(uint64_t), compare_words);
+        for (size_t i = 0; i < n; i++) {
+                print_stack(out, entries[2 * i]);
+                fprintf(out, " %llu\n",
+                        (unsigned long long)entries[2 * i + 1]);
+        }
+        free(entries);
+}
+
+/************write_sampler_summary****************************************
+*
+* Description: Function that writes how many samples a sampler took and
+*              its most frequent stacks
+*
+* Parameters: Sampler sampler: a stopped sampler
+*             FILE *out: the file the summary is written to
+*
+* Returns: void
+*
+* Expects: sampler != NULL, out != NULL, the sampler is stopped, and memory
+*          allocation suceeds
+*
+* Notes: N/A
+**************************************************************/
+void write_sampler_summary(Sampler sampler, FILE *out)
+{
+        assert(sampler && out);
+        assert(!sampler->running);
+        fprintf(out, "%llu samples, timer at %u Hz (%llu dropped), "
+                "%zu stacks\n",
+                (unsigned long long)sampler->samples, sampler->hz,
+                (unsigned long long)sampler->dropped, sampler->used);
+        size_t n;
+        uint64_t *entries = collect_entries(sampler, &n);
+        qsort(entries, n, 2 * sizeof(uint64_t), compare_counts);
+        for (size_t i = 0; i < n && i < TOP_STACKS; i++) {
+                fprintf(out, "  %6.2f%%  ", 100.0 * entries[2 * i + 1] /
+                        sampler->samples);
+                print_stack(out, entries[2 * i]);
+                fprintf(out, "\n");
+        }
+        free(entries);
+}
+
+/************collect_entries****************************************
+*
+* Description: Function that copies a sampler's table into an array of
+*              (word, count) pairs
+*
+* Parameters: Sampler sampler: the sampler
+*             size_t *n: set to the number of pairs
+*
+* Returns: the pairs, which the caller frees
+*
+* Expects: sampler != NULL, n != NULL, and memory allocation suceeds
+*
+* Notes: N/A
+**************************************************************/
+static uint64_t *collect_entries(Sampler sampler, size_t *n)
+{
+        uint64_t *entries = malloc((2 * sampler->used + 1) *
+                                   sizeof(uint64_t));
+        assert(entries);
+        *n = 0;
+        for (size_t i = 0; i < sampler->cap; i++) {
+                if (sampler->counts[i] != 0) {
+                        entries[2 * *n] = sampler->keys[i];
+                        entries[2 * *n + 1] = sampler->counts[i];
+                        (*n)++;
+                }
+        }
+        return entries;
+}
+
+/************compare_counts****************************************
+*
+* Description: qsort comparator for (word, count) pairs by count, largest
+*              first, and then as compare_words
+*
+* Parameters: const void *a, const void *b: the pairs
+*
+* Returns: negative, 0 or positive, as for qsort
+*
+* Expects: N/A
+*
+* Notes: N/A
+**************************************************************/
+static int compare_counts(const void *a, const void *b)
+{
+        uint64_t x = ((const uint64_t *)a)[1];
+        uint64_t y = ((const uint64_t *)b)[1];
+        if (x != y) {
+                return (x < y) - (x > y);
+        }
+        return compare_words(a, b);
+}
+
+/************compare_words****************************************
+*
+* Description: qsort comparator for (word, count) pairs by generation, pc
+*              and then opcode
+*
+* Parameters: const void *a, const void *b: the pairs
+*
+* Returns: negative, 0 or positive, as for qsort
+*
+* Expects: N/A
+*
+* Notes: N/A
+**************************************************************/
+static int compare_words(const void *a, const void *b)
+{
+        uint64_t x = *(const uint64_t *)a;
+        uint64_t y = *(const uint64_t *)b;
+        uint64_t xKey = (uint64_t)sample_generation(x) << 40 |
+                        (uint64_t)sample_pc(x) << 8 | sample_op(x);
+        uint64_t yKey = (uint64_t)sample_generation(y) << 40 |
+                        (uint64_t)sample_pc(y) << 8 | sample_op(y);
+        return (xKey > yKey) - (xKey < yKey);
+}
+
+/************print_stack****************************************
+*
+* Description: Function that prints the folded stack of a sample word,
+*              without its count
+*
+* Parameters: FILE *out: the file the stack is written to
+*             uint64_t word: the sample word
+*
+* Returns: void
+*
+* Expects: out != NULL
+*
+* Notes: pcs are grouped into ranges of RANGE_WORDS words, as in the
+*        profile module's hot ranges
+**************************************************************/
+static void print_stack(FILE *out, uint64_t word)
+{
+        uint32_t pc = sample_pc(word);
+        unsigned op = sample_op(word);
+        uint32_t first = pc - pc % RANGE_WORDS;
+        fprintf(out, "um;seg0 #%u;words %u-%u;pc %u;",
+                (unsigned)sample_generation(word), (unsigned)first,
+                (unsigned)(first + RANGE_WORDS - 1), (unsigned)pc);
+        if (op < NUM_OPS) {
+                fprintf(out, "after %s", op_names[op]);
+        } else {
+                fprintf(out, "start");
+        }
+}
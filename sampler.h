@@ -0,0 +1,64 @@
+/**************************************************************
+ *
+ *                     sampler.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the sampler module, a low overhead profiler that
+       records where run_um is from a SIGPROF timer instead of instrumenting
+       every instruction (refer to the sampler.c header for more details),
+       and the layout of the sample word a UM publishes for it.
+ *
+ **************************************************************/
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* run_um publishes its position as one 64 bit word, so the signal handler
+reads it with a single load: the program counter in the low 32 bits, the
+opcode of the last instruction run in the next 8 (SAMPLE_NO_OP before the
+first), and the segment 0 generation (how many times LOADP has replaced
+segment 0, modulo 2^24) in the top 24 */
+#define SAMPLE_NO_OP 0xff
+#define SAMPLE_GEN_BITS 24
+
+static inline uint64_t sample_word(uint32_t generation, unsigned op,
+                                   uint32_t pc)
+{
+        return (uint64_t)(generation & ((1u << SAMPLE_GEN_BITS) - 1)) << 40 |
+               (uint64_t)(op & 0xff) << 32 | pc;
+}
+
+static inline uint32_t sample_pc(uint64_t word)
+{
+        return (uint32_t)word;
+}
+
+static inline unsigned sample_op(uint64_t word)
+{
+        return (word >> 32) & 0xff;
+}
+
+static inline uint32_t sample_generation(uint64_t word)
+{
+        return (uint32_t)(word >> 40);
+}
+
+/* default sampling rate, in samples per second of CPU time */
+#define SAMPLER_HZ 997
+
+struct Sampler;
+typedef struct Sampler *Sampler;
+
+Sampler start_sampler(const volatile uint64_t *published, unsigned hz);
+void stop_sampler(Sampler sampler);
+void write_folded(Sampler sampler, FILE *out);
+void write_sampler_summary(Sampler sampler, FILE *out);
+void free_sampler(Sampler sampler);
+
+#endif
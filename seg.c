@@ -8,44 +8,227 @@
  *
  *     A module that handles the segments and the memory for each segment; 
        is responsible for initializing, removing, retrieving, and duplicating 
-       memories/segments.
+       memories/segments. Segments are allocated from a per-machine pool of
+       power of two size classes, so map/unmap churn reuses freed blocks 
+       instead of going through malloc and free. The whole table can be 
+       saved to a file descriptor and later restored from an mmapped 
+       image of it, with the restored segments' words left in the image.
+       While dirty tracking is on, the table also records which IDs (and 
+       which pages of large segments) have changed, so a checkpoint can 
+       write only those as a delta. A table can be forked into another 
+       that shares all of its segments copy on write. Segments of at least
+       a threshold size get their words from an anonymous mapping of their
+       own instead, so the pages a program never touches are never 
+       allocated, and all of them go back to the OS when it is unmapped.
+       Under a huge page policy other than HUGE_NEVER, those of at least 
+       HUGE_PAGE bytes are aligned to it and advised to be backed by 
+       transparent huge pages, cutting the TLB misses of random access.
  *
  **************************************************************/
 
 #include "seg.h"
 #include <stdio.h>
-#include <bitpack.h>
 #include <assert.h>
 #include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
-#define SEQ_HINT 100
+#define TABLE_HINT 100
 #define WORDSIZE 4
-#define CHARBITS 8
 #define ONE 1 
+#define READ_CHUNK (64 * 1024)
+/* segments of up to 2^(NUM_CLASSES - 1) words come from the pool, in 
+power of two size classes; bigger ones are allocated one by one */
+#define NUM_CLASSES 9
+#define LARGE_CLASS NUM_CLASSES
+/* most blocks each class keeps for reuse; the rest go back to free() */
+#define MAX_POOLED 4096
+/* segments whose words live in a restored image; only the header is ours */
+#define IMAGE_CLASS (NUM_CLASSES + 1)
+/* segments of at least lazyWords words (LAZY_WORDS unless it is changed 
+with set_lazy_threshold) have their words in an anonymous mapping, whose 
+pages are only allocated, and zeroed, by the kernel when first touched */
+#define LAZY_CLASS (NUM_CLASSES + 2)
+#define LAZY_WORDS (1u << 18)
+/* the transparent huge page size segments are aligned to under a policy 
+other than HUGE_NEVER */
+#define HUGE_PAGE (2u << 20)
+/* segments of at least this many bytes start on a page of the image, so
+their all zero pages can be left as holes in the file */
+#define IMAGE_PAGE 4096
+#define WRITE_BUFFER (64 * 1024)
+/* segments of more than DIRTY_PAGE_WORDS words are tracked a page at a 
+time; smaller ones as a whole */
+#define DIRTY_PAGE_WORDS (IMAGE_PAGE / WORDSIZE)
+#define DIRTY_CLEAN 0
+#define DIRTY_PAGES 1
+#define DIRTY_ALL 2
+/* kinds of Delta_entry */
+#define DELTA_WHOLE 1
+#define DELTA_PAGES 2
+#define DELTA_GONE 3
 
-/*the allSegements struct contains a sequence storing pointers to all the 
-mapped segments, with the index of the sequence corresponding to the segement
-ID. It also contians a sequence of all unmapped IDs, so that unmapped IDs can
-be stored and reused*/
+/*an mmapped image restored segments' words are in, and how many tables 
+refer to it*/
+typedef struct Seg_image {
+        uint8_t *base;
+        size_t length;
+        uint32_t refs;
+} Seg_image;
+
+/*the allSegements struct contains a flat array of pointers to all the 
+mapped segments, indexed directly by segment ID (NULL for IDs that are 
+unmapped), and a stack of unmapped IDs, so that unmapped IDs can be stored 
+and reused most recently unmapped first. Both arrays double when full. It 
+also owns the pool that segments are allocated from: one free list of 
+unmapped blocks per size class, and counters for get_seg_stats. A table
+restored by restore_segments shares the image its segments' words are in
+with the tables forked from it, and the last of them to be freed unmaps 
+it. forked is set on a table once it shares segments with another table
+(see fork_segments), after which their reference counts are changed 
+atomically, since the tables may be run on different threads. pub comes
+first, so that mark_dirty in seg.h can see whether tracking is on. While 
+it is, dirty holds a DIRTY_ state per ID, dirtyPages a bitmap of the stored
+pages for each ID in DIRTY_PAGES (NULL otherwise), and dirtyIds the IDs 
+that are not DIRTY_CLEAN, in the order they were first dirtied*/
 struct allSegments
 {
-        Seq_T mapped;
-        Seq_T unmapped;
+        Seg_public pub;
+        segment *mapped;
+        uint32_t numMapped;
+        uint32_t mappedCapacity;
+        uint32_t *unmapped;
+        uint32_t numUnmapped;
+        uint32_t unmappedCapacity;
+        segment freeLists[NUM_CLASSES];
+        uint32_t numFree[NUM_CLASSES];
+        Seg_stats stats;
+        Seg_image *image;
+        bool forked;
+        uint8_t *dirty;
+        uint64_t **dirtyPages;
+        uint32_t dirtyCapacity;
+        uint32_t *dirtyIds;
+        uint32_t numDirty;
 };
 
 /*the segments struct represents a single segment of the UM. Its member 
 variables represent the number of words an instance of a segment can store, 
-and a pointer to an array of 32 bit integers representing the memory itself */
+its pool size class (LARGE_CLASS if it is not pooled, IMAGE_CLASS if its 
+words are in a restored image, LAZY_CLASS if they are in a mapping of their
+own), how many slots of the 
+mapped table point at it, a pointer to an array of 32 bit integers 
+representing the memory itself, and the next block on its free list while 
+it is pooled. The words follow the header in the same block. A segment with
+more than one reference is shared, by segment 0 and the ID it was loaded 
+from, by a delta that pinned it, or by tables forked from one another, and
+is copied by get_writable_mem before any of them stores into it */
 struct segment
 {
       uint32_t numWords;
+      uint32_t refs;
+      uint16_t sizeClass;
       uint32_t *memory;  
+      segment next;
+      uint32_t words[];
+};
+
+/*the layout of a saved table, from the start given to save_segments: an
+Image_table, the numUnmapped IDs of the unmapped stack from the bottom up
+(padded to 8 bytes), numEntries Image_entry records for the mapped IDs in
+increasing order, and then the words of each segment at its entry's offset
+from the start of the file. A segment shared by segment 0 and another ID is
+saved once, and both entries give its offset. Everything is in host byte 
+order*/
+typedef struct Image_table {
+        uint32_t numMapped;
+        uint32_t numUnmapped;
+        uint32_t numEntries;
+        uint32_t reserved;
+} Image_table;
+
+typedef struct Image_entry {
+        uint32_t id;
+        uint32_t numWords;
+        uint64_t offset;
+} Image_entry;
+
+/*a delta written by write_delta has the same layout as a saved table,
+except that its entries (Delta_entry) are only for the IDs that changed, 
+and give the offset of their data from the start of the delta. A 
+DELTA_WHOLE entry's data is all of the segment's words; a DELTA_PAGES 
+entry's is numPages page numbers (padded to 8 bytes) followed, from the
+next page boundary of the file, by one DIRTY_PAGE_WORDS slot per page; a
+DELTA_GONE entry, for an ID that was unmapped, has none*/
+typedef struct Delta_entry {
+        uint32_t id;
+        uint32_t numWords;
+        uint32_t kind;
+        uint32_t numPages;
+        uint64_t offset;
+} Delta_entry;
+
+/*what take_delta hands to write_delta: the table's size and unmapped 
+stack, and for each entry, either the segment itself (pinned with a 
+reference, so a store into it copies it first) or a copy of its stored 
+pages. start is the file offset the delta is written at, and length how
+many bytes it takes*/
+struct Seg_delta {
+        Image_table table;
+        uint32_t *unmapped;
+        Delta_entry *entries;
+        segment *pinned;
+        uint32_t **pages;
+        uint32_t **pageWords;
+        uint64_t start;
+        uint64_t length;
 };
 
+/*buffers the writes of save_segments; pos is the file offset the next
+byte goes to, and failed is set once a write fails*/
+typedef struct Image_writer {
+        int fd;
+        uint8_t *buffer;
+        size_t length;
+        uint64_t pos;
+        bool failed;
+} Image_writer;
+
+static uint32_t lazyWords = LAZY_WORDS;
+static Huge_policy hugePolicy = HUGE_NEVER;
+
 /*helper functions */
-segment init_seg0(FILE *instructions);
-void fill_seg0(FILE* instructions, segment seg0);
-segment copy(segment seg);
+static allSegments new_allSegs(void);
+segment init_seg0(FILE *instructions, allSegments umSegs);
+void fill_seg0(const uint8_t *bytes, segment seg0);
+static uint8_t *read_all(FILE *input, size_t *size);
+segment copy(segment seg, allSegments umSegs, bool code);
+static segment alloc_segment(allSegments umSegs, uint32_t numWords, 
+                             bool code);
+static void *map_words(uint32_t numWords, bool huge);
+static void hold_segment(allSegments umSegs, segment seg);
+static void release_segment(allSegments umSegs, segment seg);
+static segment unshare(allSegments umSegs, uint32_t id);
+static unsigned size_class(uint32_t numWords);
+static uint64_t resident_words(segment seg);
+static void put_bytes(Image_writer *writer, const void *bytes, size_t n);
+static void put_words(Image_writer *writer, const uint32_t *words, 
+                      uint32_t numWords);
+static void skip_to(Image_writer *writer, uint64_t pos);
+static void flush_writer(Image_writer *writer);
+static uint64_t align_up(uint64_t pos, uint64_t alignment);
+static void grow_dirty(allSegments umSegs, uint32_t capacity);
+static void copy_pages(Seg_delta delta, uint32_t i, segment seg, 
+                       const uint64_t *bits);
+static bool apply_entry(allSegments umSegs, const Delta_entry *entry, 
+                        const uint8_t *body, uint64_t length, 
+                        uint64_t start);
 
 
 
@@ -65,14 +248,63 @@ segment copy(segment seg);
 allSegments init_allSegs(FILE *instructions)
 {
         assert(instructions);
-        allSegments umSegments = malloc(sizeof(struct allSegments));
-        Seq_T mapped = Seq_new(SEQ_HINT);
-        Seq_T unmapped = Seq_new(SEQ_HINT);
-        umSegments->mapped = mapped;
-        umSegments->unmapped = unmapped;
-
-        segment seg0 = init_seg0(instructions);
-        Seq_addhi(umSegments->mapped, seg0);
+        allSegments umSegments = new_allSegs();
+        umSegments->mapped[0] = init_seg0(instructions, umSegments);
+        umSegments->numMapped = 1;
+        return umSegments;
+}
+
+/************init_allSegs_words****************************************
+*
+* Description: Function that inilizes an instance of the allSegments struct
+*              from a program that is already in memory
+*
+* Parameters: const uint32_t *words: the program's instructions, in host 
+*                                    byte order
+*             uint32_t numWords: the number of instructions
+*
+* Returns: a pointer to the new allSegments struct
+*
+* Expects: words != NULL unless numWords is 0, and memory allocation 
+*          suceeds
+*      
+* Notes: segment 0 gets its own copy of the words
+**************************************************************/
+allSegments init_allSegs_words(const uint32_t *words, uint32_t numWords)
+{
+        assert(words != NULL || numWords == 0);
+        allSegments umSegments = new_allSegs();
+        segment seg0 = alloc_segment(umSegments, numWords, true);
+        if (numWords > 0) {
+                memcpy(seg0->memory, words, sizeof(uint32_t) * numWords);
+        }
+        umSegments->mapped[0] = seg0;
+        umSegments->numMapped = 1;
+        return umSegments;
+}
+
+/************new_allSegs****************************************
+*
+* Description: Function that creates an allSegments struct with no 
+*              segments and an empty pool
+*
+* Parameters: N/A
+*
+* Returns: a pointer to the new allSegments struct
+*
+* Expects: memory allocation suceeds
+*      
+* Notes: the caller installs segment 0
+**************************************************************/
+static allSegments new_allSegs(void)
+{
+        allSegments umSegments = calloc(1, sizeof(struct allSegments));
+        assert(umSegments);
+        umSegments->mapped = malloc(TABLE_HINT * sizeof(segment));
+        umSegments->unmapped = malloc(TABLE_HINT * sizeof(uint32_t));
+        assert(umSegments->mapped && umSegments->unmapped);
+        umSegments->mappedCapacity = TABLE_HINT;
+        umSegments->unmappedCapacity = TABLE_HINT;
         return umSegments;
 }
 
@@ -82,66 +314,143 @@ allSegments init_allSegs(FILE *instructions)
 *
 * Parameters: FILE *instructions: pointer to a file with bitpacked UM 
 *                                 instructions
+*             allSegments umSegs: the allSegments struct it will belong to
 *
 * Returns: a pointer to a segement struct representing segment 0
 *
 * Expects: instructions != NULL
 *      
-* Notes: N/A
+* Notes: a regular file that nothing has been read from yet is mapped with
+* mmap and converted in one pass. Anything else (a pipe or terminal, which 
+* cannot be mapped, or a FILE already read from, whose buffer may hold 
+* bytes the descriptor is past) is read through the FILE into a buffer 
+* with large reads first. A file whose length is not a multiple of 
+* 4 bytes is reported and the UM exits with EXIT_FAILURE
 **************************************************************/
-segment init_seg0(FILE *instructions)
+segment init_seg0(FILE *instructions, allSegments umSegs)
 {
         assert(instructions != NULL);
-        uint32_t numInstructions = 0;
-        int i = 0;
-        while (!(feof(instructions))){
-                fgetc(instructions);
-                i++;
-                if (i == 4){
-                        i = 0;
-                        numInstructions++;
-                }
-        }
-        rewind(instructions);
-
-        segment seg0 =  malloc(sizeof(struct segment));
-        seg0->numWords = numInstructions;
-        uint32_t *mem = (uint32_t *)calloc(numInstructions, 
-                        sizeof(uint32_t));
-        assert(mem != NULL);
-        seg0->memory = mem;
-        fill_seg0(instructions, seg0);    
+        assert(umSegs);
+        int fd = fileno(instructions);
+        struct stat info;
+        size_t size = 0;
+        uint8_t *bytes = NULL;
+        bool mapped = false;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && 
+            info.st_size > 0 && ftello(instructions) == 0) {
+                size = info.st_size;
+                void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED) {
+                        bytes = map;
+                        mapped = true;
+                }
+        }
+        if (!mapped) {
+                bytes = read_all(instructions, &size);
+        }
+        if (size % WORDSIZE != 0) {
+                fprintf(stderr, "um: program ends with %zu trailing "
+                        "byte(s) that do not form a whole instruction\n",
+                        size % WORDSIZE);
+                exit(EXIT_FAILURE);
+        }
+
+        segment seg0 = alloc_segment(umSegs, size / WORDSIZE, true);
+        fill_seg0(bytes, seg0);
+
+        if (mapped) {
+                munmap(bytes, size);
+        } else {
+                free(bytes);
+        }
         return seg0;
 }
 
+/************read_all****************************************
+*
+* Description: Function that reads everything left in a file into memory
+*
+* Parameters: FILE *input: the file to read
+*             size_t *size: set to the number of bytes read
+*
+* Returns: a malloc'ed buffer holding the bytes
+*
+* Expects: input != NULL, size != NULL, and memory allocation suceeds
+*      
+* Notes: the buffer doubles as it fills. A read error is reported and the 
+* UM exits with EXIT_FAILURE
+**************************************************************/
+static uint8_t *read_all(FILE *input, size_t *size)
+{
+        assert(input && size);
+        size_t capacity = READ_CHUNK;
+        size_t used = 0;
+        uint8_t *buffer = malloc(capacity);
+        assert(buffer);
+        for (;;) {
+                if (capacity - used < READ_CHUNK) {
+                        capacity *= 2;
+                        buffer = realloc(buffer, capacity);
+                        assert(buffer);
+                }
+                size_t want = capacity - used;
+                size_t n = fread(buffer + used, 1, want, input);
+                used += n;
+                if (n < want) {
+                        if (ferror(input)) {
+                                perror("um: reading program");
+                                exit(EXIT_FAILURE);
+                        }
+                        break;
+                }
+        }
+        *size = used;
+        return buffer;
+}
+
 
 /************fill_seg0****************************************
 *
 * Description: Function that fills the memory array of segment 0 with 
-*              instructions from a file
+*              instructions stored as big-endian words
 *
-* Parameters: FILE *instructions: pointer to a file with bitpacked UM 
-*                                 instructions
+* Parameters: const uint8_t *bytes: the program, 4 bytes per instruction, 
+*                                   most significant byte first
 *             segment seg0: an intilized segment 0
 *
 * Returns: void
 *
-* Expects: instructions != NULL, seg0 != NULL
+* Expects: bytes != NULL unless seg0 is empty, seg0 != NULL
 *      
-* Notes: alters the memory array in seg0
+* Notes: alters the memory array in seg0. On little-endian hosts the words 
+* are byte swapped 4 at a time with SSSE3 when it is available; the scalar 
+* loop is left simple enough for the compiler to vectorize
 **************************************************************/
-void fill_seg0(FILE* instructions, segment seg0)
+void fill_seg0(const uint8_t *bytes, segment seg0)
 {
-        assert(instructions);
         assert(seg0);
-        for (uint32_t i = 0; i < seg0->numWords; i++){
-                uint32_t word = 0;
-                for (int j = 1; j <= WORDSIZE; j++){
-                        word = Bitpack_newu(word, CHARBITS, 
-                                (CHARBITS * WORDSIZE) - (CHARBITS * j), 
-                                fgetc(instructions));
-                }
-                seg0->memory[i] = word;
+        assert(bytes != NULL || seg0->numWords == 0);
+        uint32_t *out = seg0->memory;
+        uint32_t n = seg0->numWords;
+        uint32_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        memcpy(out, bytes, (size_t)n * WORDSIZE);
+        i = n;
+#elif defined(__SSSE3__)
+        const __m128i swap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                                          4, 5, 6, 7, 0, 1, 2, 3);
+        for (; i + 4 <= n; i += 4) {
+                __m128i words = _mm_loadu_si128((const __m128i *)
+                                                (bytes + (size_t)i * 
+                                                         WORDSIZE));
+                _mm_storeu_si128((__m128i *)(out + i), 
+                                 _mm_shuffle_epi8(words, swap));
+        }
+#endif
+        for (; i < n; i++) {
+                const uint8_t *b = bytes + (size_t)i * WORDSIZE;
+                out[i] = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 |
+                         (uint32_t)b[2] << 8 | (uint32_t)b[3];
         }
 }
 
@@ -158,25 +467,27 @@ void fill_seg0(FILE* instructions, segment seg0)
 * Expects: umSegs != NULL, and memory allocation suceeds
 *      
 * Notes: The ID the new segment is assigned will always be an unmapped
-*       segment's ID unless there are no unmapped IDs to be used
+*       segment's ID unless there are no unmapped IDs to be used. The words
+*       are zeroed whether or not the block is reused from the pool
 **************************************************************/
 uint32_t init_segment(uint32_t numWords, allSegments umSegs)
 {
         assert(umSegs);
-        segment newSeg = malloc(sizeof(struct segment));
-        assert(newSeg);
-        newSeg->numWords = numWords;
-        uint32_t *memory = (uint32_t *)calloc(numWords, sizeof(uint32_t));
-        assert(memory);
-        newSeg->memory = memory;
+        segment newSeg = alloc_segment(umSegs, numWords, false);
 
         /*conditional checking if there are no unmapped IDs to use*/
-        if (Seq_length(umSegs->unmapped) == 0){
-                Seq_addhi(umSegs->mapped, newSeg);
-                return Seq_length(umSegs->mapped) - ONE;
+        if (umSegs->numUnmapped == 0){
+                if (umSegs->numMapped == umSegs->mappedCapacity) {
+                        umSegs->mappedCapacity *= 2;
+                        umSegs->mapped = realloc(umSegs->mapped, 
+                                umSegs->mappedCapacity * sizeof(segment));
+                        assert(umSegs->mapped);
+                }
+                umSegs->mapped[umSegs->numMapped++] = newSeg;
+                return umSegs->numMapped - ONE;
         }
-        uint32_t id = (uint32_t )(uintptr_t)Seq_remhi(umSegs->unmapped);
-        Seq_put(umSegs->mapped, id, newSeg);
+        uint32_t id = umSegs->unmapped[--umSegs->numUnmapped];
+        umSegs->mapped[id] = newSeg;
         return id;
 }
 
@@ -189,21 +500,76 @@ uint32_t init_segment(uint32_t numWords, allSegments umSegs)
 * Parameters: allSegments umSegs: an intilized allSegments struct
 *             uint32_t id: the id of the segment to be copied
 *
-* Returns: a pointer to the newly copied segment
+* Returns: a pointer to the new segment 0
 *
 * Expects: umSegs != NULL
 *      
-* Notes: UM will fail if the ID does not correspond to a mapped segment
+* Notes: UM will fail if the ID does not correspond to a mapped segment. The
+*        copy is copy-on-write: segment 0 and the ID share one segment until
+*        either is stored into through get_writable_mem, so switching to a 
+*        segment that is never written costs no memcpy
 **************************************************************/
 segment copy_and_replace(allSegments umSegs, uint32_t id)
 {
         assert(umSegs);
-        segment toCopy = Seq_get(umSegs->mapped, id);
-        segment copied = copy(toCopy);
+        segment shared = get_segment(umSegs, id);
+        hold_segment(umSegs, shared);
+        umSegs->stats.shares++;
+
+        segment oldSegment = umSegs->mapped[0];
+        umSegs->mapped[0] = shared;
+        release_segment(umSegs, oldSegment);
 
-        segment oldSegment = Seq_put(umSegs->mapped, 0, copied);
-        free_segment(oldSegment);
+        return shared;
+}
 
+/************get_writable_mem****************************************
+*
+* Description: Function that gets the memory of a segment for storing into
+*
+* Parameters: allSegments umSegs: an intilized allSegments struct
+*             uint32_t id: the id of the segment that will be stored into
+*
+* Returns: a pointer to the segment's words, which only that ID refers to
+*
+* Expects: umSegs != NULL
+*      
+* Notes: UM will fail if the ID does not correspond to a mapped segment. A 
+*        shared segment is copied first, so a pointer from get_mem for the 
+*        same ID may be stale afterwards
+**************************************************************/
+uint32_t *get_writable_mem(allSegments umSegs, uint32_t id)
+{
+        segment seg = get_segment(umSegs, id);
+        if (__atomic_load_n(&seg->refs, __ATOMIC_ACQUIRE) > 1) {
+                seg = unshare(umSegs, id);
+        }
+        return seg->memory;
+}
+
+/************unshare****************************************
+*
+* Description: Function that gives an ID its own copy of a shared segment
+*
+* Parameters: allSegments umSegs: an intilized allSegments struct
+*             uint32_t id: the id whose segment is shared
+*
+* Returns: the ID's new segment
+*
+* Expects: umSegs != NULL, and the ID's segment has more than one reference
+*      
+* Notes: the other references keep the original segment. In a forked 
+*        table the others may let go of it while it is being copied, in 
+*        which case this table releases it
+**************************************************************/
+static segment unshare(allSegments umSegs, uint32_t id)
+{
+        assert(umSegs);
+        segment shared = umSegs->mapped[id];
+        segment copied = copy(shared, umSegs, id == 0);
+        release_segment(umSegs, shared);
+        umSegs->mapped[id] = copied;
+        umSegs->stats.cowCopies++;
         return copied;
 }
 
@@ -212,24 +578,37 @@ segment copy_and_replace(allSegments umSegs, uint32_t id)
 * Description: Function that copies a segment
 *
 * Parameters: segment seg: the segment being copied
+*             allSegments umSegs: the allSegments struct whose pool the 
+*                                 copy is allocated from
+*             bool code: whether the copy is for segment 0
 *
 * Returns: a pointer to the newly copied segment
 *
-* Expects: segment != NULL, and memory allocation suceeds
+* Expects: segment != NULL, umSegs != NULL, and memory allocation suceeds
 *      
-* Notes: The ID the new segment is assigned will always be an unmapped
-*       segment's ID unless there are no unmapped IDs to be used
+* Notes: the copy is not given an ID. Into a LAZY_CLASS copy only the pages
+*        that are not all zero are copied, so the copy of a sparse segment
+*        stays sparse
 **************************************************************/
-segment copy(segment seg)
+segment copy(segment seg, allSegments umSegs, bool code)
 {
         assert(seg);
-        segment newSeg = malloc(sizeof(struct segment));
-        assert(newSeg);
-        newSeg->numWords = seg->numWords;
-        uint32_t *memory = malloc(sizeof(uint32_t) * seg->numWords);
-        memcpy(memory, seg->memory, sizeof(uint32_t) * seg->numWords);
-        newSeg->memory = memory;
-        
+        segment newSeg = alloc_segment(umSegs, seg->numWords, code);
+        if (newSeg->sizeClass != LAZY_CLASS) {
+                memcpy(newSeg->memory, seg->memory, 
+                       sizeof(uint32_t) * seg->numWords);
+                return newSeg;
+        }
+        static const uint8_t zeros[IMAGE_PAGE];
+        for (uint32_t i = 0; i < seg->numWords; i += DIRTY_PAGE_WORDS) {
+                uint32_t words = seg->numWords - i < DIRTY_PAGE_WORDS ?
+                                 seg->numWords - i : DIRTY_PAGE_WORDS;
+                if (memcmp(seg->memory + i, zeros, 
+                           (size_t)words * WORDSIZE) != 0) {
+                        memcpy(newSeg->memory + i, seg->memory + i, 
+                               (size_t)words * WORDSIZE);
+                }
+        }
         return newSeg;
 }
 
@@ -244,46 +623,394 @@ segment copy(segment seg)
 *
 * Expects: umSegs != NULL
 *      
-* Notes: N/A
+* Notes: shared segments are freed once their last reference is released
 **************************************************************/
 void free_allSegments(allSegments umSegs) 
 {
         assert(umSegs);
-        for (int i = 0; i < Seq_length(umSegs->mapped); i++) {
-                if (Seq_get(umSegs->mapped, i) != NULL){
-                        segment thisSegment = 
-                                (segment)Seq_get(umSegs->mapped, i);
-                        free_segment(thisSegment);
+        for (uint32_t i = 0; i < umSegs->numMapped; i++) {
+                if (umSegs->mapped[i] != NULL){
+                        release_segment(umSegs, umSegs->mapped[i]);
                 }
         }
-        Seq_free(&(umSegs->mapped));
-        Seq_free(&(umSegs->unmapped));
+        for (unsigned c = 0; c < NUM_CLASSES; c++) {
+                while (umSegs->freeLists[c] != NULL) {
+                        segment pooled = umSegs->freeLists[c];
+                        umSegs->freeLists[c] = pooled->next;
+                        free(pooled);
+                }
+        }
+        Seg_image *image = umSegs->image;
+        if (image != NULL && 
+            __atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                munmap(image->base, image->length);
+                free(image);
+        }
+        for (uint32_t i = 0; i < umSegs->numDirty; i++) {
+                free(umSegs->dirtyPages[umSegs->dirtyIds[i]]);
+        }
+        free(umSegs->dirty);
+        free(umSegs->dirtyPages);
+        free(umSegs->dirtyIds);
+        free(umSegs->mapped);
+        free(umSegs->unmapped);
         free(umSegs);
 }
 
-/************free_segment****************************************
+/************alloc_segment****************************************
 *
-* Description: Function that frees the memory associated with a single segment
+* Description: Function that allocates a zero-filled segment, reusing a 
+*              pooled block of the right size class when there is one
 *
-* Parameters: segment seg: a pointer to an inilized segment struct
+* Parameters: allSegments umSegs: the allSegments struct owning the pool
+*             uint32_t numWords: the number of words in the segment
+*             bool code: whether the segment is to be segment 0
+*
+* Returns: a pointer to the new segment
+*
+* Expects: umSegs != NULL, and memory allocation suceeds
+*      
+* Notes: small blocks are sized to their whole class so any segment of the
+*        class can reuse them later; large ones are sized exactly and come 
+*        from calloc, or, from lazyWords words up, from mmap. A segment of
+*        HUGE_PAGE bytes or more is mapped for huge pages when the policy 
+*        covers it (HUGE_DATA for all but segment 0, HUGE_ALL for every 
+*        one), whatever lazyWords is
+**************************************************************/
+static segment alloc_segment(allSegments umSegs, uint32_t numWords, 
+                             bool code)
+{
+        assert(umSegs);
+        Huge_policy policy = __atomic_load_n(&hugePolicy, __ATOMIC_RELAXED);
+        bool huge = (uint64_t)numWords * WORDSIZE >= HUGE_PAGE && 
+                    (policy == HUGE_ALL || (policy == HUGE_DATA && !code));
+        unsigned sizeClass = huge ||
+                numWords >= __atomic_load_n(&lazyWords, __ATOMIC_RELAXED) ?
+                LAZY_CLASS : size_class(numWords);
+        segment seg;
+        if (sizeClass == LAZY_CLASS) {
+                seg = malloc(sizeof(struct segment));
+                assert(seg);
+                seg->numWords = numWords;
+                seg->sizeClass = sizeClass;
+                seg->refs = 1;
+                seg->memory = map_words(numWords, huge);
+                seg->next = NULL;
+                umSegs->stats.lazyAllocs++;
+                umSegs->stats.hugeAllocs += huge;
+                return seg;
+        }
+        if (sizeClass == LARGE_CLASS) {
+                seg = calloc(1, sizeof(struct segment) + 
+                                (size_t)numWords * sizeof(uint32_t));
+                assert(seg);
+                umSegs->stats.largeAllocs++;
+        }
+        else if (umSegs->freeLists[sizeClass] != NULL) {
+                seg = umSegs->freeLists[sizeClass];
+                umSegs->freeLists[sizeClass] = seg->next;
+                umSegs->numFree[sizeClass]--;
+                memset(seg->words, 0, (size_t)numWords * sizeof(uint32_t));
+                umSegs->stats.poolHits++;
+        }
+        else {
+                seg = calloc(1, sizeof(struct segment) + 
+                                ((size_t)1 << sizeClass) * sizeof(uint32_t));
+                assert(seg);
+                umSegs->stats.poolMisses++;
+        }
+        seg->numWords = numWords;
+        seg->sizeClass = sizeClass;
+        seg->refs = 1;
+        seg->memory = seg->words;
+        seg->next = NULL;
+        return seg;
+}
+
+/************release_segment****************************************
+*
+* Description: Function that drops one reference to a segment, releasing 
+*              its memory when no slot of the mapped table refers to it
+*
+* Parameters: allSegments umSegs: the allSegments struct owning the pool
+*             segment seg: a pointer to an inilized segment struct
 *
 * Returns: void
 *
-* Expects: seg != NULL
+* Expects: umSegs != NULL, seg != NULL
 *      
-* Notes: N/A
+* Notes: small blocks go back on their class's free list unless it already
+*        holds MAX_POOLED blocks; everything else is freed. For a segment in
+*        a restored image only the header is freed, and a LAZY_CLASS one's 
+*        mapping is unmapped, returning its pages to the OS at once. A 
+*        segment shared with 
+*        another table goes to the pool of whichever table lets go last
 **************************************************************/
-void free_segment(segment seg) 
+static void release_segment(allSegments umSegs, segment seg) 
 {
+        assert(umSegs);
         assert(seg);
-        free(seg->memory);
+        assert(__atomic_load_n(&seg->refs, __ATOMIC_RELAXED) > 0);
+        uint32_t refs = umSegs->forked ? 
+                __atomic_sub_fetch(&seg->refs, 1, __ATOMIC_ACQ_REL) : 
+                --seg->refs;
+        if (refs > 0) {
+                return;
+        }
+        umSegs->stats.released++;
+        unsigned sizeClass = seg->sizeClass;
+        if (sizeClass < NUM_CLASSES && 
+            umSegs->numFree[sizeClass] < MAX_POOLED) {
+                seg->next = umSegs->freeLists[sizeClass];
+                umSegs->freeLists[sizeClass] = seg;
+                umSegs->numFree[sizeClass]++;
+                return;
+        }
+        if (sizeClass == LAZY_CLASS) {
+                munmap(seg->memory, (size_t)seg->numWords * WORDSIZE);
+        }
         free(seg);
 }
 
+/************hold_segment****************************************
+*
+* Description: Function that adds a reference to a segment
+*
+* Parameters: allSegments umSegs: the allSegments struct the reference is
+*                                 from
+*             segment seg: a pointer to an inilized segment struct
+*
+* Returns: void
+*
+* Expects: umSegs != NULL, seg != NULL
+*      
+* Notes: atomic in a forked table, whose segments other threads may be 
+*        adding and dropping references to. The count is 32 bits, so the
+*        tables forked from one image cannot run out of references
+**************************************************************/
+static void hold_segment(allSegments umSegs, segment seg)
+{
+        assert(umSegs && seg);
+        if (umSegs->forked) {
+                __atomic_add_fetch(&seg->refs, 1, __ATOMIC_RELAXED);
+        } else {
+                seg->refs++;
+        }
+}
+
+/************size_class****************************************
+*
+* Description: Function that finds the pool size class of a segment
+*
+* Parameters: uint32_t numWords: the number of words in the segment
+*
+* Returns: the smallest c with numWords <= 2^c, or LARGE_CLASS if that is 
+*          not below NUM_CLASSES
+*
+* Expects: N/A
+*      
+* Notes: N/A
+**************************************************************/
+static unsigned size_class(uint32_t numWords)
+{
+        unsigned sizeClass = 0;
+        while (sizeClass < NUM_CLASSES && 
+               ((uint32_t)1 << sizeClass) < numWords) {
+                sizeClass++;
+        }
+        return sizeClass;
+}
+
+/************get_seg_stats****************************************
+*
+* Description: Function that reports how the segment pool has been used
+*
+* Parameters: allSegments umSegs: an inilized allSegments struct
+*
+* Returns: the allocation counters since umSegs was created, and how many
+*          words are mapped now and how many of those are resident
+*
+* Expects: umSegs != NULL, and memory allocation suceeds
+*      
+* Notes: the pool hit rate is poolHits / (poolHits + poolMisses). A segment
+*        at two IDs counts for both. Pooled and calloced words count as 
+*        resident; for the others, which are only read in or allocated as
+*        they are touched, the kernel is asked which pages are, so this 
+*        walks the whole table
+**************************************************************/
+Seg_stats get_seg_stats(allSegments umSegs)
+{
+        assert(umSegs);
+        Seg_stats stats = umSegs->stats;
+        for (uint32_t id = 0; id < umSegs->numMapped; id++) {
+                segment seg = umSegs->mapped[id];
+                if (seg != NULL) {
+                        stats.mappedWords += seg->numWords;
+                        stats.residentWords += resident_words(seg);
+                }
+        }
+        return stats;
+}
+
+/************set_lazy_threshold****************************************
+*
+* Description: Function that sets the size from which segments are given 
+*              an anonymous mapping of their own
+*
+* Parameters: uint32_t numWords: the fewest words such a segment has
+*
+* Returns: void
+*
+* Expects: numWords > 0
+*      
+* Notes: applies to the segments every table allocates from then on; 
+*        UINT32_MAX turns it off for all but the largest. The default is 
+*        LAZY_WORDS
+**************************************************************/
+void set_lazy_threshold(uint32_t numWords)
+{
+        assert(numWords > 0);
+        __atomic_store_n(&lazyWords, numWords, __ATOMIC_RELAXED);
+}
+
+/************set_huge_policy****************************************
+*
+* Description: Function that sets which segments are mapped for 
+*              transparent huge pages
+*
+* Parameters: Huge_policy policy: HUGE_NEVER for none, HUGE_DATA for those
+*                                 of HUGE_PAGE bytes or more other than 
+*                                 segment 0, or HUGE_ALL for segment 0 too
+*
+* Returns: void
+*
+* Expects: policy is one of the three
+*      
+* Notes: applies to the segments every table allocates from then on. The 
+*        default is HUGE_NEVER, since a huge page is allocated whole when
+*        any word of it is touched, which costs sparse segments memory. 
+*        With the kernel's transparent huge pages set to never, the advice
+*        has no effect
+**************************************************************/
+void set_huge_policy(Huge_policy policy)
+{
+        assert(policy == HUGE_NEVER || policy == HUGE_DATA || 
+               policy == HUGE_ALL);
+        __atomic_store_n(&hugePolicy, policy, __ATOMIC_RELAXED);
+}
+
+/************parse_huge_policy****************************************
+*
+* Description: Function that reads a huge page policy from its name
+*
+* Parameters: const char *name: "never", "data" or "all"
+*             Huge_policy *policy: set to the policy named
+*
+* Returns: true if name is one of the three, false otherwise
+*
+* Expects: name != NULL, policy != NULL
+*      
+* Notes: for command lines; policy is left alone when false is returned
+**************************************************************/
+bool parse_huge_policy(const char *name, Huge_policy *policy)
+{
+        assert(name && policy);
+        static const char *names[] = { "never", "data", "all" };
+        for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+                if (strcmp(name, names[i]) == 0) {
+                        *policy = (Huge_policy)i;
+                        return true;
+                }
+        }
+        return false;
+}
+
+/************map_words****************************************
+*
+* Description: Function that maps zero-filled anonymous memory for the 
+*              words of a LAZY_CLASS segment
+*
+* Parameters: uint32_t numWords: the number of words in the segment
+*             bool huge: whether to map it for huge pages
+*
+* Returns: a pointer to the words, which munmap of numWords words unmaps
+*
+* Expects: numWords > 0, and the mapping suceeds
+*      
+* Notes: for huge pages, HUGE_PAGE more bytes are mapped and the parts 
+*        before the first HUGE_PAGE boundary and after the words are 
+*        unmapped again, so the words start on a huge page; then the kernel
+*        is advised with MADV_HUGEPAGE, which it may ignore
+**************************************************************/
+static void *map_words(uint32_t numWords, bool huge)
+{
+        assert(numWords > 0);
+        size_t bytes = (size_t)numWords * WORDSIZE;
+        size_t length = huge ? bytes + HUGE_PAGE : bytes;
+        uint8_t *map = mmap(NULL, length, PROT_READ | PROT_WRITE, 
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, 
+                            -1, 0);
+        assert(map != MAP_FAILED);
+        if (!huge) {
+                return map;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        uint8_t *words = (uint8_t *)align_up((uintptr_t)map, HUGE_PAGE);
+        uint8_t *end = (uint8_t *)align_up((uintptr_t)(words + bytes), page);
+        if (words > map) {
+                munmap(map, words - map);
+        }
+        if (map + length > end) {
+                munmap(end, map + length - end);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(words, bytes, MADV_HUGEPAGE);
+#endif
+        return words;
+}
+
+/************resident_words****************************************
+*
+* Description: Function that finds how many of a segment's words are in
+*              resident pages
+*
+* Parameters: segment seg: a pointer to an inilized segment struct
+*
+* Returns: the number of words, counting the pages at either end whole 
+*          (but no more than the segment has)
+*
+* Expects: seg != NULL, and memory allocation suceeds
+*      
+* Notes: asks mincore about LAZY_CLASS and IMAGE_CLASS segments; the words
+*        of the others are all counted
+**************************************************************/
+static uint64_t resident_words(segment seg)
+{
+        assert(seg);
+        if ((seg->sizeClass != LAZY_CLASS && seg->sizeClass != IMAGE_CLASS) ||
+            seg->numWords == 0) {
+                return seg->numWords;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t first = (uintptr_t)seg->memory & ~(uintptr_t)(page - 1);
+        uintptr_t end = (uintptr_t)(seg->memory + seg->numWords);
+        size_t pages = (end - first + page - 1) / page;
+        unsigned char *resident = malloc(pages);
+        assert(resident);
+        uint64_t words = 0;
+        if (mincore((void *)first, end - first, resident) == 0) {
+                for (size_t i = 0; i < pages; i++) {
+                        words += (resident[i] & 1) ? page / WORDSIZE : 0;
+                }
+        }
+        free(resident);
+        return words < seg->numWords ? words : seg->numWords;
+}
+
 /************unmap_id****************************************
 *
-* Description: Function that changes the mapped and unmapped sequences when
-* unmapping a segment
+* Description: Function that unmaps a segment: releases its memory and 
+* changes the mapped table and unmapped stack
 *
 * Parameters: uint32_t id: the id of the segment being unmapped
 *             allSegments umSegs: a pointer to an inilized allSegments struct
@@ -298,8 +1025,17 @@ void unmap_id(uint32_t id, allSegments umSegs)
 {
        
         assert(umSegs);
-        Seq_put(umSegs->mapped, id, NULL);
-        Seq_addhi(umSegs->unmapped, (void *)(uintptr_t)id);
+        assert(id < umSegs->numMapped);
+        assert(umSegs->mapped[id] != NULL);
+        release_segment(umSegs, umSegs->mapped[id]);
+        umSegs->mapped[id] = NULL;
+        if (umSegs->numUnmapped == umSegs->unmappedCapacity) {
+                umSegs->unmappedCapacity *= 2;
+                umSegs->unmapped = realloc(umSegs->unmapped, 
+                        umSegs->unmappedCapacity * sizeof(uint32_t));
+                assert(umSegs->unmapped);
+        }
+        umSegs->unmapped[umSegs->numUnmapped++] = id;
 
 }
 
@@ -321,9 +1057,8 @@ void unmap_id(uint32_t id, allSegments umSegs)
 segment get_segment(allSegments umSegs, uint32_t id)
 {
         assert(umSegs);
-        assert(id < (uint32_t)Seq_length(umSegs->mapped));
-        segment thisSeg = (segment)Seq_get(umSegs->mapped, id);
-        return thisSeg;
+        assert(id < umSegs->numMapped);
+        return umSegs->mapped[id];
 }
 
 /************get_segment****************************************
@@ -338,10 +1073,905 @@ segment get_segment(allSegments umSegs, uint32_t id)
 * Expects: seg != NULL
 *      
 * Notes: if the provided ID is of an unmapped segment, function will return 
-*        NULL
+*        NULL. The memory may be shared with another ID, so it is only for 
+*        reading; stores go through get_writable_mem
 **************************************************************/
 uint32_t *get_mem(segment seg)
 {
         assert(seg);
         return seg->memory;
-}
\ No newline at end of file
+}
+
+/************get_length****************************************
+*
+* Description: Function that serves as a getter for other modules in order to
+* get the number of words in a segment
+*              
+* Parameters: segment seg: a pointer to an inilized segment struct
+*
+* Returns: the number of words in the segment
+*
+* Expects: seg != NULL
+*      
+* Notes: N/A
+**************************************************************/
+uint32_t get_length(segment seg)
+{
+        assert(seg);
+        return seg->numWords;
+}
+
+/************save_segments****************************************
+*
+* Description: Function that writes the whole segment table to a file: 
+*              every mapped segment with its ID, and the stack of unmapped
+*              IDs
+*
+* Parameters: allSegments umSegs: an inilized allSegments struct
+*             int fd: a file descriptor open for writing
+*             uint64_t start: the file offset the table is written at, a 
+*                             multiple of 8
+*
+* Returns: true if every write succeeded
+*
+* Expects: umSegs != NULL, and memory allocation suceeds
+*      
+* Notes: segments of IMAGE_PAGE bytes or more start on a page boundary, and
+*        their all zero pages are skipped, which leaves holes in the file
+*        that read back as zeros. The layout is described above 
+*        Image_table; restore_segments reads it back
+**************************************************************/
+bool save_segments(allSegments umSegs, int fd, uint64_t start)
+{
+        assert(umSegs);
+        assert(start % 8 == 0);
+        Image_table table = { umSegs->numMapped, umSegs->numUnmapped, 0, 0 };
+        for (uint32_t id = 0; id < umSegs->numMapped; id++) {
+                table.numEntries += umSegs->mapped[id] != NULL;
+        }
+        Image_entry *entries = malloc((table.numEntries + 1) * 
+                                      sizeof(Image_entry));
+        assert(entries);
+        uint64_t pos = start + sizeof(table) + 
+                       align_up((uint64_t)table.numUnmapped * WORDSIZE, 8) +
+                       (uint64_t)table.numEntries * sizeof(Image_entry);
+        uint32_t n = 0;
+        for (uint32_t id = 0; id < umSegs->numMapped; id++) {
+                segment seg = umSegs->mapped[id];
+                if (seg == NULL) {
+                        continue;
+                }
+                entries[n].id = id;
+                entries[n].numWords = seg->numWords;
+                if (id != 0 && seg == umSegs->mapped[0]) {
+                        entries[n++].offset = entries[0].offset;
+                        continue;
+                }
+                uint64_t bytes = (uint64_t)seg->numWords * WORDSIZE;
+                pos = align_up(pos, bytes >= IMAGE_PAGE ? IMAGE_PAGE : 
+                                                          WORDSIZE);
+                entries[n++].offset = pos;
+                pos += bytes;
+        }
+
+        Image_writer writer = { fd, malloc(WRITE_BUFFER), 0, start, false };
+        assert(writer.buffer);
+        put_bytes(&writer, &table, sizeof(table));
+        put_bytes(&writer, umSegs->unmapped, 
+                  (size_t)table.numUnmapped * WORDSIZE);
+        skip_to(&writer, align_up(writer.pos, 8));
+        put_bytes(&writer, entries, 
+                  (size_t)table.numEntries * sizeof(Image_entry));
+        for (uint32_t i = 0; i < n; i++) {
+                segment seg = umSegs->mapped[entries[i].id];
+                if (i > 0 && seg == umSegs->mapped[0]) {
+                        continue;
+                }
+                skip_to(&writer, entries[i].offset);
+                put_words(&writer, seg->memory, seg->numWords);
+        }
+        flush_writer(&writer);
+        if (ftruncate(fd, pos) != 0) {
+                writer.failed = true;
+        }
+        free(writer.buffer);
+        free(entries);
+        return !writer.failed;
+}
+
+/************restore_segments****************************************
+*
+* Description: Function that rebuilds a segment table from an image of a 
+*              file save_segments wrote
+*
+* Parameters: uint8_t *image: the file, mapped readable and writable 
+*                             (privately, so stores do not reach the file)
+*             size_t length: the length of the mapping
+*             uint64_t start: the offset save_segments was given
+*
+* Returns: a pointer to the new allSegments struct, or NULL if the image is
+*          not a valid table
+*
+* Expects: image != NULL, and memory allocation suceeds
+*      
+* Notes: the restored segments' words are not copied: they stay in the 
+*        image, and pages are only read in as they are touched. On success 
+*        the table owns the mapping and unmaps it in free_allSegments; on
+*        failure it is left to the caller
+**************************************************************/
+allSegments restore_segments(uint8_t *image, size_t length, uint64_t start)
+{
+        assert(image);
+        Image_table table;
+        if (start % 8 != 0 || start + sizeof(table) > length) {
+                return NULL;
+        }
+        memcpy(&table, image + start, sizeof(table));
+        uint64_t idsAt = start + sizeof(table);
+        uint64_t entriesAt = idsAt + 
+                align_up((uint64_t)table.numUnmapped * WORDSIZE, 8);
+        uint64_t end = entriesAt + 
+                       (uint64_t)table.numEntries * sizeof(Image_entry);
+        if (table.numMapped == 0 || table.numEntries > table.numMapped ||
+            table.numUnmapped > table.numMapped || end > length) {
+                return NULL;
+        }
+
+        allSegments umSegs = new_allSegs();
+        if (table.numMapped > umSegs->mappedCapacity) {
+                umSegs->mappedCapacity = table.numMapped;
+                umSegs->mapped = realloc(umSegs->mapped, 
+                                table.numMapped * sizeof(segment));
+                assert(umSegs->mapped);
+        }
+        if (table.numUnmapped > umSegs->unmappedCapacity) {
+                umSegs->unmappedCapacity = table.numUnmapped;
+                umSegs->unmapped = realloc(umSegs->unmapped, 
+                                table.numUnmapped * sizeof(uint32_t));
+                assert(umSegs->unmapped);
+        }
+        memset(umSegs->mapped, 0, table.numMapped * sizeof(segment));
+        umSegs->numMapped = table.numMapped;
+
+        bool valid = true;
+        const Image_entry *entries = (const Image_entry *)(image + entriesAt);
+        for (uint32_t i = 0; i < table.numEntries && valid; i++) {
+                Image_entry entry = entries[i];
+                uint64_t bytes = (uint64_t)entry.numWords * WORDSIZE;
+                if (entry.id >= table.numMapped || 
+                    umSegs->mapped[entry.id] != NULL ||
+                    entry.offset % WORDSIZE != 0 || 
+                    entry.offset + bytes > length) {
+                        valid = false;
+                        break;
+                }
+                segment seg0 = umSegs->mapped[0];
+                if (i > 0 && seg0 != NULL && 
+                    entry.offset == entries[0].offset &&
+                    entry.numWords == seg0->numWords) {
+                        hold_segment(umSegs, seg0);
+                        umSegs->mapped[entry.id] = seg0;
+                        continue;
+                }
+                segment seg = malloc(sizeof(struct segment));
+                assert(seg);
+                seg->numWords = entry.numWords;
+                seg->sizeClass = IMAGE_CLASS;
+                seg->refs = 1;
+                seg->memory = (uint32_t *)(image + entry.offset);
+                seg->next = NULL;
+                umSegs->mapped[entry.id] = seg;
+        }
+        const uint32_t *ids = (const uint32_t *)(image + idsAt);
+        for (uint32_t i = 0; i < table.numUnmapped && valid; i++) {
+                if (ids[i] >= table.numMapped || 
+                    umSegs->mapped[ids[i]] != NULL) {
+                        valid = false;
+                }
+                umSegs->unmapped[i] = ids[i];
+        }
+        umSegs->numUnmapped = table.numUnmapped;
+        if (!valid || umSegs->mapped[0] == NULL) {
+                free_allSegments(umSegs);
+                return NULL;
+        }
+        umSegs->image = malloc(sizeof(Seg_image));
+        assert(umSegs->image);
+        umSegs->image->base = image;
+        umSegs->image->length = length;
+        umSegs->image->refs = 1;
+        return umSegs;
+}
+
+/************fork_segments****************************************
+*
+* Description: Function that makes a new table with the same segments at 
+*              the same IDs, and the same unmapped IDs, as another
+*
+* Parameters: allSegments parent: an inilized allSegments struct
+*
+* Returns: a pointer to the new allSegments struct
+*
+* Expects: parent != NULL, and memory allocation suceeds
+*      
+* Notes: no words are copied: every segment is shared copy on write, so 
+*        each table only pays for the segments it stores into. From here 
+*        on both tables count references atomically, and each may be run 
+*        on its own thread, but fork_segments itself must not run while 
+*        parent is. The new table has its own empty pool, and is not dirty
+*        tracked
+**************************************************************/
+allSegments fork_segments(allSegments parent)
+{
+        assert(parent);
+        allSegments child = new_allSegs();
+        parent->forked = true;
+        child->forked = true;
+        if (parent->numMapped > child->mappedCapacity) {
+                child->mappedCapacity = parent->mappedCapacity;
+                child->mapped = realloc(child->mapped, 
+                        child->mappedCapacity * sizeof(segment));
+                assert(child->mapped);
+        }
+        if (parent->numUnmapped > child->unmappedCapacity) {
+                child->unmappedCapacity = parent->unmappedCapacity;
+                child->unmapped = realloc(child->unmapped, 
+                        child->unmappedCapacity * sizeof(uint32_t));
+                assert(child->unmapped);
+        }
+        for (uint32_t id = 0; id < parent->numMapped; id++) {
+                segment seg = parent->mapped[id];
+                if (seg != NULL) {
+                        hold_segment(child, seg);
+                }
+                child->mapped[id] = seg;
+        }
+        child->numMapped = parent->numMapped;
+        memcpy(child->unmapped, parent->unmapped, 
+               parent->numUnmapped * sizeof(uint32_t));
+        child->numUnmapped = parent->numUnmapped;
+        child->image = parent->image;
+        if (child->image != NULL) {
+                __atomic_add_fetch(&child->image->refs, 1, __ATOMIC_RELAXED);
+        }
+        return child;
+}
+
+/************track_dirty****************************************
+*
+* Description: Function that turns on dirty tracking, with every mapped 
+*              segment counted as changed
+*
+* Parameters: allSegments umSegs: an inilized allSegments struct
+*
+* Returns: void
+*
+* Expects: umSegs != NULL, and memory allocation suceeds
+*      
+* Notes: so the first delta taken holds the whole table. Changes are only
+*        seen if they are reported with mark_dirty, which the handlers in 
+*        op.c, the threaded engine and the JIT all do
+**************************************************************/
+void track_dirty(allSegments umSegs)
+{
+        assert(umSegs);
+        umSegs->pub.tracking = true;
+        for (uint32_t id = 0; id < umSegs->numMapped; id++) {
+                if (umSegs->mapped[id] != NULL) {
+                        mark_dirty(umSegs, id, DIRTY_WHOLE);
+                }
+        }
+}
+
+/************record_dirty****************************************
+*
+* Description: Function that records a change to a segment ID, for 
+*              mark_dirty once it has found that dirty tracking is on
+*
+* Parameters: allSegments umSegs: an inilized allSegments struct
+*             uint32_t id: the ID that changed
+*             uint32_t index: the word that was stored, or DIRTY_WHOLE when
+*                             the ID was mapped, unmapped or replaced
+*
+* Returns: void
+*
+* Expects: umSegs != NULL, id < the number of IDs ever mapped, and memory 
+*          allocation suceeds
+*      
+* Notes: a store into a segment of more than DIRTY_PAGE_WORDS words marks 
+*        only its page; any other change marks the whole ID
+**************************************************************/
+void record_dirty(allSegments umSegs, uint32_t id, uint32_t index)
+{
+        assert(umSegs && umSegs->pub.tracking);
+        if (id >= umSegs->dirtyCapacity) {
+                grow_dirty(umSegs, umSegs->mappedCapacity);
+        }
+        uint8_t state = umSegs->dirty[id];
+        if (state == DIRTY_ALL) {
+                return;
+        }
+        if (state == DIRTY_CLEAN) {
+                umSegs->dirtyIds[umSegs->numDirty++] = id;
+        }
+        segment seg = umSegs->mapped[id];
+        if (index == DIRTY_WHOLE || seg == NULL || 
+            seg->numWords <= DIRTY_PAGE_WORDS) {
+                umSegs->dirty[id] = DIRTY_ALL;
+                return;
+        }
+        uint64_t *bits = umSegs->dirtyPages[id];
+        if (bits == NULL) {
+                uint32_t numPages = (seg->numWords - 1) / DIRTY_PAGE_WORDS + 1;
+                bits = calloc((numPages + 63) / 64, sizeof(uint64_t));
+                assert(bits);
+                umSegs->dirtyPages[id] = bits;
+        }
+        uint32_t page = index / DIRTY_PAGE_WORDS;
+        bits[page / 64] |= (uint64_t)1 << (page % 64);
+        umSegs->dirty[id] = DIRTY_PAGES;
+}
+
+/************take_delta****************************************
+*
+* Description: Function that hands everything that changed since the last
+*              delta (or since track_dirty) to a Seg_delta, and marks the 
+*              table clean
+*
+* Parameters: allSegments umSegs: an inilized allSegments struct, with 
+*                                 tracking on
+*             uint64_t start: the file offset the delta will be written at,
+*                             a multiple of 8
+*
+* Returns: the delta, to be written with write_delta and freed with 
+*          free_delta
+*
+* Expects: umSegs != NULL, and memory allocation suceeds
+*      
+* Notes: this is the only part of a checkpoint that runs on the UM's 
+*        thread. Whole segments are not copied: they are pinned with a 
+*        reference, so the copy on write in get_writable_mem keeps them as 
+*        they were until free_delta. The stored pages of large segments are
+*        copied here, so the UM stalls for as long as that takes: pinning 
+*        them instead would make the UM's next store into one copy all of 
+*        it, since copy on write is per segment
+**************************************************************/
+Seg_delta take_delta(allSegments umSegs, uint64_t start)
+{
+        assert(umSegs && umSegs->pub.tracking);
+        assert(start % 8 == 0);
+        uint32_t n = umSegs->numDirty;
+        Seg_delta delta = calloc(1, sizeof(struct Seg_delta));
+        assert(delta);
+        delta->table.numMapped = umSegs->numMapped;
+        delta->table.numUnmapped = umSegs->numUnmapped;
+        delta->table.numEntries = n;
+        delta->unmapped = malloc((umSegs->numUnmapped + 1) * 
+                                 sizeof(uint32_t));
+        delta->entries = malloc((n + 1) * sizeof(Delta_entry));
+        delta->pinned = calloc(n + 1, sizeof(segment));
+        delta->pages = calloc(n + 1, sizeof(uint32_t *));
+        delta->pageWords = calloc(n + 1, sizeof(uint32_t *));
+        assert(delta->unmapped && delta->entries && delta->pinned && 
+               delta->pages && delta->pageWords);
+        memcpy(delta->unmapped, umSegs->unmapped, 
+               umSegs->numUnmapped * sizeof(uint32_t));
+        delta->start = start;
+
+        uint64_t pos = start + sizeof(Image_table) + 
+                       align_up((uint64_t)umSegs->numUnmapped * WORDSIZE, 8)
+                       + (uint64_t)n * sizeof(Delta_entry);
+        for (uint32_t i = 0; i < n; i++) {
+                uint32_t id = umSegs->dirtyIds[i];
+                segment seg = umSegs->mapped[id];
+                Delta_entry *entry = &delta->entries[i];
+                entry->id = id;
+                entry->numWords = seg == NULL ? 0 : seg->numWords;
+                entry->numPages = 0;
+                entry->offset = 0;
+                if (seg == NULL) {
+                        entry->kind = DELTA_GONE;
+                } else if (umSegs->dirty[id] == DIRTY_PAGES) {
+                        entry->kind = DELTA_PAGES;
+                        copy_pages(delta, i, seg, umSegs->dirtyPages[id]);
+                        pos = align_up(pos, 8);
+                        entry->offset = pos - start;
+                        pos = align_up(pos + (uint64_t)entry->numPages * 
+                                       WORDSIZE, IMAGE_PAGE);
+                        pos += (uint64_t)entry->numPages * IMAGE_PAGE;
+                } else {
+                        entry->kind = DELTA_WHOLE;
+                        hold_segment(umSegs, seg);
+                        delta->pinned[i] = seg;
+                        uint64_t bytes = (uint64_t)seg->numWords * WORDSIZE;
+                        pos = align_up(pos, bytes >= IMAGE_PAGE ? 
+                                            IMAGE_PAGE : 8);
+                        entry->offset = pos - start;
+                        pos += bytes;
+                }
+                free(umSegs->dirtyPages[id]);
+                umSegs->dirtyPages[id] = NULL;
+                umSegs->dirty[id] = DIRTY_CLEAN;
+        }
+        umSegs->numDirty = 0;
+        delta->length = align_up(pos, 8) - start;
+        return delta;
+}
+
+/************delta_length****************************************
+*
+* Description: Function that gives the number of bytes a delta takes 
+*
+* Parameters: Seg_delta delta: a delta from take_delta
+*
+* Returns: the length, a multiple of 8
+*
+* Expects: delta != NULL
+*      
+* Notes: N/A
+**************************************************************/
+uint64_t delta_length(Seg_delta delta)
+{
+        assert(delta);
+        return delta->length;
+}
+
+/************write_delta****************************************
+*
+* Description: Function that writes a delta at the offset take_delta was 
+*              given
+*
+* Parameters: Seg_delta delta: a delta from take_delta
+*             int fd: a file descriptor open for writing
+*
+* Returns: true if every write succeeded
+*
+* Expects: delta != NULL, and memory allocation suceeds
+*      
+* Notes: only reads the delta and its pinned segments, so it can run on 
+*        another thread while the UM keeps running. Page aligned all zero 
+*        pages are left as holes, as in save_segments
+**************************************************************/
+bool write_delta(Seg_delta delta, int fd)
+{
+        assert(delta);
+        Image_writer writer = { fd, malloc(WRITE_BUFFER), 0, delta->start, 
+                                false };
+        assert(writer.buffer);
+        uint32_t n = delta->table.numEntries;
+        put_bytes(&writer, &delta->table, sizeof(Image_table));
+        put_bytes(&writer, delta->unmapped, 
+                  (size_t)delta->table.numUnmapped * WORDSIZE);
+        skip_to(&writer, align_up(writer.pos, 8));
+        put_bytes(&writer, delta->entries, (size_t)n * sizeof(Delta_entry));
+        for (uint32_t i = 0; i < n; i++) {
+                const Delta_entry *entry = &delta->entries[i];
+                uint64_t at = delta->start + entry->offset;
+                if (entry->kind == DELTA_WHOLE) {
+                        skip_to(&writer, at);
+                        put_words(&writer, delta->pinned[i]->memory, 
+                                  entry->numWords);
+                } else if (entry->kind == DELTA_PAGES) {
+                        skip_to(&writer, at);
+                        put_bytes(&writer, delta->pages[i], 
+                                  (size_t)entry->numPages * WORDSIZE);
+                        uint64_t slot = align_up(writer.pos, IMAGE_PAGE);
+                        const uint32_t *words = delta->pageWords[i];
+                        for (uint32_t p = 0; p < entry->numPages; p++) {
+                                uint32_t first = delta->pages[i][p] * 
+                                                 DIRTY_PAGE_WORDS;
+                                uint32_t count = entry->numWords - first;
+                                if (count > DIRTY_PAGE_WORDS) {
+                                        count = DIRTY_PAGE_WORDS;
+                                }
+                                skip_to(&writer, slot);
+                                put_words(&writer, words, count);
+                                words += count;
+                                slot += IMAGE_PAGE;
+                        }
+                }
+        }
+        skip_to(&writer, delta->start + delta->length);
+        flush_writer(&writer);
+        free(writer.buffer);
+        return !writer.failed;
+}
+
+/************free_delta****************************************
+*
+* Description: Function that frees a delta and lets go of the segments it
+*              pinned
+*
+* Parameters: allSegments umSegs: the table the delta was taken from
+*             Seg_delta delta: the delta
+*
+* Returns: void
+*
+* Expects: umSegs != NULL, delta != NULL, and write_delta is not running 
+*          on it
+*      
+* Notes: must be called on the UM's thread, since it changes the table's 
+*        reference counts and pool
+**************************************************************/
+void free_delta(allSegments umSegs, Seg_delta delta)
+{
+        assert(umSegs && delta);
+        for (uint32_t i = 0; i < delta->table.numEntries; i++) {
+                if (delta->pinned[i] != NULL) {
+                        release_segment(umSegs, delta->pinned[i]);
+                }
+                free(delta->pages[i]);
+                free(delta->pageWords[i]);
+        }
+        free(delta->unmapped);
+        free(delta->entries);
+        free(delta->pinned);
+        free(delta->pages);
+        free(delta->pageWords);
+        free(delta);
+}
+
+/************apply_delta****************************************
+*
+* Description: Function that replays a delta write_delta wrote onto a 
+*              table
+*
+* Parameters: allSegments umSegs: the table as it was when the delta was
+*                                 taken from it
+*             const uint8_t *body: the delta, as read from the file
+*             uint64_t length: its length
+*             uint64_t start: the file offset it was written at
+*
+* Returns: true if the delta was valid and has been applied
+*
+* Expects: umSegs != NULL, body != NULL, and memory allocation suceeds
+*      
+* Notes: applying the deltas of a log in order, starting from a table with
+*        nothing in it but an empty segment 0, rebuilds the table as it was
+*        at the last one. Words are copied out of body. An invalid delta 
+*        can leave the table partly changed
+**************************************************************/
+bool apply_delta(allSegments umSegs, const uint8_t *body, uint64_t length,
+                 uint64_t start)
+{
+        assert(umSegs && body);
+        Image_table table;
+        if (length < sizeof(table)) {
+                return false;
+        }
+        memcpy(&table, body, sizeof(table));
+        uint64_t entriesAt = sizeof(table) + 
+                align_up((uint64_t)table.numUnmapped * WORDSIZE, 8);
+        if (table.numMapped < umSegs->numMapped || 
+            table.numUnmapped > table.numMapped ||
+            entriesAt + (uint64_t)table.numEntries * sizeof(Delta_entry) > 
+            length) {
+                return false;
+        }
+        if (table.numMapped > umSegs->mappedCapacity) {
+                umSegs->mappedCapacity = table.numMapped;
+                umSegs->mapped = realloc(umSegs->mapped, 
+                                table.numMapped * sizeof(segment));
+                assert(umSegs->mapped);
+        }
+        for (uint32_t id = umSegs->numMapped; id < table.numMapped; id++) {
+                umSegs->mapped[id] = NULL;
+        }
+        umSegs->numMapped = table.numMapped;
+
+        for (uint32_t i = 0; i < table.numEntries; i++) {
+                Delta_entry entry;
+                memcpy(&entry, body + entriesAt + i * sizeof(entry), 
+                       sizeof(entry));
+                if (!apply_entry(umSegs, &entry, body, length, start)) {
+                        return false;
+                }
+        }
+
+        if (table.numUnmapped > umSegs->unmappedCapacity) {
+                umSegs->unmappedCapacity = table.numUnmapped;
+                umSegs->unmapped = realloc(umSegs->unmapped, 
+                                table.numUnmapped * sizeof(uint32_t));
+                assert(umSegs->unmapped);
+        }
+        memcpy(umSegs->unmapped, body + sizeof(table), 
+               table.numUnmapped * sizeof(uint32_t));
+        umSegs->numUnmapped = table.numUnmapped;
+        for (uint32_t i = 0; i < table.numUnmapped; i++) {
+                uint32_t id = umSegs->unmapped[i];
+                if (id >= table.numMapped || umSegs->mapped[id] != NULL) {
+                        return false;
+                }
+        }
+        return umSegs->mapped[0] != NULL;
+}
+
+/************apply_entry****************************************
+*
+* Description: Function that replays one entry of a delta
+*
+* Parameters: allSegments umSegs: the table being rebuilt
+*             const Delta_entry *entry: the entry
+*             const uint8_t *body: the delta it is in
+*             uint64_t length: the delta's length
+*             uint64_t start: the file offset the delta was written at
+*
+* Returns: true if the entry was valid
+*
+* Expects: umSegs != NULL, entry != NULL, body != NULL, and memory 
+*          allocation suceeds
+*      
+* Notes: a DELTA_PAGES entry must be for a segment of the same size 
+*        already in the table
+**************************************************************/
+static bool apply_entry(allSegments umSegs, const Delta_entry *entry, 
+                        const uint8_t *body, uint64_t length, 
+                        uint64_t start)
+{
+        uint32_t id = entry->id;
+        if (id >= umSegs->numMapped) {
+                return false;
+        }
+        segment seg = umSegs->mapped[id];
+        if (entry->kind == DELTA_GONE || entry->kind == DELTA_WHOLE) {
+                uint64_t bytes = (uint64_t)entry->numWords * WORDSIZE;
+                if (entry->kind == DELTA_WHOLE && 
+                    (entry->offset > length || 
+                     bytes > length - entry->offset)) {
+                        return false;
+                }
+                if (seg != NULL) {
+                        release_segment(umSegs, seg);
+                        umSegs->mapped[id] = NULL;
+                }
+                if (entry->kind == DELTA_WHOLE) {
+                        seg = alloc_segment(umSegs, entry->numWords, id == 0);
+                        memcpy(seg->memory, body + entry->offset, bytes);
+                        umSegs->mapped[id] = seg;
+                }
+                return true;
+        }
+        if (entry->offset > length || entry->numPages > length) {
+                return false;
+        }
+        uint64_t slots = align_up(start + entry->offset + 
+                                  (uint64_t)entry->numPages * WORDSIZE, 
+                                  IMAGE_PAGE) - start;
+        if (entry->kind != DELTA_PAGES || seg == NULL || 
+            seg->numWords != entry->numWords ||
+            slots + (uint64_t)entry->numPages * IMAGE_PAGE > length) {
+                return false;
+        }
+        uint32_t *memory = get_writable_mem(umSegs, id);
+        for (uint32_t p = 0; p < entry->numPages; p++) {
+                uint32_t page;
+                memcpy(&page, body + entry->offset + p * WORDSIZE, 
+                       sizeof(page));
+                uint64_t first = (uint64_t)page * DIRTY_PAGE_WORDS;
+                if (first >= entry->numWords) {
+                        return false;
+                }
+                uint64_t count = entry->numWords - first;
+                count = count < DIRTY_PAGE_WORDS ? count : DIRTY_PAGE_WORDS;
+                memcpy(memory + first, body + slots + 
+                       (uint64_t)p * IMAGE_PAGE, count * WORDSIZE);
+        }
+        return true;
+}
+
+/************grow_dirty****************************************
+*
+* Description: Function that makes room in the dirty tracking arrays for
+*              more IDs
+*
+* Parameters: allSegments umSegs: an inilized allSegments struct
+*             uint32_t capacity: the number of IDs to make room for
+*
+* Returns: void
+*
+* Expects: umSegs != NULL, and memory allocation suceeds
+*      
+* Notes: new IDs start DIRTY_CLEAN
+**************************************************************/
+static void grow_dirty(allSegments umSegs, uint32_t capacity)
+{
+        assert(capacity > umSegs->dirtyCapacity);
+        uint32_t old = umSegs->dirtyCapacity;
+        umSegs->dirty = realloc(umSegs->dirty, capacity);
+        umSegs->dirtyPages = realloc(umSegs->dirtyPages, 
+                                     capacity * sizeof(uint64_t *));
+        umSegs->dirtyIds = realloc(umSegs->dirtyIds, 
+                                   capacity * sizeof(uint32_t));
+        assert(umSegs->dirty && umSegs->dirtyPages && umSegs->dirtyIds);
+        memset(umSegs->dirty + old, DIRTY_CLEAN, capacity - old);
+        memset(umSegs->dirtyPages + old, 0, 
+               (capacity - old) * sizeof(uint64_t *));
+        umSegs->dirtyCapacity = capacity;
+}
+
+/************copy_pages****************************************
+*
+* Description: Function that copies the stored pages of a large segment 
+*              into a delta
+*
+* Parameters: Seg_delta delta: the delta being taken
+*             uint32_t i: the index of the segment's entry
+*             segment seg: the segment
+*             const uint64_t *bits: its bitmap of stored pages
+*
+* Returns: void
+*
+* Expects: delta != NULL, seg != NULL, bits != NULL, and memory allocation 
+*          suceeds
+*      
+* Notes: sets the entry's numPages
+**************************************************************/
+static void copy_pages(Seg_delta delta, uint32_t i, segment seg, 
+                       const uint64_t *bits)
+{
+        uint32_t numPages = (seg->numWords - 1) / DIRTY_PAGE_WORDS + 1;
+        uint32_t count = 0;
+        for (uint32_t w = 0; w < (numPages + 63) / 64; w++) {
+                count += __builtin_popcountll(bits[w]);
+        }
+        uint32_t *pages = malloc((count + 1) * sizeof(uint32_t));
+        uint32_t *words = malloc(((size_t)count * DIRTY_PAGE_WORDS + 1) * 
+                                 WORDSIZE);
+        assert(pages && words);
+        uint32_t n = 0;
+        uint32_t *to = words;
+        for (uint32_t page = 0; page < numPages; page++) {
+                if ((bits[page / 64] >> (page % 64) & 1) == 0) {
+                        continue;
+                }
+                uint32_t first = page * DIRTY_PAGE_WORDS;
+                uint32_t len = seg->numWords - first;
+                len = len < DIRTY_PAGE_WORDS ? len : DIRTY_PAGE_WORDS;
+                memcpy(to, seg->memory + first, (size_t)len * WORDSIZE);
+                to += len;
+                pages[n++] = page;
+        }
+        delta->entries[i].numPages = n;
+        delta->pages[i] = pages;
+        delta->pageWords[i] = words;
+}
+
+/************put_bytes****************************************
+*
+* Description: Function that adds bytes to a writer's buffer, writing the
+*              buffer out when it fills
+*
+* Parameters: Image_writer *writer: the writer
+*             const void *bytes: the bytes
+*             size_t n: how many
+*
+* Returns: void
+*
+* Expects: writer != NULL, bytes != NULL unless n is 0
+*      
+* Notes: N/A
+**************************************************************/
+static void put_bytes(Image_writer *writer, const void *bytes, size_t n)
+{
+        const uint8_t *from = bytes;
+        while (n > 0) {
+                if (writer->length == WRITE_BUFFER) {
+                        flush_writer(writer);
+                }
+                size_t chunk = WRITE_BUFFER - writer->length;
+                chunk = chunk < n ? chunk : n;
+                memcpy(writer->buffer + writer->length, from, chunk);
+                writer->length += chunk;
+                writer->pos += chunk;
+                from += chunk;
+                n -= chunk;
+        }
+}
+
+/************put_words****************************************
+*
+* Description: Function that writes a segment's words, leaving a hole for
+*              every page aligned IMAGE_PAGE bytes that are all zero
+*
+* Parameters: Image_writer *writer: the writer
+*             const uint32_t *words: the words
+*             uint32_t numWords: how many
+*
+* Returns: void
+*
+* Expects: writer != NULL, words != NULL unless numWords is 0
+*      
+* Notes: N/A
+**************************************************************/
+static void put_words(Image_writer *writer, const uint32_t *words, 
+                      uint32_t numWords)
+{
+        static const uint8_t zeros[IMAGE_PAGE];
+        const uint8_t *bytes = (const uint8_t *)words;
+        uint64_t left = (uint64_t)numWords * WORDSIZE;
+        while (left > 0) {
+                size_t chunk = IMAGE_PAGE - writer->pos % IMAGE_PAGE;
+                chunk = chunk < left ? chunk : left;
+                if (chunk == IMAGE_PAGE && 
+                    memcmp(bytes, zeros, IMAGE_PAGE) == 0) {
+                        skip_to(writer, writer->pos + IMAGE_PAGE);
+                } else {
+                        put_bytes(writer, bytes, chunk);
+                }
+                bytes += chunk;
+                left -= chunk;
+        }
+}
+
+/************skip_to****************************************
+*
+* Description: Function that moves a writer forward to a file offset,
+*              leaving the bytes in between unwritten
+*
+* Parameters: Image_writer *writer: the writer
+*             uint64_t pos: the offset, not before the writer's
+*
+* Returns: void
+*
+* Expects: writer != NULL
+*      
+* Notes: N/A
+**************************************************************/
+static void skip_to(Image_writer *writer, uint64_t pos)
+{
+        assert(pos >= writer->pos);
+        if (pos == writer->pos) {
+                return;
+        }
+        flush_writer(writer);
+        writer->pos = pos;
+}
+
+/************flush_writer****************************************
+*
+* Description: Function that writes out a writer's buffer
+*
+* Parameters: Image_writer *writer: the writer
+*
+* Returns: void
+*
+* Expects: writer != NULL
+*      
+* Notes: sets failed instead of stopping when a write fails
+**************************************************************/
+static void flush_writer(Image_writer *writer)
+{
+        uint64_t at = writer->pos - writer->length;
+        size_t done = 0;
+        while (done < writer->length && !writer->failed) {
+                ssize_t put = pwrite(writer->fd, writer->buffer + done,
+                                     writer->length - done, at + done);
+                if (put < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (put <= 0) {
+                        writer->failed = true;
+                        break;
+                }
+                done += put;
+        }
+        writer->length = 0;
+}
+
+/************align_up****************************************
+*
+* Description: Function that rounds an offset up to a multiple
+*
+* Parameters: uint64_t pos: the offset
+*             uint64_t alignment: the multiple, a power of 2
+*
+* Returns: the smallest multiple of alignment not below pos
+*
+* Expects: N/A
+*      
+* Notes: N/A
+**************************************************************/
+static uint64_t align_up(uint64_t pos, uint64_t alignment)
+{
+        return (pos + alignment - 1) & ~(alignment - 1);
+}
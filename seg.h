@@ -14,8 +14,8 @@
  **************************************************************/
 
 #include <stdlib.h>
-#include <seq.h>
 #include <except.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -27,15 +27,77 @@ typedef struct allSegments *allSegments;
 struct segment;
 typedef struct segment *segment;
 
+/*the changes to a table since the last checkpoint; see take_delta*/
+struct Seg_delta;
+typedef struct Seg_delta *Seg_delta;
+
+/*the index mark_dirty is given when a whole ID changed*/
+#define DIRTY_WHOLE UINT32_MAX
+
+/*the first member of every allSegments struct, which mark_dirty reads*/
+typedef struct Seg_public {
+        bool tracking;
+} Seg_public;
+
+/*which segments are mapped for transparent huge pages; see 
+set_huge_policy in seg.c*/
+typedef enum Huge_policy { HUGE_NEVER = 0, HUGE_DATA, HUGE_ALL } Huge_policy;
+
+/*counters kept by the segment pool, and the words mapped and resident 
+when they were taken; see get_seg_stats in seg.c*/
+typedef struct Seg_stats {
+        uint64_t poolHits;
+        uint64_t poolMisses;
+        uint64_t largeAllocs;
+        uint64_t lazyAllocs;
+        uint64_t hugeAllocs;
+        uint64_t released;
+        uint64_t shares;
+        uint64_t cowCopies;
+        uint64_t mappedWords;
+        uint64_t residentWords;
+} Seg_stats;
+
 allSegments init_allSegs(FILE *instructions);
+allSegments init_allSegs_words(const uint32_t *words, uint32_t numWords);
 uint32_t init_segment(uint32_t numWords, allSegments umSegs);
 void free_allSegments(allSegments umSegs);
-void free_segment(segment seg);
 void unmap_id(uint32_t id, allSegments umSegs);
 segment copy_and_replace(allSegments umSegs, uint32_t id);
 
 /*Functionf for other modules to interact with segments*/
 segment get_segment(allSegments umSegs, uint32_t id);
 uint32_t *get_mem(segment seg);
+uint32_t *get_writable_mem(allSegments umSegs, uint32_t id);
+uint32_t get_length(segment seg);
+Seg_stats get_seg_stats(allSegments umSegs);
+void set_lazy_threshold(uint32_t numWords);
+void set_huge_policy(Huge_policy policy);
+bool parse_huge_policy(const char *name, Huge_policy *policy);
+
+bool save_segments(allSegments umSegs, int fd, uint64_t start);
+allSegments restore_segments(uint8_t *image, size_t length, uint64_t start);
+
+allSegments fork_segments(allSegments parent);
+
+void track_dirty(allSegments umSegs);
+void record_dirty(allSegments umSegs, uint32_t id, uint32_t index);
+Seg_delta take_delta(allSegments umSegs, uint64_t start);
+uint64_t delta_length(Seg_delta delta);
+bool write_delta(Seg_delta delta, int fd);
+void free_delta(allSegments umSegs, Seg_delta delta);
+bool apply_delta(allSegments umSegs, const uint8_t *body, uint64_t length,
+                 uint64_t start);
+
+/*reports a change to a segment ID to dirty tracking (see record_dirty in 
+seg.c). Inline, so that while tracking is off, as it is unless checkpoints
+are being written, a store costs one load and branch rather than a call*/
+static inline void mark_dirty(allSegments umSegs, uint32_t id, 
+                              uint32_t index)
+{
+        if (((const Seg_public *)umSegs)->tracking) {
+                record_dirty(umSegs, id, index);
+        }
+}
 
 #endif
\ No newline at end of file
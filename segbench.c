@@ -0,0 +1,397 @@
+/**************************************************************
+ *
+ *                     segbench.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Micro-benchmark for the segment table. Drives seg.h directly, the
+ *     way op.c does, keeping a number of segments live while it times
+ *     init_segment, unmap_id, get_segment/get_mem accesses,
+ *     copy_and_replace (with and without the copy a store into segment 0
+ *     then forces) and free_allSegments.
+ *
+ *     Every operation is timed in batches, after some untimed warmup
+ *     batches, and the per operation times of the batches are summarized
+ *     as their median, 99th percentile and mean. Each combination of a
+ *     segment size distribution and an unmap order is run:
+ *
+ *         sizes   fixed    every segment 8 words
+ *                 small    1 to 64 words, weighted towards small
+ *                 mixed    as small, but 1 in 100 is 65536 words
+ *         unmap   lifo     the most recently mapped segment first
+ *                 fifo     the oldest segment first
+ *                 random   any live segment
+ *
+ *     Since the table hands out unmapped IDs most recent first, the unmap
+ *     order decides which IDs are reused. The heap bytes the table uses
+ *     beyond the segments' words are reported per live segment (glibc
+ *     only, through mallinfo2).
+ *
+ *     Usage: segbench [live segments] [trials] [batch]
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include "assert.h"
+#include "seg.h"
+
+#define DEFAULT_LIVE 10000
+#define DEFAULT_TRIALS 1000
+#define DEFAULT_BATCH 256
+#define WARMUP_TRIALS 50
+#define TEARDOWN_TRIALS 20
+#define LARGE_WORDS 65536
+
+typedef enum Size_dist { FIXED = 0, SMALL, MIXED, NUM_DISTS } Size_dist;
+typedef enum Unmap_order { LIFO = 0, FIFO, RANDOM, NUM_ORDERS } Unmap_order;
+
+static const char *dist_names[NUM_DISTS] = { "fixed", "small", "mixed" };
+static const char *order_names[NUM_ORDERS] = { "lifo", "fifo", "random" };
+
+/* the live segments, in the order they were mapped: a ring of IDs from
+head, count long */
+typedef struct Live {
+        uint32_t *ids;
+        uint32_t cap;
+        uint32_t head;
+        uint32_t count;
+} Live;
+
+/* the measured per operation times of one benchmark, one per batch */
+typedef struct Samples {
+        double *ns;
+        unsigned n;
+} Samples;
+
+typedef struct Bench {
+        allSegments segs;
+        Live live;
+        Size_dist dist;
+        Unmap_order order;
+        uint32_t state;
+        unsigned batch;
+} Bench;
+
+static void run_combination(Size_dist dist, Unmap_order order,
+                            uint32_t live, unsigned trials, unsigned batch);
+static double time_maps(Bench *bench);
+static double time_unmaps(Bench *bench);
+static double time_access(Bench *bench);
+static double time_loads(Bench *bench, int writes);
+static void time_teardown(Size_dist dist, uint32_t live, Samples *samples);
+static void measure(Bench *bench, double (*op)(Bench *), unsigned trials,
+                    Samples *samples);
+static void report(const char *dist, const char *order, const char *op,
+                   Samples *samples);
+static uint32_t pick_unmap(Bench *bench);
+static uint32_t next_size(Bench *bench);
+static int compare_doubles(const void *a, const void *b);
+static size_t heap_in_use(void);
+static double now_ns(void);
+static uint32_t next_random(uint32_t *state);
+
+/* time_loads without and with the store into segment 0, for measure */
+static double time_loads_only(Bench *bench)
+{
+        return time_loads(bench, 0);
+}
+
+static double time_loads_writes(Bench *bench)
+{
+        return time_loads(bench, 1);
+}
+
+int main(int argc, char *argv[])
+{
+        uint32_t live = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_LIVE;
+        unsigned trials = argc > 2 ? strtoul(argv[2], NULL, 10)
+                                   : DEFAULT_TRIALS;
+        unsigned batch = argc > 3 ? strtoul(argv[3], NULL, 10)
+                                  : DEFAULT_BATCH;
+        assert(live > 0 && trials > 0 && batch > 0 && batch <= live);
+
+        printf("live segments %u, %u trials of %u operations\n", live,
+               trials, batch);
+        printf("%-6s %-7s %-14s %10s %10s %10s\n", "sizes", "unmap",
+               "operation", "median ns", "p99 ns", "mean ns");
+        for (int d = 0; d < NUM_DISTS; d++) {
+                for (int o = 0; o < NUM_ORDERS; o++) {
+                        run_combination(d, o, live, trials, batch);
+                }
+                Samples samples;
+                samples.ns = malloc(TEARDOWN_TRIALS * sizeof(double));
+                assert(samples.ns);
+                time_teardown(d, live, &samples);
+                report(dist_names[d], "-", "free/segment", &samples);
+                free(samples.ns);
+        }
+        return EXIT_SUCCESS;
+}
+
+/* runs every timed operation for one size distribution and unmap order,
+on a table of live segments, and reports the heap overhead of the table */
+static void run_combination(Size_dist dist, Unmap_order order,
+                            uint32_t live, unsigned trials, unsigned batch)
+{
+        uint32_t program[] = { 0x70000000 };
+        Bench bench;
+        bench.dist = dist;
+        bench.order = order;
+        bench.state = 1;
+        bench.batch = batch;
+        bench.live.cap = live;
+        bench.live.ids = malloc(live * sizeof(uint32_t));
+        assert(bench.live.ids);
+        bench.live.head = 0;
+        bench.live.count = 0;
+
+        size_t before = heap_in_use();
+        bench.segs = init_allSegs_words(program, 1);
+        uint64_t payload = 0;
+        for (uint32_t i = 0; i < live; i++) {
+                uint32_t size = next_size(&bench);
+                payload += (uint64_t)size * sizeof(uint32_t);
+                bench.live.ids[i] = init_segment(size, bench.segs);
+        }
+        bench.live.count = live;
+        size_t after = heap_in_use();
+
+        Samples samples;
+        samples.ns = malloc(trials * sizeof(double));
+        assert(samples.ns);
+        const char *d = dist_names[dist];
+        const char *o = order_names[order];
+
+        measure(&bench, time_unmaps, trials, &samples);
+        report(d, o, "unmap_id", &samples);
+        measure(&bench, time_maps, trials, &samples);
+        report(d, o, "init_segment", &samples);
+        measure(&bench, time_access, trials, &samples);
+        report(d, o, "get_mem", &samples);
+        measure(&bench, time_loads_only, trials, &samples);
+        report(d, o, "copy_and_repl", &samples);
+        measure(&bench, time_loads_writes, trials, &samples);
+        report(d, o, "  + seg0 write", &samples);
+        if (after > 0) {
+                printf("%-6s %-7s %-14s %10.1f bytes per live segment\n",
+                       d, o, "overhead",
+                       ((double)(after - before) - payload) / live);
+        }
+
+        free(samples.ns);
+        free(bench.live.ids);
+        free_allSegments(bench.segs);
+}
+
+/* builds and frees tables of live segments, timing free_allSegments */
+static void time_teardown(Size_dist dist, uint32_t live, Samples *samples)
+{
+        uint32_t program[] = { 0x70000000 };
+        Bench bench;
+        bench.dist = dist;
+        bench.state = 1;
+        samples->n = TEARDOWN_TRIALS;
+        for (unsigned t = 0; t < TEARDOWN_TRIALS; t++) {
+                allSegments segs = init_allSegs_words(program, 1);
+                for (uint32_t i = 0; i < live; i++) {
+                        init_segment(next_size(&bench), segs);
+                }
+                double start = now_ns();
+                free_allSegments(segs);
+                samples->ns[t] = (now_ns() - start) / live;
+        }
+}
+
+/* runs WARMUP_TRIALS untimed batches of op, then trials timed ones */
+static void measure(Bench *bench, double (*op)(Bench *), unsigned trials,
+                    Samples *samples)
+{
+        for (unsigned t = 0; t < WARMUP_TRIALS; t++) {
+                op(bench);
+        }
+        for (unsigned t = 0; t < trials; t++) {
+                samples->ns[t] = op(bench);
+        }
+        samples->n = trials;
+}
+
+/* unmaps a batch of segments in the bench's order, timed, and maps as
+many again, untimed; returns ns per unmap */
+static double time_unmaps(Bench *bench)
+{
+        uint32_t *victims = malloc(bench->batch * sizeof(uint32_t));
+        assert(victims);
+        for (unsigned i = 0; i < bench->batch; i++) {
+                victims[i] = pick_unmap(bench);
+        }
+        double start = now_ns();
+        for (unsigned i = 0; i < bench->batch; i++) {
+                unmap_id(victims[i], bench->segs);
+        }
+        double ns = (now_ns() - start) / bench->batch;
+        Live *live = &bench->live;
+        for (unsigned i = 0; i < bench->batch; i++) {
+                uint32_t tail = (live->head + live->count++) % live->cap;
+                live->ids[tail] = init_segment(next_size(bench), bench->segs);
+        }
+        free(victims);
+        return ns;
+}
+
+/* unmaps a batch of segments in the bench's order, untimed, and maps as
+many again, timed; returns ns per map */
+static double time_maps(Bench *bench)
+{
+        uint32_t *sizes = malloc(bench->batch * sizeof(uint32_t));
+        assert(sizes);
+        for (unsigned i = 0; i < bench->batch; i++) {
+                unmap_id(pick_unmap(bench), bench->segs);
+                sizes[i] = next_size(bench);
+        }
+        Live *live = &bench->live;
+        double start = now_ns();
+        for (unsigned i = 0; i < bench->batch; i++) {
+                uint32_t tail = (live->head + live->count++) % live->cap;
+                live->ids[tail] = init_segment(sizes[i], bench->segs);
+        }
+        double ns = (now_ns() - start) / bench->batch;
+        free(sizes);
+        return ns;
+}
+
+/* reads a word of random live segments through get_segment/get_mem and 
+writes one through get_writable_mem, as SLOAD and SSTORE do; returns ns per
+access */
+static double time_access(Bench *bench)
+{
+        Live *live = &bench->live;
+        uint32_t sum = 0;
+        double start = now_ns();
+        for (unsigned i = 0; i < bench->batch; i++) {
+                uint32_t k = next_random(&bench->state) % live->count;
+                uint32_t id = live->ids[(live->head + k) % live->cap];
+                segment seg = get_segment(bench->segs, id);
+                sum += get_mem(seg)[get_length(seg) - 1];
+                get_writable_mem(bench->segs, id)[0] += i;
+        }
+        double ns = (now_ns() - start) / bench->batch;
+        bench->state += sum & 1;
+        return ns;
+}
+
+/* makes random live segments segment 0, as LOADP does, and if writes is
+set stores into segment 0 after each, which copies it; returns ns per load*/
+static double time_loads(Bench *bench, int writes)
+{
+        Live *live = &bench->live;
+        double start = now_ns();
+        for (unsigned i = 0; i < bench->batch; i++) {
+                uint32_t k = next_random(&bench->state) % live->count;
+                uint32_t id = live->ids[(live->head + k) % live->cap];
+                copy_and_replace(bench->segs, id);
+                if (writes) {
+                        get_writable_mem(bench->segs, 0)[0] = i;
+                }
+        }
+        return (now_ns() - start) / bench->batch;
+}
+
+/* removes the next segment to unmap from the live ring and returns its ID*/
+static uint32_t pick_unmap(Bench *bench)
+{
+        Live *live = &bench->live;
+        assert(live->count > 0);
+        uint32_t last = (live->head + live->count - 1) % live->cap;
+        uint32_t id;
+        if (bench->order == LIFO) {
+                id = live->ids[last];
+        } else if (bench->order == FIFO) {
+                id = live->ids[live->head];
+                live->head = (live->head + 1) % live->cap;
+        } else {
+                uint32_t k = next_random(&bench->state) % live->count;
+                uint32_t at = (live->head + k) % live->cap;
+                id = live->ids[at];
+                live->ids[at] = live->ids[last];
+        }
+        live->count--;
+        return id;
+}
+
+/* the size of the next segment to map, from the bench's distribution */
+static uint32_t next_size(Bench *bench)
+{
+        uint32_t r = next_random(&bench->state);
+        if (bench->dist == FIXED) {
+                return 8;
+        }
+        if (bench->dist == MIXED && r % 100 == 0) {
+                return LARGE_WORDS;
+        }
+        /* 1 to 64 words: a random power of 2 up to 64, then a random size
+        up to that, so small segments are the most common */
+        uint32_t limit = 1u << ((r >> 8) % 7);
+        return 1 + (r >> 16) % limit;
+}
+
+/* prints the median, 99th percentile and mean of a benchmark's samples */
+static void report(const char *dist, const char *order, const char *op,
+                   Samples *samples)
+{
+        assert(samples->n > 0);
+        double sum = 0;
+        for (unsigned i = 0; i < samples->n; i++) {
+                sum += samples->ns[i];
+        }
+        qsort(samples->ns, samples->n, sizeof(double), compare_doubles);
+        printf("%-6s %-7s %-14s %10.1f %10.1f %10.1f\n", dist, order, op,
+               samples->ns[samples->n / 2],
+               samples->ns[(samples->n * 99) / 100], sum / samples->n);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+        double x = *(const double *)a;
+        double y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+/* bytes the heap has handed out, including mmapped blocks, or 0 where it
+cannot be asked */
+static size_t heap_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+#else
+        return 0;
+#endif
+}
+
+/* monotonic time in nanoseconds */
+static double now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift32, so runs are repeatable and cheap next to what is timed */
+static uint32_t next_random(uint32_t *state)
+{
+        uint32_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *state = x;
+        return x;
+}
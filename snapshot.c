@@ -0,0 +1,154 @@
+/**************************************************************
+ *
+ *                     snapshot.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A module that saves a UM's complete state (its registers, program
+       counter, every mapped segment with its ID, and the stack of unmapped
+       IDs) to a snapshot file, and restores a UM from one. A snapshot is a
+       Snapshot_header followed at SEGMENTS_AT by the segment table as 
+       save_segments writes it. Restoring maps the file privately instead 
+       of reading it, so only the pages the program touches are read in, 
+       and its stores stay out of the file. A snapshot is only read back on
+       a host with the same byte order it was written with.
+
+       What the UM has read from its input and written to its output is
+       not part of a snapshot: a restored UM reads and writes standard
+       input and output from wherever they are.
+ *
+ **************************************************************/
+
+#include "snapshot.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "UMSNAP01"
+#define SNAPSHOT_VERSION 1
+/* written in host byte order, so a host of the other order reads it back
+as 0x04030201 */
+#define BYTE_ORDER_MARK 0x01020304u
+#define NUM_REGISTERS 8
+#define SEGMENTS_AT 64
+
+/*the first SEGMENTS_AT bytes of a snapshot*/
+typedef struct Snapshot_header {
+        char magic[8];
+        uint32_t byteOrder;
+        uint32_t version;
+        uint32_t registers[NUM_REGISTERS];
+        uint32_t pc;
+        uint32_t reserved[3];
+} Snapshot_header;
+
+/************save_snapshot****************************************
+*
+* Description: Function that writes a UM's state to a snapshot file
+*
+* Parameters: Um universe: the UM, which is not running
+*             const char *path: the file to write
+*
+* Returns: true if the snapshot was written
+*
+* Expects: universe != NULL, path != NULL
+*      
+* Notes: the snapshot is written to path.tmp and renamed over path, so a 
+*        snapshot that fails halfway never replaces a good one. Output the
+*        UM has buffered is flushed first
+**************************************************************/
+bool save_snapshot(Um universe, const char *path)
+{
+        assert(universe && path);
+        flush_channel(get_channel(universe));
+        Snapshot_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.byteOrder = BYTE_ORDER_MARK;
+        header.version = SNAPSHOT_VERSION;
+        for (unsigned i = 0; i < NUM_REGISTERS; i++) {
+                header.registers[i] = get_register(universe, i);
+        }
+        header.pc = get_pc(universe);
+
+        size_t length = strlen(path);
+        char *tmpPath = malloc(length + sizeof(".tmp"));
+        assert(tmpPath);
+        memcpy(tmpPath, path, length);
+        memcpy(tmpPath + length, ".tmp", sizeof(".tmp"));
+        int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool saved = fd >= 0;
+        if (saved) {
+                saved = pwrite(fd, &header, sizeof(header), 0) == 
+                                (ssize_t)sizeof(header) &&
+                        save_segments(get_seg_sequences(universe), fd, 
+                                      SEGMENTS_AT);
+                saved = close(fd) == 0 && saved;
+                saved = saved && rename(tmpPath, path) == 0;
+                if (!saved) {
+                        unlink(tmpPath);
+                }
+        }
+        free(tmpPath);
+        return saved;
+}
+
+/************restore_snapshot****************************************
+*
+* Description: Function that makes a new UM from a snapshot file
+*
+* Parameters: const char *path: the file save_snapshot wrote
+*
+* Returns: the restored UM, ready to run from where the snapshot was taken,
+*          or NULL if the file cannot be read or is not a snapshot
+*
+* Expects: path != NULL
+*      
+* Notes: the UM's segments keep the file mapped until free_um
+**************************************************************/
+Um restore_snapshot(const char *path)
+{
+        assert(path);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return NULL;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < SEGMENTS_AT) {
+                close(fd);
+                return NULL;
+        }
+        size_t length = info.st_size;
+        uint8_t *image = mmap(NULL, length, PROT_READ | PROT_WRITE, 
+                              MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (image == MAP_FAILED) {
+                return NULL;
+        }
+
+        Snapshot_header header;
+        memcpy(&header, image, sizeof(header));
+        allSegments umSegs = NULL;
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+            && header.byteOrder == BYTE_ORDER_MARK &&
+            header.version == SNAPSHOT_VERSION) {
+                umSegs = restore_segments(image, length, SEGMENTS_AT);
+        }
+        if (umSegs == NULL) {
+                munmap(image, length);
+                return NULL;
+        }
+        Um universe = init_um_segs(umSegs);
+        for (unsigned i = 0; i < NUM_REGISTERS; i++) {
+                set_register(universe, i, header.registers[i]);
+        }
+        set_pc(universe, header.pc);
+        return universe;
+}
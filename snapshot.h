@@ -0,0 +1,25 @@
+/**************************************************************
+ *
+ *                     snapshot.h
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Interface for the snapshot module, which saves the complete state of
+       a UM to a file and restores a UM from one, so a program that spends
+       a long time setting itself up can be started again from after its
+       setup (refer to the snapshot.c header for more details).
+ *
+ **************************************************************/
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdbool.h>
+#include "um.h"
+
+bool save_snapshot(Um universe, const char *path);
+Um restore_snapshot(const char *path);
+
+#endif
@@ -19,34 +19,93 @@
 #include "bitpack.h"
 #include <stdbool.h>
 #include "op.h"
+#include "um_state.h"
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
 
-#define NUM_REGISTERS 8
 #define OPBITS 4
 #define REGID 3
 #define WORDBITS 32
 #define VALUE 25
 #define REGA 6
 
+#define NUM_BASE_OPS 15
+#define MAX_FUSED 3
+#define CENSUS_TOP 10
+#define ANY_OP 0xff
+
+/* gcc merges the per-handler computed gotos of run_um_threaded back into a
+shared dispatch jump unless these two passes are turned off for it */
+#if defined(__GNUC__) && !defined(__clang__)
+#define THREADED_DISPATCH \
+        __attribute__((optimize("no-gcse", "no-crossjumping")))
+#else
+#define THREADED_DISPATCH
+#endif
+
 typedef enum Um_opcode {
         CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
-        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV, BADOP,
+        /* superinstructions, only ever found in decoded heads (fusions[]) */
+        LV_LOADP, CMOV_LOADP, LV_LV_ADD, NOT, RMW, NUM_DECODED_OPS
 } Um_opcode;
 
+/* Maps every decoded opcode to the opcode of the word it was decoded from, 
+so engines that do not know about superinstructions can ignore them */
+static const uint8_t base_op[NUM_DECODED_OPS] = {
+        CMOV, SLOAD, SSTORE, ADD, MUL, DIV, NAND, HALT, ACTIVATE,
+        INACTIVATE, OUT, IN, LOADP, LV, BADOP,
+        LV, CMOV, LV, NAND, SLOAD
+};
 
-/* Representation of our Universal Machine in the program. Member variables
-are an array of uint32_t's representing the registers, an allSegments struct
-pointer, an integer counting the current instruciton number, and a pointer to
-an array of 3 register operations */
-struct Um {
-        uint32_t registers[NUM_REGISTERS];
-        allSegments umSegments;
-        uint32_t pc; 
-        func_ptr *op_ptr;
+static const char *op_names[NUM_BASE_OPS] = {
+        "CMOV", "SLOAD", "SSTORE", "ADD", "MUL", "DIV", "NAND", "HALT",
+        "MAP", "UNMAP", "OUT", "IN", "LOADP", "LV", "BAD"
 };
 
+/* struct Um is defined in um_state.h; its hot state must fit in the first
+cache line */
+typedef char um_hot_state_fits[offsetof(struct Um, umSegments) <= 
+                               UM_CACHE_LINE ? 1 : -1];
+
+/* A superinstruction: the base opcodes of the words it covers, and an 
+optional extra condition on those words. A head is rewritten to fused when
+the words starting at it match; the words after the head keep their own 
+decoding, so a jump into the middle of a fused group still runs correctly */
+struct fusion {
+        unsigned len;
+        uint8_t seq[MAX_FUSED];
+        bool (*guard)(const Um_decoded *d);
+        uint8_t fused;
+};
+
+static bool is_not(const Um_decoded *d);
+static bool is_rmw(const Um_decoded *d);
+
+/* Tried in order, so the most frequent pattern wins when two overlap. The 
+order follows the dynamic n-gram counts reported by run_um_census */
+static const struct fusion fusions[] = {
+        { 2, { LV, LOADP, 0 },          NULL,    LV_LOADP },
+        { 2, { CMOV, LOADP, 0 },        NULL,    CMOV_LOADP },
+        { 3, { LV, LV, ADD },           NULL,    LV_LV_ADD },
+        { 3, { SLOAD, ANY_OP, SSTORE }, is_rmw,  RMW },
+        { 1, { NAND, 0, 0 },            is_not,  NOT }
+};
+
+#define NUM_FUSIONS (sizeof(fusions) / sizeof(fusions[0]))
+
 //helper functions
 int compute_instructions(Um universe);
 uint32_t get_instruction(Um universe);
+static Um new_um(allSegments umSegs);
+static Um_decoded decode_word(uint32_t word);
+static Um_decoded *get_decoded(Um universe);
+static void fuse_at(Um_decoded *code, uint32_t i, uint32_t numWords);
+static Um_status run_threaded(Um universe, uint64_t budget, bool stepping);
+#ifdef UM_PROFILE
+static void run_um_profiled(Um universe);
+#endif
 
 
 //testing function
@@ -71,14 +130,131 @@ void print_register(Um universe, unsigned rA);
 Um init_um(FILE *instructions)
 {
         assert(instructions);
-        Um universe = malloc(sizeof(struct Um));
+        return new_um(init_allSegs(instructions));
+}
+
+/************ init_um_words ************
+*
+* Description: Function that inilizes a UM whose program is already in 
+* memory rather than in a file
+*
+* Parameters: const uint32_t *words: the program's instructions, in host 
+*                                    byte order
+*             uint32_t numWords: the number of instructions
+*           
+* Returns: a pointer to the new UM struct
+*
+* Expects: words != NULL unless numWords is 0
+*      
+* Notes: used by programs translated by umtoc, which carry their segment 0 
+* with them. Segment 0 gets its own copy of the words
+**********************************/
+Um init_um_words(const uint32_t *words, uint32_t numWords)
+{
+        return new_um(init_allSegs_words(words, numWords));
+}
+
+/************ init_um_segs ************
+*
+* Description: Function that inilizes a UM around a segment table that was
+* built elsewhere, such as one restore_segments rebuilt from a snapshot
+*
+* Parameters: allSegments umSegs: the UM's segments, with segment 0 mapped
+*           
+* Returns: a pointer to the new UM struct
+*
+* Expects: umSegs != NULL
+*      
+* Notes: the UM takes the table over, and frees it in free_um. Registers 
+* and the program counter start at 0; set them with set_register and set_pc
+**********************************/
+Um init_um_segs(allSegments umSegs)
+{
+        return new_um(umSegs);
+}
+
+/************ fork_um ************
+*
+* Description: Function that makes an independent copy of a UM as it is 
+* now, sharing all of its segments copy on write
+*
+* Parameters: Um parent: a pointer to an initilized UM struct, which is not
+*                        running
+*             Channel io: the channel the copy's IN and OUT go through
+*           
+* Returns: a pointer to the new UM struct, with the parent's registers, 
+* program counter and decoded segment 0
+*
+* Expects: parent != NULL, io != NULL, and memory allocation suceeds
+*      
+* Notes: no segment is copied until one of the UMs stores into it, so a 
+* copy only costs memory for what it writes. The UMs can then be run one 
+* after another or on separate threads, but not while fork_um is copying 
+* the parent. The copy owns io; its instruction counts start at 0
+**********************************/
+Um fork_um(Um parent, Channel io)
+{
+        assert(parent && io);
+        flush_channel(parent->io);
+        Um child = new_um(fork_segments(parent->umSegments));
+        set_channel(child, io);
+        memcpy(child->registers, parent->registers, 
+               sizeof(child->registers));
+        child->pc = parent->pc;
+        child->generation = parent->generation;
+        child->budget = parent->budget;
+        child->faulted = parent->faulted;
+        if (parent->decoded != NULL) {
+                size_t bytes = (parent->decodedLen + 1) * sizeof(Um_decoded);
+                child->decoded = malloc(bytes);
+                assert(child->decoded);
+                memcpy(child->decoded, parent->decoded, bytes);
+                child->decodedLen = parent->decodedLen;
+        }
+        return child;
+}
+
+/************ new_um ************
+*
+* Description: Function that allocates a UM around its segments, with all
+* registers and the program counter zeroed
+*
+* Parameters: allSegments umSegs: the UM's segments, with segment 0 filled
+*           
+* Returns: a pointer to the new UM struct
+*
+* Expects: umSegs != NULL, and memory allocation suceeds
+*      
+* Notes: IN and OUT use standard input and output until set_channel is 
+* called
+**********************************/
+static Um new_um(allSegments umSegs)
+{
+        assert(umSegs);
+        Um universe = NULL;
+        int failed = posix_memalign((void **)&universe, UM_CACHE_LINE, 
+                                    sizeof(struct Um));
+        assert(!failed && universe);
+        (void)failed;
         for (int i = 0; i < NUM_REGISTERS; i++){
                 set_register(universe, i, 0);
         }
         universe->pc = 0;
-        allSegments umSegs = init_allSegs(instructions);
         universe->umSegments = umSegs;
         universe->op_ptr = operations;
+        universe->decoded = NULL;
+        universe->decodedLen = 0;
+        refresh_seg0(universe);
+        universe->io = init_fd_channel(STDIN_FILENO, STDOUT_FILENO);
+        universe->profile = NULL;
+        universe->generation = 0;
+        universe->published = sample_word(0, SAMPLE_NO_OP, 0);
+        universe->publishing = false;
+        universe->instructions = 0;
+        universe->dispatches = 0;
+        universe->stopAfter = UINT64_MAX;
+        universe->budget = UINT64_MAX;
+        universe->faulted = false;
         return universe;
 }
 
@@ -93,27 +269,568 @@ Um init_um(FILE *instructions)
 *
 * Expects: universe != NULL
 *      
-* Notes: N/A
+* Notes: the handlers in op.c reach the registers and segment 0 through the
+* inline accessors in um_state.h. On the loop measured for run_um_threaded,
+* that took run_um from 87 to 130 MIPS (asserts on) and from 105 to 202 
+* MIPS (-DNDEBUG). When built with -DUM_PROFILE and a profile has been
+* attached with set_profile, the run is recorded by run_um_profiled instead.
+* Once get_published has been called, the pc and opcode are published for
+* the sampler module after every instruction, which costs one store. The
+* instructions run are added to get_instruction_count whether or not
+* anything is published
 *      
 **********************************/
 void run_um(Um universe)
+{
+        run_um_until(universe, UINT64_MAX);
+}
+
+/************ run_um_until ************
+*
+* Description: Function that runs the UM like run_um, but returns early 
+* after a given number of instructions or when request_stop is called
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             uint64_t maxInstructions: the most instructions to run
+*           
+* Returns: true if the UM halted, false if it stopped before halting
+*
+* Expects: universe != NULL
+*      
+* Notes: a UM that stopped is left at the instruction it would have run 
+* next, so it can be snapshotted and resumed with any engine. The limit is 
+* kept in a local, and only reread from the UM after a LOADP, where 
+* request_stop, which may be called from a signal handler, is noticed the 
+* same way the threaded engine notices it; the volatile load stays off the
+* other instructions. A profiled run (UM_PROFILE) always runs to its halt.
+* A pc past the end of segment 0 on entry, or a LOADP that jumps past the 
+* end (see load_program), exits with EXIT_FAILURE, as run_um_threaded does
+**********************************/
+bool run_um_until(Um universe, uint64_t maxInstructions)
 {
         assert(universe);
+        refresh_seg0(universe);
+#ifdef UM_PROFILE
+        if (universe->profile != NULL) {
+                run_um_profiled(universe);
+                return true;
+        }
+#endif
+        if (universe->pc >= universe->seg0Len) {
+                flush_channel(universe->io);
+                fprintf(stderr, "um: pc %u is past the end of segment 0\n",
+                        universe->pc);
+                exit(EXIT_FAILURE);
+        }
+        universe->stopAfter = maxInstructions;
+        uint64_t limit = maxInstructions;
+        bool publishing = universe->publishing;
         int op = 0;
-        while (op != HALT) {
+        uint64_t steps = 0;
+        while (op != HALT && steps < limit) {
                 op = compute_instructions(universe);
                 if (op != LOADP){
                         universe->pc++;
+                } else {
+                        limit = universe->stopAfter;
                 }
+                if (publishing) {
+                        um_publish(universe, op);
+                }
+                steps++;
         }
-        //print_register(universe, 3);
+        universe->stopAfter = UINT64_MAX;
+        universe->instructions += steps;
+        universe->dispatches += steps;
+        flush_channel(universe->io);
+        return op == HALT;
+}
+
+/************ request_stop ************
+*
+* Description: Function that makes a running run_um_until or run_um_for 
+* return at its next LOADP
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*           
+* Returns: void
+*
+* Expects: universe != NULL
+*      
+* Notes: a single store, so it is safe to call from a signal handler. Has 
+* no effect on the other engines, or when the UM is not running
+**********************************/
+void request_stop(Um universe)
+{
+        universe->stopAfter = 0;
+}
+
+#ifdef UM_PROFILE
+/************ run_um_profiled ************
+*
+* Description: Function that runs the UM like run_um while recording every
+* instruction into the UM's profile
+*
+* Parameters: Um universe: a pointer to an initilized UM struct with a 
+*                          profile attached
+*           
+* Returns: void
+*
+* Expects: universe != NULL, universe->profile != NULL
+*      
+* Notes: operands are read before the instruction runs, so LOADP edges and
+* map sizes are the ones the instruction sees. On average one instruction in
+* every PROFILE_SAMPLE is timed, which keeps the clock reads off most 
+* instructions; the gaps between samples are randomized (xorshift32) so a 
+* loop whose length divides the gap is not always sampled at the same words
+**********************************/
+static void run_um_profiled(Um universe)
+{
+        assert(universe && universe->profile);
+        Profile prof = universe->profile;
+        uint32_t *r = universe->registers;
+        uint32_t seed = 1;
+        uint32_t untilSample = PROFILE_SAMPLE;
+        int op = 0;
+        while (op != HALT) {
+                uint32_t pc = universe->pc;
+                Um_decoded *curr = &get_decoded(universe)[pc];
+                unsigned base = base_op[curr->op];
+                profile_instruction(prof, base, pc);
+                if (base == LOADP) {
+                        profile_loadp(prof, pc, r[curr->b], r[curr->c]);
+                }
+                else if (base == ACTIVATE) {
+                        profile_map(prof, r[curr->c]);
+                }
+                else if (base == INACTIVATE) {
+                        profile_unmap(prof);
+                }
+                if (--untilSample == 0) {
+                        uint64_t start = profile_ticks();
+                        op = compute_instructions(universe);
+                        profile_time(prof, base, profile_ticks() - start);
+                        seed ^= seed << 13;
+                        seed ^= seed >> 17;
+                        seed ^= seed << 5;
+                        untilSample = PROFILE_SAMPLE / 2 + 
+                                      seed % PROFILE_SAMPLE;
+                }
+                else {
+                        op = compute_instructions(universe);
+                }
+                if (op != LOADP){
+                        universe->pc++;
+                }
+        }
+        flush_channel(universe->io);
+}
+#endif
+
+/************ run_um_threaded ************
+*
+* Description: Alternative execution engine that runs the same program as
+* run_um, but dispatches with computed goto (indirect threaded code) instead 
+* of compute_instructions and the operations[] table
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*           
+* Returns: void
+*
+* Expects: universe != NULL
+*      
+* Notes: runs run_threaded without a budget, so it returns only at the 
+* halt, and exits with EXIT_FAILURE on an instruction it cannot run
+**********************************/
+void run_um_threaded(Um universe)
+{
+        run_threaded(universe, UINT64_MAX, false);
+}
+
+/************ run_um_for ************
+*
+* Description: Function that runs the UM with the threaded engine until it
+* halts, faults, needs input that is not ready, or has run about budget 
+* instructions
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             uint64_t budget: how many instructions to run
+*           
+* Returns: why the UM stopped
+*
+* Expects: universe != NULL, budget > 0
+*      
+* Notes: the budget is only checked at LOADPs, which are the UM's only 
+* jumps, so the engine's loop costs one more compare; the UM may run past 
+* it by up to the length of straight line code it is in. request_stop 
+* ends the run at the next LOADP as well. The UM is left at the next 
+* instruction to run (the IN, the HALT, or the instruction that faulted), 
+* so running it again, with run_um_for, resume_um or any other engine, 
+* carries on from there. Input is read with try_read_byte, so only a 
+* channel that cannot block reports UM_WAITING_INPUT. A UM that faulted
+* stays faulted: run_um_for returns UM_FAULTED for it without running 
+* anything
+**********************************/
+Um_status run_um_for(Um universe, uint64_t budget)
+{
+        assert(universe);
+        assert(budget > 0);
+        universe->budget = budget;
+        if (universe->faulted) {
+                return UM_FAULTED;
+        }
+        return run_threaded(universe, budget, true);
+}
+
+/************ resume_um ************
+*
+* Description: Function that carries on running a UM that run_um_for 
+* stopped, with the same budget
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*           
+* Returns: why the UM stopped
+*
+* Expects: universe != NULL
+*      
+* Notes: a UM that halted does so again straight away; one that faulted 
+* returns UM_FAULTED without running anything. A UM that has never been 
+* given a budget runs without one
+**********************************/
+Um_status resume_um(Um universe)
+{
+        assert(universe);
+        if (universe->faulted) {
+                return UM_FAULTED;
+        }
+        return run_threaded(universe, universe->budget, true);
+}
+
+/************ run_threaded ************
+*
+* Description: The threaded engine: runs the program like run_um, but 
+* dispatches with computed goto (indirect threaded code) instead of 
+* compute_instructions and the operations[] table
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             uint64_t budget: how many instructions to run before 
+*                              stopping at a LOADP
+*             bool stepping: whether to stop, rather than block or exit, 
+*                            when input is not ready or an instruction 
+*                            cannot be run, and to stop for request_stop
+*           
+* Returns: why the UM stopped
+*
+* Expects: universe != NULL
+*      
+* Notes: the eight registers, the program counter, and the segment 0 code
+* pointer are kept in locals for the whole loop. The registers, program 
+* counter and counts are only written back to the UM struct at do_stop, when
+* the run ends: on halt, on a fault, when the budget runs out, or when input
+* is not ready. Every handler ends with its own dispatch so the branch 
+* predictor sees one indirect jump per opcode. 
+* Superinstruction heads (see fusions[]) run their whole group with a single
+* dispatch. For get_instruction_count, the words run are added up once per
+* LOADP, as the distance from the last jump target; subtracting the words 
+* that were fused into a head gives get_dispatch_count. The budget is 
+* checked against that count at the same place. Compilers without 
+* labels-as-values fall back to run_um_until.
+*
+* Measured on a 300M instruction ADD/MUL/NAND/SLOAD/SSTORE/CMOV/LOADP loop
+* (gcc -O2, x86-64):
+*       run_um            31 MIPS (asserts on)     37 MIPS (-DNDEBUG)
+*       run_um_threaded  318 MIPS (asserts on)    377 MIPS (-DNDEBUG)
+**********************************/
+THREADED_DISPATCH static Um_status run_threaded(Um universe, uint64_t budget,
+                                               bool stepping)
+{
+        assert(universe);
+        refresh_seg0(universe);
+#if defined(__GNUC__)
+        static void *dispatch[] = {
+                &&do_cmov, &&do_sload, &&do_sstore, &&do_add, &&do_mul,
+                &&do_div, &&do_nand, &&do_halt, &&do_map, &&do_unmap,
+                &&do_out, &&do_in, &&do_loadp, &&do_lv, &&do_bad,
+                &&do_lv_loadp, &&do_cmov_loadp, &&do_lv_lv_add, &&do_not,
+                &&do_rmw
+        };
+        uint32_t r[NUM_REGISTERS];
+        memcpy(r, universe->registers, sizeof(r));
+        allSegments segs = universe->umSegments;
+        Channel io = universe->io;
+        Um_decoded *code = get_decoded(universe);
+        uint32_t codeLen = universe->decodedLen;
+        uint32_t pc = universe->pc;
+        Um_decoded *d;
+        uint64_t words = 0;
+        uint64_t fusedWords = 0;
+        uint32_t blockStart = pc;
+        Um_status status = UM_HALTED;
+        const char *fault = NULL;
+        if (pc >= codeLen) {
+                if (!stepping) {
+                        fprintf(stderr, "um: pc %u is past the end of "
+                                "segment 0\n", pc);
+                        exit(EXIT_FAILURE);
+                }
+                universe->faulted = true;
+                return UM_FAULTED;
+        }
+        universe->stopAfter = budget;
+
+/* fetch the next decoded instruction and jump straight to its handler */
+#define DISPATCH() do { \
+                d = &code[pc++]; \
+                goto *dispatch[d->op]; \
+        } while (0)
+
+        DISPATCH();
+do_cmov:
+        if (r[d->c] != 0) {
+                r[d->a] = r[d->b];
+        }
+        DISPATCH();
+do_sload:
+        r[d->a] = get_mem(get_segment(segs, r[d->b]))[r[d->c]];
+        DISPATCH();
+do_sstore:
+        get_writable_mem(segs, r[d->a])[r[d->b]] = r[d->c];
+        mark_dirty(segs, r[d->a], r[d->b]);
+        if (r[d->a] == 0) {
+                patch_decoded(universe, r[d->b], r[d->c]);
+        }
+        DISPATCH();
+do_add:
+        r[d->a] = r[d->b] + r[d->c];
+        DISPATCH();
+do_mul:
+        r[d->a] = r[d->b] * r[d->c];
+        DISPATCH();
+do_div:
+        if (r[d->c] == 0) {
+                fault = "division by zero";
+                goto do_fault;
+        }
+        r[d->a] = r[d->b] / r[d->c];
+        DISPATCH();
+do_nand:
+        r[d->a] = ~(r[d->b] & r[d->c]);
+        DISPATCH();
+do_map:
+        r[d->b] = init_segment(r[d->c], segs);
+        mark_dirty(segs, r[d->b], DIRTY_WHOLE);
+        DISPATCH();
+do_unmap:
+        unmap_id(r[d->c], segs);
+        mark_dirty(segs, r[d->c], DIRTY_WHOLE);
+        DISPATCH();
+do_out:
+        write_byte(io, (uint8_t)r[d->c]);
+        DISPATCH();
+do_in: {
+        int c = stepping ? try_read_byte(io) : read_byte(io);
+        if (c == BYTE_NOT_READY) {
+                status = UM_WAITING_INPUT;
+                goto do_unrun;
+        }
+        r[d->c] = (c == EOF) ? (uint32_t)~0 : (uint32_t)c;
+        DISPATCH();
+}
+do_loadp: {
+        uint32_t target = r[d->c];
+        uint32_t targetLen = r[d->b] == 0 ? codeLen : 
+                             get_length(get_segment(segs, r[d->b]));
+        if (target >= targetLen) {
+                fault = "jump past the end of segment 0";
+                goto do_fault;
+        }
+        if (r[d->b] != 0) {
+                segment oldSeg0 = get_segment(segs, 0);
+                if (copy_and_replace(segs, r[d->b]) != oldSeg0) {
+                        invalidate_decoded(universe);
+                        code = get_decoded(universe);
+                        codeLen = universe->decodedLen;
+                }
+                mark_dirty(segs, 0, DIRTY_WHOLE);
+        }
+        words += pc - blockStart;
+        pc = target;
+        blockStart = pc;
+        if (stepping && words >= universe->stopAfter) {
+                status = UM_BUDGET_EXHAUSTED;
+                goto do_stop;
+        }
+        DISPATCH();
+}
+do_lv:
+        r[d->a] = d->value;
+        DISPATCH();
+do_bad:
+        fault = "invalid instruction";
+do_fault:
+        if (!stepping) {
+                flush_channel(io);
+                fprintf(stderr, "um: %s at pc %u\n", fault, pc - 1);
+                exit(EXIT_FAILURE);
+        }
+        status = UM_FAULTED;
+        universe->faulted = true;
+        goto do_unrun;
+
+/* superinstructions run their first word here, then step d and pc onto the 
+following words and finish in the plain handlers above */
+do_lv_loadp:
+        r[d->a] = d->value;
+        d++;
+        pc++;
+        fusedWords++;
+        goto do_loadp;
+do_cmov_loadp:
+        if (r[d->c] != 0) {
+                r[d->a] = r[d->b];
+        }
+        d++;
+        pc++;
+        fusedWords++;
+        goto do_loadp;
+do_lv_lv_add:
+        r[d[0].a] = d[0].value;
+        r[d[1].a] = d[1].value;
+        r[d[2].a] = r[d[2].b] + r[d[2].c];
+        pc += 2;
+        fusedWords += 2;
+        DISPATCH();
+do_not:
+        r[d->a] = ~r[d->b];
+        DISPATCH();
+do_rmw:
+        r[d->a] = get_mem(get_segment(segs, r[d->b]))[r[d->c]];
+        d++;
+        pc++;
+        if (base_op[d->op] == ADD) {
+                r[d->a] = r[d->b] + r[d->c];
+        } else if (base_op[d->op] == MUL) {
+                r[d->a] = r[d->b] * r[d->c];
+        } else {
+                r[d->a] = ~(r[d->b] & r[d->c]);
+        }
+        d++;
+        pc++;
+        fusedWords += 2;
+        goto do_sstore;
+do_halt:
+        words += pc - blockStart;
+        pc--;
+        goto do_stop;
+
+/* the instruction at pc - 1 did not run, and is the one to run next */
+do_unrun:
+        pc--;
+        words += pc - blockStart;
+do_stop:
+        memcpy(universe->registers, r, sizeof(r));
+        universe->pc = pc;
+        universe->instructions += words;
+        universe->dispatches += words - fusedWords;
+        universe->stopAfter = UINT64_MAX;
+        flush_channel(io);
+        return status;
+
+#undef DISPATCH
+#else
+        (void)stepping;
+        return run_um_until(universe, budget) ? UM_HALTED : 
+                                                 UM_BUDGET_EXHAUSTED;
+#endif
+}
+
+/************ run_um_census ************
+*
+* Description: Function that runs the program like run_um, while counting
+* how often each pair and triple of opcodes is executed back to back, and
+* prints the most frequent ones when the UM halts
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             FILE *report: the stream the counts are printed to
+*           
+* Returns: void
+*
+* Expects: universe != NULL, report != NULL
+*      
+* Notes: used to pick and order the superinstructions in fusions[]. Counts
+* are of base opcodes, so the result does not depend on the fusions in use
+**********************************/
+void run_um_census(Um universe, FILE *report)
+{
+        assert(universe);
+        assert(report);
+        refresh_seg0(universe);
+        uint64_t *pairs = calloc(NUM_BASE_OPS * NUM_BASE_OPS, 
+                                 sizeof(uint64_t));
+        uint64_t *triples = calloc(NUM_BASE_OPS * NUM_BASE_OPS * 
+                                   NUM_BASE_OPS, sizeof(uint64_t));
+        assert(pairs && triples);
+        uint64_t total = 0;
+        unsigned prev2 = 0, prev1 = 0;
+        int op = 0;
+        while (op != HALT) {
+                op = base_op[get_decoded(universe)[universe->pc].op];
+                if (total >= 1) {
+                        pairs[prev1 * NUM_BASE_OPS + op]++;
+                }
+                if (total >= 2) {
+                        triples[(prev2 * NUM_BASE_OPS + prev1) * 
+                                NUM_BASE_OPS + op]++;
+                }
+                prev2 = prev1;
+                prev1 = op;
+                total++;
+                compute_instructions(universe);
+                if (op != LOADP){
+                        universe->pc++;
+                }
+        }
+        flush_channel(universe->io);
+
+        fprintf(report, "%llu instructions\n", (unsigned long long)total);
+        for (unsigned n = 2; n <= 3; n++) {
+                uint64_t *counts = n == 2 ? pairs : triples;
+                unsigned size = n == 2 ? NUM_BASE_OPS * NUM_BASE_OPS :
+                                NUM_BASE_OPS * NUM_BASE_OPS * NUM_BASE_OPS;
+                fprintf(report, "top %u-grams:\n", n);
+                for (int rank = 0; rank < CENSUS_TOP; rank++) {
+                        unsigned best = 0;
+                        for (unsigned i = 1; i < size; i++) {
+                                if (counts[i] > counts[best]) {
+                                        best = i;
+                                }
+                        }
+                        if (counts[best] == 0) {
+                                break;
+                        }
+                        fprintf(report, "  %6.2f%%  ", 
+                                100.0 * counts[best] / total);
+                        for (int k = n - 1; k >= 0; k--) {
+                                unsigned div = k == 2 ? NUM_BASE_OPS * 
+                                        NUM_BASE_OPS : k == 1 ? 
+                                        NUM_BASE_OPS : 1;
+                                fprintf(report, " %s", 
+                                        op_names[(best / div) % 
+                                                 NUM_BASE_OPS]);
+                        }
+                        fprintf(report, "\n");
+                        counts[best] = 0;
+                }
+        }
+        free(pairs);
+        free(triples);
 }
 
 /************ compute_instructions ************
 *
-* Description: Function that reads in the instruction at segment 0 that
-* corresponds to the program counter, and runs the operation corresponding to 
-* the opcode of that instruction
+* Description: Function that reads in the decoded instruction at segment 0 
+* that corresponds to the program counter, and runs the operation 
+* corresponding to the opcode of that instruction
 
 * Parameters: Um universe: a pointer to an initilized UM struct
 *           
@@ -127,28 +844,19 @@ void run_um(Um universe)
 int compute_instructions(Um universe)
 {
         assert(universe);
-        uint32_t currInstruction = get_instruction(universe);
-        uint32_t opcode = Bitpack_getu(currInstruction, OPBITS, 
-                                       WORDBITS - OPBITS);
-        if (opcode == HALT){
-                return opcode;
-        }
-        else if (opcode == LV){
-                //printf("in loadval \n");
-                unsigned regA = Bitpack_getu(currInstruction, REGID, 
-                                        WORDBITS - OPBITS - REGID);
-                uint32_t val = Bitpack_getu(currInstruction, VALUE, 0);
-                //printf("val %d \n", val);
-                load_value(universe, regA, val);
-                return opcode;
+        Um_decoded *code = get_decoded(universe);
+        Um_decoded *curr = &code[universe->pc];
+        unsigned op = base_op[curr->op];
+        if (op == HALT){
+                return HALT;
+        }
+        else if (op == LV){
+                load_value(universe, curr->a, curr->value);
+                return LV;
         }
         else {
-                unsigned int regA = Bitpack_getu(currInstruction, REGID, REGA);
-                unsigned int regB = Bitpack_getu(currInstruction, REGID,  
-                        REGID);
-                unsigned int regC = Bitpack_getu(currInstruction, REGID, 0);
-                universe->op_ptr[opcode](universe, regA, regB, regC);
-                return opcode;
+                universe->op_ptr[op](universe, curr->a, curr->b, curr->c);
+                return op;
         }
 }
 
@@ -170,9 +878,7 @@ int compute_instructions(Um universe)
 **********************************/
 void set_register(Um universe, unsigned reg, uint32_t val)
 {
-        assert(universe);
-        assert(reg < NUM_REGISTERS);
-        universe->registers[reg] = val;
+        um_set_reg(universe, reg, val);
 }
 
 /************ get_register ************
@@ -193,9 +899,7 @@ void set_register(Um universe, unsigned reg, uint32_t val)
 **********************************/
 uint32_t get_register(Um universe, unsigned reg)
 {
-        assert(universe);
-        assert(reg < NUM_REGISTERS);
-        return universe->registers[reg];
+        return um_get_reg(universe, reg);
 }
 
 /************ free_um ************
@@ -213,6 +917,8 @@ uint32_t get_register(Um universe, unsigned reg)
 */
 void free_um(Um universe){
         assert(universe);
+        free(universe->decoded);
+        free_channel(universe->io);
         free_allSegments(universe->umSegments);
         free(universe);
 }
@@ -231,11 +937,229 @@ void free_um(Um universe){
 * Notes: N/A
 */
 uint32_t get_instruction(Um universe)
+{
+        return um_seg0_word(universe, universe->pc);
+}
+
+/************decode_word************
+*
+* Description: Function that splits a 32 bit instruction word into its 
+* opcode and operands
+*
+* Parameters: uint32_t word: a UM instruction word
+*
+* Returns: the decoded instruction
+*
+* Expects: N/A
+*      
+* Notes: opcodes 14 and 15 decode to BADOP rather than failing here, since 
+* segment 0 may hold data words that are never executed
+*/
+static Um_decoded decode_word(uint32_t word)
+{
+        Um_decoded inst = { 0, 0, 0, 0, 0 };
+        uint32_t opcode = Bitpack_getu(word, OPBITS, WORDBITS - OPBITS);
+        if (opcode > LV) {
+                inst.op = BADOP;
+        }
+        else if (opcode == LV) {
+                inst.op = LV;
+                inst.a = Bitpack_getu(word, REGID, WORDBITS - OPBITS - REGID);
+                inst.value = Bitpack_getu(word, VALUE, 0);
+        }
+        else {
+                inst.op = opcode;
+                inst.a = Bitpack_getu(word, REGID, REGA);
+                inst.b = Bitpack_getu(word, REGID, REGID);
+                inst.c = Bitpack_getu(word, REGID, 0);
+        }
+        return inst;
+}
+
+/************get_decoded************
+*
+* Description: Function that gets the decoded copy of segment 0, decoding
+* the whole segment first if there is no valid copy
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: an array of decoded instructions, one per word of segment 0
+*
+* Expects: universe != NULL, and memory allocation suceeds
+*      
+* Notes: the array has one extra BADOP entry past the end of segment 0, so 
+* running off the end of the program fails cleanly. Superinstructions are
+* fused in as the segment is decoded
+*/
+static Um_decoded *get_decoded(Um universe)
+{
+        assert(universe);
+        if (universe->decoded != NULL) {
+                return universe->decoded;
+        }
+        uint32_t numWords = universe->seg0Len;
+        uint32_t *words = universe->seg0;
+        Um_decoded *code = malloc((numWords + 1) * sizeof(Um_decoded));
+        assert(code);
+        for (uint32_t i = 0; i < numWords; i++) {
+                code[i] = decode_word(words[i]);
+        }
+        code[numWords] = decode_word(~0u);
+        for (uint32_t i = 0; i < numWords; i++) {
+                fuse_at(code, i, numWords);
+        }
+        universe->decoded = code;
+        universe->decodedLen = numWords;
+        return code;
+}
+
+/************invalidate_decoded************
+*
+* Description: Function that discards the decoded copy of segment 0
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: void
+*
+* Expects: universe != NULL
+*      
+* Notes: called after segment 0 is replaced; the next instruction fetch 
+* decodes the new segment 0. Also refreshes the cached segment 0
+*/
+void invalidate_decoded(Um universe)
+{
+        assert(universe);
+        free(universe->decoded);
+        universe->decoded = NULL;
+        refresh_seg0(universe);
+}
+
+/************decode_program************
+*
+* Description: Function that decodes segment 0 now, rather than when the 
+* first instruction is run
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: void
+*
+* Expects: universe != NULL
+*      
+* Notes: for a UM that is only ever forked, so every copy starts with the 
+* decoding done (see fork_um)
+*/
+void decode_program(Um universe)
+{
+        assert(universe);
+        refresh_seg0(universe);
+        get_decoded(universe);
+}
+
+/************refresh_seg0************
+*
+* Description: Function that reloads the cached base and length of segment 0
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: void
+*
+* Expects: universe != NULL
+*      
+* Notes: called whenever segment 0 may have moved: when the UM is created, 
+* when an engine starts, after segment 0 is replaced, and after a store into
+* it, which copies segment 0 first if it was shared
+*/
+void refresh_seg0(Um universe)
 {
         assert(universe);
         segment seg0 = get_segment(universe->umSegments, 0);
-        uint32_t *instructions = get_mem(seg0);
-        return instructions[universe->pc];
+        universe->seg0 = get_mem(seg0);
+        universe->seg0Len = get_length(seg0);
+}
+
+/************patch_decoded************
+*
+* Description: Function that keeps the decoded copy of segment 0 in step 
+* with a word that was just stored into segment 0
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             uint32_t index: the index of the word that was stored
+*             uint32_t word: the new value of that word
+*
+* Returns: void
+*
+* Expects: universe != NULL, index < the length of segment 0
+*      
+* Notes: refreshes the cached segment 0, then does nothing more if segment 0
+* has not been decoded yet. Every head whose group could cover the new word 
+* is fused again
+*/
+void patch_decoded(Um universe, uint32_t index, uint32_t word)
+{
+        assert(universe);
+        refresh_seg0(universe);
+        Um_decoded *code = universe->decoded;
+        if (code == NULL) {
+                return;
+        }
+        assert(index < universe->decodedLen);
+        code[index] = decode_word(word);
+        uint32_t first = index < MAX_FUSED - 1 ? 0 : index - (MAX_FUSED - 1);
+        for (uint32_t i = first; i <= index; i++) {
+                fuse_at(code, i, universe->decodedLen);
+        }
+}
+
+/************fuse_at************
+*
+* Description: Function that decides whether the decoded instruction at an 
+* index heads a superinstruction, and sets its opcode accordingly
+*
+* Parameters: Um_decoded *code: a decoded segment 0
+*             uint32_t i: the index of the candidate head
+*             uint32_t numWords: the number of words in segment 0
+*
+* Returns: void
+*
+* Expects: code != NULL, i < numWords
+*      
+* Notes: only the head's opcode changes. Matching looks at base opcodes, so
+* it gives the same answer whether or not the following words are heads 
+* themselves
+*/
+static void fuse_at(Um_decoded *code, uint32_t i, uint32_t numWords)
+{
+        assert(code);
+        code[i].op = base_op[code[i].op];
+        for (unsigned f = 0; f < NUM_FUSIONS; f++) {
+                const struct fusion *pattern = &fusions[f];
+                if (numWords - i < pattern->len) {
+                        continue;
+                }
+                bool match = true;
+                for (unsigned k = 0; k < pattern->len && match; k++) {
+                        match = pattern->seq[k] == ANY_OP ||
+                                base_op[code[i + k].op] == pattern->seq[k];
+                }
+                if (match && (pattern->guard == NULL || 
+                              pattern->guard(&code[i]))) {
+                        code[i].op = pattern->fused;
+                        return;
+                }
+        }
+}
+
+/* NAND with both operands the same register is a bitwise NOT */
+static bool is_not(const Um_decoded *d)
+{
+        return d[0].b == d[0].c;
+}
+
+/* SLOAD, then an ADD, MUL or NAND, then SSTORE */
+static bool is_rmw(const Um_decoded *d)
+{
+        uint8_t middle = base_op[d[1].op];
+        return middle == ADD || middle == MUL || middle == NAND;
 }
 
 /************ get_seg_sequences ************
@@ -276,9 +1200,171 @@ void set_pc(Um universe, uint32_t val)
         universe->pc = val;
 }
 
+/************ get_pc ************
+*
+* Description: Function that gets the program counter
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: the index in segment 0 of the next instruction to run
+*
+* Expects: universe != NULL 
+*      
+* Notes: used by other execution engines to pick up where the UM is
+*/
+uint32_t get_pc(Um universe)
+{
+        assert(universe);
+        return universe->pc;
+}
+
+/************ get_register_file ************
+*
+* Description: Function that gets the address of the UM's eight registers
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: a pointer to an array of eight uint32_t's
+*
+* Expects: universe != NULL 
+*      
+* Notes: used by the JIT, whose generated code loads and stores the 
+* registers directly. The address stays valid until free_um
+*/
+uint32_t *get_register_file(Um universe)
+{
+        assert(universe);
+        return universe->registers;
+}
+
 /*function for testing only that prints the value in a specified register as 
 an integer. Not included in final submission but extremely useful for testing*/
 void print_register(Um universe, unsigned rA)
 {
         printf("The value in rA is %u", get_register(universe, rA));
-}
\ No newline at end of file
+}
+
+/************ get_channel ************
+*
+* Description: Function that gets the channel the UM's IN and OUT use
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: the UM's channel
+*
+* Expects: universe != NULL 
+*      
+* Notes: the channel belongs to the UM and is freed by free_um
+*/
+Channel get_channel(Um universe)
+{
+        assert(universe);
+        return universe->io;
+}
+
+/************ set_channel ************
+*
+* Description: Function that points the UM's IN and OUT at another channel
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             Channel io: the new channel
+*
+* Returns: void
+*
+* Expects: universe != NULL, io != NULL
+*      
+* Notes: the old channel is flushed and freed, and the UM takes ownership of
+* the new one, so the output of a memory channel must be read before free_um
+*/
+void set_channel(Um universe, Channel io)
+{
+        assert(universe);
+        assert(io);
+        if (universe->io != io) {
+                free_channel(universe->io);
+                universe->io = io;
+        }
+}
+
+/************ set_profile ************
+*
+* Description: Function that attaches a profile for run_um to record into
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*             Profile prof: the profile, or NULL to stop profiling
+*
+* Returns: void
+*
+* Expects: universe != NULL
+*      
+* Notes: only has an effect when the UM is built with -DUM_PROFILE. The 
+* profile still belongs to the caller, who writes and frees it
+*/
+void set_profile(Um universe, Profile prof)
+{
+        assert(universe);
+        universe->profile = prof;
+}
+
+/************ get_published ************
+*
+* Description: Function that gets the word run_um publishes its position in
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: a pointer to the word, for start_sampler
+*
+* Expects: universe != NULL
+*      
+* Notes: the word is valid until free_um. Only run_um keeps it current; the
+* other engines leave it as it was. run_um only starts publishing once this
+* has been called, and before then skips the store
+*/
+const volatile uint64_t *get_published(Um universe)
+{
+        assert(universe);
+        universe->publishing = true;
+        return &universe->published;
+}
+
+/************ get_instruction_count ************
+*
+* Description: Function that gets how many UM instructions the UM has run
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: the count, including the HALT
+*
+* Expects: universe != NULL
+*      
+* Notes: run_um_until, and so run_um, adds the instructions it ran each
+* time it returns, whether it halted or stopped early. run_threaded, behind
+* run_um_threaded, run_um_for and resume_um, adds them when it leaves, on a
+* halt, an exhausted budget, a wait for input or a fault. A profiled run 
+* and run_um_jit leave the count unchanged
+*/
+uint64_t get_instruction_count(Um universe)
+{
+        assert(universe);
+        return universe->instructions;
+}
+
+/************ get_dispatch_count ************
+*
+* Description: Function that gets how many times an engine dispatched to an
+* instruction handler
+*
+* Parameters: Um universe: a pointer to an initilized UM struct
+*
+* Returns: the count
+*
+* Expects: universe != NULL
+*      
+* Notes: the same as get_instruction_count for run_um; run_um_threaded 
+* dispatches once for each superinstruction
+*/
+uint64_t get_dispatch_count(Um universe)
+{
+        assert(universe);
+        return universe->dispatches;
+}
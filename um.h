@@ -12,22 +12,59 @@
  *
  **************************************************************/
 
+#ifndef UM_H
+#define UM_H
+
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include "seg.h"
+#include "channel.h"
+#include "profile.h"
+#include "sampler.h"
 
 
 struct Um;
 typedef struct Um *Um;
 
+/*why run_um_for stopped: the UM halted, ran through its budget, reached
+an IN whose input is not ready yet, or reached an instruction it cannot
+run (an invalid opcode, a division by zero, or a jump past the end of 
+segment 0)*/
+typedef enum Um_status {
+        UM_HALTED = 0, UM_BUDGET_EXHAUSTED, UM_WAITING_INPUT, UM_FAULTED
+} Um_status;
+
 /*functions used by main*/
 Um init_um(FILE *instructions);
+Um init_um_words(const uint32_t *words, uint32_t numWords);
+Um init_um_segs(allSegments umSegs);
+Um fork_um(Um parent, Channel io);
 void run_um(Um universe);
+bool run_um_until(Um universe, uint64_t maxInstructions);
+void request_stop(Um universe);
+Um_status run_um_for(Um universe, uint64_t budget);
+Um_status resume_um(Um universe);
+void run_um_threaded(Um universe);
+void run_um_census(Um universe, FILE *report);
 
 /*functions used by other modules*/
 uint32_t get_register(Um universe, unsigned reg);
 void set_register(Um universe, unsigned reg, uint32_t val);
 allSegments get_seg_sequences(Um universe);
 void free_um(Um universe);
-void set_pc(Um universe, uint32_t val);
\ No newline at end of file
+void set_pc(Um universe, uint32_t val);
+uint32_t get_pc(Um universe);
+uint32_t *get_register_file(Um universe);
+void invalidate_decoded(Um universe);
+void decode_program(Um universe);
+void patch_decoded(Um universe, uint32_t index, uint32_t word);
+Channel get_channel(Um universe);
+void set_channel(Um universe, Channel io);
+void set_profile(Um universe, Profile prof);
+const volatile uint64_t *get_published(Um universe);
+uint64_t get_instruction_count(Um universe);
+uint64_t get_dispatch_count(Um universe);
+
+#endif
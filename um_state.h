@@ -0,0 +1,134 @@
+/**************************************************************
+ *
+ *                     um_state.h
+ *
+ *      Assignment: HW6 um
+ *      Authors: Jason Singer, Anna Zou
+ *      Date: April 10, 2024
+ *
+ *      Private interface shared by the UM and operations modules: the
+ *      definition of struct Um, and inline accessors for its hot state so
+ *      the instruction handlers in op.c do not go through the out of line
+ *      getters and setters in um.h. Nothing outside um.c and op.c should
+ *      include it
+ *
+ **************************************************************/
+
+#ifndef UM_STATE_H
+#define UM_STATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "assert.h"
+#include "um.h"
+#include "op.h"
+
+#define NUM_REGISTERS 8
+#define UM_CACHE_LINE 64
+
+/* A segment 0 word decoded once into its opcode and operands. Opcodes 14
+and 15 decode to BADOP, so op is always a valid index into operations[] and
+the threaded dispatch table. value is only used by LV */
+typedef struct Um_decoded {
+        uint8_t op;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+        uint32_t value;
+} Um_decoded;
+
+/* Representation of our Universal Machine in the program. The first cache
+line holds everything an instruction touches: the registers, the program
+counter, the base and length of segment 0, and the decoded copy of segment 0
+(NULL until it is first needed, and again after segment 0 is replaced).
+seg0 and seg0Len are refreshed whenever segment 0 is replaced or copied on
+a store (see refresh_seg0). After the line come the allSegments struct
+pointer, the table of 3 register operations, the channel IN and OUT go
+through, and the profile run_um records into (NULL when not profiling).
+Last is the word run_um publishes for the sampler module after each 
+instruction while publishing is set (see sample_word in sampler.h), which a
+SIGPROF handler reads with one load; get_published sets publishing, and 
+generation counts the LOADPs that replaced segment 0.
+instructions and dispatches are added to by run_um and run_um_threaded when
+they halt, for the perf module. stopAfter is how many instructions run_um
+may still run before it returns, lowered to 0 by request_stop and reread
+by the engines after each LOADP; budget is
+the one last given to run_um_for, which resume_um runs with again, and 
+faulted is set once run_um_for or resume_um stopped the UM on a fault, 
+which leaves it stopped there for good */
+struct Um {
+        uint32_t registers[NUM_REGISTERS];
+        uint32_t pc;
+        uint32_t seg0Len;
+        uint32_t *seg0;
+        Um_decoded *decoded;
+        uint32_t decodedLen;
+
+        allSegments umSegments __attribute__((aligned(UM_CACHE_LINE)));
+        func_ptr const *op_ptr;
+        Channel io;
+        Profile profile;
+        uint32_t generation;
+        volatile uint64_t published;
+        bool publishing;
+        uint64_t instructions;
+        uint64_t dispatches;
+        volatile uint64_t stopAfter;
+        uint64_t budget;
+        bool faulted;
+} __attribute__((aligned(UM_CACHE_LINE)));
+
+void refresh_seg0(Um universe);
+
+/* checked accessors: the same asserts as get_register and set_register */
+static inline uint32_t um_get_reg(Um universe, unsigned reg)
+{
+        assert(universe);
+        assert(reg < NUM_REGISTERS);
+        return universe->registers[reg];
+}
+
+static inline void um_set_reg(Um universe, unsigned reg, uint32_t val)
+{
+        assert(universe);
+        assert(reg < NUM_REGISTERS);
+        universe->registers[reg] = val;
+}
+
+/* unchecked accessors, for register numbers taken from the 3 bit fields of
+a decoded instruction, which are always in range */
+static inline uint32_t um_get_reg_unchecked(Um universe, unsigned reg)
+{
+        return universe->registers[reg];
+}
+
+static inline void um_set_reg_unchecked(Um universe, unsigned reg,
+                                        uint32_t val)
+{
+        universe->registers[reg] = val;
+}
+
+/* segment 0 through the cached base; the checked variant asserts the index
+is in bounds */
+static inline uint32_t um_seg0_word(Um universe, uint32_t index)
+{
+        assert(universe);
+        assert(index < universe->seg0Len);
+        return universe->seg0[index];
+}
+
+static inline uint32_t um_seg0_word_unchecked(Um universe, uint32_t index)
+{
+        return universe->seg0[index];
+}
+
+/* publishes the UM's position after an instruction with opcode op has run.
+The word is stored with a single aligned 64 bit store, which a signal
+handler on the same thread sees either entirely or not at all */
+static inline void um_publish(Um universe, unsigned op)
+{
+        universe->published = sample_word(universe->generation, op,
+                                          universe->pc);
+}
+
+#endif
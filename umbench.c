@@ -0,0 +1,299 @@
+/**************************************************************
+ *
+ *                     umbench.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Runner for the benchmark workloads umbenchwrite generates (or any
+ *     other UM programs). Each program is run in a child process with its
+ *     output sent to /dev/null, so every run starts from a fresh heap and
+ *     its peak RSS is its own. For each program the runner prints the UM
+ *     instructions executed, the execute time and MIPS, the peak RSS, and
+ *     the segments the UM mapped and how many of those needed a fresh
+ *     allocation rather than a pooled one, and of the words mapped when
+ *     the UM halted, how many megabytes' worth there were and how many of
+ *     those were resident. With -r it keeps the fastest of several runs
+ *
+ *     Usage: umbench [-t | -j] [-r runs] [-l words] [-H policy] 
+ *                    program.um ...
+ *            -t   run with the threaded (computed goto) engine
+ *            -j   run with the x86-64 JIT, which does not count
+ *                 instructions, so no MIPS are shown
+ *            -l   give segments of at least this many words a lazily
+ *                 allocated mapping of their own (see set_lazy_threshold)
+ *            -H   map segments for transparent huge pages: never (the 
+ *                 default), data (all but segment 0) or all (see 
+ *                 set_huge_policy)
+ *
+ **************************************************************/
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "assert.h"
+#include "um.h"
+#include "jit.h"
+
+/* what a child reports back to the runner over a pipe */
+typedef struct Bench_result {
+        uint64_t instructions;
+        uint64_t ns;
+        uint64_t maps;
+        uint64_t allocations;
+        uint64_t cowCopies;
+        uint64_t mappedWords;
+        uint64_t residentWords;
+        long peakKb;
+} Bench_result;
+
+typedef void (*Engine)(Um universe);
+
+static void usage(const char *progname);
+static bool run_once(const char *path, Engine engine, Bench_result *result);
+static void run_child(const char *path, Engine engine, int report);
+static void print_result(const char *path, const Bench_result *result);
+static uint64_t now_ns(void);
+
+int main(int argc, char *argv[])
+{
+        Engine engine = run_um;
+        unsigned runs = 1;
+        int i = 1;
+        for (; i < argc && argv[i][0] == '-'; i++) {
+                if (strcmp(argv[i], "-t") == 0) {
+                        engine = run_um_threaded;
+                } else if (strcmp(argv[i], "-j") == 0) {
+                        engine = run_um_jit;
+                } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+                        runs = strtoul(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+                        uint32_t lazyWords = strtoul(argv[++i], NULL, 10);
+                        if (lazyWords == 0) {
+                                usage(argv[0]);
+                        }
+                        set_lazy_threshold(lazyWords);
+                } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+                        Huge_policy policy;
+                        if (!parse_huge_policy(argv[++i], &policy)) {
+                                usage(argv[0]);
+                        }
+                        set_huge_policy(policy);
+                } else {
+                        usage(argv[0]);
+                }
+        }
+        if (i == argc || runs == 0) {
+                usage(argv[0]);
+        }
+
+        bool failed = false;
+        printf("%-16s %12s %10s %8s %9s %10s %10s %8s %10s %11s\n", 
+               "program", "instructions", "ms", "MIPS", "peak MB", "maps", 
+               "allocs", "copies", "mapped MB", "resident MB");
+        for (; i < argc; i++) {
+                Bench_result best = { 0, 0, 0, 0, 0, 0, 0, 0 };
+                bool ok = false;
+                for (unsigned run = 0; run < runs; run++) {
+                        Bench_result result;
+                        if (!run_once(argv[i], engine, &result)) {
+                                ok = false;
+                                break;
+                        }
+                        if (!ok || result.ns < best.ns) {
+                                best = result;
+                        }
+                        ok = true;
+                }
+                if (ok) {
+                        print_result(argv[i], &best);
+                } else {
+                        printf("%-16s failed\n", argv[i]);
+                        failed = true;
+                }
+                fflush(stdout);
+        }
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/************ usage ************
+*
+* Description: prints the command line usage of the runner and exits
+*
+* Parameters: const char *progname: the name the runner was invoked with
+*
+* Returns: does not return
+*
+* Expects: progname != NULL
+*
+* Notes: exits with EXIT_FAILURE
+**********************************/
+static void usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s [-t | -j] [-r runs] [-l words] "
+                "[-H never | data | all]\n          program.um ...\n", 
+                progname);
+        exit(EXIT_FAILURE);
+}
+
+/************ run_once ************
+*
+* Description: runs a program once in a child process and collects what it
+* measured
+*
+* Parameters: const char *path: the program file
+*             Engine engine: the execution engine to run it with
+*             Bench_result *result: filled in with the measurements
+*
+* Returns: true if the child ran the program to its halt
+*
+* Expects: path != NULL, engine != NULL, result != NULL
+*
+* Notes: the peak RSS comes from the child's rusage as reaped by wait4
+**********************************/
+static bool run_once(const char *path, Engine engine, Bench_result *result)
+{
+        assert(path && engine && result);
+        int fds[2];
+        if (pipe(fds) != 0) {
+                return false;
+        }
+        fflush(stdout);
+        pid_t child = fork();
+        if (child < 0) {
+                close(fds[0]);
+                close(fds[1]);
+                return false;
+        }
+        if (child == 0) {
+                close(fds[0]);
+                run_child(path, engine, fds[1]);
+        }
+        close(fds[1]);
+        ssize_t got = read(fds[0], result, sizeof(*result));
+        close(fds[0]);
+
+        int status;
+        struct rusage usage;
+        if (wait4(child, &status, 0, &usage) != child) {
+                return false;
+        }
+        result->peakKb = usage.ru_maxrss;
+        return got == sizeof(*result) && WIFEXITED(status) &&
+               WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/************ run_child ************
+*
+* Description: body of the child process: loads and runs the program, and
+* writes its measurements to the runner
+*
+* Parameters: const char *path: the program file
+*             Engine engine: the execution engine to run it with
+*             int report: the pipe the Bench_result is written to
+*
+* Returns: does not return
+*
+* Expects: path != NULL, engine != NULL
+*
+* Notes: exits with EXIT_FAILURE if the program cannot be opened; a UM that
+* fails ends the child without a report
+**********************************/
+static void run_child(const char *path, Engine engine, int report)
+{
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull < 0 || dup2(devnull, STDOUT_FILENO) < 0) {
+                _exit(EXIT_FAILURE);
+        }
+        close(devnull);
+        FILE *program = fopen(path, "rb");
+        if (program == NULL) {
+                fprintf(stderr, "umbench: could not open %s\n", path);
+                _exit(EXIT_FAILURE);
+        }
+        Um universe = init_um(program);
+        fclose(program);
+
+        uint64_t start = now_ns();
+        engine(universe);
+        Bench_result result;
+        memset(&result, 0, sizeof(result));
+        result.ns = now_ns() - start;
+        result.instructions = get_instruction_count(universe);
+        Seg_stats stats = get_seg_stats(get_seg_sequences(universe));
+        result.maps = stats.poolHits + stats.poolMisses + stats.largeAllocs +
+                      stats.lazyAllocs;
+        result.allocations = stats.poolMisses + stats.largeAllocs + 
+                             stats.lazyAllocs;
+        result.cowCopies = stats.cowCopies;
+        result.mappedWords = stats.mappedWords;
+        result.residentWords = stats.residentWords;
+        free_um(universe);
+
+        ssize_t put = write(report, &result, sizeof(result));
+        _exit(put == sizeof(result) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/************ print_result ************
+*
+* Description: prints one line of the report
+*
+* Parameters: const char *path: the program file
+*             const Bench_result *result: its measurements
+*
+* Returns: void
+*
+* Expects: path != NULL, result != NULL
+*
+* Notes: the program is named by its file name without directory or ".um"
+**********************************/
+static void print_result(const char *path, const Bench_result *result)
+{
+        const char *name = strrchr(path, '/');
+        name = name == NULL ? path : name + 1;
+        int len = strlen(name);
+        if (len > 3 && strcmp(name + len - 3, ".um") == 0) {
+                len -= 3;
+        }
+        printf("%-16.*s %12llu %10.1f ", len, name,
+               (unsigned long long)result->instructions, result->ns / 1e6);
+        if (result->instructions > 0 && result->ns > 0) {
+                printf("%8.1f", result->instructions * 1e3 / result->ns);
+        } else {
+                printf("%8s", "-");
+        }
+        printf(" %9.1f %10llu %10llu %8llu %10.1f %11.1f\n", 
+               result->peakKb / 1024.0, (unsigned long long)result->maps,
+               (unsigned long long)result->allocations,
+               (unsigned long long)result->cowCopies,
+               result->mappedWords * 4 / 1048576.0,
+               result->residentWords * 4 / 1048576.0);
+}
+
+/************ now_ns ************
+*
+* Description: reads the monotonic clock
+*
+* Parameters: N/A
+*
+* Returns: the time in nanoseconds
+*
+* Expects: N/A
+*
+* Notes: N/A
+**********************************/
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "fmt.h"
+#include "seq.h"
+
+extern void Um_write_sequence(FILE *output, Seq_T instructions);
+
+extern void build_bench_arith(Seq_T stream, uint32_t iterations,
+                              uint32_t words);
+extern void build_bench_churn(Seq_T stream, uint32_t iterations,
+                              uint32_t words);
+extern void build_bench_loadp(Seq_T stream, uint32_t iterations,
+                              uint32_t words);
+extern void build_bench_sequential(Seq_T stream, uint32_t iterations,
+                                   uint32_t words);
+extern void build_bench_random(Seq_T stream, uint32_t iterations,
+                               uint32_t words);
+extern void build_bench_output(Seq_T stream, uint32_t iterations,
+                               uint32_t words);
+
+/* The array `workloads` contains the benchmark programs umbench runs. At
+scale 1 each executes on the order of 10^8 UM instructions. */
+
+static struct workload_info {
+        const char *name;
+        uint32_t iterations;            /* at scale 1 */
+        uint32_t words;                 /* segment size, where one is used */
+        /* writes instructions into sequence */
+        void (*build_workload)(Seq_T stream, uint32_t iterations,
+                               uint32_t words);
+} workloads[] = {
+        { "arith",         10000000, 0,        build_bench_arith },
+        { "churn_1",        8000000, 1,        build_bench_churn },
+        { "churn_64",       8000000, 64,       build_bench_churn },
+        { "churn_4096",     1000000, 4096,     build_bench_churn },
+        { "churn_65536",      20000, 65536,    build_bench_churn },
+        { "loadp_switch",   1000000, 0,        build_bench_loadp },
+        { "seq_64k",        8000000, 1 << 16,  build_bench_sequential },
+        { "seq_16m",        8000000, 1 << 24,  build_bench_sequential },
+        { "random_64k",     8000000, 1 << 16,  build_bench_random },
+        { "random_16m",     8000000, 1 << 24,  build_bench_random },
+        { "random_512m",    8000000, 1 << 27,  build_bench_random },
+        { "output",         4000000, 0,        build_bench_output }
+};
+
+#define NWORKLOADS (sizeof(workloads)/sizeof(workloads[0]))
+
+static void write_workload(struct workload_info *workload, double scale);
+
+
+/*
+ * usage: umbenchwrite [-s scale] [workload ...]
+ * writes <workload>.um for the named workloads, or for all of them, with
+ * their iteration counts multiplied by scale
+ */
+int main (int argc, char *argv[])
+{
+        bool failed = false;
+        double scale = 1.0;
+        int first = 1;
+        if (argc > 2 && !strcmp(argv[1], "-s")) {
+                scale = strtod(argv[2], NULL);
+                first = 3;
+        }
+        if (scale <= 0) {
+                fprintf(stderr, "***** Scale must be positive *****\n");
+                return 1;
+        }
+        if (first == argc)
+                for (unsigned i = 0; i < NWORKLOADS; i++) {
+                        printf("***** Writing workload '%s'.\n",
+                               workloads[i].name);
+                        write_workload(&workloads[i], scale);
+                }
+        else
+                for (int j = first; j < argc; j++) {
+                        bool written = false;
+                        for (unsigned i = 0; i < NWORKLOADS; i++)
+                                if (!strcmp(workloads[i].name, argv[j])) {
+                                        written = true;
+                                        write_workload(&workloads[i], scale);
+                                }
+                        if (!written) {
+                                failed = true;
+                                fprintf(stderr,
+                                        "***** No workload named %s *****\n",
+                                        argv[j]);
+                        }
+                }
+        return failed; /* failed nonzero == exit nonzero == failure */
+}
+
+
+static void write_workload(struct workload_info *workload, double scale)
+{
+        double iterations = workload->iterations * scale;
+        if (iterations < 1) {
+                iterations = 1;
+        }
+        assert(iterations <= UINT32_MAX);
+
+        char *path = Fmt_string("%s.um", workload->name);
+        FILE *binary = fopen(path, "wb");
+        assert(binary != NULL);
+        free(path);
+
+        Seq_T instructions = Seq_new(0);
+        workload->build_workload(instructions, (uint32_t)iterations,
+                                 workload->words);
+        Um_write_sequence(binary, instructions);
+        Seq_free(&instructions);
+        fclose(binary);
+}
@@ -0,0 +1,1106 @@
+/**************************************************************
+ *
+ *                     umd.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     A long-lived UM server, and its client. The server listens on a Unix
+ *     domain socket for requests that name a program and an input file,
+ *     runs each on a pool of worker threads, and streams the program's
+ *     output back to the client as it is written, so a job costs a socket
+ *     round trip instead of a process start and a program load. The
+ *     accepting thread only accepts: connections are handed to a few
+ *     intake threads, which read the requests and find or load the
+ *     programs, so a slow client or a large program holds up only its own
+ *     intake thread.
+ *
+ *     Programs are kept loaded, with segment 0 already decoded, in a cache
+ *     keyed by a hash of their contents; a job runs in a copy forked from
+ *     the cached UM, which shares its segments copy on write (see
+ *     fork_um). The program file is read for every request, and an entry
+ *     is only used when its segment 0 holds exactly the file's words, so
+ *     neither a hash collision nor a file rewritten in place can run the
+ *     wrong program. The least recently used program is dropped when the
+ *     cache is full.
+ *
+ *     The server opens the files clients name with its own privileges, so
+ *     only the user it runs as may use it: the socket is created readable
+ *     and writable by that user alone, and a connection from any other 
+ *     user (as SO_PEERCRED gives it) is refused.
+ *
+ *     A request is the program's path and the input's path, each ended by
+ *     a NUL byte; an empty input path means no input. The reply is a
+ *     series of frames, each a Umd_frame header followed by length bytes:
+ *     UMD_OUTPUT frames carry output, and the last frame says how the job
+ *     ended: UMD_HALTED, UMD_FAULTED or UMD_ERROR, with a message for the
+ *     last two.
+ *
+ *     Usage: umd [-w workers] socket
+ *            umd -c socket [-n runs] program.um [input]
+ *            -w   run jobs on this many threads (default UMD_WORKERS)
+ *            -c   send a request to the server on socket, writing the
+ *                 output to standard output
+ *            -n   send the request this many times, one after another,
+ *                 and report the mean time per job on stderr
+ *
+ **************************************************************/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "assert.h"
+#include "um.h"
+#include "pool.h"
+
+#define UMD_WORKERS 4
+#define UMD_INTAKE 8
+#define UMD_SLICE 1000000
+#define UMD_CACHE_SIZE 64
+#define UMD_BACKLOG 128
+#define REQUEST_MAX (2 * PATH_MAX)
+#define REQUEST_TIMEOUT 1
+#define SEND_TIMEOUT 10
+#define SHUTDOWN_GRACE 5
+#define SHUTDOWN_TICK_NS 10000000
+
+/* what a reply frame carries */
+enum { UMD_OUTPUT = 1, UMD_HALTED, UMD_FAULTED, UMD_ERROR };
+
+typedef struct Umd_frame {
+        uint32_t kind;
+        uint32_t length;
+} Umd_frame;
+
+/* a loaded program: the UM jobs are forked from, and the hash and length
+of the file it was loaded from. lastUsed orders entries for eviction */
+typedef struct Cached {
+        Um image;
+        uint64_t hash;
+        size_t length;
+        uint64_t lastUsed;
+} Cached;
+
+/* the program cache, which the intake threads share under lock */
+typedef struct Cache {
+        pthread_mutex_t lock;
+        Cached entries[UMD_CACHE_SIZE];
+        unsigned count;
+        uint64_t clock;
+        uint64_t hits;
+        uint64_t loads;
+} Cache;
+
+/* a running job: the client's socket, and the input file, or -1 */
+typedef struct Job {
+        int client;
+        int input;
+        bool gone;
+} Job;
+
+/* the connections the accepting thread has handed over, waiting for an
+intake thread: a ring of capacity descriptors, count of them from head.
+closing is set once no more will be added */
+typedef struct Intake {
+        pthread_mutex_t lock;
+        pthread_cond_t ready;
+        int *clients;
+        unsigned head;
+        unsigned count;
+        unsigned capacity;
+        bool closing;
+        Cache *cache;
+        Pool pool;
+        pthread_t threads[UMD_INTAKE];
+} Intake;
+
+static volatile sig_atomic_t stopping;
+/* jobs submitted to the pool that finish_job has not yet finished */
+static uint64_t liveJobs;
+
+static void usage(const char *progname);
+static int serve(const char *socketPath, unsigned workers);
+static void hand_over(Intake *intake, int client);
+static void *run_intake(void *arg);
+static void handle_client(int client, Cache *cache, Pool pool);
+static bool read_request(int client, char **program, char **input);
+static bool same_user(int client);
+static Um start_program(Cache *cache, const char *path, Channel io,
+                        const char **error);
+static Cached *find_cached(Cache *cache, uint64_t hash,
+                           const uint8_t *bytes, size_t length);
+static Um load_program_file(const uint8_t *bytes, size_t length);
+static uint64_t hash_bytes(const uint8_t *bytes, size_t length);
+static bool same_program(Um image, const uint8_t *bytes, size_t length);
+static size_t read_input(void *cl, uint8_t *buf, size_t cap);
+static void write_output(void *cl, const uint8_t *buf, size_t len);
+static void finish_job(Um universe, Um_status status, void *cl);
+static bool send_frame(int fd, uint32_t kind, const void *bytes,
+                       uint32_t length);
+static bool send_all(int fd, const void *bytes, size_t length);
+static bool recv_all(int fd, void *bytes, size_t length);
+static void request_shutdown(int signum);
+static int run_client(const char *socketPath, const char *program,
+                      const char *input, unsigned runs);
+static int run_job(const char *socketPath, const char *request,
+                   size_t length);
+static int connect_to(const char *socketPath);
+static uint64_t now_ns(void);
+
+int main(int argc, char *argv[])
+{
+        unsigned workers = UMD_WORKERS;
+        unsigned runs = 1;
+        const char *clientSocket = NULL;
+        int i = 1;
+        for (; i < argc && argv[i][0] == '-'; i++) {
+                if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+                        workers = strtoul(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+                        clientSocket = argv[++i];
+                } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+                        runs = strtoul(argv[++i], NULL, 10);
+                } else {
+                        usage(argv[0]);
+                }
+        }
+        if (workers == 0 || runs == 0) {
+                usage(argv[0]);
+        }
+        if (clientSocket != NULL) {
+                if (argc - i < 1 || argc - i > 2) {
+                        usage(argv[0]);
+                }
+                return run_client(clientSocket, argv[i],
+                                  argc - i == 2 ? argv[i + 1] : NULL, runs);
+        }
+        if (argc - i != 1 || runs != 1) {
+                usage(argv[0]);
+        }
+        return serve(argv[i], workers);
+}
+
+/************ usage ************
+*
+* Description: prints the command line usage of umd and exits
+*
+* Parameters: const char *progname: the name umd was invoked with
+*
+* Returns: does not return
+*
+* Expects: progname != NULL
+*
+* Notes: exits with EXIT_FAILURE
+**********************************/
+static void usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s [-w workers] socket\n"
+                "       %s -c socket [-n runs] program.um [input]\n",
+                progname, progname);
+        exit(EXIT_FAILURE);
+}
+
+/************ serve ************
+*
+* Description: runs the server: accepts clients on the socket and starts
+* a job for each, until SIGINT or SIGTERM
+*
+* Parameters: const char *socketPath: where to create the socket
+*             unsigned workers: how many threads to run jobs on
+*
+* Returns: EXIT_SUCCESS, or EXIT_FAILURE if the socket cannot be created
+*
+* Expects: socketPath != NULL, workers > 0
+*
+* Notes: an old socket at socketPath is replaced, but anything else there
+* is left alone and the server does not start. The new socket is made with
+* mode 0600. On shutdown the socket file is removed, and the 
+* connections already accepted are started. Running jobs get up to 
+* SHUTDOWN_GRACE seconds to finish; the pool is then cancelled, so a job 
+* that never halts ends with an error frame at the end of its slice. The 
+* cache and pool counts are reported on stderr
+**********************************/
+static int serve(const char *socketPath, unsigned workers)
+{
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(address.sun_path)) {
+                fprintf(stderr, "umd: socket path too long\n");
+                return EXIT_FAILURE;
+        }
+        strcpy(address.sun_path, socketPath);
+        struct stat old;
+        if (lstat(socketPath, &old) == 0) {
+                if (!S_ISSOCK(old.st_mode)) {
+                        fprintf(stderr, "umd: %s exists and is not a "
+                                "socket\n", socketPath);
+                        return EXIT_FAILURE;
+                }
+                unlink(socketPath);
+        }
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        mode_t mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+        bool bound = listener >= 0 &&
+                     bind(listener, (struct sockaddr *)&address,
+                          sizeof(address)) == 0;
+        umask(mask);
+        if (!bound || listen(listener, UMD_BACKLOG) != 0) {
+                perror("umd: could not listen");
+                return EXIT_FAILURE;
+        }
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = request_shutdown;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        fprintf(stderr, "umd: listening on %s with %u workers\n",
+                socketPath, workers);
+
+        Pool pool = init_pool(workers, UMD_SLICE);
+        Cache *cache = calloc(1, sizeof(Cache));
+        assert(cache);
+        pthread_mutex_init(&cache->lock, NULL);
+        Intake *intake = calloc(1, sizeof(Intake));
+        assert(intake);
+        pthread_mutex_init(&intake->lock, NULL);
+        pthread_cond_init(&intake->ready, NULL);
+        intake->cache = cache;
+        intake->pool = pool;
+        for (unsigned i = 0; i < UMD_INTAKE; i++) {
+                int failed = pthread_create(&intake->threads[i], NULL,
+                                            run_intake, intake);
+                assert(!failed);
+                (void)failed;
+        }
+        while (!stopping) {
+                int client = accept(listener, NULL, NULL);
+                if (client < 0) {
+                        if (errno != EINTR && errno != ECONNABORTED) {
+                                perror("umd: accept");
+                        }
+                        continue;
+                }
+                hand_over(intake, client);
+        }
+        close(listener);
+        unlink(socketPath);
+        pthread_mutex_lock(&intake->lock);
+        intake->closing = true;
+        pthread_cond_broadcast(&intake->ready);
+        pthread_mutex_unlock(&intake->lock);
+        for (unsigned i = 0; i < UMD_INTAKE; i++) {
+                pthread_join(intake->threads[i], NULL);
+        }
+        pthread_cond_destroy(&intake->ready);
+        pthread_mutex_destroy(&intake->lock);
+        free(intake->clients);
+        free(intake);
+        struct timespec tick = { 0, SHUTDOWN_TICK_NS };
+        for (uint64_t waited = 0;
+             waited < SHUTDOWN_GRACE * 1000000000ull &&
+             __atomic_load_n(&liveJobs, __ATOMIC_ACQUIRE) > 0;
+             waited += SHUTDOWN_TICK_NS) {
+                nanosleep(&tick, NULL);
+        }
+        pool_cancel(pool);
+        pool_wait(pool, 0);
+        Pool_stats stats = get_pool_stats(pool);
+        free_pool(pool);
+        for (unsigned i = 0; i < cache->count; i++) {
+                free_um(cache->entries[i].image);
+        }
+        fprintf(stderr, "umd: %llu jobs, %llu programs loaded, %llu cache "
+                "hits\n", (unsigned long long)stats.finished,
+                (unsigned long long)cache->loads,
+                (unsigned long long)cache->hits);
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+        return EXIT_SUCCESS;
+}
+
+/************ handle_client ************
+*
+* Description: reads a client's request and starts its job on the pool, or
+* tells the client why it could not
+*
+* Parameters: int client: the client's socket
+*             Cache *cache: the program cache
+*             Pool pool: the pool jobs run on
+*
+* Returns: void
+*
+* Expects: cache != NULL, pool != NULL
+*
+* Notes: runs on an intake thread, so a client that is slow to send its 
+* request, up to REQUEST_TIMEOUT seconds, holds up only that thread. A 
+* client that stops reading its reply is taken to be gone once a send to it
+* has made no progress for SEND_TIMEOUT seconds, rather than holding a 
+* worker for good. The job owns the socket and the input file from here on,
+* and finish_job closes them
+**********************************/
+static void handle_client(int client, Cache *cache, Pool pool)
+{
+        struct timeval timeout = { REQUEST_TIMEOUT, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout));
+        struct timeval sendTimeout = { SEND_TIMEOUT, 0 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout,
+                   sizeof(sendTimeout));
+        char *program = NULL;
+        char *input = NULL;
+        const char *error = NULL;
+        Um universe = NULL;
+        Job *job = malloc(sizeof(Job));
+        assert(job);
+        job->client = client;
+        job->input = -1;
+        job->gone = false;
+        if (!same_user(client)) {
+                error = "permission denied";
+        } else if (!read_request(client, &program, &input)) {
+                error = "bad request";
+        } else if (input[0] != '\0' &&
+                   (job->input = open(input, O_RDONLY | O_CLOEXEC)) < 0) {
+                error = "could not open input";
+        } else {
+                Channel io = init_callback_channel(read_input, write_output,
+                                                   job);
+                universe = start_program(cache, program, io, &error);
+                if (universe == NULL) {
+                        free_channel(io);
+                }
+        }
+        free(program);
+        if (universe == NULL) {
+                send_frame(client, UMD_ERROR, error, strlen(error));
+                close(client);
+                if (job->input >= 0) {
+                        close(job->input);
+                }
+                free(job);
+                return;
+        }
+        __atomic_add_fetch(&liveJobs, 1, __ATOMIC_RELAXED);
+        pool_submit(pool, universe, finish_job, job);
+}
+
+/************ hand_over ************
+*
+* Description: gives an accepted connection to the intake threads
+*
+* Parameters: Intake *intake: the intake threads' queue
+*             int client: the client's socket
+*
+* Returns: void
+*
+* Expects: intake != NULL, and memory allocation suceeds
+*
+* Notes: the queue doubles when full
+**********************************/
+static void hand_over(Intake *intake, int client)
+{
+        pthread_mutex_lock(&intake->lock);
+        if (intake->count == intake->capacity) {
+                unsigned capacity = intake->capacity ? 
+                                    2 * intake->capacity : UMD_INTAKE;
+                int *clients = malloc(capacity * sizeof(int));
+                assert(clients);
+                for (unsigned i = 0; i < intake->count; i++) {
+                        clients[i] = intake->clients[(intake->head + i) % 
+                                                     intake->capacity];
+                }
+                free(intake->clients);
+                intake->clients = clients;
+                intake->capacity = capacity;
+                intake->head = 0;
+        }
+        intake->clients[(intake->head + intake->count) % 
+                        intake->capacity] = client;
+        intake->count++;
+        pthread_cond_signal(&intake->ready);
+        pthread_mutex_unlock(&intake->lock);
+}
+
+/************ run_intake ************
+*
+* Description: the loop of an intake thread: takes connections off the
+* queue and starts their jobs
+*
+* Parameters: void *arg: the Intake
+*
+* Returns: NULL, once the queue is empty and closing is set
+*
+* Expects: arg != NULL
+*
+* Notes: N/A
+**********************************/
+static void *run_intake(void *arg)
+{
+        Intake *intake = arg;
+        while (true) {
+                pthread_mutex_lock(&intake->lock);
+                while (intake->count == 0 && !intake->closing) {
+                        pthread_cond_wait(&intake->ready, &intake->lock);
+                }
+                if (intake->count == 0) {
+                        pthread_mutex_unlock(&intake->lock);
+                        return NULL;
+                }
+                int client = intake->clients[intake->head];
+                intake->head = (intake->head + 1) % intake->capacity;
+                intake->count--;
+                pthread_mutex_unlock(&intake->lock);
+                handle_client(client, intake->cache, intake->pool);
+        }
+}
+
+/************ same_user ************
+*
+* Description: checks that a client runs as the same user as the server
+*
+* Parameters: int client: the client's socket
+*
+* Returns: true if the peer's user ID, from SO_PEERCRED, is the server's
+*          effective user ID
+*
+* Expects: N/A
+*
+* Notes: the request is not read from a client that fails the check
+**********************************/
+static bool same_user(int client)
+{
+        struct ucred peer;
+        socklen_t length = sizeof(peer);
+        return getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer,
+                          &length) == 0 && length == sizeof(peer) &&
+               peer.uid == geteuid();
+}
+
+/************ read_request ************
+*
+* Description: reads the program and input paths a client sent
+*
+* Parameters: int client: the client's socket
+*             char **program: set to the program's path
+*             char **input: set to the input's path, which may be empty
+*
+* Returns: true if a whole request was read
+*
+* Expects: program != NULL, input != NULL
+*
+* Notes: both paths point into one malloc'ed buffer, which is freed by
+* freeing *program. Reading stops at the second NUL, so the client may keep
+* the connection open for the reply; anything the client sent after it, in
+* the same recv, is ignored
+**********************************/
+static bool read_request(int client, char **program, char **input)
+{
+        char *buffer = malloc(REQUEST_MAX);
+        assert(buffer);
+        size_t used = 0;
+        int nuls = 0;
+        while (nuls < 2 && used < REQUEST_MAX) {
+                ssize_t got = recv(client, buffer + used, REQUEST_MAX - used,
+                                   0);
+                if (got < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (got <= 0) {
+                        break;
+                }
+                size_t end = used + got;
+                while (used < end && nuls < 2) {
+                        nuls += buffer[used++] == '\0';
+                }
+        }
+        if (nuls != 2) {
+                free(buffer);
+                return false;
+        }
+        *program = buffer;
+        *input = buffer + strlen(buffer) + 1;
+        return true;
+}
+
+/************ start_program ************
+*
+* Description: forks a job's UM from a program in the cache, loading the
+* program if it is not there
+*
+* Parameters: Cache *cache: the program cache
+*             const char *path: the program file
+*             Channel io: the channel the job's UM is to use
+*             const char **error: set to why the program could not be had
+*
+* Returns: the job's UM, or NULL, in which case io is still the caller's
+*
+* Expects: cache != NULL, path != NULL, io != NULL, error != NULL
+*
+* Notes: the file is read and hashed, and an entry with the same hash and 
+* length whose segment 0 is the same words is used for it; only a program 
+* that is in no entry is loaded and decoded. Reading, hashing and loading 
+* happen outside the cache's lock, so other intake threads are held up only
+* while entries are compared and while the UM is forked, which is done 
+* under the lock so that the entry cannot be dropped first
+**********************************/
+static Um start_program(Cache *cache, const char *path, Channel io,
+                        const char **error)
+{
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+                *error = "could not open program";
+                if (fd >= 0) {
+                        close(fd);
+                }
+                return NULL;
+        }
+        size_t length = info.st_size;
+        if (length % 4 != 0) {
+                close(fd);
+                *error = "program is not a whole number of instructions";
+                return NULL;
+        }
+        const uint8_t *bytes = NULL;
+        if (length > 0) {
+                bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (bytes == MAP_FAILED) {
+                *error = "could not read program";
+                return NULL;
+        }
+        uint64_t hash = hash_bytes(bytes, length);
+
+        pthread_mutex_lock(&cache->lock);
+        Cached *entry = find_cached(cache, hash, bytes, length);
+        if (entry == NULL) {
+                pthread_mutex_unlock(&cache->lock);
+                Um image = load_program_file(bytes, length);
+                pthread_mutex_lock(&cache->lock);
+                entry = find_cached(cache, hash, bytes, length);
+                if (entry != NULL) {
+                        free_um(image);
+                } else {
+                        if (cache->count < UMD_CACHE_SIZE) {
+                                entry = &cache->entries[cache->count++];
+                        } else {
+                                entry = &cache->entries[0];
+                                for (unsigned i = 1; i < cache->count; i++) {
+                                        if (cache->entries[i].lastUsed <
+                                            entry->lastUsed) {
+                                                entry = &cache->entries[i];
+                                        }
+                                }
+                                free_um(entry->image);
+                        }
+                        entry->image = image;
+                        entry->hash = hash;
+                        entry->length = length;
+                        cache->loads++;
+                }
+        } else {
+                cache->hits++;
+        }
+        entry->lastUsed = ++cache->clock;
+        Um universe = fork_um(entry->image, io);
+        pthread_mutex_unlock(&cache->lock);
+        if (length > 0) {
+                munmap((void *)bytes, length);
+        }
+        return universe;
+}
+
+/************ find_cached ************
+*
+* Description: finds the cache entry a program was loaded into
+*
+* Parameters: Cache *cache: the program cache, with its lock held
+*             uint64_t hash: the hash_bytes of the program
+*             const uint8_t *bytes: the program
+*             size_t length: its length in bytes
+*
+* Returns: the entry, or NULL if the program is in none
+*
+* Expects: cache != NULL, bytes != NULL unless length is 0
+*
+* Notes: N/A
+**********************************/
+static Cached *find_cached(Cache *cache, uint64_t hash,
+                           const uint8_t *bytes, size_t length)
+{
+        for (unsigned i = 0; i < cache->count; i++) {
+                Cached *entry = &cache->entries[i];
+                if (entry->hash == hash && entry->length == length &&
+                    same_program(entry->image, bytes, length)) {
+                        return entry;
+                }
+        }
+        return NULL;
+}
+
+/************ load_program_file ************
+*
+* Description: makes the UM a cached program's jobs are forked from
+*
+* Parameters: const uint8_t *bytes: the program, 4 bytes per instruction,
+*                                   most significant byte first
+*             size_t length: the number of bytes, a multiple of 4
+*
+* Returns: the UM, with segment 0 decoded
+*
+* Expects: bytes != NULL unless length is 0, and memory allocation
+*          suceeds
+*
+* Notes: the UM is never run, only forked; a dropped cache entry's UM can
+* be freed while jobs forked from it run, since they hold their own
+* references to the segments they share with it
+**********************************/
+static Um load_program_file(const uint8_t *bytes, size_t length)
+{
+        uint32_t numWords = length / 4;
+        uint32_t *words = malloc((numWords + 1) * sizeof(uint32_t));
+        assert(words);
+        for (uint32_t i = 0; i < numWords; i++) {
+                uint32_t word;
+                memcpy(&word, bytes + 4 * i, sizeof(word));
+                words[i] = ntohl(word);
+        }
+        Um image = init_um_words(words, numWords);
+        free(words);
+        decode_program(image);
+        return image;
+}
+
+/************ hash_bytes ************
+*
+* Description: hashes a program's contents for the cache
+*
+* Parameters: const uint8_t *bytes: the program
+*             size_t length: its length in bytes
+*
+* Returns: the 64 bit FNV-1a hash of the bytes
+*
+* Expects: bytes != NULL unless length is 0
+*
+* Notes: FNV-1a collisions are easy to make on purpose, so an entry with
+* the same hash is only used once same_program has compared the words
+**********************************/
+static uint64_t hash_bytes(const uint8_t *bytes, size_t length)
+{
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < length; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+}
+
+/************ same_program ************
+*
+* Description: checks that a cached UM was loaded from a program's bytes
+*
+* Parameters: Um image: the cached UM
+*             const uint8_t *bytes: the program, 4 bytes per instruction,
+*                                   most significant byte first
+*             size_t length: the number of bytes, a multiple of 4
+*
+* Returns: true if segment 0 of image is exactly the program's words
+*
+* Expects: image != NULL, bytes != NULL unless length is 0
+*
+* Notes: a cached UM is never run, so its segment 0 is still the program
+* it was loaded from
+**********************************/
+static bool same_program(Um image, const uint8_t *bytes, size_t length)
+{
+        segment seg0 = get_segment(get_seg_sequences(image), 0);
+        if ((size_t)get_length(seg0) * 4 != length) {
+                return false;
+        }
+        const uint32_t *words = get_mem(seg0);
+        for (size_t i = 0; i < length / 4; i++) {
+                uint32_t word;
+                memcpy(&word, bytes + 4 * i, sizeof(word));
+                if (ntohl(word) != words[i]) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+/************ read_input ************
+*
+* Description: the Channel_reader for a job: reads its input file
+*
+* Parameters: void *cl: the Job
+*             uint8_t *buf: filled with input
+*             size_t cap: the size of buf
+*
+* Returns: the number of bytes read, 0 at the end of input, on an error,
+*          or when the job has no input file
+*
+* Expects: cl != NULL, buf != NULL
+*
+* Notes: N/A
+**********************************/
+static size_t read_input(void *cl, uint8_t *buf, size_t cap)
+{
+        Job *job = cl;
+        if (job->input < 0) {
+                return 0;
+        }
+        ssize_t got;
+        do {
+                got = read(job->input, buf, cap);
+        } while (got < 0 && errno == EINTR);
+        return got > 0 ? (size_t)got : 0;
+}
+
+/************ write_output ************
+*
+* Description: the Channel_writer for a job: sends a block of its output
+* to the client as a UMD_OUTPUT frame
+*
+* Parameters: void *cl: the Job
+*             const uint8_t *buf: the output
+*             size_t len: the number of bytes
+*
+* Returns: void
+*
+* Expects: cl != NULL, buf != NULL
+*
+* Notes: the channel calls this when its buffer fills and when the job
+* stops after a slice, so output reaches the client while the job runs.
+* Once a send fails, or makes no progress for SEND_TIMEOUT seconds, the 
+* client is taken to be gone and the rest of the output is dropped; the job 
+* still runs to its end
+**********************************/
+static void write_output(void *cl, const uint8_t *buf, size_t len)
+{
+        Job *job = cl;
+        if (!job->gone && len > 0) {
+                job->gone = !send_frame(job->client, UMD_OUTPUT, buf, len);
+        }
+}
+
+/************ finish_job ************
+*
+* Description: the Pool_done for a job: tells the client how it ended, and
+* frees it
+*
+* Parameters: Um universe: the job's UM
+*             Um_status status: how it stopped
+*             void *cl: the Job
+*
+* Returns: void
+*
+* Expects: universe != NULL, cl != NULL
+*
+* Notes: runs on a worker thread. Freeing the UM flushes the last of its
+* output, before the final frame. A job the pool cancelled at shutdown 
+* (UM_BUDGET_EXHAUSTED) ends with an error frame
+**********************************/
+static void finish_job(Um universe, Um_status status, void *cl)
+{
+        Job *job = cl;
+        uint32_t pc = get_pc(universe);
+        free_um(universe);
+        if (!job->gone) {
+                if (status == UM_FAULTED) {
+                        char message[64];
+                        int length = snprintf(message, sizeof(message),
+                                              "faulted at pc %u", pc);
+                        send_frame(job->client, UMD_FAULTED, message,
+                                   length);
+                } else if (status == UM_BUDGET_EXHAUSTED) {
+                        const char *message = "server shutting down";
+                        send_frame(job->client, UMD_ERROR, message,
+                                   strlen(message));
+                } else {
+                        send_frame(job->client, UMD_HALTED, NULL, 0);
+                }
+        }
+        close(job->client);
+        if (job->input >= 0) {
+                close(job->input);
+        }
+        free(job);
+        __atomic_sub_fetch(&liveJobs, 1, __ATOMIC_RELEASE);
+}
+
+/************ send_frame ************
+*
+* Description: sends one reply frame
+*
+* Parameters: int fd: the socket
+*             uint32_t kind: what the frame carries
+*             const void *bytes: its contents
+*             uint32_t length: how many bytes
+*
+* Returns: true if the whole frame was sent
+*
+* Expects: bytes != NULL unless length is 0
+*
+* Notes: N/A
+**********************************/
+static bool send_frame(int fd, uint32_t kind, const void *bytes,
+                       uint32_t length)
+{
+        Umd_frame frame = { kind, length };
+        return send_all(fd, &frame, sizeof(frame)) &&
+               send_all(fd, bytes, length);
+}
+
+/************ send_all ************
+*
+* Description: sends bytes on a socket, however many sends it takes
+*
+* Parameters: int fd: the socket
+*             const void *bytes: the bytes
+*             size_t length: how many
+*
+* Returns: true if every byte was sent
+*
+* Expects: bytes != NULL unless length is 0
+*
+* Notes: MSG_NOSIGNAL keeps a client that went away from raising SIGPIPE
+**********************************/
+static bool send_all(int fd, const void *bytes, size_t length)
+{
+        const uint8_t *next = bytes;
+        while (length > 0) {
+                ssize_t put = send(fd, next, length, MSG_NOSIGNAL);
+                if (put < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (put <= 0) {
+                        return false;
+                }
+                next += put;
+                length -= put;
+        }
+        return true;
+}
+
+/************ recv_all ************
+*
+* Description: receives exactly length bytes from a socket
+*
+* Parameters: int fd: the socket
+*             void *bytes: filled with the bytes
+*             size_t length: how many
+*
+* Returns: true if every byte arrived before the connection closed
+*
+* Expects: bytes != NULL unless length is 0
+*
+* Notes: N/A
+**********************************/
+static bool recv_all(int fd, void *bytes, size_t length)
+{
+        uint8_t *next = bytes;
+        while (length > 0) {
+                ssize_t got = recv(fd, next, length, 0);
+                if (got < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (got <= 0) {
+                        return false;
+                }
+                next += got;
+                length -= got;
+        }
+        return true;
+}
+
+/************ request_shutdown ************
+*
+* Description: the SIGINT and SIGTERM handler: stops the server accepting
+*
+* Parameters: int signum: the signal
+*
+* Returns: void
+*
+* Expects: N/A
+*
+* Notes: installed without SA_RESTART, so accept returns and sees the flag
+**********************************/
+static void request_shutdown(int signum)
+{
+        (void)signum;
+        stopping = 1;
+}
+
+/************ run_client ************
+*
+* Description: sends a request to the server, as many times as asked, and
+* writes the output of each job to standard output
+*
+* Parameters: const char *socketPath: the server's socket
+*             const char *program: the program file
+*             const char *input: the input file, or NULL for none
+*             unsigned runs: how many times to send the request
+*
+* Returns: EXIT_SUCCESS if every job halted
+*
+* Expects: socketPath != NULL, program != NULL, runs > 0
+*
+* Notes: the paths are made absolute first, since the server may run in
+* another directory. With more than one run, the mean time from connecting
+* to the last frame is reported on stderr
+**********************************/
+static int run_client(const char *socketPath, const char *program,
+                      const char *input, unsigned runs)
+{
+        char programPath[PATH_MAX];
+        char inputPath[PATH_MAX] = "";
+        if (realpath(program, programPath) == NULL) {
+                fprintf(stderr, "umd: could not find %s\n", program);
+                return EXIT_FAILURE;
+        }
+        if (input != NULL && realpath(input, inputPath) == NULL) {
+                fprintf(stderr, "umd: could not find %s\n", input);
+                return EXIT_FAILURE;
+        }
+        size_t programLength = strlen(programPath) + 1;
+        size_t inputLength = strlen(inputPath) + 1;
+        char *request = malloc(programLength + inputLength);
+        assert(request);
+        memcpy(request, programPath, programLength);
+        memcpy(request + programLength, inputPath, inputLength);
+
+        int result = EXIT_SUCCESS;
+        uint64_t start = now_ns();
+        for (unsigned run = 0; run < runs && result == EXIT_SUCCESS; run++) {
+                result = run_job(socketPath, request,
+                                 programLength + inputLength);
+        }
+        uint64_t elapsed = now_ns() - start;
+        if (runs > 1 && result == EXIT_SUCCESS) {
+                fprintf(stderr, "umd: %u jobs, %.1f us per job\n", runs,
+                        elapsed / 1e3 / runs);
+        }
+        free(request);
+        return result;
+}
+
+/************ run_job ************
+*
+* Description: sends one request and copies the reply to standard output
+*
+* Parameters: const char *socketPath: the server's socket
+*             const char *request: the request
+*             size_t length: its length in bytes
+*
+* Returns: EXIT_SUCCESS if the job halted
+*
+* Expects: socketPath != NULL, request != NULL
+*
+* Notes: a fault or error the server reports goes to stderr
+**********************************/
+static int run_job(const char *socketPath, const char *request,
+                   size_t length)
+{
+        int server = connect_to(socketPath);
+        if (server < 0 || !send_all(server, request, length)) {
+                fprintf(stderr, "umd: could not reach %s\n", socketPath);
+                if (server >= 0) {
+                        close(server);
+                }
+                return EXIT_FAILURE;
+        }
+        int result = EXIT_FAILURE;
+        uint8_t *buffer = NULL;
+        Umd_frame frame;
+        while (recv_all(server, &frame, sizeof(frame))) {
+                buffer = realloc(buffer, frame.length + 1);
+                assert(buffer);
+                if (!recv_all(server, buffer, frame.length)) {
+                        break;
+                }
+                if (frame.kind == UMD_OUTPUT) {
+                        fwrite(buffer, 1, frame.length, stdout);
+                        continue;
+                }
+                buffer[frame.length] = '\0';
+                if (frame.kind == UMD_HALTED) {
+                        result = EXIT_SUCCESS;
+                } else {
+                        fprintf(stderr, "umd: %s\n", (char *)buffer);
+                }
+                break;
+        }
+        fflush(stdout);
+        free(buffer);
+        close(server);
+        return result;
+}
+
+/************ connect_to ************
+*
+* Description: connects to the server's socket
+*
+* Parameters: const char *socketPath: the socket
+*
+* Returns: the connected socket, or -1
+*
+* Expects: socketPath != NULL
+*
+* Notes: N/A
+**********************************/
+static int connect_to(const char *socketPath)
+{
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(address.sun_path)) {
+                return -1;
+        }
+        strcpy(address.sun_path, socketPath);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&address,
+                               sizeof(address)) != 0) {
+                close(fd);
+                fd = -1;
+        }
+        return fd;
+}
+
+/************ now_ns ************
+*
+* Description: reads the monotonic clock
+*
+* Parameters: N/A
+*
+* Returns: the time in nanoseconds
+*
+* Expects: N/A
+*
+* Notes: N/A
+**********************************/
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
@@ -7,6 +7,26 @@
 #include "fmt.h"
 #include "seq.h"
 
+#ifdef UM_API_TESTS
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "um.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "pool.h"
+#include "host.h"
+#include "jit.h"
+#endif
+
 extern void Um_write_sequence(FILE *output, Seq_T instructions);
 
 extern void build_halt_test(Seq_T instructions);
@@ -26,6 +46,11 @@ extern void test_everything(Seq_T stream);
 extern void print_alphabet(Seq_T stream);
 extern void build_cmov(Seq_T stream);
 extern void map_unmap_remap(Seq_T stream);
+extern void build_fused_jump(Seq_T stream);
+extern void build_cow_load(Seq_T stream);
+extern void build_echo(Seq_T stream);
+extern void build_segment_alphabet(Seq_T stream);
+extern void build_loadp_past_end(Seq_T stream);
 
 /* The array `tests` contains all unit tests for the lab. */
 
@@ -52,12 +77,182 @@ static struct test_info {
         { "test_all", NULL, "", test_everything },
         { "print_abc", NULL, "", print_alphabet },
         { "build_cmov", NULL, "", build_cmov },
-        { "map_unmap_remap", NULL, "", map_unmap_remap }
+        { "map_unmap_remap", NULL, "", map_unmap_remap },
+        { "fused_jump", NULL, "Bb", build_fused_jump },
+        { "cow_load", NULL, "ok", build_cow_load },
+        { "echo", "echo me", "echo me", build_echo },
+        { "segment_alphabet", NULL, "abcdefghijklmnopqrstuvwxyz", 
+          build_segment_alphabet }
 };
 
   
 #define NTESTS (sizeof(tests)/sizeof(tests[0]))
 
+#ifdef UM_API_TESTS
+/* The array `api_tests` contains tests of the UM's C interface, which run
+ * the programs above in place rather than writing them out. They are only
+ * built when this file is compiled with -DUM_API_TESTS and linked with the
+ * UM's modules (all but main.c), and each checks its results with assert.
+ * The umd tests start the server binary, from $UMD or else ./umd, and talk
+ * to it over its socket.
+ */
+
+static void test_snapshot_restore(void);
+static void test_checkpoint_delta(void);
+static void test_checkpoint_engines(void);
+static void test_fork_isolation(void);
+static void test_pool_copies(void);
+static void test_pool_waiting(void);
+static void test_step_budget(void);
+static void test_step_input(void);
+static void test_step_fault(void);
+static void test_host_sessions(void);
+static void test_lazy_segments(void);
+static void test_umd_cache(void);
+static void test_umd_errors(void);
+static void test_umd_peer(void);
+
+static struct api_test_info {
+        const char *name;
+        void (*run_test)(void);
+} api_tests[] = {
+        { "api_snapshot_restore", test_snapshot_restore },
+        { "api_checkpoint_delta", test_checkpoint_delta },
+        { "api_checkpoint_engines", test_checkpoint_engines },
+        { "api_fork_isolation", test_fork_isolation },
+        { "api_pool_copies", test_pool_copies },
+        { "api_pool_waiting", test_pool_waiting },
+        { "api_step_budget", test_step_budget },
+        { "api_step_input", test_step_input },
+        { "api_step_fault", test_step_fault },
+        { "api_host_sessions", test_host_sessions },
+        { "api_lazy_segments", test_lazy_segments },
+        { "api_umd_cache", test_umd_cache },
+        { "api_umd_errors", test_umd_errors },
+        { "api_umd_peer", test_umd_peer }
+};
+
+#define NAPITESTS (sizeof(api_tests)/sizeof(api_tests[0]))
+#define ALPHABET "abcdefghijklmnopqrstuvwxyz"
+#define COPIES 8
+#define LAZY_TEST_WORDS 4096
+#define LAZY_DEFAULT_WORDS (1u << 18)
+#define UMD_START_TRIES 200
+#define UMD_START_TICK_NS 10000000
+#define NOBODY 65534
+
+/* the reply frame kinds umd sends, and a frame's header */
+enum { UMD_OUTPUT = 1, UMD_HALTED, UMD_FAULTED, UMD_ERROR };
+typedef struct Umd_frame {
+        uint32_t kind;
+        uint32_t length;
+} Umd_frame;
+
+/* what a umd job sent back: the kind and text of its last frame, and the 
+ * output from the frames before it
+ */
+typedef struct Umd_reply {
+        uint32_t kind;
+        char message[64];
+        char output[64];
+        size_t length;
+} Umd_reply;
+
+/* a running umd, the socket it listens on, and the file its stderr goes 
+ * to
+ */
+typedef struct Umd_server {
+        pid_t pid;
+        char *socketPath;
+        char *logPath;
+} Umd_server;
+
+/* two programs with the same length and 64 bit FNV-1a hash, which umd's 
+ * cache keys on: each outputs its letter and halts, and the two words 
+ * after the HALT, never run, were searched for to make the hashes collide
+ */
+static const uint32_t collideA[] = {
+        0xd0000041, 0xa0000000, 0x70000000, 0xf8f2551c, 0xcff027e5
+};
+static const uint32_t collideB[] = {
+        0xd0000042, 0xa0000000, 0x70000000, 0xd3bc0bac, 0xcb686905
+};
+
+/* how a UM run on a pool or a host finished, and what it wrote */
+typedef struct Copy_result {
+        Um_status status;
+        char *output;
+} Copy_result;
+
+/* the Pool_done that fills in a Copy_result, then frees the UM */
+static void collect_copy(Um universe, Um_status status, void *cl);
+
+/* the Pool_done that fills in only the status, then frees the UM */
+static void collect_status(Um universe, Um_status status, void *cl);
+
+/* input handed to a callback channel a byte at a time, only once ready is
+ * set, and the output written to it
+ */
+typedef struct Drip {
+        const char *input;
+        size_t next;
+        bool ready;
+        char output[64];
+        size_t length;
+} Drip;
+
+/* the pipe ends a host session reads and writes, and how it finished */
+typedef struct Piped {
+        int in;
+        int out;
+        Um_status status;
+} Piped;
+
+/* the Host_done that records how a session finished, closes its pipe 
+ * ends, and frees the UM
+ */
+static void close_session(Um universe, Um_status status, void *cl);
+
+static size_t drip_read(void *cl, uint8_t *buf, size_t cap);
+static void drip_write(void *cl, const uint8_t *buf, size_t len);
+
+/* loads the program build writes, on a memory channel reading input */
+static Um load_test(void (*build)(Seq_T stream), const char *input);
+
+/* a copy of what the UM has written so far, which the caller frees */
+static char *output_copy(Um universe);
+
+/* the letter count segment_alphabet keeps in its segment */
+static uint32_t letters_printed(Um universe);
+
+/* the name of a new empty file, which the caller removes and frees */
+static char *temp_path(void);
+
+/* writes numWords words to path, most significant byte first */
+static void write_words(const char *path, const uint32_t *words, 
+                        size_t numWords);
+
+/* starts umd with two workers, and waits until it accepts connections; 
+ * umd is stopped if the tests exit first, as they do when an assert fails
+ */
+static Umd_server start_umd(void);
+
+/* stops umd with SIGTERM, and reads the job, load and cache hit counts 
+ * it reports as it exits
+ */
+static void stop_umd(Umd_server server, uint64_t counts[3]);
+
+/* connects to umd, or returns -1 */
+static int connect_umd(const char *socketPath);
+
+/* sends a request, and reads the reply until umd closes the connection */
+static Umd_reply umd_request(const char *socketPath, const void *request,
+                             size_t length);
+
+/* reads a reply from a connected socket until umd closes it */
+static Umd_reply read_reply(int fd);
+#endif
+
 /*
  * open file 'path' for writing, then free the pathname;
  * if anything fails, checked runtime error
@@ -77,11 +272,19 @@ int main (int argc, char *argv[])
 {
         bool failed = false;
         if (argc == 1)
+        {
                 for (unsigned i = 0; i < NTESTS; i++) {
                         printf("***** Writing test '%s'.\n", tests[i].name);
                         write_test_files(&tests[i]);
                 }
-        else
+#ifdef UM_API_TESTS
+                for (unsigned i = 0; i < NAPITESTS; i++) {
+                        printf("***** Running test '%s'.\n", 
+                               api_tests[i].name);
+                        api_tests[i].run_test();
+                }
+#endif
+        } else
                 for (int j = 1; j < argc; j++) {
                         bool tested = false;
                         for (unsigned i = 0; i < NTESTS; i++)
@@ -89,6 +292,13 @@ int main (int argc, char *argv[])
                                         tested = true;
                                         write_test_files(&tests[i]);
                                 }
+#ifdef UM_API_TESTS
+                        for (unsigned i = 0; i < NAPITESTS; i++)
+                                if (!strcmp(api_tests[i].name, argv[j])) {
+                                        tested = true;
+                                        api_tests[i].run_test();
+                                }
+#endif
                         if (!tested) {
                                 failed = true;
                                 fprintf(stderr,
@@ -139,3 +349,775 @@ static FILE *open_and_free_pathname(char *path)
         free(path);
         return fp;
 }
+
+
+#ifdef UM_API_TESTS
+/* runs segment_alphabet partway, snapshots it, and checks that the copy
+ * restored from the snapshot prints the rest of the alphabet, just as the
+ * original goes on to
+ */
+static void test_snapshot_restore(void)
+{
+        Um original = load_test(build_segment_alphabet, NULL);
+        bool halted = run_um_until(original, 100);
+        assert(!halted);
+        char *before = output_copy(original);
+        char *path = temp_path();
+        bool saved = save_snapshot(original, path);
+        assert(saved);
+
+        Um restored = restore_snapshot(path);
+        assert(restored != NULL);
+        set_channel(restored, init_mem_channel(NULL, 0));
+        run_um(original);
+        run_um(restored);
+        char *after = output_copy(original);
+        char *rest = output_copy(restored);
+        assert(!strcmp(after, ALPHABET));
+        assert(*before != '\0' && *rest != '\0');
+        assert(!strcmp(after + strlen(before), rest));
+
+        free_um(original);
+        free_um(restored);
+        remove(path);
+        free(path);
+        free(before);
+        free(after);
+        free(rest);
+}
+
+
+/* checkpoints segment_alphabet partway, so the log holds the whole table,
+ * then runs it further and finishes the log, which adds a delta holding 
+ * the letter count it stored since; the UM restored from the log has to 
+ * apply the delta to the base to have the same count, and print the same
+ * rest of the alphabet, as the original
+ */
+static void test_checkpoint_delta(void)
+{
+        Um original = load_test(build_segment_alphabet, NULL);
+        bool halted = run_um_until(original, 50);
+        char *path = temp_path();
+        Checkpointer ckpt = start_checkpoints(original, path);
+        assert(ckpt != NULL);
+        bool taken = take_checkpoint(ckpt);
+        halted = halted || run_um_until(original, 100);
+        assert(taken && !halted);
+        char *before = output_copy(original);
+        bool written = finish_checkpoints(ckpt);
+        assert(written);
+
+        Um restored = restore_checkpoint(path);
+        assert(restored != NULL);
+        set_channel(restored, init_mem_channel(NULL, 0));
+        assert(get_pc(restored) == get_pc(original));
+        assert(letters_printed(restored) == letters_printed(original));
+        run_um(original);
+        run_um(restored);
+        char *after = output_copy(original);
+        char *rest = output_copy(restored);
+        assert(!strcmp(after, ALPHABET));
+        assert(*rest != '\0');
+        assert(!strcmp(after + strlen(before), rest));
+
+        free_um(original);
+        free_um(restored);
+        remove(path);
+        free(path);
+        free(before);
+        free(after);
+        free(rest);
+}
+
+
+/* checkpoints segment_alphabet partway, then runs it on with the threaded
+ * engine for a budget, and finishes the log, and again with the JIT to its
+ * halt; each delta holds the letter count only if the engine reported its 
+ * stores to dirty tracking, so each restored UM must have the original's 
+ * count
+ */
+static void test_checkpoint_engines(void)
+{
+        for (int jitted = 0; jitted < 2; jitted++) {
+                Um original = load_test(build_segment_alphabet, NULL);
+                bool halted = run_um_until(original, 50);
+                char *path = temp_path();
+                Checkpointer ckpt = start_checkpoints(original, path);
+                assert(ckpt != NULL);
+                bool taken = take_checkpoint(ckpt);
+                assert(taken && !halted);
+                if (jitted) {
+                        run_um_jit(original);
+                } else {
+                        Um_status status = run_um_for(original, 100);
+                        assert(status == UM_BUDGET_EXHAUSTED);
+                }
+                bool written = finish_checkpoints(ckpt);
+                assert(written);
+
+                Um restored = restore_checkpoint(path);
+                assert(restored != NULL);
+                set_channel(restored, init_mem_channel(NULL, 0));
+                assert(get_pc(restored) == get_pc(original));
+                assert(letters_printed(restored) == 
+                       letters_printed(original));
+                assert(!jitted || letters_printed(restored) == 26);
+
+                free_um(original);
+                free_um(restored);
+                remove(path);
+                free(path);
+        }
+}
+
+
+/* forks segment_alphabet partway and runs the child to its halt; the 
+ * child's stores into the letter count segment, which the two share until
+ * then, must not show in the parent, which then prints the same rest of 
+ * the alphabet as the child did
+ */
+static void test_fork_isolation(void)
+{
+        Um parent = load_test(build_segment_alphabet, NULL);
+        bool halted = run_um_until(parent, 100);
+        assert(!halted);
+        char *before = output_copy(parent);
+        uint32_t count = letters_printed(parent);
+        assert(count > 0 && count < 26);
+
+        Um child = fork_um(parent, init_mem_channel(NULL, 0));
+        run_um(child);
+        assert(letters_printed(child) == 26);
+        assert(letters_printed(parent) == count);
+        run_um(parent);
+        char *after = output_copy(parent);
+        char *rest = output_copy(child);
+        assert(!strcmp(after, ALPHABET));
+        assert(!strcmp(after + strlen(before), rest));
+
+        free_um(child);
+        free_um(parent);
+        free(before);
+        free(after);
+        free(rest);
+}
+
+
+/* forks echo once per input and runs the copies on a pool, a few 
+ * instructions at a time, so each is sliced many times and may move 
+ * between workers; every copy must halt having echoed its own input
+ */
+static void test_pool_copies(void)
+{
+        Um original = load_test(build_echo, NULL);
+        char *inputs[COPIES];
+        Copy_result results[COPIES];
+        Pool pool = init_pool(3, 20);
+        for (unsigned i = 0; i < COPIES; i++) {
+                inputs[i] = Fmt_string("copy %u reads this line", i);
+                Channel io = init_mem_channel((const uint8_t *)inputs[i],
+                                              strlen(inputs[i]));
+                pool_submit(pool, fork_um(original, io), collect_copy,
+                            &results[i]);
+        }
+        pool_wait(pool, 0);
+        Pool_stats stats = get_pool_stats(pool);
+        assert(stats.finished == COPIES && stats.slices > COPIES);
+        free_pool(pool);
+        for (unsigned i = 0; i < COPIES; i++) {
+                assert(results[i].status == UM_HALTED);
+                assert(!strcmp(results[i].output, inputs[i]));
+                free(results[i].output);
+                free(inputs[i]);
+        }
+        free_um(original);
+}
+
+
+/* runs segment_alphabet with run_um_for a small budget at a time; it must
+ * stop at the top of its loop (the only LOADP target) each time, count the
+ * same instructions by its halt as a run with run_um, stay halted, and 
+ * print the alphabet
+ */
+static void test_step_budget(void)
+{
+        Um stepped = load_test(build_segment_alphabet, NULL);
+        Um whole = load_test(build_segment_alphabet, NULL);
+        run_um(whole);
+        unsigned stops = 0;
+        Um_status status;
+        while ((status = run_um_for(stepped, 15)) == UM_BUDGET_EXHAUSTED) {
+                assert(get_pc(stepped) == 8);
+                stops++;
+        }
+        assert(status == UM_HALTED && stops > 1);
+        assert(get_instruction_count(stepped) == 
+               get_instruction_count(whole));
+        status = resume_um(stepped);
+        assert(status == UM_HALTED);
+        char *output = output_copy(stepped);
+        assert(!strcmp(output, ALPHABET));
+
+        free_um(stepped);
+        free_um(whole);
+        free(output);
+}
+
+
+/* runs echo with resume_um on a channel whose input is never ready until
+ * the test says so, a byte at a time; it must stop at the IN once for 
+ * every byte and once for the end of input, and echo everything
+ */
+static void test_step_input(void)
+{
+        Um universe = load_test(build_echo, NULL);
+        Drip drip = { "round trip", 0, false, { 0 }, 0 };
+        set_channel(universe, init_callback_channel(drip_read, drip_write,
+                                                    &drip));
+        unsigned waits = 0;
+        Um_status status;
+        while ((status = resume_um(universe)) == UM_WAITING_INPUT) {
+                assert(get_pc(universe) == 3);
+                waits++;
+                drip.ready = true;
+        }
+        assert(status == UM_HALTED);
+        assert(waits == strlen(drip.input) + 1);
+        assert(drip.length == strlen(drip.input));
+        assert(!memcmp(drip.output, drip.input, drip.length));
+        free_um(universe);
+}
+
+
+/* runs loadp_past_end, whose LOADP asks for a word past the end of the 
+ * segment it loads; it must fault at the LOADP with segment 0 left as it 
+ * was, and stay faulted however it is run again
+ */
+static void test_step_fault(void)
+{
+        Um universe = load_test(build_loadp_past_end, NULL);
+        Um_status status = run_um_for(universe, 1000);
+        assert(status == UM_FAULTED && get_pc(universe) == 5);
+        allSegments segs = get_seg_sequences(universe);
+        assert(get_length(get_segment(segs, 0)) == 7);
+        status = resume_um(universe);
+        assert(status == UM_FAULTED);
+        status = run_um_for(universe, 1000);
+        assert(status == UM_FAULTED && get_pc(universe) == 5);
+        char *output = output_copy(universe);
+        assert(!strcmp(output, "A"));
+        free_um(universe);
+        free(output);
+}
+
+
+/* runs copies of echo as host sessions on pipes, added before any input is
+ * written so that every one of them has to wait in epoll, then writes each
+ * its input in two parts; every session must halt having echoed its input
+ * to its output pipe
+ */
+static void test_host_sessions(void)
+{
+        Um original = load_test(build_echo, NULL);
+        char *inputs[COPIES];
+        int feeds[COPIES];
+        int outputs[COPIES];
+        Piped sessions[COPIES];
+        Host host = init_host(2, 20);
+        for (unsigned i = 0; i < COPIES; i++) {
+                int in[2], out[2];
+                int failed = pipe(in) | pipe(out);
+                assert(failed == 0);
+                inputs[i] = Fmt_string("session %u reads this line", i);
+                feeds[i] = in[1];
+                outputs[i] = out[0];
+                sessions[i].in = in[0];
+                sessions[i].out = out[1];
+                host_add(host, fork_um(original, init_mem_channel(NULL, 0)),
+                         in[0], out[1], close_session, &sessions[i]);
+        }
+        while (get_host_stats(host).waits < COPIES) {
+                usleep(1000);
+        }
+        for (unsigned i = 0; i < COPIES; i++) {
+                size_t length = strlen(inputs[i]);
+                ssize_t put = write(feeds[i], inputs[i], length / 2);
+                put += write(feeds[i], inputs[i] + length / 2, 
+                             length - length / 2);
+                assert(put == (ssize_t)length);
+                close(feeds[i]);
+        }
+        host_wait(host, 0);
+        assert(get_host_stats(host).finished == COPIES);
+        free_host(host);
+
+        for (unsigned i = 0; i < COPIES; i++) {
+                char output[64];
+                size_t length = 0;
+                ssize_t got;
+                while ((got = read(outputs[i], output + length, 
+                                   sizeof(output) - length)) > 0) {
+                        length += got;
+                }
+                close(outputs[i]);
+                assert(sessions[i].status == UM_HALTED);
+                assert(length == strlen(inputs[i]));
+                assert(!memcmp(output, inputs[i], length));
+                free(inputs[i]);
+        }
+        free_um(original);
+}
+
+
+/* runs echo on a pool with a channel that never has input ready; the pool
+ * must hand it to done, stopped at its IN, rather than run it again
+ */
+static void test_pool_waiting(void)
+{
+        Um universe = load_test(build_echo, NULL);
+        Drip drip = { "never read", 0, false, { 0 }, 0 };
+        set_channel(universe, init_callback_channel(drip_read, drip_write,
+                                                    &drip));
+        Copy_result result = { UM_HALTED, NULL };
+        Pool pool = init_pool(1, 20);
+        pool_submit(pool, universe, collect_status, &result);
+        pool_wait(pool, 0);
+        Pool_stats stats = get_pool_stats(pool);
+        free_pool(pool);
+        assert(result.status == UM_WAITING_INPUT);
+        assert(stats.finished == 1 && stats.slices == 1);
+}
+
+
+/* with the lazy threshold lowered, maps one segment just under it and one
+ * far over it; only the big one gets a mapping of its own, and after one 
+ * store into it only about a page of it is resident (a huge page at most,
+ * if the kernel backs it with one anyway). Unmapping it has to give the 
+ * mapping back, so its address is no longer mapped at all
+ */
+static void test_lazy_segments(void)
+{
+        Um universe = load_test(build_halt_test, NULL);
+        allSegments segs = get_seg_sequences(universe);
+        uint32_t bigWords = LAZY_TEST_WORDS * 4096;
+        Seg_stats before = get_seg_stats(segs);
+        set_lazy_threshold(LAZY_TEST_WORDS);
+        uint32_t small = init_segment(LAZY_TEST_WORDS - 1, segs);
+        uint32_t big = init_segment(bigWords, segs);
+        set_lazy_threshold(LAZY_DEFAULT_WORDS);
+        Seg_stats mapped = get_seg_stats(segs);
+        assert(mapped.lazyAllocs == before.lazyAllocs + 1);
+        assert(mapped.mappedWords == 
+               before.mappedWords + LAZY_TEST_WORDS - 1 + bigWords);
+
+        uint32_t *words = get_writable_mem(segs, big);
+        words[bigWords / 2] = 1;
+        Seg_stats touched = get_seg_stats(segs);
+        uint64_t resident = touched.residentWords - before.residentWords - 
+                            (LAZY_TEST_WORDS - 1);
+        assert(resident > 0 && resident * 32 <= bigWords);
+
+        long page = sysconf(_SC_PAGESIZE);
+        void *start = (void *)((uintptr_t)words & ~(uintptr_t)(page - 1));
+        unsigned char vec;
+        int inCore = mincore(start, page, &vec);
+        assert(inCore == 0);
+        unmap_id(big, segs);
+        inCore = mincore(start, page, &vec);
+        assert(inCore == -1 && errno == ENOMEM);
+        Seg_stats unmapped = get_seg_stats(segs);
+        assert(unmapped.mappedWords == 
+               before.mappedWords + LAZY_TEST_WORDS - 1);
+        assert(unmapped.released == touched.released + 1);
+
+        unmap_id(small, segs);
+        free_um(universe);
+}
+
+
+/* requests the two colliding programs, and each again, with umd's cache 
+ * keyed on their shared hash: every job must print its own program's 
+ * letter, so the cache loads both and hits only when the words match. The
+ * first file is then rewritten in place with the second's words, and must
+ * be run as the second program
+ */
+static void test_umd_cache(void)
+{
+        char *pathA = temp_path();
+        char *pathB = temp_path();
+        write_words(pathA, collideA, 5);
+        write_words(pathB, collideB, 5);
+        Umd_server server = start_umd();
+        const char *expected[] = { "A", "B", "A", "B", "B" };
+        const char *paths[] = { pathA, pathB, pathA, pathB, pathA };
+        for (unsigned i = 0; i < 5; i++) {
+                if (i == 4) {
+                        write_words(pathA, collideB, 5);
+                }
+                char *request = Fmt_string("%s%c%c", paths[i], 0, 0);
+                Umd_reply reply = umd_request(server.socketPath, request,
+                                              strlen(paths[i]) + 2);
+                free(request);
+                assert(reply.kind == UMD_HALTED);
+                assert(reply.length == 1 && reply.output[0] == 
+                       expected[i][0]);
+        }
+        uint64_t counts[3];
+        stop_umd(server, counts);
+        assert(counts[0] == 5 && counts[1] == 2 && counts[2] == 3);
+        remove(pathA);
+        remove(pathB);
+        free(pathA);
+        free(pathB);
+}
+
+
+/* sends umd requests that cannot run, each of which must get the error 
+ * frame that says why, a request with bytes after its second NUL, which 
+ * must still run, a program that faults, and a program that never halts, 
+ * which must be cancelled once umd is told to stop
+ */
+static void test_umd_errors(void)
+{
+        char *program = temp_path();
+        char *ragged = temp_path();
+        char *faulting = temp_path();
+        char *forever = temp_path();
+        char *missing = temp_path();
+        remove(missing);
+        write_words(program, collideA, 5);
+        FILE *file = fopen(ragged, "wb");
+        assert(file);
+        fputs("12345", file);
+        fclose(file);
+        uint32_t divide = 0x5000000a;
+        write_words(faulting, &divide, 1);
+        uint32_t loop = 0xc0000000;
+        write_words(forever, &loop, 1);
+        Umd_server server = start_umd();
+
+        struct {
+                const char *program;
+                const char *input;
+                uint32_t kind;
+                const char *message;
+        } cases[] = {
+                { missing, "", UMD_ERROR, "could not open program" },
+                { ragged, "", UMD_ERROR, 
+                  "program is not a whole number of instructions" },
+                { program, missing, UMD_ERROR, "could not open input" },
+                { faulting, "", UMD_FAULTED, "faulted at pc 0" },
+                { program, "", UMD_HALTED, "" }
+        };
+        for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+                char *request = Fmt_string("%s%c%s%cafter the request", 
+                                           cases[i].program, 0, 
+                                           cases[i].input, 0);
+                size_t length = strlen(cases[i].program) + 
+                                strlen(cases[i].input) + 19;
+                Umd_reply reply = umd_request(server.socketPath, request,
+                                              length);
+                free(request);
+                assert(reply.kind == cases[i].kind);
+                assert(!strcmp(reply.message, cases[i].message));
+        }
+        Umd_reply reply = umd_request(server.socketPath, program, 
+                                      strlen(program) + 1);
+        assert(reply.kind == UMD_ERROR);
+        assert(!strcmp(reply.message, "bad request"));
+
+        int client = connect_umd(server.socketPath);
+        assert(client >= 0);
+        char *request = Fmt_string("%s%c%c", forever, 0, 0);
+        ssize_t sent = send(client, request, strlen(forever) + 2, 0);
+        assert(sent == (ssize_t)strlen(forever) + 2);
+        free(request);
+        uint64_t counts[3];
+        stop_umd(server, counts);
+        reply = read_reply(client);
+        close(client);
+        assert(reply.kind == UMD_ERROR);
+        assert(!strcmp(reply.message, "server shutting down"));
+        assert(counts[0] == 3);
+
+        char *paths[] = { program, ragged, faulting, forever };
+        for (unsigned i = 0; i < 4; i++) {
+                remove(paths[i]);
+                free(paths[i]);
+        }
+        free(missing);
+}
+
+
+/* connects to umd as another user, through a socket opened up to everyone
+ * so that only umd's own check can refuse it, and must be refused with 
+ * "permission denied". Switching users needs root, so without it there is
+ * nothing to check
+ */
+static void test_umd_peer(void)
+{
+        if (geteuid() != 0) {
+                return;
+        }
+        char *program = temp_path();
+        write_words(program, collideA, 5);
+        Umd_server server = start_umd();
+        int opened = chmod(server.socketPath, 0666);
+        assert(opened == 0);
+        pid_t child = fork();
+        assert(child >= 0);
+        if (child == 0) {
+                if (setgid(NOBODY) != 0 || setuid(NOBODY) != 0) {
+                        _exit(2);
+                }
+                char *request = Fmt_string("%s%c%c", program, 0, 0);
+                Umd_reply reply = umd_request(server.socketPath, request,
+                                              strlen(program) + 2);
+                _exit(reply.kind == UMD_ERROR && 
+                      !strcmp(reply.message, "permission denied") ? 0 : 1);
+        }
+        int status;
+        pid_t waited = waitpid(child, &status, 0);
+        assert(waited == child);
+        uint64_t counts[3];
+        stop_umd(server, counts);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        assert(counts[0] == 0);
+        remove(program);
+        free(program);
+}
+
+
+static void collect_copy(Um universe, Um_status status, void *cl)
+{
+        Copy_result *result = cl;
+        result->status = status;
+        result->output = output_copy(universe);
+        free_um(universe);
+}
+
+
+static void collect_status(Um universe, Um_status status, void *cl)
+{
+        Copy_result *result = cl;
+        result->status = status;
+        free_um(universe);
+}
+
+
+static void close_session(Um universe, Um_status status, void *cl)
+{
+        Piped *session = cl;
+        session->status = status;
+        free_um(universe);
+        close(session->in);
+        close(session->out);
+}
+
+
+static size_t drip_read(void *cl, uint8_t *buf, size_t cap)
+{
+        Drip *drip = cl;
+        assert(cap > 0);
+        if (!drip->ready) {
+                return CHANNEL_NOT_READY;
+        }
+        drip->ready = false;
+        if (drip->input[drip->next] == '\0') {
+                return 0;
+        }
+        buf[0] = drip->input[drip->next++];
+        return 1;
+}
+
+
+static void drip_write(void *cl, const uint8_t *buf, size_t len)
+{
+        Drip *drip = cl;
+        assert(drip->length + len <= sizeof(drip->output));
+        memcpy(drip->output + drip->length, buf, len);
+        drip->length += len;
+}
+
+
+static Um load_test(void (*build)(Seq_T stream), const char *input)
+{
+        FILE *binary = tmpfile();
+        assert(binary != NULL);
+        Seq_T instructions = Seq_new(0);
+        build(instructions);
+        Um_write_sequence(binary, instructions);
+        Seq_free(&instructions);
+        rewind(binary);
+        Um universe = init_um(binary);
+        fclose(binary);
+        set_channel(universe, 
+                    init_mem_channel((const uint8_t *)input, 
+                                     input == NULL ? 0 : strlen(input)));
+        return universe;
+}
+
+
+static char *output_copy(Um universe)
+{
+        size_t length;
+        const uint8_t *output = get_mem_output(get_channel(universe), 
+                                               &length);
+        char *copy = malloc(length + 1);
+        assert(copy != NULL);
+        memcpy(copy, output, length);
+        copy[length] = '\0';
+        return copy;
+}
+
+
+static uint32_t letters_printed(Um universe)
+{
+        allSegments segs = get_seg_sequences(universe);
+        return get_mem(get_segment(segs, get_register(universe, 2)))[0];
+}
+
+
+static char *temp_path(void)
+{
+        char *path = Fmt_string("/tmp/umlabwrite-XXXXXX");
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        close(fd);
+        return path;
+}
+
+
+static void write_words(const char *path, const uint32_t *words, 
+                        size_t numWords)
+{
+        FILE *file = fopen(path, "wb");
+        assert(file);
+        for (size_t i = 0; i < numWords; i++) {
+                uint32_t word = htonl(words[i]);
+                size_t put = fwrite(&word, sizeof(word), 1, file);
+                assert(put == 1);
+        }
+        fclose(file);
+}
+
+
+static Umd_server start_umd(void)
+{
+        Umd_server server = { -1, temp_path(), temp_path() };
+        remove(server.socketPath);
+        const char *umd = getenv("UMD");
+        if (umd == NULL) {
+                umd = "./umd";
+        }
+        server.pid = fork();
+        assert(server.pid >= 0);
+        if (server.pid == 0) {
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+                FILE *log = freopen(server.logPath, "w", stderr);
+                if (log != NULL) {
+                        execl(umd, "umd", "-w", "2", server.socketPath,
+                              (char *)NULL);
+                }
+                _exit(127);
+        }
+        struct timespec tick = { 0, UMD_START_TICK_NS };
+        for (unsigned i = 0; i < UMD_START_TRIES; i++) {
+                int fd = connect_umd(server.socketPath);
+                if (fd >= 0) {
+                        close(fd);
+                        return server;
+                }
+                nanosleep(&tick, NULL);
+        }
+        fprintf(stderr, "could not start %s\n", umd);
+        assert(0);
+        return server;
+}
+
+
+static void stop_umd(Umd_server server, uint64_t counts[3])
+{
+        kill(server.pid, SIGTERM);
+        int status;
+        pid_t waited = waitpid(server.pid, &status, 0);
+        assert(waited == server.pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        FILE *log = fopen(server.logPath, "r");
+        assert(log);
+        char line[256];
+        int found = 0;
+        unsigned long long jobs, loads, hits;
+        while (found != 3 && fgets(line, sizeof(line), log) != NULL) {
+                found = sscanf(line, "umd: %llu jobs, %llu programs loaded,"
+                               " %llu cache hits", &jobs, &loads, &hits);
+        }
+        fclose(log);
+        assert(found == 3);
+        counts[0] = jobs;
+        counts[1] = loads;
+        counts[2] = hits;
+        remove(server.logPath);
+        free(server.logPath);
+        free(server.socketPath);
+}
+
+
+static int connect_umd(const char *socketPath)
+{
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        assert(strlen(socketPath) < sizeof(address.sun_path));
+        strcpy(address.sun_path, socketPath);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&address,
+                               sizeof(address)) != 0) {
+                close(fd);
+                fd = -1;
+        }
+        return fd;
+}
+
+
+static Umd_reply umd_request(const char *socketPath, const void *request,
+                             size_t length)
+{
+        int fd = connect_umd(socketPath);
+        assert(fd >= 0);
+        ssize_t sent = send(fd, request, length, 0);
+        assert(sent == (ssize_t)length);
+        shutdown(fd, SHUT_WR);
+        Umd_reply reply = read_reply(fd);
+        close(fd);
+        return reply;
+}
+
+
+static Umd_reply read_reply(int fd)
+{
+        Umd_reply reply;
+        memset(&reply, 0, sizeof(reply));
+        FILE *stream = fdopen(dup(fd), "rb");
+        assert(stream);
+        Umd_frame frame;
+        while (fread(&frame, sizeof(frame), 1, stream) == 1) {
+                char *into = frame.kind == UMD_OUTPUT ? 
+                             reply.output + reply.length : reply.message;
+                size_t room = frame.kind == UMD_OUTPUT ? 
+                              sizeof(reply.output) - reply.length : 
+                              sizeof(reply.message) - 1;
+                assert(frame.length <= room);
+                size_t got = fread(into, 1, frame.length, stream);
+                assert(got == frame.length);
+                if (frame.kind == UMD_OUTPUT) {
+                        reply.length += got;
+                } else {
+                        reply.kind = frame.kind;
+                        reply.message[got] = '\0';
+                }
+        }
+        fclose(stream);
+        return reply;
+}
+#endif
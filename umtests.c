@@ -31,7 +31,8 @@ typedef enum Um_opcode {
 /* Functions that return the two instruction types */
 
 
-Um_instruction three_register(Um_opcode op, int ra, int rb, int rc)
+static inline Um_instruction three_register
+(Um_opcode op, int ra, int rb, int rc)
 {
        uint32_t word = 0;
        word = Bitpack_newu(word, 4, 28, op);
@@ -42,7 +43,7 @@ Um_instruction three_register(Um_opcode op, int ra, int rb, int rc)
        
 }
 
-Um_instruction loadval(unsigned ra, unsigned val) {
+static inline Um_instruction loadval(unsigned ra, unsigned val) {
         Um_instruction word = 0;
         word = Bitpack_newu(word, 4, 28, LV);
         word = Bitpack_newu(word, 3, 25, ra);
@@ -86,35 +87,37 @@ static inline Um_instruction nand(Um_register a, Um_register b, Um_register c)
         return three_register(NAND, a, b, c);
 }
 
-Um_instruction input(Um_register c) {
+static inline Um_instruction input(Um_register c) {
         return three_register(IN, 0, 0, c);
 }
 
-Um_instruction output(Um_register c){
+static inline Um_instruction output(Um_register c){
         return three_register(OUT, 0, 0, c);
 }
 
-Um_instruction load_segment(Um_register a, Um_register b, Um_register c) 
+static inline Um_instruction load_segment
+(Um_register a, Um_register b, Um_register c)
 {
         return three_register(SLOAD, a, b, c);
 }
 
-Um_instruction store_segment(Um_register a, Um_register b, Um_register c) 
+static inline Um_instruction store_segment
+(Um_register a, Um_register b, Um_register c)
 {
         return three_register(SSTORE, a, b, c);
 }
 
-Um_instruction map_segment(Um_register b, Um_register c) 
+static inline Um_instruction map_segment(Um_register b, Um_register c) 
 {
         return three_register(ACTIVATE, 0, b, c);
 }
 
-Um_instruction unmap_segment(Um_register c) 
+static inline Um_instruction unmap_segment(Um_register c) 
 {
         return three_register(INACTIVATE, 0, 0, c);
 }
 
-Um_instruction load_program(Um_register b, Um_register c)
+static inline Um_instruction load_program(Um_register b, Um_register c)
 {
         return three_register(LOADP, 0, b, c);
 }
@@ -127,6 +130,18 @@ static inline void append(Seq_T stream, Um_instruction inst)
         Seq_addhi(stream, (void *)(uintptr_t)inst);
 }
 
+/* appends instructions that leave an arbitrary 32-bit word in dst, using 
+tmp as scratch, for words too wide for a single load value */
+static inline void append_word(Seq_T stream, Um_register dst, Um_register tmp,
+                               uint32_t word)
+{
+        append(stream, loadval(dst, word >> 16));
+        append(stream, loadval(tmp, 1 << 16));
+        append(stream, multiply(dst, dst, tmp));
+        append(stream, loadval(tmp, word & 0xffff));
+        append(stream, add(dst, dst, tmp));
+}
+
 const uint32_t Um_word_width = 32;
 
 void Um_write_sequence(FILE *output, Seq_T stream)
@@ -327,4 +342,267 @@ void map_unmap_remap(Seq_T stream)
         append(stream, add(r6, r6, r7)); 
         append(stream, output(r6));
         append(stream, halt());
-}
\ No newline at end of file
+}
+
+/* loads a segment holding store, output, unmap, output, halt as the program;
+its first instruction overwrites the output in the segment it was loaded 
+from with a halt, which must not reach the running copy, and unmapping that
+segment must leave the copy intact */
+void build_cow_load(Seq_T stream)
+{
+        append(stream, loadval(r1, 5));
+        append(stream, map_segment(r1, r1));
+        append(stream, loadval(r6, 0));
+        append_word(stream, r5, r2, store_segment(r1, r6, r5));
+        append(stream, store_segment(r1, r6, r5));
+        append(stream, loadval(r6, 1));
+        append_word(stream, r5, r2, output(r3));
+        append(stream, store_segment(r1, r6, r5));
+        append(stream, loadval(r6, 2));
+        append_word(stream, r5, r2, unmap_segment(r1));
+        append(stream, store_segment(r1, r6, r5));
+        append(stream, loadval(r6, 3));
+        append_word(stream, r5, r2, output(r4));
+        append(stream, store_segment(r1, r6, r5));
+        append(stream, loadval(r6, 4));
+        append_word(stream, r5, r2, halt());
+        append(stream, store_segment(r1, r6, r5));
+        append(stream, loadval(r6, 1));
+        append(stream, loadval(r3, 'o'));
+        append(stream, loadval(r4, 'k'));
+        append(stream, loadval(r0, 0));
+        append(stream, load_program(r1, r0));
+}
+
+/* lines 1-3 fuse into one LV+LV+ADD superinstruction, and the second pass
+jumps into the middle of it */
+void build_fused_jump(Seq_T stream)
+{
+        append(stream, loadval(r4, 0));
+        append(stream, loadval(r1, 'A'));
+        append(stream, loadval(r2, 1));
+        append(stream, add(r3, r1, r2));
+        append(stream, output(r3));
+        append(stream, loadval(r1, 'a'));
+        append(stream, loadval(r5, 2));
+        append(stream, loadval(r6, 12));
+        append(stream, cmov(r5, r6, r4));
+        append(stream, loadval(r4, 1));
+        append(stream, loadval(r7, 0));
+        append(stream, load_program(r7, r5));
+        append(stream, halt());
+}
+
+/* copies its input to its output a byte at a time until the end of input, 
+which IN reads as all ones (NAND of it with itself is then 0) */
+void build_echo(Seq_T stream)
+{
+        append(stream, loadval(r0, 0));
+        append(stream, loadval(r5, 3));
+        append(stream, loadval(r6, 11));
+        append(stream, input(r1));
+        append(stream, nand(r2, r1, r1));
+        append(stream, loadval(r7, 11));
+        append(stream, loadval(r4, 9));
+        append(stream, cmov(r7, r4, r2));
+        append(stream, load_program(r0, r7));
+        append(stream, output(r1));
+        append(stream, load_program(r0, r5));
+        append(stream, halt());
+}
+
+/* prints the alphabet, keeping its place in a mapped one word segment 
+rather than a register, with a LOADP per letter: r2 is the segment, r4 is 
+-26 and r6 is 1 */
+void build_segment_alphabet(Seq_T stream)
+{
+        append(stream, loadval(r1, 1));
+        append(stream, map_segment(r2, r1));
+        append(stream, loadval(r0, 0));
+        append(stream, loadval(r7, 'a'));
+        append(stream, loadval(r4, 26));
+        append(stream, nand(r4, r4, r4));
+        append(stream, loadval(r6, 1));
+        append(stream, add(r4, r4, r6));
+        append(stream, load_segment(r1, r2, r0));
+        append(stream, add(r3, r7, r1));
+        append(stream, output(r3));
+        append(stream, add(r1, r1, r6));
+        append(stream, store_segment(r2, r0, r1));
+        append(stream, add(r3, r1, r4));
+        append(stream, loadval(r5, 18));
+        append(stream, loadval(r1, 8));
+        append(stream, cmov(r5, r1, r3));
+        append(stream, load_program(r0, r5));
+        append(stream, halt());
+}
+
+/* prints A, then loads a two word segment as the program and jumps to word
+5 of it, which must fault before segment 0 is replaced */
+void build_loadp_past_end(Seq_T stream)
+{
+        append(stream, loadval(r1, 2));
+        append(stream, map_segment(r2, r1));
+        append(stream, loadval(r3, 'A'));
+        append(stream, output(r3));
+        append(stream, loadval(r4, 5));
+        append(stream, load_program(r2, r4));
+        append(stream, halt());
+}
+
+
+/* Benchmark workloads for umbench, written by umbenchwrite. Each one runs
+its loop body iterations times, counting down in r7 and keeping 0 in r0; r5
+and r6 belong to the loop tail. words is the segment size of the workloads
+that use one, and is ignored by the others */
+
+/* appends the tail of a loop that starts at start: decrements r7 and jumps
+back to start unless it reached 0, in which case it falls through */
+static void append_loop_tail(Seq_T stream, uint32_t start)
+{
+        append(stream, nand(r6, r0, r0));
+        append(stream, add(r7, r7, r6));
+        append(stream, loadval(r5, Seq_length(stream) + 4));
+        append(stream, loadval(r6, start));
+        append(stream, cmov(r5, r6, r7));
+        append(stream, load_program(r0, r5));
+}
+
+/* appends the start of a loop that runs iterations times, and returns the
+index of its first instruction */
+static uint32_t append_loop_head(Seq_T stream, uint32_t iterations)
+{
+        assert(iterations > 0);
+        append_word(stream, r7, r6, iterations);
+        return Seq_length(stream);
+}
+
+/* register arithmetic only: ADD, MUL, NAND, DIV and CMOV */
+void build_bench_arith(Seq_T stream, uint32_t iterations, uint32_t words)
+{
+        (void)words;
+        uint32_t start = append_loop_head(stream, iterations);
+        append(stream, add(r1, r1, r7));
+        append(stream, multiply(r2, r1, r1));
+        append(stream, nand(r3, r2, r1));
+        append(stream, divide(r4, r3, r7));
+        append(stream, cmov(r1, r4, r3));
+        append(stream, add(r2, r2, r4));
+        append(stream, nand(r3, r3, r3));
+        append(stream, multiply(r1, r1, r2));
+        append_loop_tail(stream, start);
+        append(stream, halt());
+}
+
+/* maps a segment of words words, touches its last word, and unmaps it */
+void build_bench_churn(Seq_T stream, uint32_t iterations, uint32_t words)
+{
+        assert(words > 0 && words < (1u << 25));
+        uint32_t start = append_loop_head(stream, iterations);
+        append(stream, loadval(r1, words));
+        append(stream, map_segment(r2, r1));
+        append(stream, loadval(r4, words - 1));
+        append(stream, store_segment(r2, r4, r7));
+        append(stream, load_segment(r3, r2, r4));
+        append(stream, unmap_segment(r2));
+        append_loop_tail(stream, start);
+        append(stream, halt());
+}
+
+/* copies the whole program into two segments, then LOADPs back and forth 
+between them, so every iteration replaces segment 0 with different code */
+void build_bench_loadp(Seq_T stream, uint32_t iterations, uint32_t words)
+{
+        (void)words;
+        append(stream, loadval(r7, 0));
+        append(stream, map_segment(r1, r7));
+        append(stream, map_segment(r2, r7));
+        uint32_t copy = Seq_length(stream);
+        append(stream, nand(r3, r0, r0));
+        append(stream, add(r4, r7, r3));
+        append(stream, load_segment(r3, r0, r4));
+        append(stream, store_segment(r1, r4, r3));
+        append(stream, store_segment(r2, r4, r3));
+        append_loop_tail(stream, copy);
+
+        uint32_t start = append_loop_head(stream, iterations);
+        append(stream, add(r3, r1, r0));
+        append(stream, add(r1, r2, r0));
+        append(stream, add(r2, r3, r0));
+        append(stream, nand(r6, r0, r0));
+        append(stream, add(r7, r7, r6));
+        append(stream, loadval(r3, 0));
+        append(stream, cmov(r3, r1, r7));
+        append(stream, loadval(r5, Seq_length(stream) + 4));
+        append(stream, loadval(r6, start));
+        append(stream, cmov(r5, r6, r7));
+        append(stream, load_program(r3, r5));
+        append(stream, halt());
+        Seq_put(stream, 0,
+                (void *)(uintptr_t)loadval(r7, Seq_length(stream)));
+}
+
+/* reads, adds to and writes back consecutive words of one segment of words
+words, wrapping around at its end; words must be a power of 2 */
+void build_bench_sequential(Seq_T stream, uint32_t iterations, 
+                            uint32_t words)
+{
+        assert(words > 0 && words < (1u << 25));
+        assert((words & (words - 1)) == 0);
+        append(stream, loadval(r3, words));
+        append(stream, map_segment(r1, r3));
+        uint32_t start = append_loop_head(stream, iterations);
+        append(stream, loadval(r4, 1));
+        append(stream, add(r2, r2, r4));
+        append(stream, loadval(r4, words - 1));
+        append(stream, nand(r2, r2, r4));
+        append(stream, nand(r2, r2, r2));
+        append(stream, load_segment(r3, r1, r2));
+        append(stream, add(r3, r3, r2));
+        append(stream, store_segment(r1, r2, r3));
+        append_loop_tail(stream, start);
+        append(stream, halt());
+}
+
+/* reads, adds to and writes back words of one segment of words words, at
+indices taken from the high bits of a linear congruential generator; words
+must be a power of 2 of at least 2^8. From 2^25 words up the size is too
+wide for one load value */
+void build_bench_random(Seq_T stream, uint32_t iterations, uint32_t words)
+{
+        assert(words >= (1u << 8));
+        assert((words & (words - 1)) == 0);
+        if (words < (1u << 25)) {
+                append(stream, loadval(r3, words));
+        } else {
+                append_word(stream, r3, r4, words);
+        }
+        append(stream, map_segment(r1, r3));
+        append(stream, loadval(r2, 1));
+        uint32_t start = append_loop_head(stream, iterations);
+        append(stream, loadval(r3, 1664525));
+        append(stream, multiply(r2, r2, r3));
+        append(stream, loadval(r3, 12345));
+        append(stream, add(r2, r2, r3));
+        append(stream, loadval(r3, (uint32_t)((1ull << 32) / words)));
+        append(stream, divide(r4, r2, r3));
+        append(stream, load_segment(r3, r1, r4));
+        append(stream, add(r3, r3, r2));
+        append(stream, store_segment(r1, r4, r3));
+        append_loop_tail(stream, start);
+        append(stream, halt());
+}
+
+/* writes a line of text per iteration */
+void build_bench_output(Seq_T stream, uint32_t iterations, uint32_t words)
+{
+        (void)words;
+        const char *line = "UM bench\n";
+        uint32_t start = append_loop_head(stream, iterations);
+        for (const char *c = line; *c != '\0'; c++) {
+                append(stream, loadval(r1, (unsigned)*c));
+                append(stream, output(r1));
+        }
+        append_loop_tail(stream, start);
+        append(stream, halt());
+}
@@ -0,0 +1,281 @@
+/**************************************************************
+ *
+ *                     umtoc.c
+ *
+ *     Assignment: HW6 um
+ *     Authors: Jason Singer, Anna Zou
+ *     Date: April 10, 2024
+ *
+ *     Ahead-of-time translator from UM binaries to C. Reads a .um file and
+ *     writes a C translation unit with one label per segment 0 word, the
+ *     registers held in locals, and segment operations calling into seg.c.
+ *     LOADP within segment 0 becomes a jump through a switch on the pc.
+ *
+ *     The translation is only valid while segment 0 holds the original
+ *     program, so a LOADP of another segment, or a store that changes a
+ *     word of segment 0, hands the machine state to run_um_threaded, which
+ *     finishes the run.
+ *
+ *     Usage: umtoc program.um > program.c
+ *            cc -O2 program.c um.o seg.o op.o channel.o -lcii -o program
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "assert.h"
+#include "bitpack.h"
+#include "um.h"
+#include "seg.h"
+
+#define OPBITS 4
+#define REGID 3
+#define WORDBITS 32
+#define VALUE 25
+#define REGA 6
+#define WORDS_PER_LINE 6
+
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+} Um_opcode;
+
+static void emit_prelude(FILE *out, const char *name, uint32_t *words,
+                         uint32_t numWords);
+static void emit_word(FILE *out, uint32_t *words, uint32_t numWords,
+                      uint32_t i);
+static void emit_epilogue(FILE *out);
+
+int main(int argc, char *argv[])
+{
+        if (argc != 2) {
+                fprintf(stderr, "usage: %s program.um > program.c\n",
+                        argv[0]);
+                exit(EXIT_FAILURE);
+        }
+        FILE *instructions = fopen(argv[1], "rb");
+        if (instructions == NULL) {
+                fprintf(stderr, "%s: could not open %s\n", argv[0], argv[1]);
+                exit(EXIT_FAILURE);
+        }
+        /* load through the UM itself so the byte layout is the one the UM
+        reads */
+        Um universe = init_um(instructions);
+        fclose(instructions);
+        segment seg0 = get_segment(get_seg_sequences(universe), 0);
+        uint32_t *words = get_mem(seg0);
+        uint32_t numWords = get_length(seg0);
+
+        emit_prelude(stdout, argv[1], words, numWords);
+        for (uint32_t i = 0; i < numWords; i++) {
+                emit_word(stdout, words, numWords, i);
+        }
+        emit_epilogue(stdout);
+
+        free_um(universe);
+        return EXIT_SUCCESS;
+}
+
+/************ emit_prelude ************
+*
+* Description: writes the includes, the program's words, and the start of
+* main up to the dispatch switch
+*
+* Parameters: FILE *out: where the C is written
+*             const char *name: the name of the .um file, for a comment
+*             uint32_t *words: segment 0
+*             uint32_t numWords: the length of segment 0
+*
+* Returns: void
+*
+* Expects: out != NULL, name != NULL
+*
+* Notes: the dispatch switch maps a pc to its label; anything past the end
+* of segment 0 fails
+**********************************/
+static void emit_prelude(FILE *out, const char *name, uint32_t *words,
+                         uint32_t numWords)
+{
+        assert(out && name);
+        fprintf(out, "/* translated from %s by umtoc */\n\n", name);
+        fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n"
+                     "#include <stdint.h>\n#include \"um.h\"\n"
+                     "#include \"seg.h\"\n#include \"op.h\"\n\n");
+        fprintf(out, "#define NUM_WORDS %uu\n", numWords);
+        fprintf(out, "#define SPILL() (regs[0] = r0, regs[1] = r1, "
+                     "regs[2] = r2, regs[3] = r3, \\\n"
+                     "                 regs[4] = r4, regs[5] = r5, "
+                     "regs[6] = r6, regs[7] = r7)\n\n");
+        fprintf(out, "static const uint32_t program[NUM_WORDS + 1] = {");
+        for (uint32_t i = 0; i < numWords; i++) {
+                fprintf(out, "%s0x%08x,", i % WORDS_PER_LINE == 0 ?
+                        "\n        " : " ", words[i]);
+        }
+        fprintf(out, "\n        0\n};\n\n");
+
+        fprintf(out,
+"int main(void)\n"
+"{\n"
+"        Um universe = init_um_words(program, NUM_WORDS);\n"
+"        allSegments segs = get_seg_sequences(universe);\n"
+"        uint32_t *regs = get_register_file(universe);\n"
+"        uint32_t r0 = 0, r1 = 0, r2 = 0, r3 = 0;\n"
+"        uint32_t r4 = 0, r5 = 0, r6 = 0, r7 = 0;\n"
+"        uint32_t pc = 0;\n"
+"        goto L0;\n"
+"dispatch:\n"
+"        switch (pc) {\n");
+        for (uint32_t i = 0; i < numWords; i++) {
+                fprintf(out, "        case %u: goto L%u;\n", i, i);
+        }
+        fprintf(out,
+"        default: goto bad;\n"
+"        }\n");
+}
+
+/************ emit_word ************
+*
+* Description: writes the label and C statements for one segment 0 word
+*
+* Parameters: FILE *out: where the C is written
+*             uint32_t *words: segment 0
+*             uint32_t numWords: the length of segment 0
+*             uint32_t i: the index of the word to translate
+*
+* Returns: void
+*
+* Expects: out != NULL, words != NULL
+*
+* Notes: every word gets a label since any of them may be a LOADP target.
+* An LV directly followed by a LOADP through the register it loads jumps
+* straight to the label when the segment is 0; a jump to the LOADP itself
+* still goes through the switch
+**********************************/
+static void emit_word(FILE *out, uint32_t *words, uint32_t numWords,
+                      uint32_t i)
+{
+        assert(out && words);
+        uint32_t word = words[i];
+        unsigned op = Bitpack_getu(word, OPBITS, WORDBITS - OPBITS);
+        unsigned a = Bitpack_getu(word, REGID, REGA);
+        unsigned b = Bitpack_getu(word, REGID, REGID);
+        unsigned c = Bitpack_getu(word, REGID, 0);
+
+        fprintf(out, "L%u:\n", i);
+        switch (op) {
+        case CMOV:
+                fprintf(out, "        if (r%u != 0) r%u = r%u;\n", c, a, b);
+                break;
+        case SLOAD:
+                fprintf(out, "        r%u = get_mem(get_segment(segs, r%u))"
+                             "[r%u];\n", a, b, c);
+                break;
+        case SSTORE:
+                fprintf(out, "        get_writable_mem(segs, r%u)[r%u] = "
+                             "r%u;\n", a, b, c);
+                fprintf(out, "        if (r%u == 0 && (r%u >= NUM_WORDS || "
+                             "r%u != program[r%u])) {\n"
+                             "                pc = %u;\n"
+                             "                goto fallback;\n"
+                             "        }\n", a, b, c, b, i + 1);
+                break;
+        case ADD:
+                fprintf(out, "        r%u = r%u + r%u;\n", a, b, c);
+                break;
+        case MUL:
+                fprintf(out, "        r%u = r%u * r%u;\n", a, b, c);
+                break;
+        case DIV:
+                fprintf(out, "        r%u = r%u / r%u;\n", a, b, c);
+                break;
+        case NAND:
+                fprintf(out, "        r%u = ~(r%u & r%u);\n", a, b, c);
+                break;
+        case HALT:
+                fprintf(out, "        goto halt;\n");
+                break;
+        case ACTIVATE:
+                fprintf(out, "        regs[%u] = r%u;\n", c, c);
+                fprintf(out, "        operations[%u](universe, 0, %u, %u);\n",
+                        op, b, c);
+                fprintf(out, "        r%u = regs[%u];\n", b, b);
+                break;
+        case INACTIVATE:
+        case OUT:
+                fprintf(out, "        regs[%u] = r%u;\n", c, c);
+                fprintf(out, "        operations[%u](universe, 0, 0, %u);\n",
+                        op, c);
+                break;
+        case IN:
+                fprintf(out, "        operations[%u](universe, 0, 0, %u);\n",
+                        op, c);
+                fprintf(out, "        r%u = regs[%u];\n", c, c);
+                break;
+        case LOADP:
+                fprintf(out, "        if (r%u == 0) {\n"
+                             "                pc = r%u;\n"
+                             "                goto dispatch;\n"
+                             "        }\n", b, c);
+                fprintf(out, "        SPILL();\n");
+                fprintf(out, "        operations[%u](universe, 0, %u, %u);\n",
+                        op, b, c);
+                fprintf(out, "        goto interpret;\n");
+                break;
+        case LV: {
+                unsigned reg = Bitpack_getu(word, REGID, VALUE);
+                uint32_t val = Bitpack_getu(word, VALUE, 0);
+                fprintf(out, "        r%u = %uu;\n", reg, val);
+                if (i + 1 >= numWords || val >= numWords) {
+                        break;
+                }
+                uint32_t next = words[i + 1];
+                if (Bitpack_getu(next, OPBITS, WORDBITS - OPBITS) == LOADP &&
+                    Bitpack_getu(next, REGID, 0) == reg) {
+                        fprintf(out, "        if (r%u == 0) goto L%u;\n",
+                                (unsigned)Bitpack_getu(next, REGID, REGID),
+                                val);
+                }
+                break;
+        }
+        default:
+                fprintf(out, "        pc = %u;\n        goto bad;\n", i);
+                break;
+        }
+}
+
+/************ emit_epilogue ************
+*
+* Description: writes the end of main: running off the end of segment 0,
+* the hand-off to the interpreter, halting, and failing
+*
+* Parameters: FILE *out: where the C is written
+*
+* Returns: void
+*
+* Expects: out != NULL
+*
+* Notes: fallback is reached with pc set, after a store changed segment 0;
+* interpret is reached after load_program has already replaced segment 0 
+* and set the pc
+**********************************/
+static void emit_epilogue(FILE *out)
+{
+        assert(out);
+        fprintf(out,
+"        pc = NUM_WORDS;\n"
+"        goto bad;\n"
+"fallback:\n"
+"        SPILL();\n"
+"        set_pc(universe, pc);\n"
+"interpret:\n"
+"        run_um_threaded(universe);\n"
+"halt:\n"
+"        free_um(universe);\n"
+"        return EXIT_SUCCESS;\n"
+"bad:\n"
+"        flush_channel(get_channel(universe));\n"
+"        fprintf(stderr, \"um: invalid instruction at pc %%u\\n\", pc);\n"
+"        exit(EXIT_FAILURE);\n"
+"}\n");
+}